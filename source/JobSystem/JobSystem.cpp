@@ -0,0 +1,290 @@
+// ******************************************************************************
+// Filename:    JobSystem.cpp
+// Project:     Qube
+// Author:      Steven Ball
+//
+// Revision History:
+//   Initial Revision - 17/10/26
+//
+// Copyright (c) 2005-2016, Steven Ball
+// ******************************************************************************
+
+#include "JobSystem.h"
+#include "../Profiler/Profiler.h"
+
+#include <stdio.h>
+
+#include <algorithm>
+
+// Times a worker looks for jobs before it goes to sleep, waking a worker up costs far more than looking
+const unsigned int JOB_SPIN_COUNT = 64;
+
+// The job system that the current thread belongs to and its queue in it
+static thread_local JobSystem* t_pJobSystem = NULL;
+static thread_local unsigned int t_queueIndex = 0;
+
+
+JobSystem::JobSystem(unsigned int numWorkers)
+{
+	m_numQueuedJobs = 0;
+	m_numSleepingWorkers = 0;
+	m_quit = false;
+
+	for (unsigned int i = 0; i < numWorkers + 2; i++)
+	{
+		JobQueue* pQueue = new JobQueue();
+		pQueue->m_pJobPool = new Job[JOB_POOL_SIZE];
+		for (unsigned int j = 0; j < JOB_POOL_SIZE; j++)
+		{
+			pQueue->m_pJobPool[j].m_pParent = NULL;
+			pQueue->m_pJobPool[j].m_numUnfinished = 0;
+		}
+		pQueue->m_nextPoolJob = 0;
+		m_vpQueues.push_back(pQueue);
+	}
+
+	t_pJobSystem = this;
+	t_queueIndex = 0;
+
+	for (unsigned int i = 0; i < numWorkers; i++)
+	{
+		m_vWorkers.push_back(thread(&JobSystem::WorkerThread, this, i + 1));
+	}
+}
+
+JobSystem::~JobSystem()
+{
+	{
+		lock_guard<mutex> lock(m_sleepMutex);
+		m_quit = true;
+	}
+	m_wakeCondition.notify_all();
+
+	for (unsigned int i = 0; i < m_vWorkers.size(); i++)
+	{
+		m_vWorkers[i].join();
+	}
+
+	for (unsigned int i = 0; i < m_vpQueues.size(); i++)
+	{
+		delete[] m_vpQueues[i]->m_pJobPool;
+		delete m_vpQueues[i];
+	}
+
+	if (t_pJobSystem == this)
+	{
+		t_pJobSystem = NULL;
+	}
+}
+
+unsigned int JobSystem::GetNumWorkers()
+{
+	return (unsigned int)m_vWorkers.size();
+}
+
+unsigned int JobSystem::GetNumThreads()
+{
+	return (unsigned int)m_vWorkers.size() + 1;
+}
+
+// Jobs
+Job* JobSystem::CreateJob(JobFunction function, Job* pParent)
+{
+	Job* pJob = AllocateJob(GetQueue());
+	pJob->m_function = function;
+	pJob->m_pParent = pParent;
+	if (pParent != NULL)
+	{
+		pParent->m_numUnfinished++;
+	}
+
+	return pJob;
+}
+
+void JobSystem::Run(Job* pJob)
+{
+	// Counted before it is pushed, so the count never drops below the jobs that are really queued
+	m_numQueuedJobs++;
+	JobQueue* pQueue = GetQueue();
+	{
+		lock_guard<mutex> lock(pQueue->m_mutex);
+		pQueue->m_vpJobs.push_back(pJob);
+	}
+
+	// A worker counts itself as sleeping before it checks for queued jobs, so either it sees this job or it gets woken
+	if (m_numSleepingWorkers > 0)
+	{
+		lock_guard<mutex> lock(m_sleepMutex);
+		m_wakeCondition.notify_one();
+	}
+}
+
+void JobSystem::Wait(Job* pJob)
+{
+	while (IsFinished(pJob) == false)
+	{
+		if (RunPendingJob() == false)
+		{
+			this_thread::yield();
+		}
+	}
+}
+
+bool JobSystem::IsFinished(Job* pJob)
+{
+	return pJob->m_numUnfinished == 0;
+}
+
+void JobSystem::ParallelFor(unsigned int count, unsigned int batchSize, ParallelForFunction function)
+{
+	if (count == 0)
+	{
+		return;
+	}
+
+	// The root only holds the batches together, it is finished here rather than run
+	Job* pRoot = CreateJob(JobFunction());
+	RunParallelFor(pRoot, 0, count, std::max(batchSize, 1u), &function);
+	Finish(pRoot);
+	Wait(pRoot);
+}
+
+JobQueue* JobSystem::GetQueue()
+{
+	if (t_pJobSystem == this)
+	{
+		return m_vpQueues[t_queueIndex];
+	}
+
+	return m_vpQueues.back();
+}
+
+// The pool is used as a ring, and a slot is claimed by moving its count from finished to 1, so slots that are still in use, like
+// a parent that is being given children, are skipped. A thread that has gone right round the ring runs a job before it looks again.
+Job* JobSystem::AllocateJob(JobQueue* pQueue)
+{
+	for (unsigned int i = 1; ; i++)
+	{
+		Job* pJob = &pQueue->m_pJobPool[pQueue->m_nextPoolJob++ % JOB_POOL_SIZE];
+		unsigned int finished = 0;
+		if (pJob->m_numUnfinished.compare_exchange_strong(finished, 1))
+		{
+			return pJob;
+		}
+
+		if (i % JOB_POOL_SIZE == 0 && RunPendingJob() == false)
+		{
+			this_thread::yield();
+		}
+	}
+}
+
+// Newest job from the thread's own queue, which is the one most likely to still be in the cache, otherwise the oldest job from
+// the next queue that has any
+Job* JobSystem::GetJob()
+{
+	if (m_numQueuedJobs == 0)
+	{
+		return NULL;
+	}
+
+	unsigned int queueIndex = t_pJobSystem == this ? t_queueIndex : (unsigned int)m_vpQueues.size() - 1;
+	JobQueue* pQueue = m_vpQueues[queueIndex];
+	{
+		lock_guard<mutex> lock(pQueue->m_mutex);
+		if (pQueue->m_vpJobs.empty() == false)
+		{
+			Job* pJob = pQueue->m_vpJobs.back();
+			pQueue->m_vpJobs.pop_back();
+			m_numQueuedJobs--;
+			return pJob;
+		}
+	}
+
+	for (unsigned int i = 1; i < m_vpQueues.size(); i++)
+	{
+		JobQueue* pVictim = m_vpQueues[(queueIndex + i) % m_vpQueues.size()];
+		lock_guard<mutex> lock(pVictim->m_mutex);
+		if (pVictim->m_vpJobs.empty() == false)
+		{
+			Job* pJob = pVictim->m_vpJobs.front();
+			pVictim->m_vpJobs.pop_front();
+			m_numQueuedJobs--;
+			return pJob;
+		}
+	}
+
+	return NULL;
+}
+
+bool JobSystem::RunPendingJob()
+{
+	Job* pJob = GetJob();
+	if (pJob == NULL)
+	{
+		return false;
+	}
+
+	Execute(pJob);
+	return true;
+}
+
+void JobSystem::Execute(Job* pJob)
+{
+	pJob->m_function();
+	Finish(pJob);
+}
+
+// The parent is read before the count drops, once a job has finished its slot can be handed out again at any time
+void JobSystem::Finish(Job* pJob)
+{
+	Job* pParent = pJob->m_pParent;
+	if (--pJob->m_numUnfinished == 0 && pParent != NULL)
+	{
+		Finish(pParent);
+	}
+}
+
+// Pushes the top half of the range as a job of its own until what is left fits a batch, then runs that batch
+void JobSystem::RunParallelFor(Job* pParent, unsigned int start, unsigned int end, unsigned int batchSize, const ParallelForFunction* pFunction)
+{
+	while (end - start > batchSize)
+	{
+		unsigned int middle = start + (end - start) / 2;
+		Run(CreateJob([=]() { RunParallelFor(pParent, middle, end, batchSize, pFunction); }, pParent));
+		end = middle;
+	}
+
+	(*pFunction)(start, end);
+}
+
+void JobSystem::WorkerThread(unsigned int queueIndex)
+{
+	t_pJobSystem = this;
+	t_queueIndex = queueIndex;
+
+	char threadName[32];
+	sprintf(threadName, "Job worker %u", queueIndex);
+	Profiler::GetInstance()->SetThreadName(threadName);
+
+	while (m_quit == false)
+	{
+		bool ranJob = false;
+		for (unsigned int i = 0; i < JOB_SPIN_COUNT && ranJob == false; i++)
+		{
+			ranJob = RunPendingJob();
+			if (ranJob == false)
+			{
+				this_thread::yield();
+			}
+		}
+
+		if (ranJob == false)
+		{
+			unique_lock<mutex> lock(m_sleepMutex);
+			m_numSleepingWorkers++;
+			m_wakeCondition.wait(lock, [this]() { return m_numQueuedJobs > 0 || m_quit; });
+			m_numSleepingWorkers--;
+		}
+	}
+}
@@ -0,0 +1,110 @@
+// ******************************************************************************
+// Filename:    JobSystem.h
+// Project:     Qube
+// Author:      Steven Ball
+//
+// Purpose:
+//   A work stealing job scheduler. Every thread that runs jobs has a queue of
+//   its own, it pushes and pops its own jobs at the back and steals the oldest
+//   jobs from the front of the other queues once its own queue is empty. A job
+//   can be made the child of another job, and a parent only finishes once all
+//   of its children have, so waiting on a parent waits on the whole tree. The
+//   threads that wait keep running jobs instead of blocking, so the main
+//   thread helps out rather than sitting idle.
+//
+// Revision History:
+//   Initial Revision - 17/10/26
+//
+// Copyright (c) 2005-2016, Steven Ball
+// ******************************************************************************
+
+#pragma once
+
+#include <atomic>
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <mutex>
+#include <thread>
+#include <vector>
+using namespace std;
+
+// Jobs that each thread can have created and not yet finished. Slots are reused once their jobs finish, so a finished job's
+// handle is only valid until the thread that created it has created about this many more jobs.
+const unsigned int JOB_POOL_SIZE = 4096;
+
+typedef function<void()> JobFunction;
+typedef function<void(unsigned int start, unsigned int end)> ParallelForFunction;
+
+struct Job
+{
+	JobFunction m_function;
+	Job* m_pParent;
+	atomic<unsigned int> m_numUnfinished; // The job itself and each of its children that hasn't finished yet
+};
+
+class JobQueue
+{
+public:
+	mutex m_mutex;
+	deque<Job*> m_vpJobs;
+	Job* m_pJobPool;
+	atomic<unsigned int> m_nextPoolJob;
+};
+
+class JobSystem
+{
+public:
+	/* Public methods */
+	JobSystem(unsigned int numWorkers); // 0 runs every job on the threads that wait for them
+	~JobSystem();
+
+	unsigned int GetNumWorkers();
+	unsigned int GetNumThreads(); // The workers and the thread that created the job system
+
+	// Jobs, any thread can create, run and wait on them. Children have to be created before their parent is run.
+	Job* CreateJob(JobFunction function, Job* pParent = NULL);
+	void Run(Job* pJob);
+	void Wait(Job* pJob); // Runs other jobs until the job and all of its children have finished
+	bool IsFinished(Job* pJob);
+
+	// Calls the function on batches of at most batchSize indices from [0, count), as jobs, and waits for all of them. The range is
+	// split in half until it fits a batch, so the threads that steal get the biggest pieces that are left.
+	void ParallelFor(unsigned int count, unsigned int batchSize, ParallelForFunction function);
+
+protected:
+	/* Protected methods */
+
+private:
+	/* Private methods */
+	JobQueue* GetQueue();
+	Job* AllocateJob(JobQueue* pQueue);
+	Job* GetJob();
+	bool RunPendingJob();
+	void Execute(Job* pJob);
+	void Finish(Job* pJob);
+	void RunParallelFor(Job* pParent, unsigned int start, unsigned int end, unsigned int batchSize, const ParallelForFunction* pFunction);
+	void WorkerThread(unsigned int queueIndex);
+
+public:
+	/* Public members */
+
+protected:
+	/* Protected members */
+
+private:
+	/* Private members */
+	// The thread that created the job system has queue 0, the workers come after it, and the last queue is shared by any other
+	// thread that creates jobs
+	vector<JobQueue*> m_vpQueues;
+	vector<thread> m_vWorkers;
+
+	// Jobs sitting in any of the queues, so the threads looking for work can skip the queues when there are none
+	atomic<unsigned int> m_numQueuedJobs;
+
+	// Workers sleep when there is nothing to run
+	mutex m_sleepMutex;
+	condition_variable m_wakeCondition;
+	atomic<unsigned int> m_numSleepingWorkers;
+	atomic<bool> m_quit;
+};
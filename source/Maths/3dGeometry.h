@@ -16,6 +16,7 @@
 
 #include "3dmaths.h"
 #include <glm/vec3.hpp>
+#include <glm/mat4x4.hpp>
 using namespace glm;
 
 
@@ -38,6 +39,36 @@ public:
 };
 
 
+enum FrustumPlane
+{
+	FrustumPlane_Left = 0,
+	FrustumPlane_Right,
+	FrustumPlane_Bottom,
+	FrustumPlane_Top,
+	FrustumPlane_Near,
+	FrustumPlane_Far,
+
+	FrustumPlane_NUM,
+};
+
+class Frustum
+{
+public:
+	// Constructors
+	Frustum();
+
+	// Setup
+	void SetFromProjectionView(const mat4& lProjection, const mat4& lView);
+
+	// Operations
+	bool IsBoxOutside(vec3 lMin, vec3 lMax);
+
+public:
+	// Normals point into the frustum
+	Plane3D mPlanes[FrustumPlane_NUM];
+};
+
+
 class Line3D
 {
 public:
@@ -0,0 +1,73 @@
+// ******************************************************************************
+// Filename:    Frustum.cpp
+// Project:     Qube
+// Author:      Steven Ball
+//
+// Purpose:
+//   View frustum implementation, the six planes are taken straight from the
+//   rows of the view-projection matrix.
+//
+// Revision History:
+//   Initial Revision - 17/10/26
+//
+// Copyright (c) 2005-2016, Steven Ball
+// ******************************************************************************
+
+#include "3dGeometry.h"
+#include <glm/glm.hpp>
+using namespace glm;
+
+
+// Constructors
+Frustum::Frustum()
+{
+}
+
+
+// Setup
+void Frustum::SetFromProjectionView(const mat4& lProjection, const mat4& lView)
+{
+	// The far plane is the difference of two rows that are almost the same when the near plane is close, so the product is
+	// made in double precision. Taken from a float view-projection it is out by whole units at the far distance.
+	dmat4 lViewProjection = dmat4(lProjection) * dmat4(lView);
+
+	// glm matrices are column major, so each row is gathered across the columns
+	dvec4 lRows[4];
+	for (int i = 0; i < 4; i++)
+	{
+		lRows[i] = dvec4(lViewProjection[0][i], lViewProjection[1][i], lViewProjection[2][i], lViewProjection[3][i]);
+	}
+
+	dvec4 lPlanes[FrustumPlane_NUM];
+	lPlanes[FrustumPlane_Left] = lRows[3] + lRows[0];
+	lPlanes[FrustumPlane_Right] = lRows[3] - lRows[0];
+	lPlanes[FrustumPlane_Bottom] = lRows[3] + lRows[1];
+	lPlanes[FrustumPlane_Top] = lRows[3] - lRows[1];
+	lPlanes[FrustumPlane_Near] = lRows[3] + lRows[2];
+	lPlanes[FrustumPlane_Far] = lRows[3] - lRows[2];
+
+	for (int i = 0; i < FrustumPlane_NUM; i++)
+	{
+		dvec4 lPlane = lPlanes[i] / length(dvec3(lPlanes[i]));
+		mPlanes[i] = Plane3D((float)lPlane.x, (float)lPlane.y, (float)lPlane.z, (float)lPlane.w);
+	}
+}
+
+
+// Operations
+// A box is outside when its corner furthest along a plane's normal is still behind that plane. Boxes that straddle the
+// corners of the frustum can pass when they are outside, which only costs a draw that didn't need doing.
+bool Frustum::IsBoxOutside(vec3 lMin, vec3 lMax)
+{
+	for (int i = 0; i < FrustumPlane_NUM; i++)
+	{
+		vec3 lNormal = mPlanes[i].mNormal;
+		vec3 lPositive(lNormal.x >= 0.0f ? lMax.x : lMin.x, lNormal.y >= 0.0f ? lMax.y : lMin.y, lNormal.z >= 0.0f ? lMax.z : lMin.z);
+		if (mPlanes[i].GetPointDistance(lPositive) < 0.0f)
+		{
+			return true;
+		}
+	}
+
+	return false;
+}
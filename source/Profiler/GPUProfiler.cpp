@@ -0,0 +1,230 @@
+// ******************************************************************************
+// Filename:    GPUProfiler.cpp
+// Project:     Qube
+// Author:      Steven Ball
+//
+// Revision History:
+//   Initial Revision - 17/10/26
+//
+// Copyright (c) 2005-2016, Steven Ball
+// ******************************************************************************
+
+#include "GPUProfiler.h"
+#include "Profiler.h"
+
+#include <algorithm>
+
+
+GPUProfiler::GPUProfiler()
+{
+	// Timer queries are core from 3.3
+	m_supported = GLEW_VERSION_3_3 || GLEW_ARB_timer_query;
+
+	for (unsigned int i = 0; i < GPU_PROFILER_NUM_FRAMES; i++)
+	{
+		if (m_supported)
+		{
+			glGenQueries(GPU_PROFILER_MAX_PASSES * 2, m_frames[i].m_queries);
+		}
+		m_frames[i].m_vPasses.reserve(GPU_PROFILER_MAX_PASSES);
+		m_frames[i].m_lastQuery = 0;
+		m_frames[i].m_clockOffset = 0;
+		m_frames[i].m_frameNumber = 0;
+		m_frames[i].m_pending = false;
+	}
+	m_numFrames = 0;
+	m_pFrame = NULL;
+	m_openPass = GPU_PROFILER_MAX_PASSES;
+	m_numDroppedPasses = 0;
+
+	m_clockOffset = 0;
+	m_framesSinceCalibrate = 0;
+	if (m_supported)
+	{
+		Calibrate();
+	}
+}
+
+GPUProfiler::~GPUProfiler()
+{
+	if (m_supported)
+	{
+		for (unsigned int i = 0; i < GPU_PROFILER_NUM_FRAMES; i++)
+		{
+			glDeleteQueries(GPU_PROFILER_MAX_PASSES * 2, m_frames[i].m_queries);
+		}
+	}
+}
+
+bool GPUProfiler::IsSupported()
+{
+	return m_supported;
+}
+
+// Frames
+void GPUProfiler::BeginFrame()
+{
+	if (m_supported == false)
+	{
+		return;
+	}
+
+	// The results come back in the order the queries were made, so stop at the first frame that the GPU hasn't finished
+	GPUProfilerFrame* pPendingFrame;
+	while ((pPendingFrame = GetOldestPendingFrame()) != NULL && ReadFrame(pPendingFrame))
+	{
+		pPendingFrame->m_pending = false;
+	}
+
+	m_framesSinceCalibrate++;
+	if (m_framesSinceCalibrate >= GPU_PROFILER_CALIBRATE_FRAMES)
+	{
+		Calibrate();
+	}
+
+	// When the GPU is so far behind that the slot is still waiting this frame is skipped, rather than waiting for it
+	GPUProfilerFrame* pFrame = &m_frames[m_numFrames % GPU_PROFILER_NUM_FRAMES];
+	if (pFrame->m_pending == false)
+	{
+		pFrame->m_vPasses.clear();
+		pFrame->m_clockOffset = m_clockOffset;
+		pFrame->m_frameNumber = m_numFrames;
+		m_pFrame = pFrame;
+	}
+	m_numFrames++;
+	m_openPass = GPU_PROFILER_MAX_PASSES;
+	m_numDroppedPasses = 0;
+}
+
+void GPUProfiler::EndFrame()
+{
+	if (m_pFrame == NULL)
+	{
+		return;
+	}
+
+	while (m_openPass != GPU_PROFILER_MAX_PASSES)
+	{
+		EndPass();
+	}
+
+	m_pFrame->m_pending = m_pFrame->m_vPasses.empty() == false;
+	m_pFrame = NULL;
+}
+
+// Passes
+void GPUProfiler::BeginPass(const char* pName)
+{
+	if (m_pFrame == NULL)
+	{
+		return;
+	}
+
+	if (m_pFrame->m_vPasses.size() == GPU_PROFILER_MAX_PASSES || m_numDroppedPasses > 0)
+	{
+		m_numDroppedPasses++;
+		return;
+	}
+
+	GPUProfilerPass pass;
+	pass.m_pName = pName;
+	pass.m_parent = m_openPass;
+	m_openPass = (unsigned int)m_pFrame->m_vPasses.size();
+	m_pFrame->m_vPasses.push_back(pass);
+
+	glQueryCounter(m_pFrame->m_queries[m_openPass * 2], GL_TIMESTAMP);
+}
+
+void GPUProfiler::EndPass()
+{
+	if (m_pFrame == NULL)
+	{
+		return;
+	}
+
+	if (m_numDroppedPasses > 0)
+	{
+		m_numDroppedPasses--;
+		return;
+	}
+
+	if (m_openPass == GPU_PROFILER_MAX_PASSES)
+	{
+		return;
+	}
+
+	m_pFrame->m_lastQuery = m_pFrame->m_queries[m_openPass * 2 + 1];
+	glQueryCounter(m_pFrame->m_lastQuery, GL_TIMESTAMP);
+	m_openPass = m_pFrame->m_vPasses[m_openPass].m_parent;
+}
+
+unsigned int GPUProfiler::ReadFrameTimes(float* pTimes, unsigned int maxTimes)
+{
+	unsigned int numTimes = std::min((unsigned int)m_vFrameTimes.size(), maxTimes);
+	for (unsigned int i = 0; i < numTimes; i++)
+	{
+		pTimes[i] = m_vFrameTimes[i];
+	}
+	m_vFrameTimes.clear();
+
+	return numTimes;
+}
+
+// Reading the GPU clock doesn't wait for the GPU, it gives the time that the commands sent so far will reach it
+void GPUProfiler::Calibrate()
+{
+	GLint64 gpuTime = 0;
+	glGetInteger64v(GL_TIMESTAMP, &gpuTime);
+	m_clockOffset = Profiler::GetTime() - gpuTime;
+	m_framesSinceCalibrate = 0;
+}
+
+GPUProfilerFrame* GPUProfiler::GetOldestPendingFrame()
+{
+	GPUProfilerFrame* pOldest = NULL;
+	for (unsigned int i = 0; i < GPU_PROFILER_NUM_FRAMES; i++)
+	{
+		if (m_frames[i].m_pending && (pOldest == NULL || (int)(m_frames[i].m_frameNumber - pOldest->m_frameNumber) < 0))
+		{
+			pOldest = &m_frames[i];
+		}
+	}
+
+	return pOldest;
+}
+
+bool GPUProfiler::ReadFrame(GPUProfilerFrame* pFrame)
+{
+	GLint available = 0;
+	glGetQueryObjectiv(pFrame->m_lastQuery, GL_QUERY_RESULT_AVAILABLE, &available);
+	if (available == 0)
+	{
+		return false;
+	}
+
+	bool profilerEnabled = Profiler::IsEnabled();
+	GLuint64 frameStart = 0;
+	GLuint64 frameEnd = 0;
+	for (unsigned int i = 0; i < pFrame->m_vPasses.size(); i++)
+	{
+		GLuint64 start = 0;
+		GLuint64 end = 0;
+		glGetQueryObjectui64v(pFrame->m_queries[i * 2], GL_QUERY_RESULT, &start);
+		glGetQueryObjectui64v(pFrame->m_queries[i * 2 + 1], GL_QUERY_RESULT, &end);
+
+		if (i == 0 || start < frameStart)
+		{
+			frameStart = start;
+		}
+		frameEnd = std::max(frameEnd, end);
+
+		if (profilerEnabled)
+		{
+			Profiler::GetInstance()->AddGPUEvent(pFrame->m_vPasses[i].m_pName, (long long)start + pFrame->m_clockOffset, (long long)end + pFrame->m_clockOffset);
+		}
+	}
+
+	m_vFrameTimes.push_back((float)((frameEnd - frameStart) * 1e-9));
+
+	return true;
+}
@@ -0,0 +1,102 @@
+// ******************************************************************************
+// Filename:    GPUProfiler.h
+// Project:     Qube
+// Author:      Steven Ball
+//
+// Purpose:
+//   Times named GPU passes with timestamp queries. Each frame takes its
+//   queries from a pool that holds a few frames, and the results are only
+//   read back once the GPU has caught up with a frame, so the CPU never waits
+//   on a query. The passes are handed to the profiler as events on its GPU
+//   track, for the overlay and the trace, and the time of each whole frame
+//   is kept for the GPU graph.
+//
+// Revision History:
+//   Initial Revision - 17/10/26
+//
+// Copyright (c) 2005-2016, Steven Ball
+// ******************************************************************************
+
+#pragma once
+
+#include "../glew/include/GL/glew.h"
+
+#include <vector>
+using namespace std;
+
+// Frames that can be waiting on their results, a frame that finds every slot still waiting isn't timed
+const unsigned int GPU_PROFILER_NUM_FRAMES = 4;
+
+// Passes that can be timed in a frame, each one takes a query at its start and its end
+const unsigned int GPU_PROFILER_MAX_PASSES = 32;
+
+// Frames between each time the GPU clock is lined up with the profiler clock
+const unsigned int GPU_PROFILER_CALIBRATE_FRAMES = 120;
+
+struct GPUProfilerPass
+{
+	const char* m_pName;
+	unsigned int m_parent; // Index of the pass that was open when this one began, or GPU_PROFILER_MAX_PASSES
+};
+
+class GPUProfilerFrame
+{
+public:
+	GLuint m_queries[GPU_PROFILER_MAX_PASSES * 2]; // Start and end timestamp of each pass
+	vector<GPUProfilerPass> m_vPasses;
+	GLuint m_lastQuery; // Once its result is there so are the results of every query before it
+	long long m_clockOffset; // Profiler clock minus GPU clock, at the time the frame was recorded
+	unsigned int m_frameNumber;
+	bool m_pending; // Recorded and waiting on its results
+};
+
+class GPUProfiler
+{
+public:
+	/* Public methods */
+	GPUProfiler(); // Needs a GL context
+	~GPUProfiler();
+
+	bool IsSupported();
+
+	// Frames, results are read back at the start of the frames that come after
+	void BeginFrame();
+	void EndFrame();
+
+	// Passes nest, and the names have to be string literals or live as long as the profiler does
+	void BeginPass(const char* pName);
+	void EndPass();
+
+	// The GPU time of every frame that has been read back since this was last called, in seconds and oldest first
+	unsigned int ReadFrameTimes(float* pTimes, unsigned int maxTimes);
+
+protected:
+	/* Protected methods */
+
+private:
+	/* Private methods */
+	void Calibrate();
+	GPUProfilerFrame* GetOldestPendingFrame();
+	bool ReadFrame(GPUProfilerFrame* pFrame);
+
+public:
+	/* Public members */
+
+protected:
+	/* Protected members */
+
+private:
+	/* Private members */
+	bool m_supported;
+
+	GPUProfilerFrame m_frames[GPU_PROFILER_NUM_FRAMES];
+	unsigned int m_numFrames;
+	GPUProfilerFrame* m_pFrame; // The frame being recorded, NULL if it isn't being timed
+	unsigned int m_openPass;
+	unsigned int m_numDroppedPasses; // Open passes that didn't fit in the frame
+
+	long long m_clockOffset;
+	unsigned int m_framesSinceCalibrate;
+
+	vector<float> m_vFrameTimes;
+};
@@ -0,0 +1,217 @@
+// ******************************************************************************
+// Filename:    Profiler.cpp
+// Project:     Qube
+// Author:      Steven Ball
+//
+// Revision History:
+//   Initial Revision - 17/10/26
+//
+// Copyright (c) 2005-2016, Steven Ball
+// ******************************************************************************
+
+#include "Profiler.h"
+
+#include <stdio.h>
+#include <string.h>
+
+#include <algorithm>
+#include <chrono>
+
+// Every event time is measured from here
+static const chrono::steady_clock::time_point c_profilerStart = chrono::steady_clock::now();
+
+// The buffer that the current thread writes its events to
+static thread_local ProfileThreadBuffer* t_pThreadBuffer = NULL;
+
+
+atomic<bool> Profiler::c_enabled(false);
+
+// The first call can come from any thread, such as every job worker at once, so the instance is a local static rather than a pointer
+Profiler* Profiler::GetInstance()
+{
+	static Profiler instance;
+	return &instance;
+}
+
+Profiler::Profiler()
+{
+	m_pGPUBuffer = NULL;
+	m_numSummedFrames = 0;
+}
+
+// Enabling
+void Profiler::SetEnabled(bool enabled)
+{
+	c_enabled = enabled;
+}
+
+// Events
+long long Profiler::GetTime()
+{
+	return chrono::duration_cast<chrono::nanoseconds>(chrono::steady_clock::now() - c_profilerStart).count();
+}
+
+void Profiler::AddEvent(const char* pName, long long start, long long end)
+{
+	AddEventToBuffer(GetThreadBuffer(), pName, start, end);
+}
+
+void Profiler::AddGPUEvent(const char* pName, long long start, long long end)
+{
+	if (m_pGPUBuffer == NULL)
+	{
+		lock_guard<mutex> lock(m_threadBuffersMutex);
+		m_pGPUBuffer = CreateThreadBuffer(true);
+	}
+
+	AddEventToBuffer(m_pGPUBuffer, pName, start, end);
+}
+
+void Profiler::SetThreadName(string name)
+{
+	ProfileThreadBuffer* pBuffer = GetThreadBuffer();
+
+	lock_guard<mutex> lock(m_threadBuffersMutex);
+	pBuffer->m_threadName = name;
+}
+
+// Called with the buffers locked
+ProfileThreadBuffer* Profiler::CreateThreadBuffer(bool gpu)
+{
+	ProfileThreadBuffer* pBuffer = new ProfileThreadBuffer();
+	pBuffer->m_threadIndex = (unsigned int)m_vpThreadBuffers.size();
+	char threadName[32];
+	sprintf(threadName, "Thread %u", pBuffer->m_threadIndex);
+	pBuffer->m_threadName = gpu ? "GPU" : threadName;
+	pBuffer->m_pEvents = NULL;
+	pBuffer->m_numEvents = 0;
+	pBuffer->m_numGatheredEvents = 0;
+	pBuffer->m_gpu = gpu;
+	m_vpThreadBuffers.push_back(pBuffer);
+
+	return pBuffer;
+}
+
+ProfileThreadBuffer* Profiler::GetThreadBuffer()
+{
+	if (t_pThreadBuffer == NULL)
+	{
+		lock_guard<mutex> lock(m_threadBuffersMutex);
+		t_pThreadBuffer = CreateThreadBuffer(false);
+	}
+
+	return t_pThreadBuffer;
+}
+
+// Only the thread itself writes to its buffer, the count is published after the event so readers never see a half written one,
+// unless the thread has gone all the way round the ring while they read
+void Profiler::AddEventToBuffer(ProfileThreadBuffer* pBuffer, const char* pName, long long start, long long end)
+{
+	if (pBuffer->m_pEvents == NULL)
+	{
+		pBuffer->m_pEvents = new ProfileEvent[PROFILER_RING_SIZE];
+	}
+
+	unsigned int eventIndex = pBuffer->m_numEvents.load(memory_order_relaxed);
+	ProfileEvent* pEvent = &pBuffer->m_pEvents[eventIndex % PROFILER_RING_SIZE];
+	pEvent->m_pName = pName;
+	pEvent->m_start = start;
+	pEvent->m_end = end;
+	pBuffer->m_numEvents.store(eventIndex + 1, memory_order_release);
+}
+
+// Frames
+void Profiler::EndFrame()
+{
+	lock_guard<mutex> lock(m_threadBuffersMutex);
+
+	for (unsigned int i = 0; i < m_vpThreadBuffers.size(); i++)
+	{
+		ProfileThreadBuffer* pBuffer = m_vpThreadBuffers[i];
+		unsigned int numEvents = pBuffer->m_numEvents.load(memory_order_acquire);
+		unsigned int firstEvent = std::max(pBuffer->m_numGatheredEvents, numEvents > PROFILER_RING_SIZE ? numEvents - PROFILER_RING_SIZE : 0u);
+		for (unsigned int j = firstEvent; j < numEvents; j++)
+		{
+			const ProfileEvent& event = pBuffer->m_pEvents[j % PROFILER_RING_SIZE];
+
+			// The same literal can have a different address in each file that uses it
+			unsigned int scopeIndex = 0;
+			while (scopeIndex < m_vFrameSums.size() && (m_vFrameSums[scopeIndex].m_gpu != pBuffer->m_gpu ||
+			       (m_vFrameSums[scopeIndex].m_pName != event.m_pName && strcmp(m_vFrameSums[scopeIndex].m_pName, event.m_pName) != 0)))
+			{
+				scopeIndex++;
+			}
+			if (scopeIndex == m_vFrameSums.size())
+			{
+				ProfileScopeStats stats;
+				stats.m_pName = event.m_pName;
+				stats.m_milliseconds = 0.0;
+				stats.m_calls = 0.0;
+				stats.m_gpu = pBuffer->m_gpu;
+				m_vFrameSums.push_back(stats);
+			}
+
+			m_vFrameSums[scopeIndex].m_milliseconds += (event.m_end - event.m_start) / 1000000.0;
+			m_vFrameSums[scopeIndex].m_calls += 1.0;
+		}
+		pBuffer->m_numGatheredEvents = numEvents;
+	}
+
+	m_numSummedFrames++;
+	if (m_numSummedFrames >= PROFILER_AVERAGE_FRAMES)
+	{
+		m_vScopeStats = m_vFrameSums;
+		for (unsigned int i = 0; i < m_vFrameSums.size(); i++)
+		{
+			m_vScopeStats[i].m_milliseconds /= m_numSummedFrames;
+			m_vScopeStats[i].m_calls /= m_numSummedFrames;
+			m_vFrameSums[i].m_milliseconds = 0.0;
+			m_vFrameSums[i].m_calls = 0.0;
+		}
+		m_numSummedFrames = 0;
+	}
+}
+
+unsigned int Profiler::GetNumScopes()
+{
+	return (unsigned int)m_vScopeStats.size();
+}
+
+ProfileScopeStats Profiler::GetScopeStats(unsigned int index)
+{
+	return m_vScopeStats[index];
+}
+
+// Chrome trace
+bool Profiler::WriteChromeTrace(string filename)
+{
+	FILE* pFile = fopen(filename.c_str(), "w");
+	if (pFile == NULL)
+	{
+		return false;
+	}
+
+	lock_guard<mutex> lock(m_threadBuffersMutex);
+
+	fprintf(pFile, "{\"displayTimeUnit\":\"ms\",\"traceEvents\":[\n");
+	bool firstEvent = true;
+	for (unsigned int i = 0; i < m_vpThreadBuffers.size(); i++)
+	{
+		ProfileThreadBuffer* pBuffer = m_vpThreadBuffers[i];
+		fprintf(pFile, "%s{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":1,\"tid\":%u,\"args\":{\"name\":\"%s\"}}", firstEvent ? "" : ",\n", pBuffer->m_threadIndex,
+		        pBuffer->m_threadName.c_str());
+		firstEvent = false;
+
+		// Complete events, in microseconds. Scope names are code identifiers, so they never need escaping.
+		unsigned int numEvents = pBuffer->m_numEvents.load(memory_order_acquire);
+		for (unsigned int j = numEvents > PROFILER_RING_SIZE ? numEvents - PROFILER_RING_SIZE : 0; j < numEvents; j++)
+		{
+			const ProfileEvent& event = pBuffer->m_pEvents[j % PROFILER_RING_SIZE];
+			fprintf(pFile, ",\n{\"name\":\"%s\",\"ph\":\"X\",\"pid\":1,\"tid\":%u,\"ts\":%.3f,\"dur\":%.3f}", event.m_pName, pBuffer->m_threadIndex,
+			        event.m_start / 1000.0, (event.m_end - event.m_start) / 1000.0);
+		}
+	}
+	fprintf(pFile, "\n]}\n");
+
+	return fclose(pFile) == 0;
+}
@@ -0,0 +1,148 @@
+// ******************************************************************************
+// Filename:    Profiler.h
+// Project:     Qube
+// Author:      Steven Ball
+//
+// Purpose:
+//   A scoped CPU profiler. PROFILE_SCOPE marks a block of code, and when the
+//   profiler is enabled the time spent in it is written to a ring buffer of
+//   the thread that ran it. At the end of each frame the events are summed up
+//   per scope for the overlay, and the whole of every ring buffer can be
+//   written out as a Chrome trace, to be opened in chrome://tracing. While
+//   the profiler is disabled a scope costs a single flag check. GPU passes
+//   timed by the GPUProfiler are added as events of a GPU track of their own.
+//
+// Revision History:
+//   Initial Revision - 17/10/26
+//
+// Copyright (c) 2005-2016, Steven Ball
+// ******************************************************************************
+
+#pragma once
+
+#include <atomic>
+#include <mutex>
+#include <string>
+#include <vector>
+using namespace std;
+
+// Events kept for each thread, once a thread has written this many its oldest events are written over
+const unsigned int PROFILER_RING_SIZE = 65536;
+
+// Frames that the per scope breakdown is averaged over before it is shown
+const unsigned int PROFILER_AVERAGE_FRAMES = 30;
+
+struct ProfileEvent
+{
+	const char* m_pName;
+	long long m_start; // Nanoseconds since the profiler was created
+	long long m_end;
+};
+
+class ProfileThreadBuffer
+{
+public:
+	string m_threadName;
+	unsigned int m_threadIndex;
+	ProfileEvent* m_pEvents; // Allocated with the first event, so threads that are only named cost next to nothing
+	atomic<unsigned int> m_numEvents; // Every event the thread has written, the newest is at (m_numEvents - 1) % PROFILER_RING_SIZE
+	unsigned int m_numGatheredEvents; // Events already summed up by EndFrame
+	bool m_gpu; // The GPU track rather than a thread
+};
+
+struct ProfileScopeStats
+{
+	const char* m_pName;
+	double m_milliseconds; // Average time per frame, summed over every thread and call
+	double m_calls; // Average calls per frame
+	bool m_gpu;
+};
+
+class Profiler
+{
+public:
+	/* Public methods */
+	static Profiler* GetInstance();
+
+	// Enabling
+	void SetEnabled(bool enabled);
+	static bool IsEnabled() { return c_enabled.load(memory_order_relaxed); }
+
+	// Events, the names have to be string literals or live as long as the profiler does
+	static long long GetTime();
+	void AddEvent(const char* pName, long long start, long long end);
+	void AddGPUEvent(const char* pName, long long start, long long end); // Already moved onto the profiler clock, only one thread may add them
+	void SetThreadName(string name); // Shown for the thread in the trace
+
+	// Frames
+	void EndFrame(); // Sums up the events that ended since the last frame into the per scope breakdown
+	unsigned int GetNumScopes();
+	ProfileScopeStats GetScopeStats(unsigned int index); // In the order that the scopes were first seen
+
+	// Chrome trace
+	bool WriteChromeTrace(string filename);
+
+protected:
+	/* Protected methods */
+	Profiler();
+	Profiler(const Profiler&) {};
+	Profiler &operator=(const Profiler&) { return *this; };
+
+private:
+	/* Private methods */
+	ProfileThreadBuffer* CreateThreadBuffer(bool gpu);
+	ProfileThreadBuffer* GetThreadBuffer();
+	void AddEventToBuffer(ProfileThreadBuffer* pBuffer, const char* pName, long long start, long long end);
+
+public:
+	/* Public members */
+
+protected:
+	/* Protected members */
+
+private:
+	/* Private members */
+	static atomic<bool> c_enabled;
+
+	// A buffer for every thread that has added an event or been named, they are kept until the program exits
+	mutex m_threadBuffersMutex;
+	vector<ProfileThreadBuffer*> m_vpThreadBuffers;
+	ProfileThreadBuffer* m_pGPUBuffer;
+
+	// Per scope breakdown, summed over the frames since it was last shown
+	vector<ProfileScopeStats> m_vScopeStats;
+	vector<ProfileScopeStats> m_vFrameSums;
+	unsigned int m_numSummedFrames;
+};
+
+// Times the rest of the block that it is in
+class ProfileScope
+{
+public:
+	ProfileScope(const char* pName)
+	{
+		m_pName = pName;
+		m_start = Profiler::IsEnabled() ? Profiler::GetTime() : -1;
+	}
+
+	~ProfileScope()
+	{
+		if (m_start >= 0)
+		{
+			Profiler::GetInstance()->AddEvent(m_pName, m_start, Profiler::GetTime());
+		}
+	}
+
+private:
+	const char* m_pName;
+	long long m_start;
+};
+
+// Defining QUBE_NO_PROFILER compiles every scope out
+#ifdef QUBE_NO_PROFILER
+#define PROFILE_SCOPE(name)
+#else
+#define PROFILE_SCOPE_JOIN(a, b) a##b
+#define PROFILE_SCOPE_NAME(line) PROFILE_SCOPE_JOIN(profileScope, line)
+#define PROFILE_SCOPE(name) ProfileScope PROFILE_SCOPE_NAME(__LINE__)(name)
+#endif //QUBE_NO_PROFILER
@@ -24,6 +24,14 @@ bool boundingBox = false;
 bool innerVoxels = false;
 bool innerFaces = false;
 bool mergeFaces = false;
+bool binaryMesher = false;
+bool packedVertices = false;
+bool ambientOcclusion = false;
+bool levelOfDetail = false;
+bool lodCrossFade = true;
+bool batchedDraws = false;
+bool frustumCulling = true;
+bool occlusionCulling = false;
 bool lightMovement = false;
 bool lightColorLock = false;
 
@@ -31,7 +39,7 @@ void QubeGame::CreateGUI()
 {
 	// Controls window
 	m_pControlsWindow = new Window(m_pNanoGUIScreen, "Controls");
-	m_pControlsWindow->setSize(Vector2i(175, 350));
+	m_pControlsWindow->setSize(Vector2i(175, 591));
 	m_pControlsWindow->setPosition(Vector2i(10, 125));
 
 	// Information
@@ -46,30 +54,48 @@ void QubeGame::CreateGUI()
 	m_pTrianglesInformationLabel = new Label(m_pControlsWindow, "[TRIANGLES]", "arial");
 	m_pTrianglesInformationLabel->setFontSize(13);
 	m_pTrianglesInformationLabel->setPosition(Vector2i(20, 76));
+	m_pMeshMemoryInformationLabel = new Label(m_pControlsWindow, "[MESH MEMORY]", "arial");
+	m_pMeshMemoryInformationLabel->setFontSize(13);
+	m_pMeshMemoryInformationLabel->setPosition(Vector2i(20, 89));
+	m_pPackedSavingInformationLabel = new Label(m_pControlsWindow, "[PACKED SAVING]", "arial");
+	m_pPackedSavingInformationLabel->setFontSize(13);
+	m_pPackedSavingInformationLabel->setPosition(Vector2i(20, 102));
+	m_pDrawCallsInformationLabel = new Label(m_pControlsWindow, "[DRAW CALLS]", "arial");
+	m_pDrawCallsInformationLabel->setFontSize(13);
+	m_pDrawCallsInformationLabel->setPosition(Vector2i(20, 115));
+	m_pVisibleMatricesInformationLabel = new Label(m_pControlsWindow, "[VISIBLE MATRICES]", "arial");
+	m_pVisibleMatricesInformationLabel->setFontSize(13);
+	m_pVisibleMatricesInformationLabel->setPosition(Vector2i(20, 128));
+	m_pVisibleChunksInformationLabel = new Label(m_pControlsWindow, "[VISIBLE CHUNKS]", "arial");
+	m_pVisibleChunksInformationLabel->setFontSize(13);
+	m_pVisibleChunksInformationLabel->setPosition(Vector2i(20, 141));
+	m_pOccludedInformationLabel = new Label(m_pControlsWindow, "[OCCLUDED]", "arial");
+	m_pOccludedInformationLabel->setFontSize(13);
+	m_pOccludedInformationLabel->setPosition(Vector2i(20, 154));
 
 	// Rendering
 	l = new Label(m_pControlsWindow, "Rendering", "arial");
-	l->setPosition(Vector2i(10, 108));
+	l->setPosition(Vector2i(10, 173));
 	CheckBox *cb = new CheckBox(m_pControlsWindow, "Wireframe", [](bool state) { wireframe = state; });
 	cb->setChecked(wireframe);
 	cb->setTooltip("Wireframe rendering.");
 	cb->setFontSize(14);
-	cb->setPosition(Vector2i(20, 125));
+	cb->setPosition(Vector2i(20, 190));
 	cb = new CheckBox(m_pControlsWindow, "Lighting", [](bool state) { lighting = state; });
 	cb->setChecked(lighting);
 	cb->setTooltip("Lighting rendering.");
 	cb->setFontSize(14);
-	cb->setPosition(Vector2i(20, 147));
+	cb->setPosition(Vector2i(20, 212));
 	cb = new CheckBox(m_pControlsWindow, "Shadow", [](bool state) { shadows = state; });
 	cb->setChecked(shadows);
 	cb->setTooltip("Shadows rendering.");
 	cb->setFontSize(14);
-	cb->setPosition(Vector2i(20, 169));
+	cb->setPosition(Vector2i(20, 234));
 	cb = new CheckBox(m_pControlsWindow, "Bounding Box", [](bool state) { boundingBox = state; });
 	cb->setChecked(shadows);
 	cb->setTooltip("Bounding box rendering.");
 	cb->setFontSize(14);
-	cb->setPosition(Vector2i(20, 191));	
+	cb->setPosition(Vector2i(20, 256));	
 	cb = new CheckBox(m_pControlsWindow, "Inner Voxels");
 	cb->setChecked(innerVoxels);
 	cb->setCallback([&](bool state)
@@ -80,7 +106,7 @@ void QubeGame::CreateGUI()
 	});
 	cb->setTooltip("Render the inner voxels.");
 	cb->setFontSize(14);
-	cb->setPosition(Vector2i(20, 213));
+	cb->setPosition(Vector2i(20, 278));
 	cb = new CheckBox(m_pControlsWindow, "Inner Faces");
 	cb->setChecked(innerFaces);
 	cb->setCallback([&](bool state)
@@ -91,7 +117,7 @@ void QubeGame::CreateGUI()
 	});
 	cb->setTooltip("Render the inner faces.");
 	cb->setFontSize(14);
-	cb->setPosition(Vector2i(20, 235));
+	cb->setPosition(Vector2i(20, 300));
 	cb = new CheckBox(m_pControlsWindow, "Face Merging");
 	cb->setChecked(mergeFaces);
 	cb->setCallback([&](bool state)
@@ -102,25 +128,94 @@ void QubeGame::CreateGUI()
 	});
 	cb->setTooltip("Voxel face merging.");
 	cb->setFontSize(14);
-	cb->setPosition(Vector2i(20, 257));
+	cb->setPosition(Vector2i(20, 322));
+	cb = new CheckBox(m_pControlsWindow, "Binary Mesher");
+	cb->setChecked(binaryMesher);
+	cb->setCallback([&](bool state)
+	{
+		binaryMesher = state;
+		m_pQBTFile->SetMesher(binaryMesher ? QBTMesher_BinaryGreedy : QBTMesher_Default);
+		m_pQBTFile->RecreateStaticBuffers();
+	});
+	cb->setTooltip("Mesh with 64-bit occupancy columns and greedy merging on per colour bit-planes.");
+	cb->setFontSize(14);
+	cb->setPosition(Vector2i(20, 344));
+	cb = new CheckBox(m_pControlsWindow, "Packed Vertices");
+	cb->setChecked(packedVertices);
+	cb->setCallback([&](bool state)
+	{
+		packedVertices = state;
+		m_pQBTFile->SetVertexFormat(packedVertices ? QBTVertexFormat_Packed : QBTVertexFormat_PositionColorNormal);
+		m_pQBTFile->RecreateStaticBuffers();
+	});
+	cb->setTooltip("Pack each vertex into 8 bytes, decoded in the vertex shader.");
+	cb->setFontSize(14);
+	cb->setPosition(Vector2i(20, 366));
+	cb = new CheckBox(m_pControlsWindow, "Ambient Occlusion");
+	cb->setChecked(ambientOcclusion);
+	cb->setCallback([&](bool state)
+	{
+		ambientOcclusion = state;
+		m_pQBTFile->SetAmbientOcclusion(ambientOcclusion);
+		m_pQBTFile->RecreateStaticBuffers();
+	});
+	cb->setTooltip("Darken the corners of the voxel faces by their neighbours, baked into the vertices when meshing.");
+	cb->setFontSize(14);
+	cb->setPosition(Vector2i(20, 388));
+	cb = new CheckBox(m_pControlsWindow, "Level of Detail");
+	cb->setChecked(levelOfDetail);
+	cb->setCallback([&](bool state)
+	{
+		levelOfDetail = state;
+		m_pQBTFile->SetNumLODs(levelOfDetail ? QBT_MAX_LODS : 0);
+		m_pQBTFile->RecreateStaticBuffers();
+	});
+	cb->setTooltip("Draw distant matrices from downsampled copies of their voxels, picked by how big the voxels are on screen.");
+	cb->setFontSize(14);
+	cb->setPosition(Vector2i(20, 410));
+	cb = new CheckBox(m_pControlsWindow, "LOD Cross-Fade", [](bool state) { lodCrossFade = state; });
+	cb->setChecked(lodCrossFade);
+	cb->setTooltip("Dither between two levels of detail while a matrix moves from one to the other, instead of popping.");
+	cb->setFontSize(14);
+	cb->setPosition(Vector2i(20, 432));
+	cb = new CheckBox(m_pControlsWindow, "Batched Draws");
+	cb->setChecked(batchedDraws);
+	cb->setCallback([&](bool state)
+	{
+		batchedDraws = state;
+		m_pQBTFile->SetBatchedRendering(batchedDraws);
+		m_pQBTFile->RecreateStaticBuffers();
+	});
+	cb->setTooltip("Draw all the chunks of each vertex format with one multi-draw from a shared buffer.");
+	cb->setFontSize(14);
+	cb->setPosition(Vector2i(20, 454));
+	cb = new CheckBox(m_pControlsWindow, "Frustum Culling", [](bool state) { frustumCulling = state; });
+	cb->setChecked(frustumCulling);
+	cb->setTooltip("Skip the matrices and chunks that are outside of the camera's view.");
+	cb->setFontSize(14);
+	cb->setPosition(Vector2i(20, 476));
+	cb = new CheckBox(m_pControlsWindow, "Occlusion Culling", [](bool state) { occlusionCulling = state; });
+	cb->setChecked(occlusionCulling);
+	cb->setTooltip("Skip the matrices and chunks hidden behind the biggest merged faces, tested on the CPU.");
+	cb->setFontSize(14);
+	cb->setPosition(Vector2i(20, 498));
 
 	l = new Label(m_pControlsWindow, "File Operations", "arial");
-	l->setPosition(Vector2i(10, 287));
+	l->setPosition(Vector2i(10, 528));
 	Button *b = new Button(m_pControlsWindow, "Open");
 	b->setFontSize(18);
-	b->setPosition(Vector2i(20, 308));
+	b->setPosition(Vector2i(20, 549));
 	b->setCallback([&]
 	{
 		string fileName = file_dialog({ { "qbt", "Qubicle Binary Tree" } }, false);
 		if (fileName != "")
 		{
-			m_pQBTFile->Unload();
-			m_pQBTFile->LoadQBTFile(fileName);
+			m_pQBTFile->LoadQBTFileAsync(fileName);
 		}
 	});
 	b = new Button(m_pControlsWindow, "Save");
 	b->setFontSize(18);
-	b->setPosition(Vector2i(85, 308));
+	b->setPosition(Vector2i(85, 549));
 	b->setCallback([&]
 	{
 		string fileName = file_dialog({ { "qbt", "Qubicle Binary Tree" }, }, true);
@@ -130,7 +225,7 @@ void QubeGame::CreateGUI()
 	// Light
 	m_pLightWindow = new Window(m_pNanoGUIScreen, "Light");
 	m_pLightWindow->setSize(Vector2i(175, 350));
-	m_pLightWindow->setPosition(Vector2i(10, 500));
+	m_pLightWindow->setPosition(Vector2i(210, 125));
 
 	cb = new CheckBox(m_pLightWindow, "Light Movement", [](bool state) { lightMovement = state; });
 	cb->setChecked(lightMovement);
@@ -379,8 +474,23 @@ void QubeGame::UpdateGUI()
 	m_pQBTFile->SetCreateInnerVoxels(innerVoxels);
 	m_pQBTFile->SetCreateInnerFaces(innerFaces);
 	m_pQBTFile->SetMergeFaces(mergeFaces);
-
-	m_pControlsWindow->setTitle(m_pQBTFile->GetFilename());
+	m_pQBTFile->SetMesher(binaryMesher ? QBTMesher_BinaryGreedy : QBTMesher_Default);
+	m_pQBTFile->SetVertexFormat(packedVertices ? QBTVertexFormat_Packed : QBTVertexFormat_PositionColorNormal);
+	m_pQBTFile->SetAmbientOcclusion(ambientOcclusion);
+	m_pQBTFile->SetNumLODs(levelOfDetail ? QBT_MAX_LODS : 0);
+	m_pQBTFile->SetLODCrossFade(lodCrossFade);
+	m_pQBTFile->SetBatchedRendering(batchedDraws);
+	m_pQBTFile->SetFrustumCulling(frustumCulling);
+	m_pQBTFile->SetOcclusionCulling(occlusionCulling);
+
+	if (m_pQBTFile->IsAsyncLoading())
+	{
+		m_pControlsWindow->setTitle("Loading...");
+	}
+	else
+	{
+		m_pControlsWindow->setTitle(m_pQBTFile->GetFilename());
+	}
 
 	string matrices = "Number of matrices: " + to_string(m_pQBTFile->GetNumMatrices());
 	m_pMatricesInformationLabel->setCaption(matrices);
@@ -391,6 +501,27 @@ void QubeGame::UpdateGUI()
 	string triangles = "Number of triangles: " + to_string(m_pQBTFile->GetNumTriangles());
 	m_pTrianglesInformationLabel->setCaption(triangles);
 
+	// Static meshes are uploaded whole, so the memory saved is also what is saved on every upload
+	char meshMemory[64];
+	sprintf(meshMemory, "Mesh memory: %.2f MB", m_pQBTFile->GetMeshMemory() / (1024.0f * 1024.0f));
+	m_pMeshMemoryInformationLabel->setCaption(meshMemory);
+
+	char packedSaving[64];
+	sprintf(packedSaving, "Packed saving: %.2f MB", (m_pQBTFile->GetUnpackedMeshMemory() - m_pQBTFile->GetMeshMemory()) / (1024.0f * 1024.0f));
+	m_pPackedSavingInformationLabel->setCaption(packedSaving);
+
+	string drawCalls = "Draw calls: " + to_string(m_pQBTFile->GetNumDrawCalls());
+	m_pDrawCallsInformationLabel->setCaption(drawCalls);
+
+	string visibleMatrices = "Visible matrices: " + to_string(m_pQBTFile->GetNumVisibleMatrices()) + " (" + to_string(m_pQBTFile->GetNumCulledMatrices()) + " culled)";
+	m_pVisibleMatricesInformationLabel->setCaption(visibleMatrices);
+
+	string visibleChunks = "Visible chunks: " + to_string(m_pQBTFile->GetNumVisibleChunks()) + " (" + to_string(m_pQBTFile->GetNumCulledChunks()) + " culled)";
+	m_pVisibleChunksInformationLabel->setCaption(visibleChunks);
+
+	string occluded = "Occluded: " + to_string(m_pQBTFile->GetNumOccludedMatrices()) + " matrices, " + to_string(m_pQBTFile->GetNumOccludedChunks()) + " chunks";
+	m_pOccludedInformationLabel->setCaption(occluded);
+
 	m_bLightMovement = lightMovement;
 }
 
@@ -110,11 +110,21 @@ void QubeGame::Create(QubeSettings* pQubeSettings)
 	initGraph(&m_fpsGraph, GRAPH_RENDER_FPS, "Frame Time");
 	initGraph(&m_cpuGraph, GRAPH_RENDER_MS, "CPU Time");
 	initGraph(&m_gpuGraph, GRAPH_RENDER_MS, "GPU Time");
-	initGPUTimer(&m_gpuTimer);
+	m_pGPUProfiler = new GPUProfiler();
+
+	/* Profiler, enabled from the start when a trace is wanted after a number of frames */
+	Profiler::GetInstance()->SetThreadName("Main");
+	Profiler::GetInstance()->SetEnabled(m_pQubeSettings->m_profiler || m_pQubeSettings->m_profilerTraceFrame > 0);
+	m_profilerFrame = 0;
+
+	/* Create the job system, a worker for every other hardware thread */
+	m_pJobSystem = new JobSystem(std::max(thread::hardware_concurrency(), 1u) - 1);
 
 	/* QBT File */
 	m_pQBTFile = new QBT(m_pRenderer);
+	m_pQBTFile->SetJobSystem(m_pJobSystem);
 	m_pQBTFile->LoadQBTFile("media/assets/qbt/ground_tile1.qbt");
+	m_asyncUploadBudget = 2.0f;
 
 	/* Pause and quit */
 	m_bGameQuit = false;
@@ -176,6 +186,12 @@ void QubeGame::Destroy()
 	{
 		DestroyGUI();
 
+		delete m_pQBTFile;
+
+		delete m_pJobSystem;
+
+		delete m_pGPUProfiler;
+
 		delete m_pGameCamera;
 		delete m_pDefaultViewport;
 		delete m_pDefaultLight;
@@ -333,6 +349,42 @@ CameraMode QubeGame::GetCameraMode()
 	return m_cameraMode;
 }
 
+// Profiling
+void QubeGame::EndProfilerFrame()
+{
+	if (Profiler::IsEnabled() == false)
+	{
+		return;
+	}
+
+	Profiler::GetInstance()->EndFrame();
+
+	m_profilerFrame++;
+	if (m_profilerFrame == (unsigned int)m_pQubeSettings->m_profilerTraceFrame)
+	{
+		WriteProfilerTrace();
+	}
+}
+
+void QubeGame::ToggleProfiler()
+{
+	Profiler::GetInstance()->SetEnabled(Profiler::IsEnabled() == false);
+}
+
+void QubeGame::WriteProfilerTrace()
+{
+	char filename[64];
+	sprintf(filename, "qube_trace_%u.json", m_profilerFrame);
+	if (Profiler::GetInstance()->WriteChromeTrace(filename))
+	{
+		cout << "Wrote profiler trace '" << filename << "'\n";
+	}
+	else
+	{
+		cout << "Can't write profiler trace '" << filename << "'\n";
+	}
+}
+
 // Accessors
 QubeSettings* QubeGame::GetQubeSettings()
 {
@@ -347,4 +399,9 @@ Screen* QubeGame::GetNanoGUIScreen()
 QBT* QubeGame::GetQBTModel()
 {
 	return m_pQBTFile;
+}
+
+JobSystem* QubeGame::GetJobSystem()
+{
+	return m_pJobSystem;
 }
\ No newline at end of file
@@ -22,6 +22,9 @@
 #include "Renderer/camera.h"
 #include "Renderer/light.h"
 #include "qbt/QBT.h"
+#include "JobSystem/JobSystem.h"
+#include "Profiler/Profiler.h"
+#include "Profiler/GPUProfiler.h"
 #include "QubeWindow.h"
 #include "QubeSettings.h"
 
@@ -146,11 +149,18 @@ public:
 	void RenderDebugInformation();
 	void RenderNanoVG();
 	void RenderNanoGUI();
+	void RenderProfilerOverlay();
+
+	// Profiling
+	void EndProfilerFrame();
+	void ToggleProfiler();
+	void WriteProfilerTrace();
 
 	// Accessors
 	QubeSettings* GetQubeSettings();
 	Screen* GetNanoGUIScreen();
 	QBT* GetQBTModel();
+	JobSystem* GetJobSystem();
 
 protected:
 	/* Protected methods */
@@ -262,7 +272,7 @@ private:
 	PerfGraph m_fpsGraph;
 	PerfGraph m_cpuGraph;
 	PerfGraph m_gpuGraph;
-	GPUtimer m_gpuTimer;
+	GPUProfiler* m_pGPUProfiler;
 	double m_cpuTime;
 
 	// NanoGUI root screen
@@ -273,6 +283,12 @@ private:
 	Label *m_pMatricesInformationLabel;
 	Label *m_pVerticesInformationLabel;
 	Label *m_pTrianglesInformationLabel;
+	Label *m_pMeshMemoryInformationLabel;
+	Label *m_pPackedSavingInformationLabel;
+	Label *m_pDrawCallsInformationLabel;
+	Label *m_pVisibleMatricesInformationLabel;
+	Label *m_pVisibleChunksInformationLabel;
+	Label *m_pOccludedInformationLabel;
 	ComboBox* m_pMatricesCombo;
 	PopupButton *m_pAmbientButton_Light;
 	PopupButton *m_pDiffuseButton_Light;
@@ -282,8 +298,15 @@ private:
 	PopupButton *m_pSpecularButton_Material;
 	PopupButton *m_pEmissionButton_Material;
 
+	// Job system
+	JobSystem* m_pJobSystem;
+
+	// Profiler
+	unsigned int m_profilerFrame;
+
 	// QBT File
 	QBT* m_pQBTFile;
+	float m_asyncUploadBudget;
 
 	// Singleton instance
 	static QubeGame *c_instance;
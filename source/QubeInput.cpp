@@ -184,6 +184,16 @@ void QubeGame::KeyPressed(int key, int scancode, int mods)
 			m_bKeyboardMenu = true;
 			break;
 		}		
+		case GLFW_KEY_F8:
+		{
+			ToggleProfiler();
+			break;
+		}
+		case GLFW_KEY_F9:
+		{
+			WriteProfilerTrace();
+			break;
+		}
 	}
 }
 
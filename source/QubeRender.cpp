@@ -32,14 +32,17 @@ void QubeGame::EndShaderRender()
 
 void QubeGame::Render()
 {
+	PROFILE_SCOPE("QubeGame::Render");
+
 	if (m_pQubeWindow->GetMinimized())
 	{
 		// Don't call any render functions if minimized
 		return;
 	}
 
-	// Start timings
-	startGPUTimer(&m_gpuTimer);
+	// Start timings, the GPU frame reads back the passes of earlier frames that the GPU has finished
+	m_pGPUProfiler->BeginFrame();
+	m_pGPUProfiler->BeginPass("Frame");
 
 
 	// Start the scene
@@ -59,8 +62,13 @@ void QubeGame::Render()
 	// Set viewport
 	m_pRenderer->SetViewport(m_pDefaultViewport);
 
-	// Reset line drawing
+	// Camera and light uniform blocks, shared by every shader for the rest of the frame
+	m_pRenderer->SetCameraUniforms(m_pGameCamera);
+	m_pRenderer->SetLightUniforms(m_pDefaultLight);
+
+	// Reset line and debug primitive drawing
 	m_pRenderer->ResetLines();
+	m_pRenderer->ResetDebugPrimitives();
 	
 	// Draw Axis
 	m_pRenderer->DrawLine(vec3(0.0f, 0.0f, 0.0f), vec3(5.0f, 0.0f, 0.0f), Colour(1.0f, 0.0f, 0.0f), Colour(1.0f, 0.0f, 0.0f));
@@ -71,24 +79,35 @@ void QubeGame::Render()
 	m_pRenderer->DrawCube(m_pDefaultLight->m_position, 1.0f, 1.0f, 1.0f, m_pDefaultLight->m_diffuse);
 
 	// Render the QBT file
+	m_pGPUProfiler->BeginPass("QBT geometry");
 	m_pQBTFile->Render(m_pGameCamera, m_pDefaultLight);
+	m_pGPUProfiler->EndPass();
 
-	// Render lines
-	m_pRenderer->RenderLines(m_pGameCamera);
+	// Render lines and debug primitives
+	m_pGPUProfiler->BeginPass("Debug lines");
+	m_pRenderer->RenderLines();
+	m_pRenderer->RenderDebugPrimitives();
+	m_pGPUProfiler->EndPass();
 
 	// Render nanovg
+	m_pGPUProfiler->BeginPass("NanoVG");
 	RenderNanoVG();
+	m_pGPUProfiler->EndPass();
 
 	// Render the nanogui
+	m_pGPUProfiler->BeginPass("NanoGUI");
 	RenderNanoGUI();
+	m_pGPUProfiler->EndPass();
 
 	// Stop timings
 	m_cpuTime = m_pQubeWindow->GetTime() - m_glfwTime;
 	updateGraph(&m_cpuGraph, (float)m_cpuTime);
 
 	// Update GPU graphs
-	float gpuTimes[3];
-	unsigned int n = stopGPUTimer(&m_gpuTimer, gpuTimes, 3);
+	m_pGPUProfiler->EndPass();
+	m_pGPUProfiler->EndFrame();
+	float gpuTimes[GPU_PROFILER_NUM_FRAMES];
+	unsigned int n = m_pGPUProfiler->ReadFrameTimes(gpuTimes, GPU_PROFILER_NUM_FRAMES);
 	for (unsigned int i = 0; i < n; i++)
 	{
 		updateGraph(&m_gpuGraph, gpuTimes[i]);
@@ -119,14 +138,78 @@ void QubeGame::RenderDebugInformation()
 
 	renderGraph(m_pNanovg, 5, 5, &m_fpsGraph);
 	renderGraph(m_pNanovg, 5 + 200 + 5, 5, &m_cpuGraph);
-	if (m_gpuTimer.supported)
+	if (m_pGPUProfiler->IsSupported())
 	{
 		renderGraph(m_pNanovg, 5 + 200 + 5 + 200 + 5, 5, &m_gpuGraph);
 	}
+
+	if (Profiler::IsEnabled())
+	{
+		RenderProfilerOverlay();
+	}
+}
+
+// Per scope breakdown in the top right corner, the times include any scopes nested inside. The GPU passes come after the CPU
+// scopes, a few frames behind them.
+void QubeGame::RenderProfilerOverlay()
+{
+	Profiler* pProfiler = Profiler::GetInstance();
+	unsigned int numScopes = pProfiler->GetNumScopes();
+
+	float width = 320.0f;
+	float rowHeight = 16.0f;
+	float x = m_windowWidth - width - 5.0f;
+	float y = 5.0f;
+
+	nvgBeginPath(m_pNanovg);
+	nvgRect(m_pNanovg, x, y, width, rowHeight * (numScopes + 1) + 4.0f);
+	nvgFillColor(m_pNanovg, nvgRGBA(0, 0, 0, 128));
+	nvgFill(m_pNanovg);
+
+	nvgFontFace(m_pNanovg, "arial");
+	nvgFontSize(m_pNanovg, 14.0f);
+	nvgFillColor(m_pNanovg, nvgRGBA(240, 240, 240, 192));
+	nvgTextAlign(m_pNanovg, NVG_ALIGN_LEFT | NVG_ALIGN_TOP);
+	nvgText(m_pNanovg, x + 3.0f, y + 2.0f, "Profiler (F8 toggle, F9 trace)", NULL);
+	nvgTextAlign(m_pNanovg, NVG_ALIGN_RIGHT | NVG_ALIGN_TOP);
+	nvgText(m_pNanovg, x + width - 55.0f, y + 2.0f, "ms", NULL);
+	nvgText(m_pNanovg, x + width - 3.0f, y + 2.0f, "calls", NULL);
+
+	unsigned int row = 1;
+	for (int gpu = 0; gpu < 2; gpu++)
+	{
+		nvgFillColor(m_pNanovg, gpu ? nvgRGBA(255, 192, 0, 255) : nvgRGBA(240, 240, 240, 255));
+		for (unsigned int i = 0; i < numScopes; i++)
+		{
+			ProfileScopeStats stats = pProfiler->GetScopeStats(i);
+			if (stats.m_gpu != (gpu == 1))
+			{
+				continue;
+			}
+
+			float rowY = y + 2.0f + rowHeight * row;
+			row++;
+
+			char lNameBuff[128];
+			char lTimeBuff[32];
+			char lCallsBuff[32];
+			sprintf(lNameBuff, "%s%s", gpu ? "GPU " : "", stats.m_pName);
+			sprintf(lTimeBuff, "%.3f", stats.m_milliseconds);
+			sprintf(lCallsBuff, "%.1f", stats.m_calls);
+
+			nvgTextAlign(m_pNanovg, NVG_ALIGN_LEFT | NVG_ALIGN_TOP);
+			nvgText(m_pNanovg, x + 3.0f, rowY, lNameBuff, NULL);
+			nvgTextAlign(m_pNanovg, NVG_ALIGN_RIGHT | NVG_ALIGN_TOP);
+			nvgText(m_pNanovg, x + width - 55.0f, rowY, lTimeBuff, NULL);
+			nvgText(m_pNanovg, x + width - 3.0f, rowY, lCallsBuff, NULL);
+		}
+	}
 }
 
 void QubeGame::RenderNanoVG()
 {
+	PROFILE_SCOPE("QubeGame::RenderNanoVG");
+
 	float pxRatio = (float)m_windowWidth / (float)m_windowHeight;
 	nvgBeginFrame(m_pNanovg, m_windowWidth, m_windowHeight, pxRatio);
 
@@ -138,6 +221,8 @@ void QubeGame::RenderNanoVG()
 
 void QubeGame::RenderNanoGUI()
 {
+	PROFILE_SCOPE("QubeGame::RenderNanoGUI");
+
 	m_pNanoGUIScreen->drawContents();
 	m_pNanoGUIScreen->drawWidgets();
 }
\ No newline at end of file
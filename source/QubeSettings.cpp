@@ -51,6 +51,8 @@ void QubeSettings::LoadSettings()
 	m_debugRendering = reader.GetBoolean("Debug", "DebugRendering", false);
 	m_gameMode = reader.Get("Debug", "GameMode", "Debug");
 	m_version = reader.Get("Debug", "Version", "1.0");
+	m_profiler = reader.GetBoolean("Debug", "Profiler", false);
+	m_profilerTraceFrame = reader.GetInteger("Debug", "ProfilerTraceFrame", 0);
 }
 
 // Save settings
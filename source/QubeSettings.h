@@ -62,6 +62,8 @@ public:
 	bool m_debugRendering;
 	string m_gameMode;
 	string m_version;
+	bool m_profiler;
+	int m_profilerTraceFrame;
 
 protected:
 	/* Protected members */
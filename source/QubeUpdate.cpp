@@ -22,6 +22,8 @@ using namespace std;
 // Updating
 void QubeGame::Update()
 {
+	PROFILE_SCOPE("QubeGame::Update");
+
 	// FPS
 #ifdef _WIN32
 	QueryPerformanceCounter(&m_fpsCurrentTicks);
@@ -72,6 +74,12 @@ void QubeGame::Update()
 	{
 	}
 
+	// Stream in any model that is loading in the background, without going over the per-frame upload budget
+	m_pQBTFile->UpdateAsyncLoad(m_asyncUploadBudget);
+
+	// Remesh the chunks of any voxels that were edited, so the edits show up this frame
+	m_pQBTFile->UpdateDirtyChunks();
+
 	// Update controls
 	UpdateControls(m_deltaTime);
 
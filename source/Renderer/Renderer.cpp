@@ -11,11 +11,14 @@
 
 #include "../glew/include/GL/glew.h"
 #include "Renderer.h"
+#include "../Profiler/Profiler.h"
 
 #include <glm/glm.hpp>
 #include <glm/gtc/matrix_transform.hpp>
 #include <glm/gtc/type_ptr.hpp>
 
+#include <string.h>
+#include <algorithm>
 #include <iostream>
 using namespace std;
 
@@ -51,6 +54,34 @@ Renderer::Renderer(int width, int height)
 	m_clipNear = 0.1f;
 	m_clipFar = 10000.0f;
 
+	// Shared quad index buffers, created when they are first needed
+	m_quadIndexBuffer16 = 0;
+	m_quadIndexBuffer32 = 0;
+	m_numQuadIndexBuffer32Quads = 0;
+
+	// Shared uniform buffers, created once GLEW is up
+	for (int i = 0; i < ShaderUniformBlock_NUM; i++)
+	{
+		m_uniformBuffers[i] = 0;
+	}
+	m_drawUniformStride = sizeof(DrawUniformBlock);
+
+	// Debug line ring buffer, created once GLEW is up
+	m_lineVertexArray = 0;
+	m_lineRingBuffer = 0;
+	m_linePersistentMapping = false;
+	m_pLineRingMemory = NULL;
+	for (unsigned int i = 0; i < LINE_RING_NUM_SECTIONS; i++)
+	{
+		m_lineRingFences[i] = 0;
+	}
+	m_lineRingSection = 0;
+
+	// Debug primitive buffers, created once GLEW is up
+	m_debugPrimitiveVertexArray = 0;
+	m_debugPrimitiveVertexBuffer = 0;
+	m_debugPrimitiveInstanceBuffer = 0;
+
 	// Glew init
 	glewExperimental = GL_TRUE;
 	GLenum err = glewInit();
@@ -63,19 +94,190 @@ Renderer::Renderer(int width, int height)
 
 	// Setup the shaders
 	SetupShaders();
+	CreateUniformBuffers();
+	CreateLineBuffers();
+	CreateDebugPrimitiveBuffers();
 }
 
 Renderer::~Renderer()
 {
 	ResetLines();
 
+	for (unsigned int i = 0; i < LINE_RING_NUM_SECTIONS; i++)
+	{
+		if (m_lineRingFences[i] != 0)
+		{
+			glDeleteSync(m_lineRingFences[i]);
+		}
+	}
+	if (m_pLineRingMemory != NULL)
+	{
+		glBindBuffer(GL_ARRAY_BUFFER, m_lineRingBuffer);
+		glUnmapBuffer(GL_ARRAY_BUFFER);
+		glBindBuffer(GL_ARRAY_BUFFER, 0);
+	}
+	glDeleteBuffers(1, &m_lineRingBuffer);
+	glDeleteVertexArrays(1, &m_lineVertexArray);
+
+	glDeleteBuffers(1, &m_debugPrimitiveVertexBuffer);
+	glDeleteBuffers(1, &m_debugPrimitiveInstanceBuffer);
+	glDeleteVertexArrays(1, &m_debugPrimitiveVertexArray);
+
+	glDeleteBuffers(1, &m_quadIndexBuffer16);
+	glDeleteBuffers(1, &m_quadIndexBuffer32);
+	glDeleteBuffers(ShaderUniformBlock_NUM, m_uniformBuffers);
+
 	delete m_pPositionColorShader;
+	delete m_pInstancedPositionShader;
 }
 
 // Setup
 void Renderer::SetupShaders()
 {
 	m_pPositionColorShader = new Shader("media/shaders/PositionColor.vertex", "media/shaders/PositionColor.fragment");
+	m_pInstancedPositionShader = new Shader("media/shaders/InstancedPosition.vertex", "media/shaders/PositionColor.fragment");
+}
+
+void Renderer::CreateUniformBuffers()
+{
+	glGenBuffers(ShaderUniformBlock_NUM, m_uniformBuffers);
+
+	// The camera and light blocks never move, so they are bound once here
+	glBindBuffer(GL_UNIFORM_BUFFER, m_uniformBuffers[ShaderUniformBlock_Camera]);
+	glBufferData(GL_UNIFORM_BUFFER, sizeof(CameraUniformBlock), NULL, GL_DYNAMIC_DRAW);
+	glBindBufferBase(GL_UNIFORM_BUFFER, ShaderUniformBlock_Camera, m_uniformBuffers[ShaderUniformBlock_Camera]);
+
+	glBindBuffer(GL_UNIFORM_BUFFER, m_uniformBuffers[ShaderUniformBlock_Light]);
+	glBufferData(GL_UNIFORM_BUFFER, sizeof(LightUniformBlock), NULL, GL_DYNAMIC_DRAW);
+	glBindBufferBase(GL_UNIFORM_BUFFER, ShaderUniformBlock_Light, m_uniformBuffers[ShaderUniformBlock_Light]);
+
+	glBindBuffer(GL_UNIFORM_BUFFER, 0);
+
+	// Per draw entries have to start on the offset alignment to be bound on their own
+	GLint offsetAlignment = 0;
+	glGetIntegerv(GL_UNIFORM_BUFFER_OFFSET_ALIGNMENT, &offsetAlignment);
+	if (offsetAlignment > 0)
+	{
+		m_drawUniformStride = (sizeof(DrawUniformBlock) + offsetAlignment - 1) / offsetAlignment * offsetAlignment;
+	}
+}
+
+void Renderer::CreateLineBuffers()
+{
+	GLsizeiptr ringSize = (GLsizeiptr)LINE_RING_NUM_SECTIONS * LINE_RING_SECTION_VERTICES * sizeof(LineVertex);
+
+	glGenVertexArrays(1, &m_lineVertexArray);
+	glGenBuffers(1, &m_lineRingBuffer);
+
+	glBindVertexArray(m_lineVertexArray);
+	glBindBuffer(GL_ARRAY_BUFFER, m_lineRingBuffer);
+
+	m_linePersistentMapping = GLEW_VERSION_4_4 || GLEW_ARB_buffer_storage;
+	if (m_linePersistentMapping)
+	{
+		GLbitfield flags = GL_MAP_WRITE_BIT | GL_MAP_PERSISTENT_BIT | GL_MAP_COHERENT_BIT;
+		glBufferStorage(GL_ARRAY_BUFFER, ringSize, NULL, flags);
+		m_pLineRingMemory = (LineVertex*)glMapBufferRange(GL_ARRAY_BUFFER, 0, ringSize, flags);
+		m_linePersistentMapping = m_pLineRingMemory != NULL;
+	}
+	if (m_linePersistentMapping == false)
+	{
+		glBufferData(GL_ARRAY_BUFFER, ringSize, NULL, GL_STREAM_DRAW);
+	}
+
+	glVertexAttribPointer(0, 3, GL_FLOAT, GL_FALSE, sizeof(LineVertex), (GLvoid*)0);
+	glEnableVertexAttribArray(0);
+	glVertexAttribPointer(1, 4, GL_UNSIGNED_BYTE, GL_TRUE, sizeof(LineVertex), (GLvoid*)(sizeof(GLfloat) * 3));
+	glEnableVertexAttribArray(1);
+
+	glBindVertexArray(0);
+	glBindBuffer(GL_ARRAY_BUFFER, 0);
+}
+
+void Renderer::CreateDebugPrimitiveBuffers()
+{
+	vector<vec3> vVertices;
+
+	// Box, the 4 edges along each axis
+	m_debugPrimitiveFirstVertex[DebugPrimitive_Box] = (unsigned int)vVertices.size();
+	for (int axis = 0; axis < 3; axis++)
+	{
+		for (int edge = 0; edge < 4; edge++)
+		{
+			vec3 start;
+			start[(axis + 1) % 3] = (edge & 1) ? 0.5f : -0.5f;
+			start[(axis + 2) % 3] = (edge & 2) ? 0.5f : -0.5f;
+			start[axis] = -0.5f;
+			vec3 end = start;
+			end[axis] = 0.5f;
+
+			vVertices.push_back(start);
+			vVertices.push_back(end);
+		}
+	}
+
+	// Sphere, a circle around each axis
+	m_debugPrimitiveFirstVertex[DebugPrimitive_Sphere] = (unsigned int)vVertices.size();
+	for (int axis = 0; axis < 3; axis++)
+	{
+		for (unsigned int segment = 0; segment < DEBUG_SPHERE_SEGMENTS; segment++)
+		{
+			for (unsigned int end = 0; end < 2; end++)
+			{
+				float angle = (float)(segment + end) / (float)DEBUG_SPHERE_SEGMENTS * 2.0f * PI;
+				vec3 point;
+				point[(axis + 1) % 3] = cos(angle);
+				point[(axis + 2) % 3] = sin(angle);
+
+				vVertices.push_back(point);
+			}
+		}
+	}
+
+	// Frustum, the box scaled up to the clip space cube
+	m_debugPrimitiveFirstVertex[DebugPrimitive_Frustum] = (unsigned int)vVertices.size();
+	for (unsigned int i = m_debugPrimitiveFirstVertex[DebugPrimitive_Box]; i < m_debugPrimitiveFirstVertex[DebugPrimitive_Sphere]; i++)
+	{
+		vVertices.push_back(vVertices[i] * 2.0f);
+	}
+
+	// Arrow, the shaft and 4 lines of the head
+	m_debugPrimitiveFirstVertex[DebugPrimitive_Arrow] = (unsigned int)vVertices.size();
+	vVertices.push_back(vec3(0.0f, 0.0f, 0.0f));
+	vVertices.push_back(vec3(0.0f, 0.0f, 1.0f));
+	for (int i = 0; i < 4; i++)
+	{
+		float side = (i & 1) ? 0.1f : -0.1f;
+		vVertices.push_back(vec3(0.0f, 0.0f, 1.0f));
+		vVertices.push_back((i & 2) ? vec3(side, 0.0f, 0.8f) : vec3(0.0f, side, 0.8f));
+	}
+
+	for (int i = 0; i < DebugPrimitive_NUM; i++)
+	{
+		unsigned int endVertex = (i + 1 < DebugPrimitive_NUM) ? m_debugPrimitiveFirstVertex[i + 1] : (unsigned int)vVertices.size();
+		m_debugPrimitiveNumVertices[i] = endVertex - m_debugPrimitiveFirstVertex[i];
+	}
+
+	glGenVertexArrays(1, &m_debugPrimitiveVertexArray);
+	glGenBuffers(1, &m_debugPrimitiveVertexBuffer);
+	glGenBuffers(1, &m_debugPrimitiveInstanceBuffer);
+
+	glBindVertexArray(m_debugPrimitiveVertexArray);
+
+	glBindBuffer(GL_ARRAY_BUFFER, m_debugPrimitiveVertexBuffer);
+	glBufferData(GL_ARRAY_BUFFER, sizeof(vec3) * vVertices.size(), vVertices.data(), GL_STATIC_DRAW);
+	glVertexAttribPointer(0, 3, GL_FLOAT, GL_FALSE, sizeof(vec3), (GLvoid*)0);
+	glEnableVertexAttribArray(0);
+
+	// The instance attributes are pointed at the instances of each primitive type before it is drawn
+	for (int i = 4; i <= 8; i++)
+	{
+		glEnableVertexAttribArray(i);
+		glVertexAttribDivisor(i, 1);
+	}
+
+	glBindVertexArray(0);
+	glBindBuffer(GL_ARRAY_BUFFER, 0);
 }
 
 // Resize
@@ -85,6 +287,16 @@ void Renderer::ResizeWindow(int newWidth, int newHeight)
 	m_windowHeight = newHeight;
 }
 
+int Renderer::GetWindowWidth()
+{
+	return m_windowWidth;
+}
+
+int Renderer::GetWindowHeight()
+{
+	return m_windowHeight;
+}
+
 // Scene
 bool Renderer::ClearScene(bool pixel, bool depth, bool stencil)
 {
@@ -142,140 +354,359 @@ void Renderer::SetViewport(Viewport* pViewport)
 	glViewport(pViewport->Left, pViewport->Bottom, pViewport->Width, pViewport->Height);
 }
 
-// Rendering
-void Renderer::ResetLines()
+// Shared quad index buffers
+GLuint Renderer::GetQuadIndexBuffer(unsigned int numVertices)
 {
-	for (unsigned int i = 0; i < m_vpLines.size(); i++)
+	unsigned int numQuads = numVertices / 4;
+
+	if (numVertices <= QUAD_INDEX_BUFFER_16_MAX_VERTICES)
 	{
-		delete m_vpLines[i];
-		m_vpLines[i] = 0;
+		if (m_quadIndexBuffer16 == 0)
+		{
+			glGenBuffers(1, &m_quadIndexBuffer16);
+			CreateQuadIndexBuffer(m_quadIndexBuffer16, QUAD_INDEX_BUFFER_16_MAX_VERTICES / 4, true);
+		}
+
+		return m_quadIndexBuffer16;
+	}
+
+	// Growing keeps the same buffer name, so vertex arrays that already use the buffer stay valid
+	if (numQuads > m_numQuadIndexBuffer32Quads)
+	{
+		if (m_quadIndexBuffer32 == 0)
+		{
+			glGenBuffers(1, &m_quadIndexBuffer32);
+		}
+
+		m_numQuadIndexBuffer32Quads = std::max(numQuads, m_numQuadIndexBuffer32Quads * 2);
+		CreateQuadIndexBuffer(m_quadIndexBuffer32, m_numQuadIndexBuffer32Quads, false);
 	}
-	m_vpLines.clear();
+
+	return m_quadIndexBuffer32;
 }
 
-void Renderer::DrawLine(vec3 lineSart, vec3 lineEnd, Colour lineStartColour, Colour lineEndColour)
+GLenum Renderer::GetQuadIndexType(unsigned int numVertices)
+{
+	return numVertices <= QUAD_INDEX_BUFFER_16_MAX_VERTICES ? GL_UNSIGNED_SHORT : GL_UNSIGNED_INT;
+}
+
+void Renderer::CreateQuadIndexBuffer(GLuint quadIndexBuffer, unsigned int numQuads, bool shortIndices)
 {
-	Line* pNewLine = new Line();
-	pNewLine->m_lineStart = lineSart;
-	pNewLine->m_lineEnd = lineEnd;
-	pNewLine->m_lineStartColour = lineStartColour;
-	pNewLine->m_lineEndColour = lineEndColour;
+	size_t numIndices = (size_t)numQuads * 6;
+	size_t indexSize = shortIndices ? sizeof(GLushort) : sizeof(GLuint);
+	vector<unsigned char> indices(numIndices * indexSize);
 
-	m_vpLines.push_back(pNewLine);
+	for (size_t i = 0; i < numIndices; i++)
+	{
+		GLuint index = (GLuint)(i / 6 * 4 + QUAD_INDICES[i % 6]);
+		if (shortIndices)
+		{
+			((GLushort*)indices.data())[i] = (GLushort)index;
+		}
+		else
+		{
+			((GLuint*)indices.data())[i] = index;
+		}
+	}
+
+	// Bound through the array buffer target, so that the element array binding of whichever vertex array is bound is left alone.
+	// The array buffer binding is put back afterwards, the buffers are created while meshes are setting up their vertex arrays.
+	GLint previousArrayBuffer = 0;
+	glGetIntegerv(GL_ARRAY_BUFFER_BINDING, &previousArrayBuffer);
+	glBindBuffer(GL_ARRAY_BUFFER, quadIndexBuffer);
+	glBufferData(GL_ARRAY_BUFFER, indices.size(), indices.data(), GL_STATIC_DRAW);
+	glBindBuffer(GL_ARRAY_BUFFER, previousArrayBuffer);
 }
 
-void Renderer::DrawCube(vec3 pos, float length, float height, float width, Colour color)
+// Shared uniform blocks
+void Renderer::SetCameraUniforms(Camera* pCamera)
 {
-	float half_length = length*0.5f;
-	float half_height = height*0.5f;
-	float half_width = width*0.5f;
-
-	DrawLine(pos + vec3(-half_length, -half_height, -half_width), pos+vec3(half_length, -half_height, -half_width), color, color);
-	DrawLine(pos + vec3(-half_length, half_height, -half_width), pos + vec3(half_length, half_height, -half_width), color, color);
-	DrawLine(pos + vec3(-half_length, -half_height, -half_width), pos + vec3(-half_length, half_height, -half_width), color, color);
-	DrawLine(pos + vec3(half_length, -half_height, -half_width), pos + vec3(half_length, half_height, -half_width), color, color);
-	DrawLine(pos + vec3(-half_length, -half_height, half_width), pos + vec3(half_length, -half_height, half_width), color, color);
-	DrawLine(pos + vec3(-half_length, half_height, half_width), pos + vec3(half_length, half_height, half_width), color, color);
-	DrawLine(pos + vec3(-half_length, -half_height, half_width), pos + vec3(-half_length, half_height, half_width), color, color);
-	DrawLine(pos + vec3(half_length, -half_height, half_width), pos + vec3(half_length, half_height, half_width), color, color);
-	DrawLine(pos + vec3(-half_length, -half_height, -half_width), pos + vec3(-half_length, -half_height, half_width), color, color);
-	DrawLine(pos + vec3(half_length, -half_height, -half_width), pos + vec3(half_length, -half_height, half_width), color, color);
-	DrawLine(pos + vec3(-half_length, half_height, -half_width), pos + vec3(-half_length, half_height, half_width), color, color);
-	DrawLine(pos + vec3(half_length, half_height, -half_width), pos + vec3(half_length, half_height, half_width), color, color);
-}
-
-void Renderer::RenderLines(Camera* pCamera)
-{
-	// Num vertices
-	unsigned int numVertices = (unsigned int)m_vpLines.size() * 2;
-
-	// Vertices
-	PositionColorVertex* linesBuffer = new PositionColorVertex[numVertices];
-	int arrayCounter = 0;
-	for (unsigned int i = 0; i < (unsigned int)m_vpLines.size(); i++)
+	CameraUniformBlock cameraUniforms;
+	cameraUniforms.m_view = lookAt(pCamera->GetPosition(), pCamera->GetView(), pCamera->GetUp());
+	cameraUniforms.m_projection = perspective(45.0f, (GLfloat)m_windowWidth / (GLfloat)m_windowHeight, 0.01f, 1000.0f);
+	cameraUniforms.m_viewPosition = vec4(pCamera->GetPosition(), 1.0f);
+	pCamera->SetViewProjection(cameraUniforms.m_projection, cameraUniforms.m_view);
+
+	glBindBuffer(GL_UNIFORM_BUFFER, m_uniformBuffers[ShaderUniformBlock_Camera]);
+	glBufferSubData(GL_UNIFORM_BUFFER, 0, sizeof(CameraUniformBlock), &cameraUniforms);
+	glBindBuffer(GL_UNIFORM_BUFFER, 0);
+}
+
+void Renderer::SetLightUniforms(Light* pLight)
+{
+	LightUniformBlock lightUniforms;
+	lightUniforms.m_position = vec4(pLight->m_position, 1.0f);
+	lightUniforms.m_ambient = vec4(pLight->m_ambient.GetRed(), pLight->m_ambient.GetGreen(), pLight->m_ambient.GetBlue(), 1.0f);
+	lightUniforms.m_diffuse = vec4(pLight->m_diffuse.GetRed(), pLight->m_diffuse.GetGreen(), pLight->m_diffuse.GetBlue(), 1.0f);
+	lightUniforms.m_specular = vec4(pLight->m_specular.GetRed(), pLight->m_specular.GetGreen(), pLight->m_specular.GetBlue(), 1.0f);
+	lightUniforms.m_attenuation = vec4(pLight->m_constantAttenuation, pLight->m_linearAttenuation, pLight->m_quadraticAttenuation, 0.0f);
+
+	glBindBuffer(GL_UNIFORM_BUFFER, m_uniformBuffers[ShaderUniformBlock_Light]);
+	glBufferSubData(GL_UNIFORM_BUFFER, 0, sizeof(LightUniformBlock), &lightUniforms);
+	glBindBuffer(GL_UNIFORM_BUFFER, 0);
+}
+
+void Renderer::SetDrawUniforms(const vector<DrawUniformBlock>& vDrawUniforms)
+{
+	if (vDrawUniforms.empty())
 	{
-		linesBuffer[arrayCounter + 0].x = m_vpLines[i]->m_lineStart.x;
-		linesBuffer[arrayCounter + 0].y = m_vpLines[i]->m_lineStart.y;
-		linesBuffer[arrayCounter + 0].z = m_vpLines[i]->m_lineStart.z;
-		linesBuffer[arrayCounter + 0].r = m_vpLines[i]->m_lineStartColour.GetRed();
-		linesBuffer[arrayCounter + 0].g = m_vpLines[i]->m_lineStartColour.GetGreen();
-		linesBuffer[arrayCounter + 0].b = m_vpLines[i]->m_lineStartColour.GetBlue();
-		linesBuffer[arrayCounter + 0].a = m_vpLines[i]->m_lineStartColour.GetAlpha();
-		linesBuffer[arrayCounter + 1].x = m_vpLines[i]->m_lineEnd.x;
-		linesBuffer[arrayCounter + 1].y = m_vpLines[i]->m_lineEnd.y;
-		linesBuffer[arrayCounter + 1].z = m_vpLines[i]->m_lineEnd.z;
-		linesBuffer[arrayCounter + 1].r = m_vpLines[i]->m_lineEndColour.GetRed();
-		linesBuffer[arrayCounter + 1].g = m_vpLines[i]->m_lineEndColour.GetGreen();
-		linesBuffer[arrayCounter + 1].b = m_vpLines[i]->m_lineEndColour.GetBlue();
-		linesBuffer[arrayCounter + 1].a = m_vpLines[i]->m_lineEndColour.GetAlpha();
-
-		arrayCounter += 2;
+		return;
 	}
 
-	// Indices
-	unsigned int numIndices = numVertices;
-	GLuint* indicesBuffer = new GLuint[numVertices];
-	for (unsigned int i = 0; i < numVertices; i++)
+	const GLvoid* pData = &vDrawUniforms[0];
+	size_t dataSize = vDrawUniforms.size() * m_drawUniformStride;
+	if (m_drawUniformStride != sizeof(DrawUniformBlock))
 	{
-		indicesBuffer[i] = i;
+		m_drawUniformStaging.resize(dataSize);
+		for (unsigned int i = 0; i < vDrawUniforms.size(); i++)
+		{
+			memcpy(&m_drawUniformStaging[i * m_drawUniformStride], &vDrawUniforms[i], sizeof(DrawUniformBlock));
+		}
+		pData = &m_drawUniformStaging[0];
 	}
 
-	GLuint VBO, VAO, EBO;
+	// Orphaned every frame, so the draws of the last frame can still be reading the old storage
+	glBindBuffer(GL_UNIFORM_BUFFER, m_uniformBuffers[ShaderUniformBlock_Draw]);
+	glBufferData(GL_UNIFORM_BUFFER, dataSize, pData, GL_STREAM_DRAW);
+	glBindBuffer(GL_UNIFORM_BUFFER, 0);
+}
 
-	glGenVertexArrays(1, &VAO);
-	glGenBuffers(1, &VBO);
-	glGenBuffers(1, &EBO);
+void Renderer::BindDrawUniforms(unsigned int drawIndex)
+{
+	glBindBufferRange(GL_UNIFORM_BUFFER, ShaderUniformBlock_Draw, m_uniformBuffers[ShaderUniformBlock_Draw], drawIndex * m_drawUniformStride, sizeof(DrawUniformBlock));
+}
 
-	// Bind the Vertex Array Object first, then bind and set vertex buffer(s) and attribute pointer(s).
-	glBindVertexArray(VAO);
+// Rendering
+void Renderer::ResetLines()
+{
+	// Cleared without freeing, so the lines of the next frame are written into the same memory
+	m_vLineVertices.clear();
+}
 
-	glBindBuffer(GL_ARRAY_BUFFER, VBO);
-	glBufferData(GL_ARRAY_BUFFER, sizeof(PositionColorVertex)*numVertices, linesBuffer, GL_STATIC_DRAW);
+void Renderer::DrawLine(vec3 lineSart, vec3 lineEnd, Colour lineStartColour, Colour lineEndColour)
+{
+	LineVertex startVertex = { lineSart.x, lineSart.y, lineSart.z, PackLineColour(lineStartColour) };
+	LineVertex endVertex = { lineEnd.x, lineEnd.y, lineEnd.z, PackLineColour(lineEndColour) };
 
-	glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, EBO);
-	glBufferData(GL_ELEMENT_ARRAY_BUFFER, sizeof(GLuint)*numIndices, indicesBuffer, GL_STATIC_DRAW);
+	m_vLineVertices.push_back(startVertex);
+	m_vLineVertices.push_back(endVertex);
+}
 
-	glVertexAttribPointer(0, 3, GL_FLOAT, GL_FALSE, sizeof(GLfloat) * 7, (GLvoid*)0);
-	glEnableVertexAttribArray(0);
-	glVertexAttribPointer(1, 4, GL_FLOAT, GL_FALSE, sizeof(GLfloat) * 7, (GLvoid*)(sizeof(GLfloat) * 3));
-	glEnableVertexAttribArray(1);
+void Renderer::DrawLines(const vec3* pLinePoints, unsigned int numLines, Colour lineColour)
+{
+	unsigned int rgba = PackLineColour(lineColour);
+	size_t firstVertex = m_vLineVertices.size();
+	m_vLineVertices.resize(firstVertex + (size_t)numLines * 2);
 
-	glBindBuffer(GL_ARRAY_BUFFER, 0); // Note that this is allowed, the call to glVertexAttribPointer registered VBO as the currently bound vertex buffer object so afterwards we can safely unbind
+	LineVertex* pVertices = &m_vLineVertices[firstVertex];
+	for (unsigned int i = 0; i < numLines * 2; i++)
+	{
+		pVertices[i].x = pLinePoints[i].x;
+		pVertices[i].y = pLinePoints[i].y;
+		pVertices[i].z = pLinePoints[i].z;
+		pVertices[i].rgba = rgba;
+	}
+}
 
-	glBindVertexArray(0); // Unbind VAO (it's always a good thing to unbind any buffer/array to prevent strange bugs), remember: do NOT unbind the EBO, keep it bound to this VAO
+void Renderer::DrawCube(vec3 pos, float length, float height, float width, Colour color)
+{
+	vec3 halfSize = vec3(length, height, width) * 0.5f;
+
+	DrawBox(pos - halfSize, pos + halfSize, color);
+}
 
-	// Use shader
+void Renderer::RenderLines()
+{
+	PROFILE_SCOPE("Renderer::RenderLines");
+
+	unsigned int numVertices = (unsigned int)m_vLineVertices.size();
+	if (numVertices == 0)
+	{
+		return;
+	}
+
+	// Use shader, the view and projection come from the camera block, set at the start of the frame
 	m_pPositionColorShader->UseShader();
+	m_pPositionColorShader->SetUniform(ShaderUniform_Model, mat4());
+
+	glBindVertexArray(m_lineVertexArray);
+	glBindBuffer(GL_ARRAY_BUFFER, m_lineRingBuffer);
+
+	for (unsigned int vertexIndex = 0; vertexIndex < numVertices; vertexIndex += LINE_RING_SECTION_VERTICES)
+	{
+		unsigned int numSectionVertices = std::min(numVertices - vertexIndex, LINE_RING_SECTION_VERTICES);
+		unsigned int firstVertex = m_lineRingSection * LINE_RING_SECTION_VERTICES;
+		size_t dataSize = numSectionVertices * sizeof(LineVertex);
+
+		if (m_linePersistentMapping)
+		{
+			// Wait for the GPU to finish with the last lines that were drawn from this section
+			GLsync& fence = m_lineRingFences[m_lineRingSection];
+			if (fence != 0)
+			{
+				while (glClientWaitSync(fence, GL_SYNC_FLUSH_COMMANDS_BIT, 1000000) == GL_TIMEOUT_EXPIRED)
+				{
+				}
+				glDeleteSync(fence);
+				fence = 0;
+			}
+
+			memcpy(m_pLineRingMemory + firstVertex, &m_vLineVertices[vertexIndex], dataSize);
+			glDrawArrays(GL_LINES, firstVertex, numSectionVertices);
+
+			fence = glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+		}
+		else
+		{
+			// Orphaned each time the ring wraps around, so the sections never have to wait for draws that use the old storage
+			if (m_lineRingSection == 0)
+			{
+				glBufferData(GL_ARRAY_BUFFER, (GLsizeiptr)LINE_RING_NUM_SECTIONS * LINE_RING_SECTION_VERTICES * sizeof(LineVertex), NULL, GL_STREAM_DRAW);
+			}
+
+			GLbitfield flags = GL_MAP_WRITE_BIT | GL_MAP_INVALIDATE_RANGE_BIT | GL_MAP_UNSYNCHRONIZED_BIT;
+			void* pSection = glMapBufferRange(GL_ARRAY_BUFFER, firstVertex * sizeof(LineVertex), dataSize, flags);
+			if (pSection != NULL)
+			{
+				memcpy(pSection, &m_vLineVertices[vertexIndex], dataSize);
+				glUnmapBuffer(GL_ARRAY_BUFFER);
+				glDrawArrays(GL_LINES, firstVertex, numSectionVertices);
+			}
+		}
+
+		m_lineRingSection = (m_lineRingSection + 1) % LINE_RING_NUM_SECTIONS;
+	}
 
-	// Create transformations
-	mat4 view;
-	mat4 projection;
-	view = lookAt(pCamera->GetPosition(), pCamera->GetView(), pCamera->GetUp());
-	projection = perspective(45.0f, (GLfloat)m_windowWidth / (GLfloat)m_windowHeight, 0.01f, 1000.0f);
-	
-	// Get their uniform location
-	GLint modelLoc = glGetUniformLocation(m_pPositionColorShader->GetShader(), "model");
-	GLint viewLoc = glGetUniformLocation(m_pPositionColorShader->GetShader(), "view");
-	GLint projLoc = glGetUniformLocation(m_pPositionColorShader->GetShader(), "projection");
-
-	// Pass the matrices to the shader
-	glUniformMatrix4fv(viewLoc, 1, GL_FALSE, value_ptr(view));
-	// Note: currently we set the projection matrix each frame, but since the projection matrix rarely changes it's often best practice to set it outside the main loop only once.
-	glUniformMatrix4fv(projLoc, 1, GL_FALSE, value_ptr(projection));
-
-	glBindVertexArray(VAO);
-
-	mat4 model;
-	model = translate(model, vec3(0.0f, 0.0f, 0.0f));
-	glUniformMatrix4fv(modelLoc, 1, GL_FALSE, value_ptr(model));
-
-	glDrawElements(GL_LINES, numIndices, GL_UNSIGNED_INT, 0);
+	glBindBuffer(GL_ARRAY_BUFFER, 0);
 	glBindVertexArray(0);
+}
 
-	glDeleteBuffers(1, &VBO);
-	glDeleteBuffers(1, &EBO);
-	glDeleteVertexArrays(1, &VAO);
+unsigned int Renderer::PackLineColour(const Colour& colour)
+{
+	unsigned int red = (unsigned int)(std::min(std::max(colour.GetRed(), 0.0f), 1.0f) * 255.0f + 0.5f);
+	unsigned int green = (unsigned int)(std::min(std::max(colour.GetGreen(), 0.0f), 1.0f) * 255.0f + 0.5f);
+	unsigned int blue = (unsigned int)(std::min(std::max(colour.GetBlue(), 0.0f), 1.0f) * 255.0f + 0.5f);
+	unsigned int alpha = (unsigned int)(std::min(std::max(colour.GetAlpha(), 0.0f), 1.0f) * 255.0f + 0.5f);
 
-	delete[] linesBuffer;
-	delete[] indicesBuffer;
+	return red | (green << 8) | (blue << 16) | (alpha << 24);
+}
+
+// Debug primitives
+void Renderer::ResetDebugPrimitives()
+{
+	for (int i = 0; i < DebugPrimitive_NUM; i++)
+	{
+		m_vDebugPrimitiveInstances[i].clear();
+	}
+}
+
+void Renderer::DrawDebugPrimitive(DebugPrimitive primitive, const mat4& transform, Colour colour)
+{
+	DebugPrimitiveInstance instance;
+	instance.m_transform = transform;
+	instance.m_colour = vec4(colour.GetRed(), colour.GetGreen(), colour.GetBlue(), colour.GetAlpha());
+
+	m_vDebugPrimitiveInstances[primitive].push_back(instance);
+}
+
+void Renderer::DrawBox(vec3 boundsMin, vec3 boundsMax, Colour colour)
+{
+	mat4 transform;
+	transform[0][0] = boundsMax.x - boundsMin.x;
+	transform[1][1] = boundsMax.y - boundsMin.y;
+	transform[2][2] = boundsMax.z - boundsMin.z;
+	transform[3] = vec4((boundsMin + boundsMax) * 0.5f, 1.0f);
+
+	DrawDebugPrimitive(DebugPrimitive_Box, transform, colour);
+}
+
+void Renderer::DrawSphere(vec3 center, float radius, Colour colour)
+{
+	mat4 transform;
+	transform[0][0] = radius;
+	transform[1][1] = radius;
+	transform[2][2] = radius;
+	transform[3] = vec4(center, 1.0f);
+
+	DrawDebugPrimitive(DebugPrimitive_Sphere, transform, colour);
+}
+
+void Renderer::DrawFrustum(const mat4& projection, const mat4& view, Colour colour)
+{
+	DrawDebugPrimitive(DebugPrimitive_Frustum, inverse(projection * view), colour);
+}
+
+void Renderer::DrawArrow(vec3 start, vec3 end, Colour colour)
+{
+	vec3 direction = end - start;
+	float arrowLength = length(direction);
+	if (arrowLength <= 0.0f)
+	{
+		return;
+	}
+
+	// The head is scaled with the length, so the whole arrow is scaled evenly along the basis of its direction
+	vec3 zAxis = direction / arrowLength;
+	vec3 up = (fabs(zAxis.y) < 0.99f) ? vec3(0.0f, 1.0f, 0.0f) : vec3(1.0f, 0.0f, 0.0f);
+	vec3 xAxis = normalize(cross(up, zAxis));
+	vec3 yAxis = cross(zAxis, xAxis);
+
+	mat4 transform;
+	transform[0] = vec4(xAxis * arrowLength, 0.0f);
+	transform[1] = vec4(yAxis * arrowLength, 0.0f);
+	transform[2] = vec4(direction, 0.0f);
+	transform[3] = vec4(start, 1.0f);
+
+	DrawDebugPrimitive(DebugPrimitive_Arrow, transform, colour);
+}
+
+void Renderer::RenderDebugPrimitives()
+{
+	PROFILE_SCOPE("Renderer::RenderDebugPrimitives");
+
+	size_t numInstances = 0;
+	for (int i = 0; i < DebugPrimitive_NUM; i++)
+	{
+		numInstances += m_vDebugPrimitiveInstances[i].size();
+	}
+	if (numInstances == 0)
+	{
+		return;
+	}
+
+	// The view and projection come from the camera block, set at the start of the frame
+	m_pInstancedPositionShader->UseShader();
+
+	glBindVertexArray(m_debugPrimitiveVertexArray);
+	glBindBuffer(GL_ARRAY_BUFFER, m_debugPrimitiveInstanceBuffer);
+
+	// Orphaned every frame, so the draws of the last frame can still be reading the old storage
+	glBufferData(GL_ARRAY_BUFFER, sizeof(DebugPrimitiveInstance) * numInstances, NULL, GL_STREAM_DRAW);
+
+	size_t instanceOffset = 0;
+	for (int i = 0; i < DebugPrimitive_NUM; i++)
+	{
+		const vector<DebugPrimitiveInstance>& vInstances = m_vDebugPrimitiveInstances[i];
+		if (vInstances.empty())
+		{
+			continue;
+		}
+
+		size_t dataSize = sizeof(DebugPrimitiveInstance) * vInstances.size();
+		glBufferSubData(GL_ARRAY_BUFFER, instanceOffset, dataSize, vInstances.data());
+
+		// A column of the transform at a time, then the colour
+		for (int column = 0; column < 4; column++)
+		{
+			glVertexAttribPointer(4 + column, 4, GL_FLOAT, GL_FALSE, sizeof(DebugPrimitiveInstance), (GLvoid*)(instanceOffset + sizeof(vec4) * column));
+		}
+		glVertexAttribPointer(8, 4, GL_FLOAT, GL_FALSE, sizeof(DebugPrimitiveInstance), (GLvoid*)(instanceOffset + sizeof(mat4)));
+
+		glDrawArraysInstanced(GL_LINES, m_debugPrimitiveFirstVertex[i], m_debugPrimitiveNumVertices[i], (GLsizei)vInstances.size());
+
+		instanceOffset += dataSize;
+	}
+
+	glBindBuffer(GL_ARRAY_BUFFER, 0);
+	glBindVertexArray(0);
 }
\ No newline at end of file
@@ -24,6 +24,7 @@ using namespace std;
 #include "camera.h"
 #include "Shader.h"
 #include "colour.h"
+#include "light.h"
 #include "viewport.h"
 #include "../Maths/3dmaths.h"
 
@@ -49,17 +50,86 @@ class PositionColorNormalVertex
 {
 public:
 	float x, y, z;      // Position
-	float r, g, b, a;   // Colour
+	float r, g, b, a;   // Colour, voxel meshes keep the ambient occlusion light of the vertex in the alpha
 	float nx, ny, nz;   // Normal
 };
 
-class Line
+// A voxel vertex packed into 8 bytes, decoded in the PackedPositionColorNormal vertex shader
+class PackedPositionColorNormalVertex
+{
+public:
+	unsigned int xyz;   // Position, the voxel grid corner in 10 bits per axis
+	unsigned int rgbn;  // Colour in 8 bits per channel, normal index in bits 24 to 26, ambient occlusion level in bits 27 and 28
+};
+
+// The vertex order of every quad in the shared quad index buffers, offset by 4 vertices for each quad
+const unsigned int QUAD_INDICES[6] = { 0, 2, 1, 1, 2, 3 };
+
+// Meshes with up to this many vertices can be drawn with 16-bit indices
+const unsigned int QUAD_INDEX_BUFFER_16_MAX_VERTICES = 65536;
+
+// std140 layouts of the shared uniform blocks, these must match the blocks declared in the shaders
+class CameraUniformBlock
+{
+public:
+	mat4 m_view;
+	mat4 m_projection;
+	vec4 m_viewPosition;
+};
+
+class LightUniformBlock
 {
 public:
-	vec3 m_lineStart;
-	vec3 m_lineEnd;
-	Colour m_lineStartColour;
-	Colour m_lineEndColour;
+	vec4 m_position;
+	vec4 m_ambient;
+	vec4 m_diffuse;
+	vec4 m_specular;
+	vec4 m_attenuation; // Constant, linear and quadratic
+};
+
+// One entry of the per draw array, each draw binds its own entry before drawing
+class DrawUniformBlock
+{
+public:
+	mat4 m_model;
+	vec4 m_materialAmbient;
+	vec4 m_materialDiffuse;
+	vec4 m_materialSpecular; // Shininess in w
+	vec4 m_options; // Lighting enabled in x, the share of pixels a level of detail draws while cross-fading in y, and whether it draws the rest of them instead in z
+};
+
+// A debug line vertex, drawn with the PositionColor shader
+class LineVertex
+{
+public:
+	float x, y, z;      // Position
+	unsigned int rgba;  // Colour in 8 bits per channel, red in the lowest byte
+};
+
+// Debug lines are streamed through a ring of buffer sections. Each section is drawn as soon as it is written, and is only
+// written again once the GPU has finished drawing from it, so any number of lines can be drawn in a frame.
+const unsigned int LINE_RING_NUM_SECTIONS = 3;
+const unsigned int LINE_RING_SECTION_VERTICES = 262144; // Must be even, so that no line is split across sections
+
+// Debug primitives are line meshes of a unit size, drawn as instances with their own transform and colour
+enum DebugPrimitive
+{
+	DebugPrimitive_Box = 0,    // A cube from -0.5 to 0.5
+	DebugPrimitive_Sphere,     // Three circles of radius 1 around the axes
+	DebugPrimitive_Frustum,    // A cube from -1 to 1, which is the frustum once transformed by the inverse view projection
+	DebugPrimitive_Arrow,      // From the origin to 1 along z, with the head at z
+
+	DebugPrimitive_NUM,
+};
+
+// Number of line segments in each circle of the sphere
+const unsigned int DEBUG_SPHERE_SEGMENTS = 32;
+
+class DebugPrimitiveInstance
+{
+public:
+	mat4 m_transform;
+	vec4 m_colour;
 };
 
 class Renderer
@@ -74,6 +144,8 @@ public:
 
 	// Resize
 	void ResizeWindow(int newWidth, int newHeight);
+	int GetWindowWidth();
+	int GetWindowHeight();
 
 	// Scene
 	bool ClearScene(bool pixel = true, bool depth = true, bool stencil = true);
@@ -85,17 +157,43 @@ public:
 	void ResizeViewport(Viewport* pViewport, int bottom, int left, int width, int height, float fov);
 	void SetViewport(Viewport* pViewport);
 
+	// Shared quad index buffers, for meshes made of quads that are written in the QUAD_INDICES vertex order
+	GLuint GetQuadIndexBuffer(unsigned int numVertices);
+	GLenum GetQuadIndexType(unsigned int numVertices);
+
+	// Shared uniform blocks, each is written with a single buffer upload. The camera and light are set once a frame, the
+	// per draw array is uploaded whole and each draw then only binds its own entry.
+	void SetCameraUniforms(Camera* pCamera);
+	void SetLightUniforms(Light* pLight);
+	void SetDrawUniforms(const vector<DrawUniformBlock>& vDrawUniforms);
+	void BindDrawUniforms(unsigned int drawIndex);
+
 	// Rendering
 	void ResetLines();
 	void DrawLine(vec3 lineSart, vec3 lineEnd, Colour lineStartColour, Colour lineEndColour);
+	void DrawLines(const vec3* pLinePoints, unsigned int numLines, Colour lineColour); // Two points for each line
 	void DrawCube(vec3 pos, float length, float height, float width, Colour color);
-	void RenderLines(Camera* pCamera);
+	void RenderLines();
+
+	// Debug primitives, each primitive type is drawn with a single instanced draw call when they are rendered
+	void ResetDebugPrimitives();
+	void DrawDebugPrimitive(DebugPrimitive primitive, const mat4& transform, Colour colour);
+	void DrawBox(vec3 boundsMin, vec3 boundsMax, Colour colour);
+	void DrawSphere(vec3 center, float radius, Colour colour);
+	void DrawFrustum(const mat4& projection, const mat4& view, Colour colour);
+	void DrawArrow(vec3 start, vec3 end, Colour colour);
+	void RenderDebugPrimitives();
 
 protected:
 	/* Protected methods */
 
 private:
 	/* Private methods */
+	void CreateQuadIndexBuffer(GLuint quadIndexBuffer, unsigned int numQuads, bool shortIndices);
+	void CreateUniformBuffers();
+	void CreateLineBuffers();
+	void CreateDebugPrimitiveBuffers();
+	unsigned int PackLineColour(const Colour& colour);
 
 public:
 	/* Public members */
@@ -115,9 +213,37 @@ private:
 
 	// Shaders
 	Shader* m_pPositionColorShader;
-
-	// Rendering
-	vector<Line*> m_vpLines;
+	Shader* m_pInstancedPositionShader;
+
+	// Shared quad index buffers, the 32-bit buffer grows to fit the largest mesh that uses it
+	GLuint m_quadIndexBuffer16;
+	GLuint m_quadIndexBuffer32;
+	unsigned int m_numQuadIndexBuffer32Quads;
+
+	// Shared uniform buffers, one per ShaderUniformBlock. Entries of the per draw array are spaced out to the uniform buffer
+	// offset alignment, so they are staged before the upload.
+	GLuint m_uniformBuffers[ShaderUniformBlock_NUM];
+	unsigned int m_drawUniformStride;
+	vector<unsigned char> m_drawUniformStaging;
+
+	// Debug lines are gathered here during the frame, and streamed through the ring buffer when they are rendered. The
+	// ring is persistently mapped when buffer storage is supported, otherwise it is orphaned each time it wraps around.
+	vector<LineVertex> m_vLineVertices;
+	GLuint m_lineVertexArray;
+	GLuint m_lineRingBuffer;
+	bool m_linePersistentMapping;
+	LineVertex* m_pLineRingMemory;
+	GLsync m_lineRingFences[LINE_RING_NUM_SECTIONS];
+	unsigned int m_lineRingSection;
+
+	// Debug primitives, the unit meshes of every primitive type share one vertex buffer. The instances of each type are
+	// gathered during the frame and uploaded one after another into the instance buffer when they are rendered.
+	vector<DebugPrimitiveInstance> m_vDebugPrimitiveInstances[DebugPrimitive_NUM];
+	GLuint m_debugPrimitiveVertexArray;
+	GLuint m_debugPrimitiveVertexBuffer;
+	GLuint m_debugPrimitiveInstanceBuffer;
+	unsigned int m_debugPrimitiveFirstVertex[DebugPrimitive_NUM];
+	unsigned int m_debugPrimitiveNumVertices[DebugPrimitive_NUM];
 };
 
 int CheckGLErrors(char *file, int line);
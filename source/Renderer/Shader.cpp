@@ -11,12 +11,29 @@
 
 #include "Shader.h"
 
+#include <glm/gtc/type_ptr.hpp>
+
 #include <string>
 #include <fstream>
 #include <sstream>
 #include <iostream>
 using namespace std;
 
+// Names of the uniforms in the shader source, in the same order as ShaderUniform
+static const char* SHADER_UNIFORM_NAMES[ShaderUniform_NUM] =
+{
+	"model",
+	"matrixData",
+};
+
+// Names of the uniform blocks in the shader source, in the same order as ShaderUniformBlock
+static const char* SHADER_UNIFORM_BLOCK_NAMES[ShaderUniformBlock_NUM] =
+{
+	"CameraBlock",
+	"LightBlock",
+	"DrawBlock",
+};
+
 Shader::Shader(const char* vertexPath, const char* fragmentPath, const char* geometryPath)
 {
 	// Retrieve the vertex/fragment source code from filePath
@@ -134,6 +151,9 @@ Shader::Shader(const char* vertexPath, const char* fragmentPath, const char* geo
 	{
 		glDeleteShader(geometry);
 	}
+
+	CacheUniformLocations();
+	BindUniformBlocks();
 }
 
 Shader::~Shader()
@@ -148,4 +168,50 @@ GLuint Shader::GetShader()
 void Shader::UseShader()
 {
 	glUseProgram(m_pProgram);
+}
+
+void Shader::CacheUniformLocations()
+{
+	for (int i = 0; i < ShaderUniform_NUM; i++)
+	{
+		m_uniformLocations[i] = glGetUniformLocation(m_pProgram, SHADER_UNIFORM_NAMES[i]);
+	}
+}
+
+void Shader::BindUniformBlocks()
+{
+	for (int i = 0; i < ShaderUniformBlock_NUM; i++)
+	{
+		GLuint blockIndex = glGetUniformBlockIndex(m_pProgram, SHADER_UNIFORM_BLOCK_NAMES[i]);
+		if (blockIndex != GL_INVALID_INDEX)
+		{
+			glUniformBlockBinding(m_pProgram, blockIndex, i);
+		}
+	}
+}
+
+// Uniforms
+GLint Shader::GetUniformLocation(ShaderUniform uniform)
+{
+	return m_uniformLocations[uniform];
+}
+
+void Shader::SetUniform(ShaderUniform uniform, int value)
+{
+	glUniform1i(m_uniformLocations[uniform], value);
+}
+
+void Shader::SetUniform(ShaderUniform uniform, float value)
+{
+	glUniform1f(m_uniformLocations[uniform], value);
+}
+
+void Shader::SetUniform(ShaderUniform uniform, const vec3& value)
+{
+	glUniform3f(m_uniformLocations[uniform], value.x, value.y, value.z);
+}
+
+void Shader::SetUniform(ShaderUniform uniform, const mat4& value)
+{
+	glUniformMatrix4fv(m_uniformLocations[uniform], 1, GL_FALSE, value_ptr(value));
 }
\ No newline at end of file
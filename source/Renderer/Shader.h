@@ -15,6 +15,31 @@
 
 #include <GL/glew.h>
 
+#include <glm/vec3.hpp>
+#include <glm/mat4x4.hpp>
+using namespace glm;
+
+// Every uniform used by the shaders outside of the uniform blocks, their locations are looked up once when the program is
+// linked. Uniforms that a shader doesn't have are left at -1, which GL ignores when set.
+enum ShaderUniform
+{
+	ShaderUniform_Model = 0,
+	ShaderUniform_MatrixData,
+
+	ShaderUniform_NUM,
+};
+
+// Uniform blocks shared by every shader, each block is bound to the binding point of its enum value when the program is
+// linked, so a buffer bound there is seen by every shader that declares the block
+enum ShaderUniformBlock
+{
+	ShaderUniformBlock_Camera = 0,
+	ShaderUniformBlock_Light,
+	ShaderUniformBlock_Draw,
+
+	ShaderUniformBlock_NUM,
+};
+
 class Shader
 {
 public:
@@ -25,6 +50,19 @@ public:
 
 	void UseShader();
 
+	// Uniforms, the shader must be in use
+	GLint GetUniformLocation(ShaderUniform uniform);
+	void SetUniform(ShaderUniform uniform, int value);
+	void SetUniform(ShaderUniform uniform, float value);
+	void SetUniform(ShaderUniform uniform, const vec3& value);
+	void SetUniform(ShaderUniform uniform, const mat4& value);
+
+private:
+	void CacheUniformLocations();
+	void BindUniformBlocks();
+
 private:
 	GLuint m_pProgram;
+
+	GLint m_uniformLocations[ShaderUniform_NUM];
 };
\ No newline at end of file
@@ -20,6 +20,8 @@
 #include <glm/vec3.hpp>
 using namespace glm;
 
+#include "../Maths/3dGeometry.h"
+
 class Renderer;
 
 
@@ -45,6 +47,12 @@ public:
 	// Setup
 	void SetupCameraFromPositionAndView(vec3 pos, vec3 view, vec3 upRef);
 
+	// Projection, view and frustum, set from the matrices that the renderer draws the camera with
+	void SetViewProjection(const mat4 &projection, const mat4 &view) { m_projection = projection; m_view = view; m_frustum.SetFromProjectionView(projection, view); }
+	const mat4& GetProjectionMatrix() const { return m_projection; }
+	const mat4& GetViewMatrix() const { return m_view; }
+	Frustum* GetFrustum() { return &m_frustum; }
+
 	// Camera movement
 	void Fly(const float speed);
 	void Move(const float speed);
@@ -76,4 +84,9 @@ private:
 	float m_zoomAmount;
 	float m_minZoomAmount;
 	float m_maxZoomAmount;
+
+	// The matrices that the camera was last drawn with and its view frustum in world space
+	mat4 m_projection;
+	mat4 m_view;
+	Frustum m_frustum;
 };
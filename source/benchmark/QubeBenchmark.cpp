@@ -0,0 +1,2509 @@
+// ******************************************************************************
+// Filename:    QubeBenchmark.cpp
+// Project:     Qube
+// Author:      Steven Ball
+//
+// Purpose:
+//   Headless benchmark for the Qube voxel pipeline. Runs without a window or
+//   an OpenGL context, so it can be used to compare loader and mesher changes
+//   on the bundled assets and on large synthetic models. With --stages only
+//   the per matrix parse, inflate, visibility and meshing times are measured,
+//   and --json and --csv write them out to track regressions between builds.
+//   With --generate a synthetic model is written from a seed and the
+//   generator settings, to load and stress test at sizes up to 512^3.
+//
+// Revision History:
+//   Initial Revision - 17/10/26
+//
+// Copyright (c) 2005-2016, Steven Ball
+// ******************************************************************************
+
+#include "../qbt/QBT.h"
+#include "../qbt/QBTGenerator.h"
+#include "../JobSystem/JobSystem.h"
+#include "../Profiler/Profiler.h"
+
+#include <glm/gtc/matrix_transform.hpp>
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <math.h>
+#include <string.h>
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <string>
+#include <thread>
+#include <vector>
+using namespace std;
+
+
+// Timing
+typedef chrono::high_resolution_clock BenchmarkClock;
+
+double GetElapsedMilliseconds(BenchmarkClock::time_point start)
+{
+	return chrono::duration<double, milli>(BenchmarkClock::now() - start).count();
+}
+
+// Synthetic models, cubes of terrain in a row along x
+QBTGeneratorSettings GetSyntheticSettings(unsigned int numMatrices, unsigned int size)
+{
+	QBTGeneratorSettings settings;
+	settings.m_numMatrices = numMatrices;
+	settings.m_sizeX = size;
+	settings.m_sizeY = size;
+	settings.m_sizeZ = size;
+
+	return settings;
+}
+
+bool WriteSyntheticQBT(string filename, unsigned int numMatrices, unsigned int size)
+{
+	QBTGenerator generator(GetSyntheticSettings(numMatrices, size));
+	return generator.WriteFile(filename);
+}
+
+long GetFileSize(string filename)
+{
+	FILE* pFile = fopen(filename.c_str(), "rb");
+	if (pFile == NULL)
+	{
+		return 0;
+	}
+	fseek(pFile, 0, SEEK_END);
+	long size = ftell(pFile);
+	fclose(pFile);
+	return size;
+}
+
+// Job system benchmark
+// Work for one index of the parallel for, a little over a microsecond of arithmetic that can't be skipped
+unsigned int GetJobWork(unsigned int index)
+{
+	unsigned int hash = index;
+	for (int i = 0; i < 512; i++)
+	{
+		hash = (hash * 1664525u + 1013904223u) ^ (hash >> 13);
+	}
+	return hash;
+}
+
+bool CheckJobSystem(unsigned int numWorkers)
+{
+	JobSystem jobSystem(numWorkers);
+
+	// Every index of a parallel for is visited once, with counts that don't split evenly and with far more batches than the job
+	// pools have room for
+	bool passed = true;
+	unsigned int counts[] = { 1, 1000, 100003 };
+	for (unsigned int i = 0; i < 3; i++)
+	{
+		vector<unsigned char> visits(counts[i], 0);
+		jobSystem.ParallelFor(counts[i], 4, [&](unsigned int start, unsigned int end)
+		{
+			for (unsigned int j = start; j < end; j++)
+			{
+				visits[j]++;
+			}
+		});
+		passed = passed && (unsigned int)count(visits.begin(), visits.end(), 1) == counts[i];
+	}
+
+	// A parent with children that have children of their own only finishes once all of them have run
+	atomic<unsigned int> numRun(0);
+	Job* pRoot = jobSystem.CreateJob([&]() { numRun++; });
+	for (unsigned int i = 0; i < 64; i++)
+	{
+		Job* pChild = jobSystem.CreateJob([&]() { numRun++; }, pRoot);
+		for (unsigned int j = 0; j < 64; j++)
+		{
+			jobSystem.Run(jobSystem.CreateJob([&]() { numRun++; }, pChild));
+		}
+		jobSystem.Run(pChild);
+	}
+	jobSystem.Run(pRoot);
+	jobSystem.Wait(pRoot);
+	passed = passed && numRun == 1 + 64 + 64 * 64;
+
+	// Jobs made and waited on by a thread that isn't part of the job system, like the async loader thread
+	atomic<unsigned int> numExternal(0);
+	thread externalThread([&]()
+	{
+		jobSystem.ParallelFor(10000, 16, [&](unsigned int start, unsigned int end)
+		{
+			numExternal += end - start;
+		});
+	});
+	externalThread.join();
+	passed = passed && numExternal == 10000;
+
+	return passed;
+}
+
+void RunJobSystemBenchmark(unsigned int numThreads, const vector<unsigned int>& expected, double* pSingleThreadTime)
+{
+	JobSystem jobSystem(numThreads - 1);
+
+	// Empty jobs under a parent, the cost of creating, queueing, running and finishing each one
+	const unsigned int numJobs = 1000;
+	const int rounds = 200;
+	BenchmarkClock::time_point jobStart = BenchmarkClock::now();
+	for (int round = 0; round < rounds; round++)
+	{
+		Job* pRoot = jobSystem.CreateJob([]() {});
+		for (unsigned int i = 0; i < numJobs; i++)
+		{
+			jobSystem.Run(jobSystem.CreateJob([]() {}, pRoot));
+		}
+		jobSystem.Run(pRoot);
+		jobSystem.Wait(pRoot);
+	}
+	double jobTime = GetElapsedMilliseconds(jobStart) * 1000000.0 / (rounds * numJobs);
+
+	// A parallel for with enough work in each index for the threads to pay off
+	vector<unsigned int> results(expected.size());
+	const int iterations = 10;
+	BenchmarkClock::time_point parallelStart = BenchmarkClock::now();
+	for (int iteration = 0; iteration < iterations; iteration++)
+	{
+		jobSystem.ParallelFor((unsigned int)results.size(), 64, [&](unsigned int start, unsigned int end)
+		{
+			for (unsigned int i = start; i < end; i++)
+			{
+				results[i] = GetJobWork(i);
+			}
+		});
+	}
+	double parallelTime = GetElapsedMilliseconds(parallelStart) / iterations;
+	if (numThreads == 1)
+	{
+		*pSingleThreadTime = parallelTime;
+	}
+
+	printf("%-8u %16.1f %14.3f %9.2fx %6s\n", numThreads, jobTime, parallelTime, *pSingleThreadTime / parallelTime, results == expected ? "yes" : "NO");
+}
+
+// Profiler benchmark
+bool GetScopeStats(const char* pName, ProfileScopeStats* pStats)
+{
+	Profiler* pProfiler = Profiler::GetInstance();
+	for (unsigned int i = 0; i < pProfiler->GetNumScopes(); i++)
+	{
+		*pStats = pProfiler->GetScopeStats(i);
+		if (strcmp(pStats->m_pName, pName) == 0)
+		{
+			return true;
+		}
+	}
+
+	return false;
+}
+
+size_t CountOccurrences(const string& text, const string& pattern)
+{
+	size_t count = 0;
+	for (size_t position = text.find(pattern); position != string::npos; position = text.find(pattern, position + pattern.size()))
+	{
+		count++;
+	}
+	return count;
+}
+
+bool CheckProfiler()
+{
+	Profiler* pProfiler = Profiler::GetInstance();
+	pProfiler->SetThreadName("Benchmark");
+	JobSystem jobSystem(3);
+
+	// Scopes on the main thread and the workers are summed up per frame, and a disabled profiler records nothing
+	const unsigned int numFrames = PROFILER_AVERAGE_FRAMES;
+	for (unsigned int frame = 0; frame < numFrames; frame++)
+	{
+		pProfiler->SetEnabled(true);
+		for (unsigned int i = 0; i < 10; i++)
+		{
+			PROFILE_SCOPE("CheckProfiler main");
+		}
+		jobSystem.ParallelFor(100, 1, [](unsigned int, unsigned int)
+		{
+			PROFILE_SCOPE("CheckProfiler job");
+		});
+		pProfiler->SetEnabled(false);
+		for (unsigned int i = 0; i < 10; i++)
+		{
+			PROFILE_SCOPE("CheckProfiler main");
+		}
+		pProfiler->EndFrame();
+	}
+
+	ProfileScopeStats mainStats;
+	ProfileScopeStats jobStats;
+	bool passed = GetScopeStats("CheckProfiler main", &mainStats) && mainStats.m_calls == 10.0 &&
+	              GetScopeStats("CheckProfiler job", &jobStats) && jobStats.m_calls == 100.0;
+
+	// Every event ends up in the trace, along with the names of the threads
+	string filename = "QubeBenchmark_trace.json";
+	passed = passed && pProfiler->WriteChromeTrace(filename);
+	string trace;
+	FILE* pFile = fopen(filename.c_str(), "rb");
+	if (pFile != NULL)
+	{
+		char buffer[4096];
+		size_t numRead;
+		while ((numRead = fread(buffer, 1, sizeof(buffer), pFile)) > 0)
+		{
+			trace.append(buffer, numRead);
+		}
+		fclose(pFile);
+	}
+	remove(filename.c_str());
+
+	passed = passed && trace.compare(0, 1, "{") == 0 && trace.size() >= 4 && trace.compare(trace.size() - 4, 4, "\n]}\n") == 0;
+	passed = passed && CountOccurrences(trace, "\"name\":\"CheckProfiler main\"") == numFrames * 10;
+	passed = passed && CountOccurrences(trace, "\"name\":\"CheckProfiler job\"") == numFrames * 100;
+	passed = passed && CountOccurrences(trace, "\"Benchmark\"") == 1 && CountOccurrences(trace, "\"Job worker 3\"") >= 1;
+
+	return passed;
+}
+
+// The cost of a scope, and the breakdown of a load of a model
+void RunProfilerBenchmark(string filename)
+{
+	Profiler* pProfiler = Profiler::GetInstance();
+
+	JobSystem jobSystem(std::max(thread::hardware_concurrency(), 1u) - 1);
+	QBT qbt(NULL);
+	qbt.SetJobSystem(&jobSystem);
+	qbt.SetLoaderBackend(QBTLoaderBackend_MemoryMapped);
+	qbt.SetParallelLoading(true);
+
+	pProfiler->SetEnabled(true);
+	for (unsigned int frame = 0; frame < PROFILER_AVERAGE_FRAMES; frame++)
+	{
+		{
+			PROFILE_SCOPE("Load");
+			qbt.ReadQBTFile(filename);
+			qbt.Unload();
+		}
+		pProfiler->EndFrame();
+	}
+
+	printf("%-36s %12s %10s\n", "Scope", "ms per load", "Calls");
+	for (unsigned int i = 0; i < pProfiler->GetNumScopes(); i++)
+	{
+		ProfileScopeStats stats = pProfiler->GetScopeStats(i);
+		if (stats.m_calls > 0.0)
+		{
+			printf("%-36s %12.4f %10.1f\n", stats.m_pName, stats.m_milliseconds, stats.m_calls);
+		}
+	}
+
+	const int numScopes = 10000000;
+	pProfiler->SetEnabled(false);
+	BenchmarkClock::time_point disabledStart = BenchmarkClock::now();
+	for (int i = 0; i < numScopes; i++)
+	{
+		PROFILE_SCOPE("Disabled");
+	}
+	double disabledTime = GetElapsedMilliseconds(disabledStart) * 1000000.0 / numScopes;
+
+	pProfiler->SetEnabled(true);
+	BenchmarkClock::time_point enabledStart = BenchmarkClock::now();
+	for (int i = 0; i < numScopes; i++)
+	{
+		PROFILE_SCOPE("Enabled");
+	}
+	double enabledTime = GetElapsedMilliseconds(enabledStart) * 1000000.0 / numScopes;
+	pProfiler->SetEnabled(false);
+
+	printf("Scope cost: %.2f ns disabled, %.2f ns enabled\n", disabledTime, enabledTime);
+}
+
+// Loader benchmark
+double TimeLoad(string filename, QBTLoaderBackend backend, bool parallel, int iterations)
+{
+	JobSystem jobSystem(std::max(thread::hardware_concurrency(), 1u) - 1);
+	QBT qbt(NULL);
+	qbt.SetJobSystem(&jobSystem);
+	qbt.SetLoaderBackend(backend);
+	qbt.SetParallelLoading(parallel);
+
+	BenchmarkClock::time_point start = BenchmarkClock::now();
+	for (int i = 0; i < iterations; i++)
+	{
+		qbt.ReadQBTFile(filename);
+		qbt.Unload();
+	}
+
+	return GetElapsedMilliseconds(start) / iterations;
+}
+
+bool CompareMatrices(QBT* pQBT1, QBT* pQBT2)
+{
+	if (pQBT1->GetNumMatrices() != pQBT2->GetNumMatrices())
+	{
+		return false;
+	}
+
+	for (int i = 0; i < pQBT1->GetNumMatrices(); i++)
+	{
+		QBTMatrix* pMatrix1 = pQBT1->GetMatrix(i);
+		QBTMatrix* pMatrix2 = pQBT2->GetMatrix(i);
+		unsigned int numVoxels = pMatrix1->m_sizeX * pMatrix1->m_sizeY * pMatrix1->m_sizeZ;
+		if (pMatrix1->m_sizeX != pMatrix2->m_sizeX || pMatrix1->m_sizeY != pMatrix2->m_sizeY || pMatrix1->m_sizeZ != pMatrix2->m_sizeZ ||
+			memcmp(pMatrix1->m_pColour, pMatrix2->m_pColour, numVoxels * sizeof(unsigned int)) != 0 ||
+			memcmp(pMatrix1->m_pVisibilityMask, pMatrix2->m_pVisibilityMask, numVoxels * sizeof(unsigned int)) != 0)
+		{
+			return false;
+		}
+	}
+
+	return true;
+}
+
+bool CompareLoads(string filename, QBTLoaderBackend backend1, bool parallel1, QBTLoaderBackend backend2, bool parallel2)
+{
+	// Always use several workers for the comparison, so the threaded path is checked even on a single core machine
+	JobSystem jobSystem(3);
+	QBT qbt1(NULL);
+	qbt1.SetJobSystem(&jobSystem);
+	qbt1.SetLoaderBackend(backend1);
+	qbt1.SetParallelLoading(parallel1);
+	QBT qbt2(NULL);
+	qbt2.SetJobSystem(&jobSystem);
+	qbt2.SetLoaderBackend(backend2);
+	qbt2.SetParallelLoading(parallel2);
+
+	if (qbt1.ReadQBTFile(filename) == false || qbt2.ReadQBTFile(filename) == false)
+	{
+		return false;
+	}
+
+	return CompareMatrices(&qbt1, &qbt2);
+}
+
+string GetBaseFilename(string filename)
+{
+	return filename.substr(filename.find_last_of("/\\") + 1);
+}
+
+void RunLoaderBenchmark(string filename, int iterations)
+{
+	// Warm up the file cache and both code paths, so neither backend pays for being run first
+	TimeLoad(filename, QBTLoaderBackend_FileStream, false, 1);
+	TimeLoad(filename, QBTLoaderBackend_MemoryMapped, false, 1);
+
+	// The iterations are split into rounds that alternate which backend goes first, and the best round of each is kept. A small
+	// file loads in a tenth of a millisecond, so a single block of iterations is easily thrown by whatever else the machine is doing.
+	const int numRounds = 5;
+	int roundIterations = std::max(iterations / numRounds, 1);
+	double streamTime = 0.0;
+	double mappedTime = 0.0;
+	for (int i = 0; i < numRounds; i++)
+	{
+		QBTLoaderBackend firstBackend = (i % 2) == 0 ? QBTLoaderBackend_FileStream : QBTLoaderBackend_MemoryMapped;
+		QBTLoaderBackend secondBackend = (i % 2) == 0 ? QBTLoaderBackend_MemoryMapped : QBTLoaderBackend_FileStream;
+		double firstTime = TimeLoad(filename, firstBackend, false, roundIterations);
+		double secondTime = TimeLoad(filename, secondBackend, false, roundIterations);
+		double roundStreamTime = firstBackend == QBTLoaderBackend_FileStream ? firstTime : secondTime;
+		double roundMappedTime = firstBackend == QBTLoaderBackend_MemoryMapped ? firstTime : secondTime;
+		streamTime = i == 0 ? roundStreamTime : std::min(streamTime, roundStreamTime);
+		mappedTime = i == 0 ? roundMappedTime : std::min(mappedTime, roundMappedTime);
+	}
+	bool match = CompareLoads(filename, QBTLoaderBackend_FileStream, false, QBTLoaderBackend_MemoryMapped, false);
+
+	printf("%-36s %10.1f %12.4f %12.4f %8.2fx %6s\n", GetBaseFilename(filename).c_str(), GetFileSize(filename) / 1024.0f, streamTime, mappedTime, streamTime / mappedTime, match ? "yes" : "NO");
+}
+
+void RunParallelLoadBenchmark(string filename, int iterations)
+{
+	TimeLoad(filename, QBTLoaderBackend_MemoryMapped, false, 1);
+
+	double serialTime = TimeLoad(filename, QBTLoaderBackend_MemoryMapped, false, iterations);
+	double parallelTime = TimeLoad(filename, QBTLoaderBackend_MemoryMapped, true, iterations);
+	bool match = CompareLoads(filename, QBTLoaderBackend_MemoryMapped, false, QBTLoaderBackend_MemoryMapped, true) &&
+	             CompareLoads(filename, QBTLoaderBackend_FileStream, false, QBTLoaderBackend_FileStream, true);
+
+	printf("%-36s %10.1f %12.4f %12.4f %8.2fx %6s\n", GetBaseFilename(filename).c_str(), GetFileSize(filename) / 1024.0f, serialTime, parallelTime, serialTime / parallelTime, match ? "yes" : "NO");
+}
+
+// Mesher benchmark
+double TimeMesh(QBT* pQBT, QBTMesher mesher, bool mergeFaces, int iterations)
+{
+	pQBT->SetMesher(mesher);
+	pQBT->SetMergeFaces(mergeFaces);
+
+	// Each chunk is meshed into the mesh arenas, the same as when the chunks are meshed and uploaded straight away
+	BenchmarkClock::time_point start = BenchmarkClock::now();
+	for (int i = 0; i < iterations; i++)
+	{
+		for (int j = 0; j < pQBT->GetNumMatrices(); j++)
+		{
+			QBTMatrix* pMatrix = pQBT->GetMatrix(j);
+			for (unsigned int k = 0; k < pMatrix->m_vChunks.size(); k++)
+			{
+				pQBT->CreateMeshData(pMatrix, &pMatrix->m_vChunks[k]);
+			}
+		}
+	}
+
+	return GetElapsedMilliseconds(start) / iterations;
+}
+
+// Reference for the two pass meshing that was replaced, where every chunk was walked once to count its vertices and then
+// again to fill its buffers. Each chunk is meshed twice in a row, so it costs the same two full walks.
+double TimeTwoPassMesh(QBT* pQBT, QBTMesher mesher, bool mergeFaces, int iterations)
+{
+	pQBT->SetMesher(mesher);
+	pQBT->SetMergeFaces(mergeFaces);
+
+	BenchmarkClock::time_point start = BenchmarkClock::now();
+	for (int i = 0; i < iterations; i++)
+	{
+		for (int j = 0; j < pQBT->GetNumMatrices(); j++)
+		{
+			QBTMatrix* pMatrix = pQBT->GetMatrix(j);
+			for (unsigned int k = 0; k < pMatrix->m_vChunks.size(); k++)
+			{
+				for (int pass = 0; pass < 2; pass++)
+				{
+					pQBT->CreateMeshData(pMatrix, &pMatrix->m_vChunks[k]);
+				}
+			}
+		}
+	}
+
+	return GetElapsedMilliseconds(start) / iterations;
+}
+
+// Rasterizes the quads of a mesh into one entry per voxel face, holding the face colour and which way its first triangle
+// winds, so meshes with a different quad layout can be compared. The ambient occlusion levels of the quad corners go into a
+// second entry per voxel face, in the GetFaceAmbientOcclusion() order. Returns false if any two quads overlap, or if a quad
+// is split along its darker diagonal.
+bool GetFaceCoverage(QBTMatrix* pMatrix, vector<unsigned int>& coverage, vector<unsigned int>& ambientOcclusion)
+{
+	unsigned int numVoxels = pMatrix->m_sizeX * pMatrix->m_sizeY * pMatrix->m_sizeZ;
+	coverage.assign(numVoxels * 6, 0);
+	ambientOcclusion.assign(numVoxels * 6, 0);
+
+	for (unsigned int chunk = 0; chunk < pMatrix->m_vChunks.size(); chunk++)
+	{
+		const QBTChunk* pChunk = &pMatrix->m_vChunks[chunk];
+		for (unsigned int quad = 0; quad < pChunk->m_numVertices / 4; quad++)
+		{
+			const PositionColorNormalVertex* pQuad = &pChunk->m_pVertices[quad * 4];
+			float normal[3] = { pQuad[0].nx, pQuad[0].ny, pQuad[0].nz };
+			int normalAxis = normal[0] != 0.0f ? 0 : (normal[1] != 0.0f ? 1 : 2);
+			int face = normalAxis * 2 + (normal[normalAxis] > 0.0f ? 0 : 1);
+
+			int minVoxel[3];
+			int maxVoxel[3];
+			for (int axis = 0; axis < 3; axis++)
+			{
+				float minPosition = 1.0e9f;
+				float maxPosition = -1.0e9f;
+				for (int i = 0; i < 4; i++)
+				{
+					float position = axis == 0 ? pQuad[i].x : (axis == 1 ? pQuad[i].y : pQuad[i].z);
+					minPosition = std::min(minPosition, position);
+					maxPosition = std::max(maxPosition, position);
+				}
+
+				if (axis == normalAxis)
+				{
+					minVoxel[axis] = maxVoxel[axis] = (int)floorf(minPosition + (normal[axis] > 0.0f ? -0.5f : 0.5f) + 0.5f);
+				}
+				else
+				{
+					minVoxel[axis] = (int)floorf(minPosition + 0.5f + 0.5f);
+					maxVoxel[axis] = (int)floorf(maxPosition - 0.5f + 0.5f);
+				}
+			}
+
+			const PositionColorNormalVertex& v0 = pChunk->m_pVertices[quad * 4 + QUAD_INDICES[0]];
+			const PositionColorNormalVertex& v1 = pChunk->m_pVertices[quad * 4 + QUAD_INDICES[1]];
+			const PositionColorNormalVertex& v2 = pChunk->m_pVertices[quad * 4 + QUAD_INDICES[2]];
+			float edge1[3] = { v1.x - v0.x, v1.y - v0.y, v1.z - v0.z };
+			float edge2[3] = { v2.x - v0.x, v2.y - v0.y, v2.z - v0.z };
+			float cross[3] = { edge1[1] * edge2[2] - edge1[2] * edge2[1], edge1[2] * edge2[0] - edge1[0] * edge2[2], edge1[0] * edge2[1] - edge1[1] * edge2[0] };
+			bool frontFacing = cross[0] * normal[0] + cross[1] * normal[1] + cross[2] * normal[2] > 0.0f;
+
+			// Put the corner levels back in the face layout order, the quad may have been turned to move its diagonal
+			const QBTFaceLayout* pFaceLayout = NULL;
+			for (int i = 0; i < QBTFace_NUM; i++)
+			{
+				if (QBT_FACE_LAYOUTS[i].m_normalAxis == normalAxis && (QBT_FACE_LAYOUTS[i].m_direction > 0) == (normal[normalAxis] > 0.0f))
+				{
+					pFaceLayout = &QBT_FACE_LAYOUTS[i];
+				}
+			}
+			unsigned int levels[4];
+			unsigned int quadAmbientOcclusion = 0;
+			for (int i = 0; i < 4; i++)
+			{
+				float position[3] = { pQuad[i].x, pQuad[i].y, pQuad[i].z };
+				unsigned int cornerU = position[pFaceLayout->m_uAxis] > minVoxel[pFaceLayout->m_uAxis] ? 1 : 0;
+				unsigned int cornerV = position[pFaceLayout->m_vAxis] > minVoxel[pFaceLayout->m_vAxis] ? 1 : 0;
+				levels[i] = GetAmbientOcclusionLevel(pQuad[i].a);
+				for (int j = 0; j < 4; j++)
+				{
+					if (pFaceLayout->m_cornerU[j] == cornerU && pFaceLayout->m_cornerV[j] == cornerV)
+					{
+						quadAmbientOcclusion |= levels[i] << (j * 2);
+					}
+				}
+			}
+			if (levels[0] + levels[3] < levels[1] + levels[2])
+			{
+				return false;
+			}
+
+			unsigned int colour = (unsigned int)(pQuad[0].r * 255.0f + 0.5f) | ((unsigned int)(pQuad[0].g * 255.0f + 0.5f) << 8) | ((unsigned int)(pQuad[0].b * 255.0f + 0.5f) << 16);
+			colour |= frontFacing ? 0x01000000 : 0x02000000;
+
+			for (int z = minVoxel[2]; z <= maxVoxel[2]; z++)
+			{
+				for (int y = minVoxel[1]; y <= maxVoxel[1]; y++)
+				{
+					for (int x = minVoxel[0]; x <= maxVoxel[0]; x++)
+					{
+						unsigned int index = face * numVoxels + x + pMatrix->m_sizeX * (y + pMatrix->m_sizeY * z);
+						if (coverage[index] != 0)
+						{
+							return false;
+						}
+						coverage[index] = colour;
+						ambientOcclusion[index] = quadAmbientOcclusion;
+					}
+				}
+			}
+		}
+	}
+
+	return true;
+}
+
+// Every face of a quad has to have the occlusion of its own voxel, which also checks faces were only merged with matching occlusion
+bool CheckAmbientOcclusion(QBTMatrix* pMatrix, const vector<unsigned int>& coverage, const vector<unsigned int>& ambientOcclusion, bool ambientOcclusionEnabled)
+{
+	const QBTFace faces[6] = { QBTFace_Right, QBTFace_Left, QBTFace_Top, QBTFace_Bottom, QBTFace_Front, QBTFace_Back };
+
+	unsigned int numVoxels = pMatrix->m_sizeX * pMatrix->m_sizeY * pMatrix->m_sizeZ;
+	for (unsigned int i = 0; i < coverage.size(); i++)
+	{
+		if (coverage[i] == 0)
+		{
+			continue;
+		}
+
+		unsigned int voxel = i % numVoxels;
+		int x = voxel % pMatrix->m_sizeX;
+		int y = (voxel / pMatrix->m_sizeX) % pMatrix->m_sizeY;
+		int z = voxel / (pMatrix->m_sizeX * pMatrix->m_sizeY);
+		unsigned int expected = ambientOcclusionEnabled ? GetFaceAmbientOcclusion(pMatrix, x, y, z, faces[i / numVoxels]) : 0;
+		if (ambientOcclusion[i] != expected)
+		{
+			return false;
+		}
+	}
+
+	return true;
+}
+
+bool CompareMeshers(QBT* pQBT, bool mergeFaces, bool ambientOcclusion)
+{
+	pQBT->SetMergeFaces(mergeFaces);
+	pQBT->SetAmbientOcclusion(ambientOcclusion);
+
+	for (int i = 0; i < pQBT->GetNumMatrices(); i++)
+	{
+		QBTMatrix* pMatrix = pQBT->GetMatrix(i);
+
+		vector<unsigned int> defaultCoverage;
+		vector<unsigned int> defaultAmbientOcclusion;
+		pQBT->SetMesher(QBTMesher_Default);
+		pQBT->CreateMeshData(pMatrix);
+		bool defaultValid = GetFaceCoverage(pMatrix, defaultCoverage, defaultAmbientOcclusion) &&
+		                    CheckAmbientOcclusion(pMatrix, defaultCoverage, defaultAmbientOcclusion, ambientOcclusion);
+
+		vector<unsigned int> binaryCoverage;
+		vector<unsigned int> binaryAmbientOcclusion;
+		pQBT->SetMesher(QBTMesher_BinaryGreedy);
+		pQBT->CreateMeshData(pMatrix);
+		bool binaryValid = GetFaceCoverage(pMatrix, binaryCoverage, binaryAmbientOcclusion) &&
+		                   CheckAmbientOcclusion(pMatrix, binaryCoverage, binaryAmbientOcclusion, ambientOcclusion);
+
+		pQBT->DeleteMeshData(pMatrix);
+
+		if (defaultValid == false || binaryValid == false || defaultCoverage != binaryCoverage || defaultAmbientOcclusion != binaryAmbientOcclusion)
+		{
+			return false;
+		}
+	}
+
+	return true;
+}
+
+void RunMesherBenchmark(string filename, int iterations)
+{
+	QBT qbt(NULL);
+	if (qbt.ReadQBTFile(filename) == false)
+	{
+		printf("Failed to load '%s'\n", filename.c_str());
+		return;
+	}
+
+	unsigned long long numVoxels = 0;
+	for (int i = 0; i < qbt.GetNumMatrices(); i++)
+	{
+		QBTMatrix* pMatrix = qbt.GetMatrix(i);
+		numVoxels += (unsigned long long)pMatrix->m_sizeX * pMatrix->m_sizeY * pMatrix->m_sizeZ;
+	}
+
+	for (int ambientOcclusion = 0; ambientOcclusion < 2; ambientOcclusion++)
+	{
+		for (int merge = 0; merge < 2; merge++)
+		{
+			bool match = CompareMeshers(&qbt, merge == 1, ambientOcclusion == 1);
+
+			QBTMesher meshers[] = { QBTMesher_Default, QBTMesher_BinaryGreedy };
+			for (int i = 0; i < 2; i++)
+			{
+				TimeMesh(&qbt, meshers[i], merge == 1, 1);
+				double meshTime = TimeMesh(&qbt, meshers[i], merge == 1, iterations);
+				double twoPassTime = TimeTwoPassMesh(&qbt, meshers[i], merge == 1, iterations);
+
+				printf("%-36s %-8s %6s %6s %12.3f %14.3f %14.1f %12d %6s\n", GetBaseFilename(filename).c_str(), meshers[i] == QBTMesher_Default ? "Default" : "Binary", merge == 1 ? "yes" : "no",
+				       ambientOcclusion == 1 ? "yes" : "no", meshTime, twoPassTime, numVoxels / (meshTime * 1000.0), qbt.GetNumTriangles(), match ? "yes" : "NO");
+			}
+		}
+	}
+	qbt.SetAmbientOcclusion(false);
+}
+
+// Vertex format benchmark, decodes the packed vertices the same way as the PackedPositionColorNormal vertex shader
+bool ComparePackedVertices(QBT* pQBT)
+{
+	const float normals[6][3] = { { 1.0f, 0.0f, 0.0f }, { -1.0f, 0.0f, 0.0f }, { 0.0f, 1.0f, 0.0f }, { 0.0f, -1.0f, 0.0f }, { 0.0f, 0.0f, 1.0f }, { 0.0f, 0.0f, -1.0f } };
+
+	for (int i = 0; i < pQBT->GetNumMatrices(); i++)
+	{
+		QBTMatrix* pMatrix = pQBT->GetMatrix(i);
+
+		pQBT->SetVertexFormat(QBTVertexFormat_PositionColorNormal);
+		pQBT->CreateMeshData(pMatrix);
+		vector<PositionColorNormalVertex> vertices;
+		for (unsigned int j = 0; j < pMatrix->m_vChunks.size(); j++)
+		{
+			const QBTChunk* pChunk = &pMatrix->m_vChunks[j];
+			vertices.insert(vertices.end(), pChunk->m_pVertices, pChunk->m_pVertices + pChunk->m_numVertices);
+		}
+
+		pQBT->SetVertexFormat(QBTVertexFormat_Packed);
+		pQBT->CreateMeshData(pMatrix);
+		vector<PackedPositionColorNormalVertex> packedVertices;
+		bool match = true;
+		for (unsigned int j = 0; j < pMatrix->m_vChunks.size(); j++)
+		{
+			const QBTChunk* pChunk = &pMatrix->m_vChunks[j];
+			match &= pChunk->m_numVertices == 0 || pChunk->m_vertexFormat == QBTVertexFormat_Packed;
+			packedVertices.insert(packedVertices.end(), pChunk->m_pPackedVertices, pChunk->m_pPackedVertices + pChunk->m_numVertices);
+		}
+		match &= packedVertices.size() == vertices.size();
+		for (unsigned int j = 0; j < vertices.size() && match; j++)
+		{
+			unsigned int xyz = packedVertices[j].xyz;
+			unsigned int rgbn = packedVertices[j].rgbn;
+			const float* pNormal = normals[(rgbn >> 24) & 7];
+
+			match = (xyz & 1023) - 0.5f == vertices[j].x && ((xyz >> 10) & 1023) - 0.5f == vertices[j].y && ((xyz >> 20) & 1023) - 0.5f == vertices[j].z &&
+			        fabs((rgbn & 255) / 255.0f - vertices[j].r) < 0.001f && fabs(((rgbn >> 8) & 255) / 255.0f - vertices[j].g) < 0.001f && fabs(((rgbn >> 16) & 255) / 255.0f - vertices[j].b) < 0.001f &&
+			        pNormal[0] == vertices[j].nx && pNormal[1] == vertices[j].ny && pNormal[2] == vertices[j].nz && ((rgbn >> 27) & 3) == GetAmbientOcclusionLevel(vertices[j].a);
+		}
+		pQBT->DeleteMeshData(pMatrix);
+
+		if (match == false)
+		{
+			return false;
+		}
+	}
+
+	return true;
+}
+
+double TimeVertexFormat(QBT* pQBT, QBTMesher mesher, QBTVertexFormat vertexFormat, int iterations)
+{
+	pQBT->SetVertexFormat(vertexFormat);
+	return TimeMesh(pQBT, mesher, false, iterations);
+}
+
+void RunVertexFormatBenchmark(string filename, int iterations)
+{
+	QBT qbt(NULL);
+	if (qbt.ReadQBTFile(filename) == false)
+	{
+		printf("Failed to load '%s'\n", filename.c_str());
+		return;
+	}
+
+	// Each mesher writes the packed vertices itself, so both are checked against their own full vertices
+	QBTMesher meshers[] = { QBTMesher_Default, QBTMesher_BinaryGreedy };
+	for (int i = 0; i < 2; i++)
+	{
+		qbt.SetMesher(meshers[i]);
+		bool match = true;
+		for (int merge = 0; merge < 2; merge++)
+		{
+			qbt.SetMergeFaces(merge == 1);
+			for (int ambientOcclusion = 0; ambientOcclusion < 2; ambientOcclusion++)
+			{
+				qbt.SetAmbientOcclusion(ambientOcclusion == 1);
+				match = match && ComparePackedVertices(&qbt);
+			}
+		}
+		qbt.SetAmbientOcclusion(false);
+
+		TimeVertexFormat(&qbt, meshers[i], QBTVertexFormat_PositionColorNormal, 1);
+		double fullTime = TimeVertexFormat(&qbt, meshers[i], QBTVertexFormat_PositionColorNormal, iterations);
+		size_t fullMemory = qbt.GetMeshMemory();
+		TimeVertexFormat(&qbt, meshers[i], QBTVertexFormat_Packed, 1);
+		double packedTime = TimeVertexFormat(&qbt, meshers[i], QBTVertexFormat_Packed, iterations);
+		size_t packedMemory = qbt.GetMeshMemory();
+
+		printf("%-36s %-8s %12.1f %12.1f %9.1f%% %12.3f %12.3f %6s\n", GetBaseFilename(filename).c_str(), meshers[i] == QBTMesher_Default ? "Default" : "Binary", fullMemory / 1024.0,
+		       packedMemory / 1024.0, 100.0 * (1.0 - (double)packedMemory / fullMemory), fullTime, packedTime, match ? "yes" : "NO");
+	}
+}
+
+// Edit benchmark, the time from changing the voxels to having the affected chunks remeshed and ready to draw. A headless QBT
+// keeps a copy of each mesh where the renderer would upload it, so the copy stands in for the upload.
+bool CompareEdits(QBT* pQBT)
+{
+	for (int i = 0; i < pQBT->GetNumMatrices(); i++)
+	{
+		QBTMatrix* pMatrix = pQBT->GetMatrix(i);
+		unsigned int numVoxels = pMatrix->m_sizeX * pMatrix->m_sizeY * pMatrix->m_sizeZ;
+
+		// The masks that were patched up around each edit against masks recomputed from scratch
+		vector<unsigned int> editedMasks(pMatrix->m_pVisibilityMask, pMatrix->m_pVisibilityMask + numVoxels);
+		RecomputeVisibilityMask(pMatrix);
+		if (memcmp(&editedMasks[0], pMatrix->m_pVisibilityMask, numVoxels * sizeof(unsigned int)) != 0)
+		{
+			return false;
+		}
+
+		// The chunks that were remeshed after each edit against a remesh of the whole matrix
+		vector<unsigned int> editedCoverage;
+		vector<unsigned int> editedAmbientOcclusion;
+		bool editedValid = GetFaceCoverage(pMatrix, editedCoverage, editedAmbientOcclusion);
+		vector<unsigned int> fullCoverage;
+		vector<unsigned int> fullAmbientOcclusion;
+		pQBT->CreateMeshData(pMatrix);
+		bool fullValid = GetFaceCoverage(pMatrix, fullCoverage, fullAmbientOcclusion);
+		if (editedValid == false || fullValid == false || editedCoverage != fullCoverage || editedAmbientOcclusion != fullAmbientOcclusion)
+		{
+			return false;
+		}
+	}
+
+	return true;
+}
+
+void RunEditBenchmark(string filename, QBTMesher mesher, bool mergeFaces, int brushSize, int numEdits)
+{
+	QBT qbt(NULL);
+	qbt.SetMesher(mesher);
+	qbt.SetMergeFaces(mergeFaces);
+	if (qbt.ReadQBTFile(filename) == false || qbt.GetNumMatrices() == 0)
+	{
+		printf("Failed to load '%s'\n", filename.c_str());
+		return;
+	}
+
+	// Rebuilding every chunk, which was the only way to show an edit before
+	qbt.RecreateStaticBuffers();
+	BenchmarkClock::time_point fullStart = BenchmarkClock::now();
+	qbt.RecreateStaticBuffers();
+	double fullTime = GetElapsedMilliseconds(fullStart);
+
+	// Paint and erase boxes at repeatable pseudo random places, every edit is remeshed straight away like it would be in a frame
+	QBTMatrix* pMatrix = qbt.GetMatrix(0);
+	unsigned int random = 12345;
+	double totalTime = 0.0;
+	double maxTime = 0.0;
+	unsigned int totalChunks = 0;
+	for (int i = 0; i < numEdits; i++)
+	{
+		int position[3];
+		unsigned int sizes[3] = { pMatrix->m_sizeX, pMatrix->m_sizeY, pMatrix->m_sizeZ };
+		for (int axis = 0; axis < 3; axis++)
+		{
+			random = random * 1664525u + 1013904223u;
+			position[axis] = (int)((random >> 8) % sizes[axis]) - brushSize / 2;
+		}
+		int end[3] = { position[0] + brushSize - 1, position[1] + brushSize - 1, position[2] + brushSize - 1 };
+
+		BenchmarkClock::time_point start = BenchmarkClock::now();
+		if ((i & 1) == 0)
+		{
+			qbt.SetVoxelBox(pMatrix, position[0], position[1], position[2], end[0], end[1], end[2], Colour(1.0f, 0.5f, (i % 256) / 255.0f));
+		}
+		else
+		{
+			qbt.ClearVoxelBox(pMatrix, position[0], position[1], position[2], end[0], end[1], end[2]);
+		}
+		totalChunks += qbt.GetNumDirtyChunks();
+		qbt.UpdateDirtyChunks();
+		double editTime = GetElapsedMilliseconds(start);
+
+		totalTime += editTime;
+		maxTime = std::max(maxTime, editTime);
+	}
+
+	bool match = CompareEdits(&qbt);
+
+	char brush[32];
+	sprintf(brush, "%dx%dx%d", brushSize, brushSize, brushSize);
+	printf("%-36s %-8s %-8s %6s %12.3f %12.3f %8.1f %12.3f %6s\n", GetBaseFilename(filename).c_str(), brush, mesher == QBTMesher_Default ? "Default" : "Binary",
+	       mergeFaces ? "yes" : "no", totalTime / numEdits, maxTime, (double)totalChunks / numEdits, fullTime, match ? "yes" : "NO");
+}
+
+// Draw submission benchmark, the CPU side of QBT::Render for models with many matrices. The GL calls themselves need a
+// context, so the uniform lookups that used to happen by name are counted rather than timed.
+volatile float g_transformSink; // Keeps the transforms from being optimized away
+volatile float g_cameraDistance = 200.0f; // Read for every transform, like the camera would be, so it can't be hoisted out of the loops
+
+void RunDrawSubmissionBenchmark(string filename, int frames)
+{
+	QBT qbt(NULL);
+	if (qbt.ReadQBTFile(filename) == false || qbt.GetNumMatrices() == 0)
+	{
+		printf("Failed to load '%s'\n", filename.c_str());
+		return;
+	}
+	qbt.CreateStaticRenderBuffers();
+
+	vec3 cameraView(0.0f, 0.0f, 0.0f);
+	vec3 cameraUp(0.0f, 1.0f, 0.0f);
+	float aspectRatio = 1280.0f / 720.0f;
+
+	// The camera transforms built again for every matrix, like Render used to
+	BenchmarkClock::time_point perMatrixStart = BenchmarkClock::now();
+	for (int frame = 0; frame < frames; frame++)
+	{
+		for (int i = 0; i < qbt.GetNumMatrices(); i++)
+		{
+			QBTMatrix* pMatrix = qbt.GetMatrix(i);
+			vec3 cameraPosition(0.0f, 50.0f, g_cameraDistance);
+			mat4 view = lookAt(cameraPosition, cameraView, cameraUp);
+			mat4 projection = perspective(45.0f, aspectRatio, 0.01f, 1000.0f);
+			mat4 model = translate(mat4(), vec3(pMatrix->m_positionX, pMatrix->m_positionY, pMatrix->m_positionZ));
+			g_transformSink = view[3][2] + projection[2][3] + model[3][0];
+		}
+	}
+	double perMatrixTime = GetElapsedMilliseconds(perMatrixStart) / frames;
+
+	// The camera transforms built once a frame
+	BenchmarkClock::time_point perFrameStart = BenchmarkClock::now();
+	for (int frame = 0; frame < frames; frame++)
+	{
+		vec3 cameraPosition(0.0f, 50.0f, g_cameraDistance);
+		mat4 view = lookAt(cameraPosition, cameraView, cameraUp);
+		mat4 projection = perspective(45.0f, aspectRatio, 0.01f, 1000.0f);
+		g_transformSink = view[3][2] + projection[2][3];
+	}
+	double perFrameTime = GetElapsedMilliseconds(perFrameStart) / frames;
+
+	// Gathering the draw lists, which builds the model transforms and is all that is left to do for each matrix
+	BenchmarkClock::time_point drawListStart = BenchmarkClock::now();
+	for (int frame = 0; frame < frames; frame++)
+	{
+		qbt.BuildDrawLists();
+	}
+	double drawListTime = GetElapsedMilliseconds(drawListStart) / frames;
+
+	// Before, every matrix looked up its 7 material and transform uniforms by name, on top of the 9 per frame ones
+	unsigned int numMatrices = (unsigned int)qbt.GetNumMatrices();
+	unsigned int lookupsBefore = 9 + 7 * numMatrices;
+
+	// GL uniform calls, with loose uniforms every matrix set its 4 material fields and model transform after the 10 per frame
+	// ones. With the uniform blocks there is one upload of the per draw array and one range bind for each matrix.
+	unsigned int uniformCallsBefore = 10 + 5 * numMatrices;
+	unsigned int uniformCallsAfter = 1 + numMatrices;
+
+	// Batched, the chunks of each vertex format go in a single multi-draw
+	unsigned int numDrawCalls = qbt.GetNumDrawCalls();
+	qbt.SetBatchedRendering(true);
+	qbt.BuildDrawLists();
+	unsigned int numBatchedDrawCalls = qbt.GetNumDrawCalls();
+
+	printf("%-36s %9u %8u %8u %13.4f %13.4f %13.4f %14.1f %8u %8u %8u %8u\n", GetBaseFilename(filename).c_str(), numMatrices, numDrawCalls, numBatchedDrawCalls, perMatrixTime, perFrameTime,
+	       drawListTime, drawListTime * 1000000.0 / numMatrices, lookupsBefore, 0, uniformCallsBefore, uniformCallsAfter);
+}
+
+// Visibility benchmark
+// Frustum culling benchmark
+bool IsVertexInsideClipSpace(const dmat4& viewProjection, vec3 position)
+{
+	dvec4 clip = viewProjection * dvec4(position, 1.0);
+	return fabs(clip.x) <= clip.w && fabs(clip.y) <= clip.w && fabs(clip.z) <= clip.w;
+}
+
+// Every chunk that was culled must have no vertex inside the clip volume, checked a vertex at a time against the projection
+bool CompareCulling(QBT* pQBT, const dmat4& viewProjection)
+{
+	unsigned int numChunks = 0;
+	for (int i = 0; i < pQBT->GetNumMatrices(); i++)
+	{
+		QBTMatrix* pMatrix = pQBT->GetMatrix(i);
+		vec3 position((float)pMatrix->m_positionX, (float)pMatrix->m_positionY, (float)pMatrix->m_positionZ);
+		for (unsigned int j = 0; j < pMatrix->m_vChunks.size(); j++)
+		{
+			QBTChunk* pChunk = &pMatrix->m_vChunks[j];
+			if (pChunk->m_numIndices == 0)
+			{
+				continue;
+			}
+			numChunks++;
+
+			bool anyInside = false;
+			for (unsigned int k = 0; k < pChunk->m_numVertices && anyInside == false; k++)
+			{
+				PositionColorNormalVertex* pVertex = &pChunk->m_pVertices[k];
+				anyInside = IsVertexInsideClipSpace(viewProjection, vec3(pVertex->x, pVertex->y, pVertex->z) + position);
+			}
+
+			// Visible chunks can be outside, the box test is conservative
+			if (anyInside && pQBT->IsChunkInDrawLists(pChunk) == false)
+			{
+				return false;
+			}
+		}
+	}
+
+	return numChunks == pQBT->GetNumVisibleChunks() + pQBT->GetNumCulledChunks();
+}
+
+void RunCullingBenchmark(string filename, int frames)
+{
+	QBT qbt(NULL);
+	if (qbt.ReadQBTFile(filename) == false || qbt.GetNumMatrices() == 0)
+	{
+		printf("Failed to load '%s'\n", filename.c_str());
+		return;
+	}
+	qbt.CreateStaticRenderBuffers();
+
+	// The matrices are laid out along x, the camera stands over them a quarter of the way along and looks down the row
+	QBTMatrix* pLastMatrix = qbt.GetMatrix(qbt.GetNumMatrices() - 1);
+	float width = (float)(pLastMatrix->m_positionX + pLastMatrix->m_sizeX);
+	float size = (float)pLastMatrix->m_sizeY;
+	vec3 cameraPosition(width * 0.25f, size, size * 0.5f);
+	vec3 cameraView(width * 0.25f + size, size * 0.5f, size * 0.5f);
+	mat4 view = lookAt(cameraPosition, cameraView, vec3(0.0f, 1.0f, 0.0f));
+	mat4 projection = perspective(45.0f, 1280.0f / 720.0f, 0.01f, 1000.0f);
+	Frustum frustum;
+	frustum.SetFromProjectionView(projection, view);
+
+	BenchmarkClock::time_point allStart = BenchmarkClock::now();
+	for (int frame = 0; frame < frames; frame++)
+	{
+		qbt.BuildDrawLists();
+	}
+	double allTime = GetElapsedMilliseconds(allStart) / frames;
+	unsigned int allDrawCalls = qbt.GetNumDrawCalls();
+
+	BenchmarkClock::time_point culledStart = BenchmarkClock::now();
+	for (int frame = 0; frame < frames; frame++)
+	{
+		qbt.BuildDrawLists(&frustum);
+	}
+	double culledTime = GetElapsedMilliseconds(culledStart) / frames;
+	unsigned int culledDrawCalls = qbt.GetNumDrawCalls();
+	unsigned int culledTriangles = 0;
+	for (int i = 0; i < qbt.GetNumMatrices(); i++)
+	{
+		for (unsigned int j = 0; j < qbt.GetMatrix(i)->m_vChunks.size(); j++)
+		{
+			QBTChunk* pChunk = &qbt.GetMatrix(i)->m_vChunks[j];
+			culledTriangles += qbt.IsChunkInDrawLists(pChunk) ? 0 : pChunk->m_numTriangles;
+		}
+	}
+
+	char visible[32];
+	char culled[32];
+	sprintf(visible, "%u/%u", qbt.GetNumVisibleMatrices(), qbt.GetNumVisibleChunks());
+	sprintf(culled, "%u/%u", qbt.GetNumCulledMatrices(), qbt.GetNumCulledChunks());
+	printf("%-36s %12s %12s %11.4f %11.4f %8u %8u %9.1f%% %6s\n", GetBaseFilename(filename).c_str(), visible, culled, allTime, culledTime,
+	       allDrawCalls, culledDrawCalls, 100.0 * culledTriangles / qbt.GetNumTriangles(), CompareCulling(&qbt, dmat4(projection) * dmat4(view)) ? "yes" : "NO");
+}
+
+// Instancing benchmark
+volatile float g_tileHeight = 0.0f; // Read for every tile moved, so the moves can't be hoisted out of the frame loops
+
+size_t GetModelMemory(QBT* pQBT)
+{
+	// The colours and visibility masks of every voxel, on top of the meshes
+	size_t modelMemory = pQBT->GetMeshMemory();
+	for (int i = 0; i < pQBT->GetNumMatrices(); i++)
+	{
+		QBTMatrix* pMatrix = pQBT->GetMatrix(i);
+		modelMemory += sizeof(unsigned int) * 2 * pMatrix->m_sizeX * pMatrix->m_sizeY * pMatrix->m_sizeZ;
+	}
+	return modelMemory;
+}
+
+vec3 GetTilePosition(unsigned int tileIndex, unsigned int tilesPerRow, float tileSize)
+{
+	return vec3((tileIndex % tilesPerRow) * tileSize, g_tileHeight, (tileIndex / tilesPerRow) * tileSize);
+}
+
+// A QBT of its own for every tile, each with its own voxels, meshes and draws
+void RunTileCopies(string filename, unsigned int numTiles, int frames, double* pSetupTime, size_t* pMemory, unsigned int* pDrawCalls, double* pFrameTime)
+{
+	unsigned int tilesPerRow = (unsigned int)ceil(sqrt((double)numTiles));
+	BenchmarkClock::time_point copiesStart = BenchmarkClock::now();
+	vector<QBT*> vpCopies;
+	for (unsigned int i = 0; i < numTiles; i++)
+	{
+		QBT* pCopy = new QBT(NULL);
+		pCopy->ReadQBTFile(filename);
+		pCopy->CreateStaticRenderBuffers();
+		vpCopies.push_back(pCopy);
+	}
+	*pSetupTime = GetElapsedMilliseconds(copiesStart);
+	float tileSize = (float)vpCopies[0]->GetMatrix(0)->m_sizeX;
+
+	*pMemory = 0;
+	*pDrawCalls = 0;
+	for (unsigned int i = 0; i < numTiles; i++)
+	{
+		vpCopies[i]->BuildDrawLists();
+		*pMemory += GetModelMemory(vpCopies[i]);
+		*pDrawCalls += vpCopies[i]->GetNumDrawCalls();
+	}
+
+	// Every frame each copy moves its matrices to the tile and gathers its draw lists
+	BenchmarkClock::time_point copiesFrameStart = BenchmarkClock::now();
+	for (int frame = 0; frame < frames; frame++)
+	{
+		for (unsigned int i = 0; i < numTiles; i++)
+		{
+			vec3 tilePosition = GetTilePosition(i, tilesPerRow, tileSize);
+			for (int j = 0; j < vpCopies[i]->GetNumMatrices(); j++)
+			{
+				QBTMatrix* pMatrix = vpCopies[i]->GetMatrix(j);
+				pMatrix->m_positionX = (int)tilePosition.x;
+				pMatrix->m_positionY = (int)tilePosition.y;
+				pMatrix->m_positionZ = (int)tilePosition.z;
+			}
+			vpCopies[i]->BuildDrawLists();
+		}
+	}
+	*pFrameTime = GetElapsedMilliseconds(copiesFrameStart) / frames;
+
+	for (unsigned int i = 0; i < numTiles; i++)
+	{
+		delete vpCopies[i];
+	}
+}
+
+void RunInstancingBenchmark(string filename, unsigned int numTiles, unsigned int maxCopies, int frames)
+{
+	QBT model(NULL);
+	if (model.ReadQBTFile(filename) == false || model.GetNumMatrices() == 0)
+	{
+		printf("Failed to load '%s'\n", filename.c_str());
+		return;
+	}
+	unsigned int tilesPerRow = (unsigned int)ceil(sqrt((double)numTiles));
+	float tileSize = (float)model.GetMatrix(0)->m_sizeX;
+
+	// Every tile keeps its own unmerged meshes, which doesn't fit in memory for more than a few thousand tiles
+	char copiesColumns[128];
+	sprintf(copiesColumns, "%12s %11s %8s %11s", "-", "-", "-", "-");
+	if (numTiles <= maxCopies)
+	{
+		double copiesSetupTime;
+		size_t copiesMemory;
+		unsigned int copiesDrawCalls;
+		double copiesFrameTime;
+		RunTileCopies(filename, numTiles, frames, &copiesSetupTime, &copiesMemory, &copiesDrawCalls, &copiesFrameTime);
+		sprintf(copiesColumns, "%12.1f %11.2f %8u %11.3f", copiesSetupTime, copiesMemory / (1024.0 * 1024.0), copiesDrawCalls, copiesFrameTime);
+	}
+
+	// One model with an instance for every tile
+	BenchmarkClock::time_point instancedStart = BenchmarkClock::now();
+	QBT* pInstanced = new QBT(NULL);
+	pInstanced->ReadQBTFile(filename);
+	pInstanced->CreateStaticRenderBuffers();
+	for (unsigned int i = 0; i < numTiles; i++)
+	{
+		pInstanced->AddInstance(translate(mat4(), GetTilePosition(i, tilesPerRow, tileSize)));
+	}
+	double instancedSetupTime = GetElapsedMilliseconds(instancedStart);
+
+	pInstanced->BuildDrawLists();
+	size_t instancedMemory = GetModelMemory(pInstanced) + sizeof(QBTInstance) * pInstanced->GetNumInstances();
+	unsigned int instancedDrawCalls = pInstanced->GetNumDrawCalls();
+
+	// Every frame all the instances are moved, the worst case for the instance buffer upload
+	BenchmarkClock::time_point instancedFrameStart = BenchmarkClock::now();
+	for (int frame = 0; frame < frames; frame++)
+	{
+		for (unsigned int i = 0; i < numTiles; i++)
+		{
+			pInstanced->SetInstanceTransform(i, translate(mat4(), GetTilePosition(i, tilesPerRow, tileSize)));
+		}
+		pInstanced->BuildDrawLists();
+	}
+	double instancedFrameTime = GetElapsedMilliseconds(instancedFrameStart) / frames;
+	delete pInstanced;
+
+	printf("%-36s %9u %s %12.1f %11.2f %8u %11.3f\n", GetBaseFilename(filename).c_str(), numTiles, copiesColumns,
+	       instancedSetupTime, instancedMemory / (1024.0 * 1024.0), instancedDrawCalls, instancedFrameTime);
+}
+
+// Visibility benchmark
+const char* GetSimdLevelName(QBTSimdLevel simdLevel)
+{
+	switch (simdLevel)
+	{
+		case QBTSimdLevel_Scalar: return "Scalar";
+		case QBTSimdLevel_SSE2: return "SSE2";
+		case QBTSimdLevel_AVX2: return "AVX2";
+	}
+	return "";
+}
+
+void GetVisibilityMasks(QBT* pQBT, vector<vector<unsigned int> >& masks)
+{
+	masks.resize(pQBT->GetNumMatrices());
+	for (int i = 0; i < pQBT->GetNumMatrices(); i++)
+	{
+		QBTMatrix* pMatrix = pQBT->GetMatrix(i);
+		masks[i].assign(pMatrix->m_pVisibilityMask, pMatrix->m_pVisibilityMask + pMatrix->m_sizeX * pMatrix->m_sizeY * pMatrix->m_sizeZ);
+	}
+}
+
+void SetVisibilityMasks(QBT* pQBT, const vector<vector<unsigned int> >& masks)
+{
+	for (int i = 0; i < pQBT->GetNumMatrices(); i++)
+	{
+		std::copy(masks[i].begin(), masks[i].end(), pQBT->GetMatrix(i)->m_pVisibilityMask);
+	}
+}
+
+// Triangles an unmerged mesh would have, two for every face bit that is set
+unsigned long long GetFaceTriangles(const vector<vector<unsigned int> >& masks)
+{
+	unsigned long long numTriangles = 0;
+	for (unsigned int i = 0; i < masks.size(); i++)
+	{
+		for (unsigned int j = 0; j < masks[i].size(); j++)
+		{
+			for (unsigned int bit = QBTVisibility_X_Positive; bit <= QBTVisibility_Z_Positive; bit <<= 1)
+			{
+				numTriangles += (masks[i][j] & bit) != 0 ? 2 : 0;
+			}
+		}
+	}
+	return numTriangles;
+}
+
+void RunVisibilityBenchmark(string filename, int iterations)
+{
+	QBT qbt(NULL);
+	qbt.SetRecomputeVisibility(false);
+	if (qbt.ReadQBTFile(filename) == false)
+	{
+		printf("Failed to load '%s'\n", filename.c_str());
+		return;
+	}
+
+	unsigned long long numVoxels = 0;
+	for (int i = 0; i < qbt.GetNumMatrices(); i++)
+	{
+		QBTMatrix* pMatrix = qbt.GetMatrix(i);
+		numVoxels += (unsigned long long)pMatrix->m_sizeX * pMatrix->m_sizeY * pMatrix->m_sizeZ;
+	}
+
+	vector<vector<unsigned int> > fileMasks;
+	GetVisibilityMasks(&qbt, fileMasks);
+
+	// The scalar masks are the reference for the vectorized ones
+	vector<vector<unsigned int> > scalarMasks;
+	for (int i = 0; i < qbt.GetNumMatrices(); i++)
+	{
+		RecomputeVisibilityMask(qbt.GetMatrix(i), QBTSimdLevel_Scalar);
+	}
+	GetVisibilityMasks(&qbt, scalarMasks);
+
+	for (int level = QBTSimdLevel_Scalar; level <= GetSupportedSimdLevel(); level++)
+	{
+		double totalTime = 0.0;
+		for (int i = 0; i < iterations; i++)
+		{
+			SetVisibilityMasks(&qbt, fileMasks);
+
+			BenchmarkClock::time_point start = BenchmarkClock::now();
+			for (int j = 0; j < qbt.GetNumMatrices(); j++)
+			{
+				RecomputeVisibilityMask(qbt.GetMatrix(j), (QBTSimdLevel)level);
+			}
+			totalTime += GetElapsedMilliseconds(start);
+		}
+		double recomputeTime = totalTime / iterations;
+
+		vector<vector<unsigned int> > masks;
+		GetVisibilityMasks(&qbt, masks);
+
+		// Reading and writing back 4 bytes of mask per voxel
+		printf("%-36s %-8s %12.4f %12.1f %10.2f %6s %6s\n", GetBaseFilename(filename).c_str(), GetSimdLevelName((QBTSimdLevel)level), recomputeTime,
+		       numVoxels / (recomputeTime * 1000.0), numVoxels * 8.0 / (recomputeTime * 1000000.0), masks == scalarMasks ? "yes" : "NO", fileMasks == scalarMasks ? "yes" : "no");
+	}
+
+	// Masks that have every face bit set, as some exporters write them, against the recomputed masks
+	vector<vector<unsigned int> > allOnesMasks = fileMasks;
+	for (unsigned int i = 0; i < allOnesMasks.size(); i++)
+	{
+		for (unsigned int j = 0; j < allOnesMasks[i].size(); j++)
+		{
+			allOnesMasks[i][j] = allOnesMasks[i][j] != 0 ? 127 : 0;
+		}
+	}
+	printf("%-36s %-8s %llu unmerged triangles with all ones masks, %llu recomputed\n", "", "", GetFaceTriangles(allOnesMasks), GetFaceTriangles(scalarMasks));
+}
+
+// Occlusion culling benchmark
+bool IsBoxOccluded(QBTOcclusionBuffer* pBuffer, float minX, float minY, float minZ, float maxX, float maxY, float maxZ)
+{
+	return pBuffer->IsBoxOccluded(vec3(minX, minY, minZ), vec3(maxX, maxY, maxZ));
+}
+
+// A wall across the view with boxes around it, the checks the occlusion buffer has to pass with every SIMD level and thread count
+bool CheckOcclusionBuffer(QBTSimdLevel simdLevel, unsigned int numThreads)
+{
+	JobSystem jobSystem(numThreads - 1);
+	QBTOcclusionBuffer buffer;
+	buffer.SetSimdLevel(simdLevel);
+	buffer.SetJobSystem(&jobSystem);
+
+	mat4 view = lookAt(vec3(0.0f, 0.0f, -50.0f), vec3(0.0f, 0.0f, 0.0f), vec3(0.0f, 1.0f, 0.0f));
+	mat4 projection = perspective(45.0f, 16.0f / 9.0f, 0.01f, 1000.0f);
+	buffer.BeginFrame(projection, view);
+
+	// Nothing is hidden before there are occluders
+	bool passed = IsBoxOccluded(&buffer, -1.0f, -1.0f, 10.0f, 1.0f, 1.0f, 12.0f) == false;
+
+	QBTOccluder wall;
+	wall.m_corners[0] = vec3(-10.0f, -10.0f, 0.0f);
+	wall.m_corners[1] = vec3(10.0f, -10.0f, 0.0f);
+	wall.m_corners[2] = vec3(-10.0f, 10.0f, 0.0f);
+	wall.m_corners[3] = vec3(10.0f, 10.0f, 0.0f);
+	passed = passed && buffer.AddOccluder(wall, vec3(0.0f, 0.0f, 0.0f));
+	buffer.Rasterize();
+
+	// Behind the wall, in front of it, behind it but reaching past its edge, and lying on it
+	passed = passed && IsBoxOccluded(&buffer, -1.0f, -1.0f, 10.0f, 1.0f, 1.0f, 12.0f);
+	passed = passed && IsBoxOccluded(&buffer, -8.0f, -8.0f, 1.0f, 8.0f, 8.0f, 100.0f);
+	passed = passed && IsBoxOccluded(&buffer, -1.0f, -1.0f, -12.0f, 1.0f, 1.0f, -10.0f) == false;
+	passed = passed && IsBoxOccluded(&buffer, 5.0f, -1.0f, 10.0f, 20.0f, 1.0f, 12.0f) == false;
+	passed = passed && IsBoxOccluded(&buffer, -1.0f, -1.0f, 0.0f, 1.0f, 1.0f, 2.0f) == false;
+
+	// Boxes that reach behind the camera are never hidden
+	passed = passed && IsBoxOccluded(&buffer, -1.0f, -1.0f, -60.0f, 1.0f, 1.0f, 20.0f) == false;
+
+	// The wall seen from behind still hides what is on the other side of it
+	view = lookAt(vec3(0.0f, 0.0f, 50.0f), vec3(0.0f, 0.0f, 0.0f), vec3(0.0f, 1.0f, 0.0f));
+	buffer.BeginFrame(projection, view);
+	buffer.AddOccluder(wall, vec3(0.0f, 0.0f, 0.0f));
+	buffer.Rasterize();
+	passed = passed && IsBoxOccluded(&buffer, -1.0f, -1.0f, -12.0f, 1.0f, 1.0f, -10.0f);
+	passed = passed && IsBoxOccluded(&buffer, -1.0f, -1.0f, 10.0f, 1.0f, 1.0f, 12.0f) == false;
+
+	return passed;
+}
+
+void GetDrawnChunks(QBT* pQBT, vector<QBTChunk*>& chunks)
+{
+	chunks.clear();
+	for (int i = 0; i < pQBT->GetNumMatrices(); i++)
+	{
+		QBTMatrix* pMatrix = pQBT->GetMatrix(i);
+		for (unsigned int j = 0; j < pMatrix->m_vChunks.size(); j++)
+		{
+			if (pQBT->IsChunkInDrawLists(&pMatrix->m_vChunks[j]))
+			{
+				chunks.push_back(&pMatrix->m_vChunks[j]);
+			}
+		}
+	}
+}
+
+// Finds which chunks really can be seen by drawing every triangle of the chunks inside the frustum into a depth buffer, keeping
+// the chunk that is nearest at each pixel centre. Returns how many of the chunks that can be seen are missing from the draw lists.
+unsigned int CountMissedOcclusion(QBT* pQBT, const vector<QBTChunk*>& frustumChunks, const mat4& projection, const mat4& view, unsigned int width, unsigned int height)
+{
+	mat4 viewProjection = projection * view;
+	vector<float> depth(width * height, 0.0f);
+	vector<QBTChunk*> nearestChunks(width * height, NULL);
+	static const unsigned int quadIndices[6] = { 0, 2, 1, 1, 2, 3 };
+
+	for (int i = 0; i < pQBT->GetNumMatrices(); i++)
+	{
+		QBTMatrix* pMatrix = pQBT->GetMatrix(i);
+		vec3 position((float)pMatrix->m_positionX, (float)pMatrix->m_positionY, (float)pMatrix->m_positionZ);
+		for (unsigned int j = 0; j < pMatrix->m_vChunks.size(); j++)
+		{
+			QBTChunk* pChunk = &pMatrix->m_vChunks[j];
+			if (find(frustumChunks.begin(), frustumChunks.end(), pChunk) == frustumChunks.end())
+			{
+				continue;
+			}
+
+			for (unsigned int k = 0; k < pChunk->m_numIndices; k += 3)
+			{
+				vec3 screen[3];
+				bool behindCamera = false;
+				for (int corner = 0; corner < 3; corner++)
+				{
+					unsigned int index = k + corner;
+					PositionColorNormalVertex* pVertex = &pChunk->m_pVertices[(index / 6) * 4 + quadIndices[index % 6]];
+					vec4 clip = viewProjection * vec4(vec3(pVertex->x, pVertex->y, pVertex->z) + position, 1.0f);
+					behindCamera = behindCamera || clip.w < QBT_OCCLUSION_MIN_DEPTH;
+					screen[corner] = vec3((clip.x / clip.w * 0.5f + 0.5f) * width, (clip.y / clip.w * 0.5f + 0.5f) * height, 1.0f / clip.w);
+				}
+				float area = (screen[1].x - screen[0].x) * (screen[2].y - screen[0].y) - (screen[2].x - screen[0].x) * (screen[1].y - screen[0].y);
+				if (behindCamera || fabs(area) < 1.0e-9f)
+				{
+					continue;
+				}
+
+				int minX = std::max((int)floorf(std::min(std::min(screen[0].x, screen[1].x), screen[2].x)), 0);
+				int maxX = std::min((int)floorf(std::max(std::max(screen[0].x, screen[1].x), screen[2].x)) + 1, (int)width);
+				int minY = std::max((int)floorf(std::min(std::min(screen[0].y, screen[1].y), screen[2].y)), 0);
+				int maxY = std::min((int)floorf(std::max(std::max(screen[0].y, screen[1].y), screen[2].y)) + 1, (int)height);
+				for (int y = minY; y < maxY; y++)
+				{
+					for (int x = minX; x < maxX; x++)
+					{
+						// The pixel centre is inside when its barycentric weights are all positive
+						float pixelX = x + 0.5f;
+						float pixelY = y + 0.5f;
+						float weight0 = ((screen[1].x - pixelX) * (screen[2].y - pixelY) - (screen[2].x - pixelX) * (screen[1].y - pixelY)) / area;
+						float weight1 = ((screen[2].x - pixelX) * (screen[0].y - pixelY) - (screen[0].x - pixelX) * (screen[2].y - pixelY)) / area;
+						float weight2 = 1.0f - weight0 - weight1;
+						if (weight0 < 0.0f || weight1 < 0.0f || weight2 < 0.0f)
+						{
+							continue;
+						}
+
+						float pixelDepth = weight0 * screen[0].z + weight1 * screen[1].z + weight2 * screen[2].z;
+						if (pixelDepth > depth[y * width + x])
+						{
+							depth[y * width + x] = pixelDepth;
+							nearestChunks[y * width + x] = pChunk;
+						}
+					}
+				}
+			}
+		}
+	}
+
+	sort(nearestChunks.begin(), nearestChunks.end());
+	nearestChunks.erase(unique(nearestChunks.begin(), nearestChunks.end()), nearestChunks.end());
+	unsigned int numMissed = 0;
+	for (unsigned int i = 0; i < nearestChunks.size(); i++)
+	{
+		if (nearestChunks[i] != NULL && pQBT->IsChunkInDrawLists(nearestChunks[i]) == false)
+		{
+			numMissed++;
+		}
+	}
+
+	return numMissed;
+}
+
+void RunOcclusionBenchmark(string filename, int frames)
+{
+	QBT qbt(NULL);
+	qbt.SetMergeFaces(true);
+	if (qbt.ReadQBTFile(filename) == false || qbt.GetNumMatrices() == 0)
+	{
+		printf("Failed to load '%s'\n", filename.c_str());
+		return;
+	}
+	qbt.CreateStaticRenderBuffers();
+
+	// The camera stands in the lowest valley near a quarter of the way along the row of matrices and looks down the row, so the
+	// hills in front of it hide the ones further on
+	QBTMatrix* pLastMatrix = qbt.GetMatrix(qbt.GetNumMatrices() - 1);
+	unsigned int size = pLastMatrix->m_sizeY;
+	QBTGenerator generator(GetSyntheticSettings(qbt.GetNumMatrices(), size));
+	int cameraX = (pLastMatrix->m_positionX + (int)pLastMatrix->m_sizeX) / 4;
+	for (int x = cameraX; x < cameraX + 64; x++)
+	{
+		if (generator.GetTerrainHeight(x, size / 2) < generator.GetTerrainHeight(cameraX, size / 2))
+		{
+			cameraX = x;
+		}
+	}
+	vec3 cameraPosition(cameraX + 0.5f, generator.GetTerrainHeight(cameraX, size / 2) + 2.0f, size * 0.5f);
+	mat4 view = lookAt(cameraPosition, cameraPosition + vec3(1.0f, 0.0f, 0.0f), vec3(0.0f, 1.0f, 0.0f));
+	mat4 projection = perspective(45.0f, 1280.0f / 720.0f, 0.01f, 1000.0f);
+	Frustum frustum;
+	frustum.SetFromProjectionView(projection, view);
+
+	BenchmarkClock::time_point frustumStart = BenchmarkClock::now();
+	for (int frame = 0; frame < frames; frame++)
+	{
+		qbt.BuildDrawLists(&frustum);
+	}
+	double frustumTime = GetElapsedMilliseconds(frustumStart) / frames;
+	vector<QBTChunk*> frustumChunks;
+	GetDrawnChunks(&qbt, frustumChunks);
+	unsigned int frustumTriangles = 0;
+	for (unsigned int i = 0; i < frustumChunks.size(); i++)
+	{
+		frustumTriangles += frustumChunks[i]->m_numTriangles;
+	}
+
+	// Every SIMD level on one thread, then the widest with more threads, all compared against the scalar draw lists
+	QBTSimdLevel widestSimdLevel = QBTOcclusionBuffer().GetSimdLevel();
+	vector<QBTSimdLevel> simdLevels;
+	vector<unsigned int> numThreads;
+	for (int i = 0; i <= (int)widestSimdLevel; i++)
+	{
+		simdLevels.push_back((QBTSimdLevel)i);
+		numThreads.push_back(1);
+	}
+	simdLevels.push_back(widestSimdLevel);
+	numThreads.push_back(4);
+
+	vector<QBTChunk*> scalarChunks;
+	for (unsigned int i = 0; i < simdLevels.size(); i++)
+	{
+		JobSystem jobSystem(numThreads[i] - 1);
+		QBTOcclusionBuffer occlusionBuffer;
+		occlusionBuffer.SetSimdLevel(simdLevels[i]);
+		occlusionBuffer.SetJobSystem(&jobSystem);
+
+		BenchmarkClock::time_point occlusionStart = BenchmarkClock::now();
+		for (int frame = 0; frame < frames; frame++)
+		{
+			occlusionBuffer.BeginFrame(projection, view);
+			qbt.BuildDrawLists(&frustum, &occlusionBuffer);
+		}
+		double occlusionTime = GetElapsedMilliseconds(occlusionStart) / frames;
+
+		vector<QBTChunk*> drawnChunks;
+		GetDrawnChunks(&qbt, drawnChunks);
+		if (i == 0)
+		{
+			scalarChunks = drawnChunks;
+		}
+		unsigned int drawnTriangles = 0;
+		for (unsigned int j = 0; j < drawnChunks.size(); j++)
+		{
+			drawnTriangles += drawnChunks[j]->m_numTriangles;
+		}
+
+		// The missed chunks are only counted once, it is the same for every level when the draw lists match
+		char missed[16] = "-";
+		if (i == 0)
+		{
+			sprintf(missed, "%u", CountMissedOcclusion(&qbt, frustumChunks, projection, view, occlusionBuffer.GetWidth() * 4, occlusionBuffer.GetHeight() * 4));
+		}
+
+		printf("%-36s %-8s %8u %10u %10u %10u %12.4f %12.4f %9.1f%% %6s %7s\n", GetBaseFilename(filename).c_str(), GetSimdLevelName(simdLevels[i]), numThreads[i],
+		       occlusionBuffer.GetNumOccluders(), (unsigned int)frustumChunks.size(), (unsigned int)drawnChunks.size(), frustumTime, occlusionTime,
+		       100.0 * (frustumTriangles - drawnTriangles) / std::max(frustumTriangles, 1u), drawnChunks == scalarChunks ? "yes" : "NO", missed);
+	}
+}
+
+// Level of detail benchmark
+// Every level of every matrix is half the size of the level before it, and after edits holds the same voxels and faces as a
+// chain built again from the edited matrix
+bool CompareLODs(QBT* pQBT)
+{
+	vector<vector<unsigned int> > editedColours;
+	vector<vector<unsigned int> > editedMasks;
+	vector<vector<unsigned int> > editedCoverage;
+	for (int i = 0; i < pQBT->GetNumMatrices(); i++)
+	{
+		QBTMatrix* pMatrix = pQBT->GetMatrix(i);
+		if (pMatrix->m_vpLODs.size() != pQBT->GetNumLODs())
+		{
+			return false;
+		}
+
+		QBTMatrix* pFine = pMatrix;
+		for (unsigned int j = 0; j < pMatrix->m_vpLODs.size(); j++)
+		{
+			QBTMatrix* pLOD = pMatrix->m_vpLODs[j];
+			if (pLOD->m_sizeX != (pFine->m_sizeX + 1) / 2 || pLOD->m_sizeY != (pFine->m_sizeY + 1) / 2 || pLOD->m_sizeZ != (pFine->m_sizeZ + 1) / 2 ||
+			    pLOD->m_lodScale != pFine->m_lodScale * 2)
+			{
+				return false;
+			}
+
+			unsigned int numVoxels = pLOD->m_sizeX * pLOD->m_sizeY * pLOD->m_sizeZ;
+			editedColours.push_back(vector<unsigned int>(pLOD->m_pColour, pLOD->m_pColour + numVoxels));
+			editedMasks.push_back(vector<unsigned int>(pLOD->m_pVisibilityMask, pLOD->m_pVisibilityMask + numVoxels));
+			vector<unsigned int> ambientOcclusion;
+			editedCoverage.push_back(vector<unsigned int>());
+			if (GetFaceCoverage(pLOD, editedCoverage.back(), ambientOcclusion) == false)
+			{
+				return false;
+			}
+			pFine = pLOD;
+		}
+	}
+
+	pQBT->RecreateStaticBuffers();
+
+	unsigned int levelIndex = 0;
+	for (int i = 0; i < pQBT->GetNumMatrices(); i++)
+	{
+		QBTMatrix* pMatrix = pQBT->GetMatrix(i);
+		for (unsigned int j = 0; j < pMatrix->m_vpLODs.size(); j++, levelIndex++)
+		{
+			QBTMatrix* pLOD = pMatrix->m_vpLODs[j];
+			unsigned int numVoxels = pLOD->m_sizeX * pLOD->m_sizeY * pLOD->m_sizeZ;
+			vector<unsigned int> coverage;
+			vector<unsigned int> ambientOcclusion;
+			if (GetFaceCoverage(pLOD, coverage, ambientOcclusion) == false || coverage != editedCoverage[levelIndex] ||
+			    vector<unsigned int>(pLOD->m_pColour, pLOD->m_pColour + numVoxels) != editedColours[levelIndex] ||
+			    vector<unsigned int>(pLOD->m_pVisibilityMask, pLOD->m_pVisibilityMask + numVoxels) != editedMasks[levelIndex])
+			{
+				return false;
+			}
+		}
+	}
+
+	return true;
+}
+
+void RunLODBenchmark(string filename, unsigned int numLODs, QBTLODDownsample downsample, bool crossFade, int frames)
+{
+	BenchmarkClock::time_point setupStart = BenchmarkClock::now();
+	QBT qbt(NULL);
+	qbt.SetMergeFaces(true);
+	qbt.SetNumLODs(numLODs);
+	qbt.SetLODDownsample(downsample);
+	qbt.SetLODCrossFade(crossFade);
+	if (qbt.ReadQBTFile(filename) == false || qbt.GetNumMatrices() == 0)
+	{
+		printf("Failed to load '%s'\n", filename.c_str());
+		return;
+	}
+	qbt.CreateStaticRenderBuffers();
+	double setupTime = GetElapsedMilliseconds(setupStart);
+
+	// The camera stands over the start of the row of matrices and looks down it, so most of them are far away
+	QBTMatrix* pLastMatrix = qbt.GetMatrix(qbt.GetNumMatrices() - 1);
+	float size = (float)pLastMatrix->m_sizeY;
+	vec3 cameraPosition(-size, size * 2.0f, size * 0.5f);
+	mat4 view = lookAt(cameraPosition, cameraPosition + vec3(4.0f, -1.0f, 0.0f), vec3(0.0f, 1.0f, 0.0f));
+	mat4 projection = perspective(45.0f, 1280.0f / 720.0f, 0.01f, 100000.0f);
+	Frustum frustum;
+	frustum.SetFromProjectionView(projection, view);
+
+	BenchmarkClock::time_point frameStart = BenchmarkClock::now();
+	for (int frame = 0; frame < frames; frame++)
+	{
+		qbt.SelectLODs(cameraPosition, projection, 720);
+		qbt.BuildDrawLists(&frustum);
+	}
+	double frameTime = GetElapsedMilliseconds(frameStart) / frames;
+
+	char levels[64] = "-";
+	if (numLODs > 0)
+	{
+		sprintf(levels, "%u/%u/%u/%u", qbt.GetNumLODMatrices(0), qbt.GetNumLODMatrices(1), qbt.GetNumLODMatrices(2), qbt.GetNumLODMatrices(3));
+	}
+	const char* pDownsample = numLODs == 0 ? "-" : downsample == QBTLODDownsample_Majority ? "Majority" : "Average";
+	const char* pCrossFade = numLODs == 0 ? "-" : crossFade ? "yes" : "no";
+	unsigned int drawnTriangles = qbt.GetNumDrawnTriangles();
+
+	// Paint and erase boxes across the matrices, then check the levels they were patched into against a fresh chain
+	char match[8] = "-";
+	if (numLODs > 0)
+	{
+		unsigned int random = 12345;
+		for (int i = 0; i < 32; i++)
+		{
+			random = random * 1664525u + 1013904223u;
+			QBTMatrix* pMatrix = qbt.GetMatrix((random >> 8) % qbt.GetNumMatrices());
+			int position[3];
+			unsigned int sizes[3] = { pMatrix->m_sizeX, pMatrix->m_sizeY, pMatrix->m_sizeZ };
+			for (int axis = 0; axis < 3; axis++)
+			{
+				random = random * 1664525u + 1013904223u;
+				position[axis] = (int)((random >> 8) % sizes[axis]) - 2;
+			}
+
+			if ((i & 1) == 0)
+			{
+				qbt.SetVoxelBox(pMatrix, position[0], position[1], position[2], position[0] + 4, position[1] + 4, position[2] + 4, Colour(1.0f, 0.5f, (i % 256) / 255.0f));
+			}
+			else
+			{
+				qbt.ClearVoxelBox(pMatrix, position[0], position[1], position[2], position[0] + 4, position[1] + 4, position[2] + 4);
+			}
+			qbt.UpdateDirtyChunks();
+		}
+		sprintf(match, "%s", CompareLODs(&qbt) ? "yes" : "NO");
+	}
+
+	printf("%-36s %6u %-9s %5s %10.1f %11.2f %13s %12u %11.1f%% %11.4f %6s\n", GetBaseFilename(filename).c_str(), numLODs, pDownsample, pCrossFade, setupTime,
+	       qbt.GetMeshMemory() / (1024.0 * 1024.0), levels, drawnTriangles, 100.0 * drawnTriangles / std::max((unsigned int)qbt.GetNumTriangles(), 1u), frameTime, match);
+}
+
+// Stage benchmark
+// One matrix of one file loaded and meshed with one combination of the mesher options, averaged over the iterations
+struct StageResult
+{
+	string m_filename;
+	unsigned int m_matrixIndex;
+	string m_matrixName;
+	unsigned int m_sizeX;
+	unsigned int m_sizeY;
+	unsigned int m_sizeZ;
+	QBTMesher m_mesher;
+	bool m_mergeFaces;
+	bool m_innerVoxels;
+	bool m_innerFaces;
+	double m_parseTime;
+	double m_inflateTime;
+	double m_visibilityTime;
+	double m_meshTime;
+	unsigned int m_numVertices;
+	unsigned int m_numTriangles;
+};
+
+const char* GetMesherName(QBTMesher mesher)
+{
+	return mesher == QBTMesher_BinaryGreedy ? "binary" : "default";
+}
+
+// Every combination of merging faces, inner voxels and inner faces, with both meshers. The visibility masks are always
+// recomputed, so that stage is timed as well.
+bool RunStageBenchmark(string filename, int iterations, vector<StageResult>& results)
+{
+	for (unsigned int mesherIndex = 0; mesherIndex < 2; mesherIndex++)
+	{
+		for (unsigned int options = 0; options < 8; options++)
+		{
+			QBTMesher mesher = mesherIndex == 0 ? QBTMesher_Default : QBTMesher_BinaryGreedy;
+			bool mergeFaces = (options & 1) != 0;
+			bool innerVoxels = (options & 2) != 0;
+			bool innerFaces = (options & 4) != 0;
+
+			vector<StageResult> matrixResults;
+			for (int iteration = 0; iteration < iterations; iteration++)
+			{
+				QBT qbt(NULL);
+				qbt.SetLoaderBackend(QBTLoaderBackend_MemoryMapped);
+				qbt.SetRecomputeVisibility(true);
+				qbt.SetMesher(mesher);
+				qbt.SetMergeFaces(mergeFaces);
+				qbt.SetCreateInnerVoxels(innerVoxels);
+				qbt.SetCreateInnerFaces(innerFaces);
+				if (qbt.ReadQBTFile(filename) == false)
+				{
+					printf("Failed to load '%s'\n", filename.c_str());
+					return false;
+				}
+
+				matrixResults.resize(qbt.GetNumMatrices());
+				for (int i = 0; i < qbt.GetNumMatrices(); i++)
+				{
+					QBTMatrix* pMatrix = qbt.GetMatrix(i);
+					BenchmarkClock::time_point meshStart = BenchmarkClock::now();
+					for (unsigned int j = 0; j < pMatrix->m_vChunks.size(); j++)
+					{
+						qbt.CreateMeshData(pMatrix, &pMatrix->m_vChunks[j]);
+					}
+					double meshTime = GetElapsedMilliseconds(meshStart);
+
+					StageResult& result = matrixResults[i];
+					if (iteration == 0)
+					{
+						result.m_filename = GetBaseFilename(filename);
+						result.m_matrixIndex = i;
+						result.m_matrixName = pMatrix->m_name;
+						result.m_sizeX = pMatrix->m_sizeX;
+						result.m_sizeY = pMatrix->m_sizeY;
+						result.m_sizeZ = pMatrix->m_sizeZ;
+						result.m_mesher = mesher;
+						result.m_mergeFaces = mergeFaces;
+						result.m_innerVoxels = innerVoxels;
+						result.m_innerFaces = innerFaces;
+						result.m_parseTime = 0.0;
+						result.m_inflateTime = 0.0;
+						result.m_visibilityTime = 0.0;
+						result.m_meshTime = 0.0;
+						result.m_numVertices = pMatrix->m_numVertices;
+						result.m_numTriangles = pMatrix->m_numTriangles;
+					}
+					result.m_parseTime += pMatrix->m_parseMilliseconds / iterations;
+					result.m_inflateTime += pMatrix->m_inflateMilliseconds / iterations;
+					result.m_visibilityTime += pMatrix->m_visibilityMilliseconds / iterations;
+					result.m_meshTime += meshTime / iterations;
+				}
+			}
+
+			// The whole file on one line, the matrices are in the JSON and CSV results
+			StageResult total = matrixResults.empty() ? StageResult() : matrixResults[0];
+			for (unsigned int i = 1; i < matrixResults.size(); i++)
+			{
+				total.m_parseTime += matrixResults[i].m_parseTime;
+				total.m_inflateTime += matrixResults[i].m_inflateTime;
+				total.m_visibilityTime += matrixResults[i].m_visibilityTime;
+				total.m_meshTime += matrixResults[i].m_meshTime;
+				total.m_numTriangles += matrixResults[i].m_numTriangles;
+			}
+			if (matrixResults.empty() == false)
+			{
+				printf("%-36s %8u %-8s %5s %5s %5s %11.4f %11.4f %11.4f %11.4f %10u\n", total.m_filename.c_str(), (unsigned int)matrixResults.size(),
+				       GetMesherName(mesher), mergeFaces ? "yes" : "no", innerVoxels ? "yes" : "no", innerFaces ? "yes" : "no", total.m_parseTime,
+				       total.m_inflateTime, total.m_visibilityTime, total.m_meshTime, total.m_numTriangles);
+			}
+
+			results.insert(results.end(), matrixResults.begin(), matrixResults.end());
+		}
+	}
+
+	return true;
+}
+
+// Matrix names come from the file, so anything that would break the JSON is escaped
+string EscapeJSON(const string& text)
+{
+	string escaped;
+	for (unsigned int i = 0; i < text.size(); i++)
+	{
+		unsigned char c = (unsigned char)text[i];
+		if (c == '"' || c == '\\')
+		{
+			escaped += '\\';
+			escaped += c;
+		}
+		else if (c < 0x20)
+		{
+			char code[8];
+			sprintf(code, "\\u%04x", c);
+			escaped += code;
+		}
+		else
+		{
+			escaped += c;
+		}
+	}
+	return escaped;
+}
+
+string EscapeCSV(const string& text)
+{
+	string escaped = "\"";
+	for (unsigned int i = 0; i < text.size(); i++)
+	{
+		if (text[i] == '"')
+		{
+			escaped += '"';
+		}
+		escaped += text[i];
+	}
+	return escaped + "\"";
+}
+
+bool WriteStageResultsJSON(string filename, int iterations, const vector<StageResult>& results)
+{
+	FILE* pFile = fopen(filename.c_str(), "w");
+	if (pFile == NULL)
+	{
+		return false;
+	}
+
+	fprintf(pFile, "{\n\"iterations\": %d,\n\"units\": \"milliseconds\",\n\"results\": [", iterations);
+	for (unsigned int i = 0; i < results.size(); i++)
+	{
+		const StageResult& result = results[i];
+		fprintf(pFile, "%s\n{\"file\": \"%s\", \"matrix\": %u, \"name\": \"%s\", \"size\": [%u, %u, %u], \"mesher\": \"%s\", \"mergeFaces\": %s, \"innerVoxels\": %s, "
+		        "\"innerFaces\": %s, \"parse\": %.6f, \"inflate\": %.6f, \"visibility\": %.6f, \"mesh\": %.6f, \"vertices\": %u, \"triangles\": %u}",
+		        i == 0 ? "" : ",", EscapeJSON(result.m_filename).c_str(), result.m_matrixIndex, EscapeJSON(result.m_matrixName).c_str(), result.m_sizeX,
+		        result.m_sizeY, result.m_sizeZ, GetMesherName(result.m_mesher), result.m_mergeFaces ? "true" : "false", result.m_innerVoxels ? "true" : "false",
+		        result.m_innerFaces ? "true" : "false", result.m_parseTime, result.m_inflateTime, result.m_visibilityTime, result.m_meshTime,
+		        result.m_numVertices, result.m_numTriangles);
+	}
+	fprintf(pFile, "\n]\n}\n");
+
+	return fclose(pFile) == 0;
+}
+
+bool WriteStageResultsCSV(string filename, const vector<StageResult>& results)
+{
+	FILE* pFile = fopen(filename.c_str(), "w");
+	if (pFile == NULL)
+	{
+		return false;
+	}
+
+	fprintf(pFile, "file,matrix,name,sizeX,sizeY,sizeZ,mesher,mergeFaces,innerVoxels,innerFaces,parseMs,inflateMs,visibilityMs,meshMs,vertices,triangles\n");
+	for (unsigned int i = 0; i < results.size(); i++)
+	{
+		const StageResult& result = results[i];
+		fprintf(pFile, "%s,%u,%s,%u,%u,%u,%s,%d,%d,%d,%.6f,%.6f,%.6f,%.6f,%u,%u\n", EscapeCSV(result.m_filename).c_str(), result.m_matrixIndex,
+		        EscapeCSV(result.m_matrixName).c_str(), result.m_sizeX, result.m_sizeY, result.m_sizeZ, GetMesherName(result.m_mesher), result.m_mergeFaces,
+		        result.m_innerVoxels, result.m_innerFaces, result.m_parseTime, result.m_inflateTime, result.m_visibilityTime, result.m_meshTime,
+		        result.m_numVertices, result.m_numTriangles);
+	}
+
+	return fclose(pFile) == 0;
+}
+
+// One file name per line, blank lines and lines starting with # are skipped
+bool ReadFileList(string filename, vector<string>& files)
+{
+	FILE* pFile = fopen(filename.c_str(), "r");
+	if (pFile == NULL)
+	{
+		return false;
+	}
+
+	char line[1024];
+	while (fgets(line, sizeof(line), pFile) != NULL)
+	{
+		string entry = line;
+		while (entry.empty() == false && (entry.back() == '\n' || entry.back() == '\r' || entry.back() == ' ' || entry.back() == '\t'))
+		{
+			entry.pop_back();
+		}
+		if (entry.empty() == false && entry[0] != '#')
+		{
+			files.push_back(entry);
+		}
+	}
+	fclose(pFile);
+
+	return true;
+}
+
+// Generator benchmark
+bool ReadWholeFile(string filename, vector<unsigned char>& data)
+{
+	FILE* pFile = fopen(filename.c_str(), "rb");
+	if (pFile == NULL)
+	{
+		return false;
+	}
+
+	data.clear();
+	unsigned char buffer[65536];
+	size_t numRead;
+	while ((numRead = fread(buffer, 1, sizeof(buffer), pFile)) > 0)
+	{
+		data.insert(data.end(), buffer, buffer + numRead);
+	}
+	fclose(pFile);
+
+	return true;
+}
+
+// Loads a generated file back and checks it holds what the generator wrote, the matrices and sizes asked for, the same solid voxels,
+// masks that match the recomputed ones and, when hollow, no voxel that is hidden on every side. The masks are compared a matrix at
+// a time so the largest models only need one extra copy of one matrix.
+bool CheckGeneratedQBT(QBTGenerator* pGenerator, string filename)
+{
+	QBT qbt(NULL);
+	qbt.SetRecomputeVisibility(false);
+	const QBTGeneratorSettings& settings = pGenerator->GetSettings();
+	if (qbt.ReadQBTFile(filename) == false || qbt.GetNumMatrices() != (int)settings.m_numMatrices)
+	{
+		return false;
+	}
+
+	unsigned long long numSolidVoxels = 0;
+	for (int i = 0; i < qbt.GetNumMatrices(); i++)
+	{
+		QBTMatrix* pMatrix = qbt.GetMatrix(i);
+		if (pMatrix->m_sizeX != settings.m_sizeX || pMatrix->m_sizeY != settings.m_sizeY || pMatrix->m_sizeZ != settings.m_sizeZ)
+		{
+			return false;
+		}
+
+		size_t numVoxels = (size_t)pMatrix->m_sizeX * pMatrix->m_sizeY * pMatrix->m_sizeZ;
+		for (size_t j = 0; j < numVoxels; j++)
+		{
+			unsigned int mask = pMatrix->m_pVisibilityMask[j];
+			if (mask != 0)
+			{
+				numSolidVoxels++;
+				if (settings.m_hollow && mask == QBTVisibility_Solid)
+				{
+					return false;
+				}
+			}
+		}
+
+		vector<unsigned int> fileMask(pMatrix->m_pVisibilityMask, pMatrix->m_pVisibilityMask + numVoxels);
+		RecomputeVisibilityMask(pMatrix);
+		if (memcmp(&fileMask[0], pMatrix->m_pVisibilityMask, numVoxels * sizeof(unsigned int)) != 0)
+		{
+			return false;
+		}
+	}
+
+	return numSolidVoxels == pGenerator->GetNumSolidVoxels();
+}
+
+void RunGeneratorBenchmark(QBTGeneratorSettings settings)
+{
+	char filename[64];
+	sprintf(filename, "QubeBenchmark_generated_%u.qbt", settings.m_sizeX);
+	QBTGenerator generator(settings);
+	BenchmarkClock::time_point start = BenchmarkClock::now();
+	if (generator.WriteFile(filename) == false)
+	{
+		printf("Failed to write '%s'\n", filename);
+		return;
+	}
+	double writeTime = GetElapsedMilliseconds(start);
+	long fileSize = GetFileSize(filename);
+	unsigned long long numSolidVoxels = generator.GetNumSolidVoxels();
+	bool match = CheckGeneratedQBT(&generator, filename);
+
+	// Writing again with the same seed has to give the same bytes, and another seed different ones. Skipped for the largest models,
+	// where holding the files to compare them costs more than the check is worth.
+	const char* sameSeed = "-";
+	const char* newSeed = "-";
+	if ((unsigned long long)settings.m_sizeX * settings.m_sizeY * settings.m_sizeZ * settings.m_numMatrices <= 256 * 256 * 256)
+	{
+		vector<unsigned char> firstFile;
+		vector<unsigned char> secondFile;
+		ReadWholeFile(filename, firstFile);
+		QBTGenerator sameGenerator(settings);
+		sameSeed = sameGenerator.WriteFile(filename) && ReadWholeFile(filename, secondFile) && secondFile == firstFile ? "yes" : "NO";
+
+		QBTGeneratorSettings newSettings = settings;
+		newSettings.m_seed++;
+		QBTGenerator newGenerator(newSettings);
+		newSeed = newGenerator.WriteFile(filename) && ReadWholeFile(filename, secondFile) && secondFile != firstFile ? "yes" : "NO";
+	}
+	remove(filename);
+
+	const QBTGeneratorSettings& clamped = generator.GetSettings();
+	double numVoxels = (double)clamped.m_sizeX * clamped.m_sizeY * clamped.m_sizeZ * clamped.m_numMatrices;
+	char size[32];
+	sprintf(size, "%ux%ux%u", clamped.m_sizeX, clamped.m_sizeY, clamped.m_sizeZ);
+	printf("%-8s %-12s %8u %5.2f %6s %7.2f %12.1f %11.1f %8.1f %8.1f %6s %5s %5s\n", QBTGenerator::GetShapeName(clamped.m_shape), size, clamped.m_numMatrices,
+	       clamped.m_fillRatio, clamped.m_hollow ? "yes" : "no", clamped.m_colourEntropy, writeTime, fileSize / 1024.0, numVoxels / (writeTime * 1000.0),
+	       numSolidVoxels * 100.0 / numVoxels, match ? "yes" : "NO", sameSeed, newSeed);
+}
+
+QBTGeneratorSettings GetGeneratorSettings(QBTGeneratorShape shape, unsigned int numMatrices, unsigned int size, float fillRatio, bool hollow, float colourEntropy)
+{
+	QBTGeneratorSettings settings = GetSyntheticSettings(numMatrices, size);
+	settings.m_shape = shape;
+	settings.m_fillRatio = fillRatio;
+	settings.m_hollow = hollow;
+	settings.m_colourEntropy = colourEntropy;
+
+	return settings;
+}
+
+// Size on the command line, either one size for every axis or x, y and z as XxYxZ
+bool ParseGeneratorSize(const char* pArgument, QBTGeneratorSettings& settings)
+{
+	unsigned int sizeX;
+	unsigned int sizeY;
+	unsigned int sizeZ;
+	if (sscanf(pArgument, "%ux%ux%u", &sizeX, &sizeY, &sizeZ) == 3)
+	{
+		settings.m_sizeX = sizeX;
+		settings.m_sizeY = sizeY;
+		settings.m_sizeZ = sizeZ;
+		return true;
+	}
+	if (sscanf(pArgument, "%u", &sizeX) == 1)
+	{
+		settings.m_sizeX = sizeX;
+		settings.m_sizeY = sizeX;
+		settings.m_sizeZ = sizeX;
+		return true;
+	}
+
+	return false;
+}
+
+bool ParseGeneratorShape(string argument, QBTGeneratorSettings& settings)
+{
+	const char* shapeNames[QBTGeneratorShape_NUM] = { "terrain", "noise", "random" };
+	for (int i = 0; i < QBTGeneratorShape_NUM; i++)
+	{
+		if (argument == shapeNames[i])
+		{
+			settings.m_shape = (QBTGeneratorShape)i;
+			return true;
+		}
+	}
+
+	return false;
+}
+
+void PrintUsage()
+{
+	printf("Usage: QubeBenchmark [--stages] [--iterations n] [--json results.json] [--csv results.csv] [--list files.txt] [files.qbt...]\n");
+	printf("       QubeBenchmark --generate model.qbt [--seed n] [--matrices n] [--size n|XxYxZ] [--shape terrain|noise|random] [--fill f]\n");
+	printf("                     [--hollow] [--entropy f] [--noise-scale f] [--octaves n]\n");
+}
+
+int main(int argc, char** argv)
+{
+	vector<string> files;
+	bool stagesOnly = false;
+	int stageIterations = 10;
+	string jsonFilename;
+	string csvFilename;
+	string generateFilename;
+	QBTGeneratorSettings generateSettings;
+	for (int i = 1; i < argc; i++)
+	{
+		string argument = argv[i];
+		if (argument == "--generate" && i + 1 < argc)
+		{
+			generateFilename = argv[++i];
+		}
+		else if (argument == "--seed" && i + 1 < argc)
+		{
+			generateSettings.m_seed = (unsigned int)strtoul(argv[++i], NULL, 10);
+		}
+		else if (argument == "--matrices" && i + 1 < argc)
+		{
+			generateSettings.m_numMatrices = (unsigned int)std::max(atoi(argv[++i]), 1);
+		}
+		else if (argument == "--size" && i + 1 < argc)
+		{
+			if (ParseGeneratorSize(argv[++i], generateSettings) == false)
+			{
+				printf("Can't read the size '%s'\n", argv[i]);
+				return 1;
+			}
+		}
+		else if (argument == "--shape" && i + 1 < argc)
+		{
+			if (ParseGeneratorShape(argv[++i], generateSettings) == false)
+			{
+				printf("Unknown shape '%s'\n", argv[i]);
+				return 1;
+			}
+		}
+		else if (argument == "--fill" && i + 1 < argc)
+		{
+			generateSettings.m_fillRatio = (float)atof(argv[++i]);
+		}
+		else if (argument == "--hollow")
+		{
+			generateSettings.m_hollow = true;
+		}
+		else if (argument == "--entropy" && i + 1 < argc)
+		{
+			generateSettings.m_colourEntropy = (float)atof(argv[++i]);
+		}
+		else if (argument == "--noise-scale" && i + 1 < argc)
+		{
+			generateSettings.m_noiseScale = (float)atof(argv[++i]);
+		}
+		else if (argument == "--octaves" && i + 1 < argc)
+		{
+			generateSettings.m_noiseOctaves = (unsigned int)std::max(atoi(argv[++i]), 1);
+		}
+		else if (argument == "--stages")
+		{
+			stagesOnly = true;
+		}
+		else if (argument == "--iterations" && i + 1 < argc)
+		{
+			stageIterations = std::max(atoi(argv[++i]), 1);
+		}
+		else if (argument == "--json" && i + 1 < argc)
+		{
+			jsonFilename = argv[++i];
+		}
+		else if (argument == "--csv" && i + 1 < argc)
+		{
+			csvFilename = argv[++i];
+		}
+		else if (argument == "--list" && i + 1 < argc)
+		{
+			if (ReadFileList(argv[++i], files) == false)
+			{
+				printf("Can't read the file list '%s'\n", argv[i]);
+				return 1;
+			}
+		}
+		else if (argument.compare(0, 2, "--") == 0)
+		{
+			// Unknown flags, and known ones missing their value, would otherwise be taken for files
+			printf("Unknown argument or missing value '%s'\n", argument.c_str());
+			PrintUsage();
+			return 1;
+		}
+		else
+		{
+			files.push_back(argument);
+		}
+	}
+	if (generateFilename.empty() == false)
+	{
+		QBTGenerator generator(generateSettings);
+		const QBTGeneratorSettings& settings = generator.GetSettings();
+		BenchmarkClock::time_point start = BenchmarkClock::now();
+		if (generator.WriteFile(generateFilename) == false)
+		{
+			printf("Failed to write '%s'\n", generateFilename.c_str());
+			return 1;
+		}
+		printf("Wrote '%s', %s shape with seed %u, %u matrices of %ux%ux%u, %llu solid voxels, %.1f KB in %.1f ms\n", generateFilename.c_str(),
+		       QBTGenerator::GetShapeName(settings.m_shape), settings.m_seed, settings.m_numMatrices, settings.m_sizeX, settings.m_sizeY, settings.m_sizeZ,
+		       generator.GetNumSolidVoxels(), GetFileSize(generateFilename) / 1024.0, GetElapsedMilliseconds(start));
+		return 0;
+	}
+
+	if (files.size() == 0)
+	{
+		files.push_back("media/assets/qbt/ground_tile1.qbt");
+		files.push_back("media/assets/qbt/pikachu.qbt");
+		files.push_back("media/assets/qbt/test_model.qbt");
+		files.push_back("media/assets/qbt/test_model2.qbt");
+		files.push_back("media/assets/qbt/test_model3.qbt");
+		files.push_back("media/assets/qbt/test_model4.qbt");
+		files.push_back("media/assets/qbt/test_model5.qbt");
+	}
+
+	// Each stage of loading and meshing every matrix, with every combination of the mesher options
+	printf("Stage benchmark, time per load of the whole file averaged over %d loads, with the visibility masks recomputed\n", stageIterations);
+	printf("%-36s %8s %-8s %5s %5s %5s %11s %11s %11s %11s %10s\n", "File", "Matrices", "Mesher", "Merge", "InVox", "InFac", "Parse (ms)", "Inflate (ms)",
+	       "Visib. (ms)", "Mesh (ms)", "Triangles");
+	vector<StageResult> stageResults;
+	bool stagesLoaded = true;
+	for (unsigned int i = 0; i < files.size(); i++)
+	{
+		stagesLoaded = RunStageBenchmark(files[i], stageIterations, stageResults) && stagesLoaded;
+	}
+	if (jsonFilename.empty() == false)
+	{
+		printf("%s '%s'\n", WriteStageResultsJSON(jsonFilename, stageIterations, stageResults) ? "Wrote" : "FAILED to write", jsonFilename.c_str());
+	}
+	if (csvFilename.empty() == false)
+	{
+		printf("%s '%s'\n", WriteStageResultsCSV(csvFilename, stageResults) ? "Wrote" : "FAILED to write", csvFilename.c_str());
+	}
+	if (stagesOnly)
+	{
+		return stagesLoaded ? 0 : 1;
+	}
+
+	printf("\nLoader benchmark, average time per load over the best round\n");
+	printf("%-36s %10s %12s %12s %9s %6s\n", "File", "Size (KB)", "FILE* (ms)", "Mapped (ms)", "Speedup", "Match");
+	for (unsigned int i = 0; i < files.size(); i++)
+	{
+		RunLoaderBenchmark(files[i], 500);
+	}
+
+	// Large synthetic models
+	unsigned int syntheticSizes[] = { 64, 128, 256 };
+	unsigned int syntheticMatrices[] = { 16, 4, 1 };
+	for (unsigned int i = 0; i < 3; i++)
+	{
+		char filename[64];
+		sprintf(filename, "QubeBenchmark_synthetic_%u.qbt", syntheticSizes[i]);
+		if (WriteSyntheticQBT(filename, syntheticMatrices[i], syntheticSizes[i]) == false)
+		{
+			printf("Failed to write '%s'\n", filename);
+			continue;
+		}
+
+		RunLoaderBenchmark(filename, 5);
+		remove(filename);
+	}
+
+	// Synthetic model generator, every shape written, loaded back and checked. Fill is the share of the voxels that are solid in
+	// the file, after hollowing, and the seed columns are whether the same seed writes the same bytes and another seed doesn't.
+	printf("\nGenerator benchmark, time to write each model\n");
+	printf("%-8s %-12s %8s %5s %6s %7s %12s %11s %8s %8s %6s %5s %5s\n", "Shape", "Size", "Matrices", "Fill", "Hollow", "Entropy", "Write (ms)",
+	       "Size (KB)", "MVox/s", "Solid %", "Match", "Same", "New");
+	RunGeneratorBenchmark(GetGeneratorSettings(QBTGeneratorShape_Terrain, 1, 128, 0.5f, false, 0.0f));
+	RunGeneratorBenchmark(GetGeneratorSettings(QBTGeneratorShape_Terrain, 1, 128, 0.5f, true, 0.0f));
+	RunGeneratorBenchmark(GetGeneratorSettings(QBTGeneratorShape_Terrain, 8, 64, 0.25f, false, 0.5f));
+	RunGeneratorBenchmark(GetGeneratorSettings(QBTGeneratorShape_Noise, 1, 128, 0.5f, false, 0.0f));
+	RunGeneratorBenchmark(GetGeneratorSettings(QBTGeneratorShape_Noise, 1, 128, 0.3f, true, 1.0f));
+	RunGeneratorBenchmark(GetGeneratorSettings(QBTGeneratorShape_Random, 1, 64, 0.5f, false, 1.0f));
+	RunGeneratorBenchmark(GetGeneratorSettings(QBTGeneratorShape_Random, 1, 64, 0.9f, true, 0.0f));
+	RunGeneratorBenchmark(GetGeneratorSettings(QBTGeneratorShape_Terrain, 1, QBT_GENERATOR_MAX_SIZE, 0.5f, false, 0.1f));
+
+	// Job system, the cost of each job and how a parallel for scales with more threads
+	printf("\nJob system benchmark, %u hardware threads. Empty job is the time to create, run and finish a job that does nothing,\n", thread::hardware_concurrency());
+	printf("parallel is a parallel for over 65536 indices of about a microsecond each, and speedup is against one thread\n");
+	bool jobChecks = CheckJobSystem(0) && CheckJobSystem(1) && CheckJobSystem(3);
+	printf("Job system checks: %s\n", jobChecks ? "passed" : "FAILED");
+	printf("%-8s %16s %14s %10s %6s\n", "Threads", "Empty job (ns)", "Parallel (ms)", "Speedup", "Match");
+	vector<unsigned int> jobThreads;
+	jobThreads.push_back(1);
+	jobThreads.push_back(2);
+	jobThreads.push_back(4);
+	jobThreads.push_back(8);
+	if (find(jobThreads.begin(), jobThreads.end(), thread::hardware_concurrency()) == jobThreads.end() && thread::hardware_concurrency() > 1)
+	{
+		jobThreads.push_back(thread::hardware_concurrency());
+		sort(jobThreads.begin(), jobThreads.end());
+	}
+	vector<unsigned int> expectedJobWork(65536);
+	for (unsigned int i = 0; i < expectedJobWork.size(); i++)
+	{
+		expectedJobWork[i] = GetJobWork(i);
+	}
+	double singleThreadJobTime = 0.0;
+	for (unsigned int i = 0; i < jobThreads.size(); i++)
+	{
+		RunJobSystemBenchmark(jobThreads[i], expectedJobWork, &singleThreadJobTime);
+	}
+
+	// Profiler, checked with the job system it profiles
+	printf("\nProfiler benchmark, the per scope breakdown of loading a model with 64 matrices of 32^3, averaged over %u loads\n", PROFILER_AVERAGE_FRAMES);
+	bool profilerChecks = CheckProfiler();
+	printf("Profiler checks: %s\n", profilerChecks ? "passed" : "FAILED");
+	if (WriteSyntheticQBT("QubeBenchmark_profiler.qbt", 64, 32))
+	{
+		RunProfilerBenchmark("QubeBenchmark_profiler.qbt");
+		remove("QubeBenchmark_profiler.qbt");
+	}
+	else
+	{
+		printf("Failed to write '%s'\n", "QubeBenchmark_profiler.qbt");
+	}
+
+	// Parallel matrix unpacking, on models with many matrices
+	printf("\nParallel load benchmark, %u hardware threads, average time per load\n", thread::hardware_concurrency());
+	printf("%-36s %10s %12s %12s %9s %6s\n", "File", "Size (KB)", "Serial (ms)", "Par. (ms)", "Speedup", "Match");
+	unsigned int parallelSizes[] = { 32, 64, 128 };
+	unsigned int parallelMatrices[] = { 64, 64, 8 };
+	for (unsigned int i = 0; i < 3; i++)
+	{
+		char filename[64];
+		sprintf(filename, "QubeBenchmark_parallel_%ux%u.qbt", parallelMatrices[i], parallelSizes[i]);
+		if (WriteSyntheticQBT(filename, parallelMatrices[i], parallelSizes[i]) == false)
+		{
+			printf("Failed to write '%s'\n", filename);
+			continue;
+		}
+
+		RunParallelLoadBenchmark(filename, 5);
+		remove(filename);
+	}
+
+	// Meshing
+	printf("\nMesher benchmark, average time per mesh of the whole model, against meshing every chunk twice to count and then fill as the two pass mesher did\n");
+	printf("%-36s %-8s %6s %6s %12s %14s %14s %12s %6s\n", "File", "Mesher", "Merge", "AO", "Mesh (ms)", "Two-pass (ms)", "MVoxels/s", "Triangles", "Match");
+	for (unsigned int i = 0; i < files.size(); i++)
+	{
+		RunMesherBenchmark(files[i], 100);
+	}
+	unsigned int mesherSizes[] = { 64, 128, 256 };
+	for (unsigned int i = 0; i < 3; i++)
+	{
+		char filename[64];
+		sprintf(filename, "QubeBenchmark_mesher_%u.qbt", mesherSizes[i]);
+		if (WriteSyntheticQBT(filename, 1, mesherSizes[i]) == false)
+		{
+			printf("Failed to write '%s'\n", filename);
+			continue;
+		}
+
+		RunMesherBenchmark(filename, 5);
+		remove(filename);
+	}
+
+	// Packed vertex format, the mesh memory is also the number of bytes uploaded every time the meshes are rebuilt
+	printf("\nVertex format benchmark, unmerged meshes, vertex memory (indices come from the shared quad index buffer) and mesh time in each format\n");
+	printf("%-36s %-8s %12s %12s %10s %12s %12s %6s\n", "File", "Mesher", "Full (KB)", "Packed (KB)", "Saving", "Full (ms)", "Packed (ms)", "Match");
+	for (unsigned int i = 0; i < files.size(); i++)
+	{
+		RunVertexFormatBenchmark(files[i], 100);
+	}
+	unsigned int vertexFormatSizes[] = { 64, 128, 256 };
+	for (unsigned int i = 0; i < 3; i++)
+	{
+		char filename[64];
+		sprintf(filename, "QubeBenchmark_vertex_format_%u.qbt", vertexFormatSizes[i]);
+		if (WriteSyntheticQBT(filename, 1, vertexFormatSizes[i]) == false)
+		{
+			printf("Failed to write '%s'\n", filename);
+			continue;
+		}
+
+		RunVertexFormatBenchmark(filename, 5);
+		remove(filename);
+	}
+
+	// Voxel editing on a large model
+	printf("\nEdit benchmark, time from an edit until the chunks it touched are remeshed, against remeshing the whole model\n");
+	printf("%-36s %-8s %-8s %6s %12s %12s %8s %12s %6s\n", "File", "Brush", "Mesher", "Merge", "Avg (ms)", "Max (ms)", "Chunks", "Full (ms)", "Match");
+	const char* editFilename = "QubeBenchmark_edit_256.qbt";
+	if (WriteSyntheticQBT(editFilename, 1, 256))
+	{
+		int brushSizes[] = { 1, 8, 32 };
+		QBTMesher editMeshers[] = { QBTMesher_Default, QBTMesher_BinaryGreedy };
+		for (int i = 0; i < 3; i++)
+		{
+			for (int j = 0; j < 2; j++)
+			{
+				for (int merge = 0; merge < 2; merge++)
+				{
+					RunEditBenchmark(editFilename, editMeshers[j], merge == 1, brushSizes[i], 50);
+				}
+			}
+		}
+		remove(editFilename);
+	}
+	else
+	{
+		printf("Failed to write '%s'\n", editFilename);
+	}
+
+	// Draw submission with many matrices
+	printf("\nDraw submission benchmark, CPU time per frame before any GL calls. Camera transforms built for every matrix against once a\n");
+	printf("frame, the time to gather the draw lists and per draw uniforms, the uniform locations looked up by name every frame\n");
+	printf("before and after caching, and the GL calls setting uniforms every frame with loose uniforms and with uniform blocks.\n");
+	printf("Draws are the GL draw calls per frame with a draw for every chunk and with the batched multi-draws\n");
+	printf("%-36s %9s %8s %8s %13s %13s %13s %14s %8s %8s %8s %8s\n", "File", "Matrices", "Draws", "Batched", "Per mat. (ms)", "Once (ms)", "Lists (ms)", "Lists/mat (ns)", "Lookups", "Cached",
+	       "Calls", "Blocks");
+	unsigned int drawMatrices[] = { 64, 256, 1024 };
+	for (unsigned int i = 0; i < 3; i++)
+	{
+		char filename[64];
+		sprintf(filename, "QubeBenchmark_draw_%ux16.qbt", drawMatrices[i]);
+		if (WriteSyntheticQBT(filename, drawMatrices[i], 16) == false)
+		{
+			printf("Failed to write '%s'\n", filename);
+			continue;
+		}
+
+		RunDrawSubmissionBenchmark(filename, 200);
+		remove(filename);
+	}
+
+	// Frustum culling, with the camera seeing part of a long row of matrices
+	printf("\nFrustum culling benchmark, matrices/chunks visible and culled, the time to build the draw lists without and with culling,\n");
+	printf("the draws and the share of triangles left out. Match checks no culled chunk has a vertex inside the clip volume\n");
+	printf("%-36s %12s %12s %11s %11s %8s %8s %10s %6s\n", "File", "Visible", "Culled", "All (ms)", "Culled (ms)", "Draws", "Culled", "Triangles", "Match");
+	unsigned int cullingSizes[] = { 16, 64, 256 };
+	unsigned int cullingMatrices[] = { 1024, 64, 1 };
+	for (unsigned int i = 0; i < 3; i++)
+	{
+		char filename[64];
+		sprintf(filename, "QubeBenchmark_culling_%ux%u.qbt", cullingMatrices[i], cullingSizes[i]);
+		if (WriteSyntheticQBT(filename, cullingMatrices[i], cullingSizes[i]) == false)
+		{
+			printf("Failed to write '%s'\n", filename);
+			continue;
+		}
+
+		RunCullingBenchmark(filename, 200);
+		remove(filename);
+	}
+
+	// Occlusion culling, on terrain seen from just over its hills
+	printf("\nOcclusion culling benchmark, chunks visible after frustum culling alone and with occlusion culling as well, the time to\n");
+	printf("build the draw lists with each, including rasterizing the occluders, and the share of the triangles left after frustum\n");
+	printf("culling that are occluded. Match compares the draw lists with the scalar ones, and Missed counts the occluded chunks that\n");
+	printf("can be seen in a depth buffer of every triangle at 4 times the resolution. The camera looks along the terrain from a valley\n");
+	bool occlusionChecks = true;
+	for (int i = 0; i <= (int)QBTOcclusionBuffer().GetSimdLevel(); i++)
+	{
+		occlusionChecks = occlusionChecks && CheckOcclusionBuffer((QBTSimdLevel)i, 1) && CheckOcclusionBuffer((QBTSimdLevel)i, 4);
+	}
+	printf("Occlusion buffer checks: %s\n", occlusionChecks ? "passed" : "FAILED");
+	printf("%-36s %-8s %8s %10s %10s %10s %12s %12s %10s %6s %7s\n", "File", "SIMD", "Threads", "Occluders", "Frustum", "Visible", "Frustum (ms)", "Occl. (ms)", "Triangles",
+	       "Match", "Missed");
+	unsigned int occlusionSizes[] = { 32, 64, 128 };
+	unsigned int occlusionMatrices[] = { 256, 64, 16 };
+	for (unsigned int i = 0; i < 3; i++)
+	{
+		char filename[64];
+		sprintf(filename, "QubeBenchmark_occlusion_%ux%u.qbt", occlusionMatrices[i], occlusionSizes[i]);
+		if (WriteSyntheticQBT(filename, occlusionMatrices[i], occlusionSizes[i]) == false)
+		{
+			printf("Failed to write '%s'\n", filename);
+			continue;
+		}
+
+		RunOcclusionBenchmark(filename, 50);
+		remove(filename);
+	}
+
+	// Levels of detail, with the camera looking down a long row of matrices
+	printf("\nLevel of detail benchmark, setup is loading and meshing every level, memory is the vertex data of every level, and Levels\n");
+	printf("counts the matrices drawn at each level, full detail first. Triangles are the ones drawn after frustum culling and their\n");
+	printf("share of the full detail model, frame is the CPU time to pick the levels and build the draw lists. Match checks the levels\n");
+	printf("patched after edits against ones built again\n");
+	printf("%-36s %6s %-9s %5s %10s %11s %13s %12s %12s %11s %6s\n", "File", "LODs", "Downsample", "Fade", "Setup (ms)", "Memory (MB)", "Levels", "Triangles",
+	       "Share", "Frame (ms)", "Match");
+	unsigned int lodSizes[] = { 16, 32, 64 };
+	unsigned int lodMatrices[] = { 1024, 256, 64 };
+	for (unsigned int i = 0; i < 3; i++)
+	{
+		char filename[64];
+		sprintf(filename, "QubeBenchmark_lod_%ux%u.qbt", lodMatrices[i], lodSizes[i]);
+		if (WriteSyntheticQBT(filename, lodMatrices[i], lodSizes[i]) == false)
+		{
+			printf("Failed to write '%s'\n", filename);
+			continue;
+		}
+
+		RunLODBenchmark(filename, 0, QBTLODDownsample_Majority, false, 20);
+		RunLODBenchmark(filename, QBT_MAX_LODS, QBTLODDownsample_Majority, false, 20);
+		RunLODBenchmark(filename, QBT_MAX_LODS, QBTLODDownsample_Average, false, 20);
+		RunLODBenchmark(filename, QBT_MAX_LODS, QBTLODDownsample_Majority, true, 20);
+		remove(filename);
+	}
+
+	// Repeated placements of the same tile, as separate models against instances of one model
+	printf("\nInstancing benchmark, a QBT for every tile against one QBT with an instance per tile. Setup is loading and meshing,\n");
+	printf("memory is voxels, meshes and instance data, and frame is the CPU time to move every tile and gather the draws\n");
+	printf("%-36s %9s %12s %11s %8s %11s %12s %11s %8s %11s\n", "File", "Tiles", "Copies (ms)", "Copies (MB)", "Draws", "Frame (ms)",
+	       "Inst. (ms)", "Inst. (MB)", "Draws", "Frame (ms)");
+	unsigned int instancingTiles[] = { 1000, 10000, 50000 };
+	for (unsigned int i = 0; i < 3; i++)
+	{
+		RunInstancingBenchmark("media/assets/qbt/ground_tile1.qbt", instancingTiles[i], 1000, 20);
+	}
+
+	// Visibility mask recomputation
+	printf("\nVisibility benchmark, average time to recompute the masks of the whole model\n");
+	printf("%-36s %-8s %12s %12s %10s %6s %6s\n", "File", "SIMD", "Time (ms)", "MVoxels/s", "GB/s", "Match", "File");
+	for (unsigned int i = 0; i < files.size(); i++)
+	{
+		RunVisibilityBenchmark(files[i], 100);
+	}
+	unsigned int visibilitySizes[] = { 64, 128, 256 };
+	for (unsigned int i = 0; i < 3; i++)
+	{
+		char filename[64];
+		sprintf(filename, "QubeBenchmark_visibility_%u.qbt", visibilitySizes[i]);
+		if (WriteSyntheticQBT(filename, 1, visibilitySizes[i]) == false)
+		{
+			printf("Failed to write '%s'\n", filename);
+			continue;
+		}
+
+		RunVisibilityBenchmark(filename, 10);
+		remove(filename);
+	}
+
+	return 0;
+}
@@ -45,6 +45,9 @@ int main(void)
 
 		/* Render */
 		pQubeGame->Render();
+
+		/* End the profiler frame */
+		pQubeGame->EndProfilerFrame();
 	}
 
 	/* Cleanup */
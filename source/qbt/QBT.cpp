@@ -10,12 +10,17 @@
 // ******************************************************************************
 
 #include "QBT.h"
-#include "../QubeGame.h"
 #include "../zlib/zlib.h"
+#include "../Profiler/Profiler.h"
 
 #include <stdio.h>
 #include <string.h>
 #include <assert.h>
+#include <float.h>
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <thread>
 using namespace std;
 
 #include <glm/glm.hpp>
@@ -23,29 +28,144 @@ using namespace std;
 #include <glm/gtc/type_ptr.hpp>
 using namespace glm;
 
+#ifndef _WIN32
+#define fopen_s(ppFile, filename, mode) ((*(ppFile) = fopen((filename), (mode))) == NULL)
+#endif //_WIN32
+
+// Number of x planes of voxel data that are inflated and unpacked together
+const unsigned int QBT_INFLATE_BLOCK_PLANES = 16;
+
+// Smallest size the mesh arenas grow to, in vertices
+const size_t QBT_MESH_ARENA_MIN_VERTICES = 16384;
+
+// Largest matrix that fits the 10 bit per axis positions of the packed vertex format, a matrix of this size has corners from 0 to 1023
+const unsigned int QBT_PACKED_VERTEX_MAX_SIZE = 1023;
+
+// Largest piece of mesh data uploaded in one go by the async loader, so a single big matrix is spread over several frames
+const size_t QBT_ASYNC_UPLOAD_SLICE_SIZE = 1024 * 1024;
+
 
 QBT::QBT(Renderer* pRenderer)
 {
 	m_pRenderer = pRenderer;
+	m_pJobSystem = NULL;
+
+	// Color map
+	m_numColors = 0;
+	m_pColors = NULL;
+
+	// Loader backend
+	m_loaderBackend = QBTLoaderBackend_MemoryMapped;
+	m_parallelLoading = true;
+	m_recomputeVisibility = true;
+
+	// Async loading
+	m_pAsyncQBT = NULL;
+	m_asyncUploadIndex = 0;
+	m_asyncUploadChunk = 0;
+	m_asyncUploadOffset = 0;
+	m_asyncLoadFinished = false;
+	m_asyncLoadCancelled = false;
+	m_asyncLoadSucceeded = false;
 
 	// Render modes
 	m_wireframeRender = false;
 	m_useLighting = true;
 	m_boundingBox = false;
+	m_batchedRendering = false;
+	m_frustumCulling = true;
+	m_occlusionCulling = false;
+
+	// Level of detail
+	m_numLODs = 0;
+	m_lodDownsample = QBTLODDownsample_Majority;
+	m_lodPixelSize = 2.0f;
+	m_lodCrossFade = true;
+	memset(m_numLODMatrices, 0, sizeof(m_numLODMatrices));
 
 	// Creation optimizations
 	m_createInnerVoxels = false;
 	m_createInnerFaces = false;
 	m_mergeFaces = false;
-
-	// Shaders
-	m_pPositionColorNormalShader = new Shader("media/shaders/PositionColorNormal.vertex", "media/shaders/PositionColorNormal.fragment");
-	m_pNormalDrawingShader = new Shader("media/shaders/NormalDrawing.vertex", "media/shaders/NormalDrawing.fragment", "media/shaders/NormalDrawing.geometry");
+	m_ambientOcclusion = false;
+	m_mesher = QBTMesher_Default;
+	m_vertexFormat = QBTVertexFormat_PositionColorNormal;
+
+	// Editing
+	m_anyDirtyChunks = false;
+
+	// Culling counts
+	m_numVisibleMatrices = 0;
+	m_numCulledMatrices = 0;
+	m_numVisibleChunks = 0;
+	m_numCulledChunks = 0;
+	m_numOccludedMatrices = 0;
+	m_numOccludedChunks = 0;
+
+	// Batched rendering
+	memset(m_batches, 0, sizeof(m_batches));
+	m_batchesDirty = false;
+	m_multiDrawIndirect = false;
+	m_matrixDataBuffer = 0;
+	m_matrixDataTexture = 0;
+	m_indirectBuffer = 0;
+
+	// Instancing
+	m_instanceBuffer = 0;
+	m_instancesDirty = false;
+
+	// Shaders, a QBT without a renderer is headless and never touches OpenGL
+	m_pPositionColorNormalShader = NULL;
+	m_pPackedPositionColorNormalShader = NULL;
+	m_pBatchedPositionColorNormalShader = NULL;
+	m_pBatchedPackedPositionColorNormalShader = NULL;
+	m_pInstancedPositionColorNormalShader = NULL;
+	m_pInstancedPackedPositionColorNormalShader = NULL;
+	m_pNormalDrawingShader = NULL;
+	if (m_pRenderer != NULL)
+	{
+		m_pPositionColorNormalShader = new Shader("media/shaders/PositionColorNormal.vertex", "media/shaders/PositionColorNormal.fragment");
+		m_pPackedPositionColorNormalShader = new Shader("media/shaders/PackedPositionColorNormal.vertex", "media/shaders/PositionColorNormal.fragment");
+		m_pBatchedPositionColorNormalShader = new Shader("media/shaders/BatchedPositionColorNormal.vertex", "media/shaders/PositionColorNormal.fragment");
+		m_pBatchedPackedPositionColorNormalShader = new Shader("media/shaders/BatchedPackedPositionColorNormal.vertex", "media/shaders/PositionColorNormal.fragment");
+		m_pInstancedPositionColorNormalShader = new Shader("media/shaders/InstancedPositionColorNormal.vertex", "media/shaders/PositionColorNormal.fragment");
+		m_pInstancedPackedPositionColorNormalShader = new Shader("media/shaders/InstancedPackedPositionColorNormal.vertex", "media/shaders/PositionColorNormal.fragment");
+		m_pNormalDrawingShader = new Shader("media/shaders/NormalDrawing.vertex", "media/shaders/NormalDrawing.fragment", "media/shaders/NormalDrawing.geometry");
+
+		// The vertex arrays of the chunks point at the instance buffer as soon as they are created, so it exists from the start
+		QBTInstance defaultInstance;
+		defaultInstance.m_transform = mat4();
+		defaultInstance.m_tint = vec4(1.0f, 1.0f, 1.0f, 1.0f);
+		glGenBuffers(1, &m_instanceBuffer);
+		glBindBuffer(GL_ARRAY_BUFFER, m_instanceBuffer);
+		glBufferData(GL_ARRAY_BUFFER, sizeof(QBTInstance), &defaultInstance, GL_DYNAMIC_DRAW);
+		glBindBuffer(GL_ARRAY_BUFFER, 0);
+
+		// Base instances are what carry the matrix index of each indirect draw
+		m_multiDrawIndirect = GLEW_VERSION_4_3 || (GLEW_ARB_multi_draw_indirect && GLEW_ARB_base_instance);
+	}
 }
 
 QBT::~QBT()
 {
+	CancelAsyncLoad();
 	Unload();
+
+	delete m_pPositionColorNormalShader;
+	delete m_pPackedPositionColorNormalShader;
+	delete m_pBatchedPositionColorNormalShader;
+	delete m_pBatchedPackedPositionColorNormalShader;
+	delete m_pInstancedPositionColorNormalShader;
+	delete m_pInstancedPackedPositionColorNormalShader;
+	delete m_pNormalDrawingShader;
+
+	if (m_pRenderer != NULL)
+	{
+		glDeleteTextures(1, &m_matrixDataTexture);
+		glDeleteBuffers(1, &m_matrixDataBuffer);
+		glDeleteBuffers(1, &m_indirectBuffer);
+		glDeleteBuffers(1, &m_instanceBuffer);
+	}
 }
 
 // Unloading
@@ -55,8 +175,11 @@ void QBT::Unload()
 
 	for (unsigned int i = 0; i < m_vpQBTMatrices.size(); i++)
 	{
+		DeleteLODs(m_vpQBTMatrices[i]);
+		delete[] m_vpQBTMatrices[i]->m_name;
 		delete[] m_vpQBTMatrices[i]->m_pColour;
 		delete[] m_vpQBTMatrices[i]->m_pVisibilityMask;
+		DeleteMeshData(m_vpQBTMatrices[i]);
 
 		delete m_vpQBTMatrices[i]->m_pMaterial;
 
@@ -64,20 +187,70 @@ void QBT::Unload()
 		m_vpQBTMatrices[i] = NULL;
 	}
 	m_vpQBTMatrices.clear();
+
+	delete[] m_pColors;
+	m_pColors = NULL;
+	m_numColors = 0;
 }
 
 void QBT::DestroyStaticBuffers()
 {
 	for (unsigned int i = 0; i < m_vpQBTMatrices.size(); i++)
 	{
-		glDeleteBuffers(1, &m_vpQBTMatrices[i]->m_VBO);
-		glDeleteBuffers(1, &m_vpQBTMatrices[i]->m_EBO);
-		glDeleteVertexArrays(1, &m_vpQBTMatrices[i]->m_VAO);
+		DestroyMatrixBuffers(m_vpQBTMatrices[i]);
+		for (unsigned int j = 0; j < m_vpQBTMatrices[i]->m_vpLODs.size(); j++)
+		{
+			DestroyMatrixBuffers(m_vpQBTMatrices[i]->m_vpLODs[j]);
+		}
+	}
+
+	DestroyBatches();
+}
+
+void QBT::DestroyMatrixBuffers(QBTMatrix* pMatrix)
+{
+	for (unsigned int i = 0; i < pMatrix->m_vChunks.size(); i++)
+	{
+		DestroyChunkBuffers(&pMatrix->m_vChunks[i]);
 	}
 }
 
 // Loading
 bool QBT::LoadQBTFile(string filename)
+{
+	if (ReadQBTFile(filename) == false)
+	{
+		return false;
+	}
+
+	CreateStaticRenderBuffers();
+
+	return true;
+}
+
+bool QBT::ReadQBTFile(string filename)
+{
+	PROFILE_SCOPE("QBT::ReadQBTFile");
+
+	bool ok;
+	if (m_loaderBackend == QBTLoaderBackend_MemoryMapped)
+	{
+		ok = ReadQBTFileMapped(filename);
+	}
+	else
+	{
+		ok = ReadQBTFileStream(filename);
+	}
+
+	for (unsigned int i = 0; ok && i < m_vpQBTMatrices.size(); i++)
+	{
+		CreateLODs(m_vpQBTMatrices[i]);
+	}
+
+	return ok;
+}
+
+bool QBT::ReadQBTFileStream(string filename)
 {
 	FILE* pQBTfile = NULL;
 	fopen_s(&pQBTfile, filename.c_str(), "rb");
@@ -120,15 +293,67 @@ bool QBT::LoadQBTFile(string filename)
 
 		fclose(pQBTfile);
 
-		SetVisibilityInformation();
-		CreateStaticRenderBuffers();
-
-		return true;
+		// A matrix that can't be unpacked fails the load, the same as it does for the mapped loader
+		return InflateQueuedMatrices();
 	}
 
 	return false;
 }
 
+bool QBT::ReadQBTFileMapped(string filename)
+{
+	if (m_fileMapping.Open(filename) == false)
+	{
+		return false;
+	}
+
+	int lastindex = (int)filename.find_last_of("/");
+	if (lastindex == -1)
+	{
+		lastindex = (int)filename.find_last_of("\\");
+	}
+	m_filename = filename.substr(lastindex+1);
+
+	QBTMemoryReader reader(m_fileMapping.GetData(), m_fileMapping.GetSize());
+	bool ok = true;
+
+	// Header
+	ok &= reader.Read(&m_magic, 4);
+	ok &= reader.Read(&m_major, 1);
+	ok &= reader.Read(&m_minor, 1);
+	ok &= reader.Read(&m_globalScaleX, sizeof(m_globalScaleX));
+	ok &= reader.Read(&m_globalScaleY, sizeof(m_globalScaleY));
+	ok &= reader.Read(&m_globalScaleZ, sizeof(m_globalScaleZ));
+
+	// Color map, read as a single block rather than a byte at a time
+	ok &= reader.Skip(8) != NULL;
+	ok &= reader.Read(&m_numColors, sizeof(unsigned int));
+	if (ok == false || (size_t)m_numColors * 4 > reader.GetRemaining())
+	{
+		m_numColors = 0;
+		m_fileMapping.Close();
+		return false;
+	}
+	m_pColors = new char[m_numColors * 4];
+	reader.Read(m_pColors, m_numColors * 4);
+
+	// Data tree
+	ok &= reader.Skip(8) != NULL;
+	if (ok == false)
+	{
+		m_fileMapping.Close();
+		return false;
+	}
+
+	ok = LoadNode(reader);
+
+	// The queued matrices point into the mapping, so they must be unpacked before it is closed
+	ok &= InflateQueuedMatrices();
+	m_fileMapping.Close();
+
+	return ok;
+}
+
 bool QBT::LoadNode(FILE* pQBTfile)
 {
 	unsigned int nodeTypeID;
@@ -179,9 +404,14 @@ bool QBT::LoadModel(FILE* pQBTfile)
 
 bool QBT::LoadMatrix(FILE* pQBTfile)
 {
+	PROFILE_SCOPE("QBT::LoadMatrix");
+
+	chrono::steady_clock::time_point parseStart = chrono::steady_clock::now();
 	int ok = 0;
 
 	QBTMatrix* pNewMatrix = new QBTMatrix();
+	pNewMatrix->m_inflateMilliseconds = 0.0f;
+	pNewMatrix->m_visibilityMilliseconds = 0.0f;
 
 	// Name
 	ok = fread(&pNewMatrix->m_nameLength, sizeof(unsigned int), 1, pQBTfile) == 1;
@@ -214,87 +444,10 @@ bool QBT::LoadMatrix(FILE* pQBTfile)
 	pNewMatrix->m_voxelData = new unsigned char[pNewMatrix->m_voxelDataSize];
 	ok = fread(&pNewMatrix->m_voxelData[0], sizeof(unsigned char)*pNewMatrix->m_voxelDataSize, 1, pQBTfile) == 1;
 
-	// DEBUG OUTPUT
-	//printf("Compressed voxel data size is: %lu\n", pNewMatrix->m_voxelDataSize);
-	//printf("Compressed voxel data is: ");
-	//for (unsigned int i = 0; i < pNewMatrix->m_voxelDataSize; i++)
-	//{
-	//	printf("%c", pNewMatrix->m_voxelData[i]);
-	//}
-	//printf("\n");
-
-	pNewMatrix->m_voxelDataSizeDecompressed = (pNewMatrix->m_sizeX * pNewMatrix->m_sizeY * pNewMatrix->m_sizeZ) * 4;
-	pNewMatrix->m_voxelDataDecompressed = new unsigned char[pNewMatrix->m_voxelDataSizeDecompressed];
+	QueueInflate(pNewMatrix, pNewMatrix->m_voxelData, pNewMatrix->m_voxelDataSize);
 
-	// Setup zlib buffers
-	z_stream infstream;
-	infstream.zalloc = Z_NULL;
-	infstream.zfree = Z_NULL;
-	infstream.opaque = Z_NULL;
-	infstream.avail_in = (uInt)pNewMatrix->m_voxelDataSize; // size of input
-	infstream.next_in = (Bytef *)pNewMatrix->m_voxelData; // input char array
-	infstream.avail_out = (uInt)pNewMatrix->m_voxelDataSizeDecompressed; // size of output
-	infstream.next_out = (Bytef *)pNewMatrix->m_voxelDataDecompressed; // output char array
-
-	// Decompression
-	inflateInit(&infstream);
-	inflate(&infstream, Z_NO_FLUSH);
-	inflateEnd(&infstream);
-
-	// DEBUG OUTPUT
-	//printf("Decompressed voxel data size is: %lu\n", pNewMatrix->m_voxelDataSizeDecompressed);
-	//printf("Decompressed voxel data is: ");
-	//for (unsigned int i = 0; i < pNewMatrix->m_voxelDataSizeDecompressed; i++)
-	//{
-	//	printf("%c", pNewMatrix->m_voxelDataDecompressed[i]);
-	//}
-	//printf("\n");
-
-	pNewMatrix->m_pColour = new unsigned int[pNewMatrix->m_sizeX * pNewMatrix->m_sizeY * pNewMatrix->m_sizeZ];
-	pNewMatrix->m_pVisibilityMask = new unsigned int[pNewMatrix->m_sizeX * pNewMatrix->m_sizeY * pNewMatrix->m_sizeZ];
-
-	unsigned int byteCounter = 0;
-	for (unsigned int x = 0; x < pNewMatrix->m_sizeX; x++)
-	{
-		for (unsigned int z = 0; z < pNewMatrix->m_sizeZ; z++)
-		{
-			for (unsigned int y = 0; y < pNewMatrix->m_sizeY; y++)
-			{
-				int r = pNewMatrix->m_voxelDataDecompressed[byteCounter+0];
-				int g = pNewMatrix->m_voxelDataDecompressed[byteCounter+1];
-				int b = pNewMatrix->m_voxelDataDecompressed[byteCounter+2];
-				int mask = pNewMatrix->m_voxelDataDecompressed[byteCounter+3]; // Visibility mask
-				byteCounter += 4;
-
-				unsigned int colour = 0;
-
-				// If mask is 0, this is an invisible voxel, not active
-				if (mask != 0)
-				{
-					// Squish the rgba into a single unsigned int for storage in the matrix structure
-					unsigned int alpha = (int)(mask == 0 ? 0 : 255) << 24;
-					unsigned int blue = (int)(b) << 16;
-					unsigned int green = (int)(g) << 8;
-					unsigned int red = (int)(r);
-
-					colour = red + green + blue + alpha;
-				}
-
-				pNewMatrix->m_pColour[x + pNewMatrix->m_sizeX * (y + pNewMatrix->m_sizeY * z)] = colour;
-				pNewMatrix->m_pVisibilityMask[x + pNewMatrix->m_sizeX * (y + pNewMatrix->m_sizeY * z)] = mask;
-			}
-		}
-	}
-
-	// Material
-	pNewMatrix->m_pMaterial = new Material();
-	pNewMatrix->m_pMaterial->m_ambient = Colour(1.0f, 1.0f, 1.0f);
-	pNewMatrix->m_pMaterial->m_diffuse = Colour(1.0f, 1.0f, 1.0f);
-	pNewMatrix->m_pMaterial->m_specular = Colour(1.0f, 1.0f, 1.0f);
-	pNewMatrix->m_pMaterial->m_emission = Colour(0.0f, 0.0f, 0.0f);
-	pNewMatrix->m_pMaterial->m_shininess = 64.0f;
-
-	m_vpQBTMatrices.push_back(pNewMatrix);
+	AddMatrix(pNewMatrix);
+	pNewMatrix->m_parseMilliseconds = chrono::duration<float, milli>(chrono::steady_clock::now() - parseStart).count();
 
 	return true;
 }
@@ -316,914 +469,987 @@ bool QBT::SkipNode(FILE* pQBTfile)
 	return true;
 }
 
-// Setup
-void QBT::SetVisibilityInformation()
+bool QBT::LoadNode(QBTMemoryReader& reader)
 {
-	for (unsigned int i = 0; i < m_vpQBTMatrices.size(); i++)
+	unsigned int nodeTypeID;
+	unsigned int dataSize;
+	if (reader.Read(&nodeTypeID, sizeof(unsigned int)) == false || reader.Read(&dataSize, sizeof(unsigned int)) == false)
 	{
-		QBTMatrix* pMatrix = m_vpQBTMatrices[i];
+		return false;
+	}
+
+	switch (nodeTypeID)
+	{
+		case 0:
+		{
+			return LoadMatrix(reader);
+		}
+		case 1:
+		{
+			return LoadModel(reader);
+		}
+		case 2:
+		{
+			return LoadCompound(reader);
+		}
+		default:
+		{
+			return reader.Skip(dataSize) != NULL;
+		}
+	}
+}
 
-		pMatrix->m_numVertices = 0;
-		pMatrix->m_numTriangles = 0;
-		pMatrix->m_numIndices = 0;
+bool QBT::LoadModel(QBTMemoryReader& reader)
+{
+	unsigned int childCount;
+	if (reader.Read(&childCount, sizeof(unsigned int)) == false)
+	{
+		return false;
+	}
 
-		if (m_mergeFaces)
+	for (unsigned int i = 0; i < childCount; i++)
+	{
+		if (LoadNode(reader) == false)
 		{
-			int cubeSize = pMatrix->m_sizeX * pMatrix->m_sizeY * pMatrix->m_sizeZ;
-			int *l_merged;
-			l_merged = new int[cubeSize];
+			return false;
+		}
+	}
 
-			for (int i = 0; i < cubeSize; i++)
-			{
-				l_merged[i] = MergedSide_None;
-			}
+	return true;
+}
 
-			unsigned int verticesCounter = 0;
-			unsigned int indicesCounter = 0;
-			for (unsigned int x = 0; x < pMatrix->m_sizeX; x++)
-			{
-				for (unsigned int y = 0; y < pMatrix->m_sizeY; y++)
-				{
-					for (unsigned int z = 0; z < pMatrix->m_sizeZ; z++)
-					{
-						unsigned int colour = pMatrix->m_pColour[x + pMatrix->m_sizeX * (y + pMatrix->m_sizeY * z)];
-						unsigned int mask = pMatrix->m_pVisibilityMask[x + pMatrix->m_sizeX * (y + pMatrix->m_sizeY * z)];
-						unsigned int alpha = (colour & 0xFF000000) >> 24;
-						unsigned int blue = (colour & 0x00FF0000) >> 16;
-						unsigned int green = (colour & 0x0000FF00) >> 8;
-						unsigned int red = (colour & 0x000000FF);
-
-						float r = (float)(red / 255.0f);
-						float g = (float)(green / 255.0f);
-						float b = (float)(blue / 255.0f);
-
-						if (mask == 0)
-						{
-							continue;
-						}
+bool QBT::LoadMatrix(QBTMemoryReader& reader)
+{
+	PROFILE_SCOPE("QBT::LoadMatrix");
 
-						if (mask == 1 && m_createInnerVoxels == false)
-						{
-							continue;
-						}
+	chrono::steady_clock::time_point parseStart = chrono::steady_clock::now();
+	bool ok = true;
 
-						int merged = l_merged[x + pMatrix->m_sizeX * (y + pMatrix->m_sizeY * z)];
+	QBTMatrix* pNewMatrix = new QBTMatrix();
+	pNewMatrix->m_inflateMilliseconds = 0.0f;
+	pNewMatrix->m_visibilityMilliseconds = 0.0f;
 
-						// Back
-						if ((mask & 32) == 32)
-						{
-							if ((merged & MergedSide_Z_Negative) != MergedSide_Z_Negative)
-							{
-								bool stopMerging = false;
-								int increaseX = 0;
-								for (unsigned int x1 = x + 1; x1 < pMatrix->m_sizeX && stopMerging == false; x1++)
-								{
-									unsigned int colour1 = pMatrix->m_pColour[x1 + pMatrix->m_sizeX * (y + pMatrix->m_sizeY * z)];
-									unsigned int mask1 = pMatrix->m_pVisibilityMask[x1 + pMatrix->m_sizeX * (y + pMatrix->m_sizeY * z)];
-									int merged1 = l_merged[x1 + pMatrix->m_sizeX * (y + pMatrix->m_sizeY * z)];
+	// Name
+	ok &= reader.Read(&pNewMatrix->m_nameLength, sizeof(unsigned int));
+	if (ok == false || pNewMatrix->m_nameLength > reader.GetRemaining())
+	{
+		delete pNewMatrix;
+		return false;
+	}
+	pNewMatrix->m_name = new char[pNewMatrix->m_nameLength + 1];
+	reader.Read(&pNewMatrix->m_name[0], pNewMatrix->m_nameLength);
+	pNewMatrix->m_name[pNewMatrix->m_nameLength] = 0;
 
-									if ((merged1 & MergedSide_Z_Negative) == MergedSide_Z_Negative)
-									{
-										stopMerging = true;
-										continue;
-									}
-									if ((mask1 & 32) != 32)
-									{
-										stopMerging = true;
-										continue;
-									}
-									if (colour1 != colour)
-									{
-										stopMerging = true;
-										continue;
-									}
+	// Position
+	ok &= reader.Read(&pNewMatrix->m_positionX, sizeof(int));
+	ok &= reader.Read(&pNewMatrix->m_positionY, sizeof(int));
+	ok &= reader.Read(&pNewMatrix->m_positionZ, sizeof(int));
 
-									increaseX++;
-									l_merged[x1 + pMatrix->m_sizeX * (y + pMatrix->m_sizeY * z)] |= MergedSide_Z_Negative;
-								}
+	// Local scale
+	ok &= reader.Read(&pNewMatrix->m_localScaleX, sizeof(unsigned int));
+	ok &= reader.Read(&pNewMatrix->m_localScaleY, sizeof(unsigned int));
+	ok &= reader.Read(&pNewMatrix->m_localScaleZ, sizeof(unsigned int));
 
-								stopMerging = false;
-								int increaseY = 0;
-								for (unsigned int y1 = y + 1; y1 < pMatrix->m_sizeY && stopMerging == false; y1++)
-								{
-									unsigned int colour1 = pMatrix->m_pColour[x + pMatrix->m_sizeX * (y1 + pMatrix->m_sizeY * z)];
-									unsigned int mask1 = pMatrix->m_pVisibilityMask[x + pMatrix->m_sizeX * (y1 + pMatrix->m_sizeY * z)];
-									int merged1 = l_merged[x + pMatrix->m_sizeX * (y1 + pMatrix->m_sizeY * z)];
+	// Pivot
+	ok &= reader.Read(&pNewMatrix->m_pivotX, sizeof(pNewMatrix->m_pivotX));
+	ok &= reader.Read(&pNewMatrix->m_pivotY, sizeof(pNewMatrix->m_pivotY));
+	ok &= reader.Read(&pNewMatrix->m_pivotZ, sizeof(pNewMatrix->m_pivotZ));
 
-									if ((merged1 & MergedSide_Z_Negative) == MergedSide_Z_Negative)
-									{
-										stopMerging = true;
-										continue;
-									}
-									if ((mask1 & 32) != 32)
-									{
-										stopMerging = true;
-										continue;
-									}
-									if (colour1 != colour)
-									{
-										stopMerging = true;
-										continue;
-									}
+	// Size
+	ok &= reader.Read(&pNewMatrix->m_sizeX, sizeof(unsigned int));
+	ok &= reader.Read(&pNewMatrix->m_sizeY, sizeof(unsigned int));
+	ok &= reader.Read(&pNewMatrix->m_sizeZ, sizeof(unsigned int));
+
+	// Voxel data, inflated straight out of the file mapping without taking a copy
+	ok &= reader.Read(&pNewMatrix->m_voxelDataSize, sizeof(unsigned int));
+	const unsigned char* pCompressedData = ok ? reader.Skip(pNewMatrix->m_voxelDataSize) : NULL;
+	if (pCompressedData == NULL)
+	{
+		delete[] pNewMatrix->m_name;
+		delete pNewMatrix;
+		return false;
+	}
 
-									bool stopMergingX = false;
-									for (int xAdd = 1; xAdd <= increaseX && stopMergingX == false; xAdd++)
-									{
-										unsigned int x1 = x + xAdd;
-
-										unsigned int colour1 = pMatrix->m_pColour[x1 + pMatrix->m_sizeX * (y1 + pMatrix->m_sizeY * z)];
-										unsigned int mask1 = pMatrix->m_pVisibilityMask[x1 + pMatrix->m_sizeX * (y1 + pMatrix->m_sizeY * z)];
-										int merged1 = l_merged[x1 + pMatrix->m_sizeX * (y1 + pMatrix->m_sizeY * z)];
-
-										if ((merged1 & MergedSide_Z_Negative) == MergedSide_Z_Negative)
-										{
-											stopMergingX = true;
-											continue;
-										}
-										if ((mask1 & 32) != 32)
-										{
-											stopMergingX = true;
-											continue;
-										}
-										if (colour1 != colour)
-										{
-											stopMergingX = true;
-											continue;
-										}
-									}
+	QueueInflate(pNewMatrix, pCompressedData, pNewMatrix->m_voxelDataSize);
 
-									if (stopMergingX == true)
-									{
-										stopMerging = true;
-										continue;
-									}
+	AddMatrix(pNewMatrix);
+	pNewMatrix->m_parseMilliseconds = chrono::duration<float, milli>(chrono::steady_clock::now() - parseStart).count();
 
-									increaseY++;
-									l_merged[x + pMatrix->m_sizeX * (y1 + pMatrix->m_sizeY * z)] |= MergedSide_Z_Negative;
+	return true;
+}
 
-									for (int xAdd = 1; xAdd <= increaseX; xAdd++)
-									{
-										unsigned int x1 = x + xAdd;
-										l_merged[x1 + pMatrix->m_sizeX * (y1 + pMatrix->m_sizeY * z)] |= MergedSide_Z_Negative;
-									}
-								}
+bool QBT::LoadCompound(QBTMemoryReader& /*reader*/)
+{
+	// Compounds are not supported atm...
+	return true;
+}
 
-								pMatrix->m_numVertices += 4;
-								pMatrix->m_numTriangles += 2;
-							}
-						}
+bool QBT::SkipNode(QBTMemoryReader& reader)
+{
+	unsigned int dataSize;
+	if (reader.Read(&dataSize, sizeof(unsigned int)) == false)
+	{
+		return false;
+	}
 
-						// Front
-						if ((mask & 64) == 64)
-						{
-							if ((merged & MergedSide_Z_Positive) != MergedSide_Z_Positive)
-							{
-								bool stopMerging = false;
-								int increaseX = 0;
-								for (unsigned int x1 = x + 1; x1 < pMatrix->m_sizeX && stopMerging == false; x1++)
-								{
-									unsigned int colour1 = pMatrix->m_pColour[x1 + pMatrix->m_sizeX * (y + pMatrix->m_sizeY * z)];
-									unsigned int mask1 = pMatrix->m_pVisibilityMask[x1 + pMatrix->m_sizeX * (y + pMatrix->m_sizeY * z)];
-									int merged1 = l_merged[x1 + pMatrix->m_sizeX * (y + pMatrix->m_sizeY * z)];
+	return reader.Skip(dataSize) != NULL;
+}
 
-									if ((merged1 & MergedSide_Z_Positive) == MergedSide_Z_Positive)
-									{
-										stopMerging = true;
-										continue;
-									}
-									if ((mask1 & 64) != 64)
-									{
-										stopMerging = true;
-										continue;
-									}
-									if (colour1 != colour)
-									{
-										stopMerging = true;
-										continue;
-									}
+void QBT::QueueInflate(QBTMatrix* pMatrix, const unsigned char* pCompressedData, unsigned int compressedSize)
+{
+	QBTInflateJob job;
+	job.m_pMatrix = pMatrix;
+	job.m_pCompressedData = pCompressedData;
+	job.m_compressedSize = compressedSize;
+	m_vInflateJobs.push_back(job);
+}
 
-									increaseX++;
-									l_merged[x1 + pMatrix->m_sizeX * (y + pMatrix->m_sizeY * z)] |= MergedSide_Z_Positive;
-								}
+bool QBT::InflateQueuedMatrices()
+{
+	unsigned int numJobs = (unsigned int)m_vInflateJobs.size();
+	bool parallel = m_parallelLoading && m_pJobSystem != NULL && m_pJobSystem->GetNumWorkers() > 0 && numJobs > 1;
 
-								stopMerging = false;
-								int increaseY = 0;
-								for (unsigned int y1 = y + 1; y1 < pMatrix->m_sizeY && stopMerging == false; y1++)
-								{
-									unsigned int colour1 = pMatrix->m_pColour[x + pMatrix->m_sizeX * (y1 + pMatrix->m_sizeY * z)];
-									unsigned int mask1 = pMatrix->m_pVisibilityMask[x + pMatrix->m_sizeX * (y1 + pMatrix->m_sizeY * z)];
-									int merged1 = l_merged[x + pMatrix->m_sizeX * (y1 + pMatrix->m_sizeY * z)];
+	if (parallel)
+	{
+		// Largest matrices first, so a big matrix doesn't get picked up last and leave the other workers idle
+		stable_sort(m_vInflateJobs.begin(), m_vInflateJobs.end(), [](const QBTInflateJob& lhs, const QBTInflateJob& rhs)
+		{
+			return (unsigned long long)lhs.m_pMatrix->m_sizeX * lhs.m_pMatrix->m_sizeY * lhs.m_pMatrix->m_sizeZ >
+			       (unsigned long long)rhs.m_pMatrix->m_sizeX * rhs.m_pMatrix->m_sizeY * rhs.m_pMatrix->m_sizeZ;
+		});
+	}
 
-									if ((merged1 & MergedSide_Z_Positive) == MergedSide_Z_Positive)
-									{
-										stopMerging = true;
-										continue;
-									}
-									if ((mask1 & 64) != 64)
-									{
-										stopMerging = true;
-										continue;
-									}
-									if (colour1 != colour)
-									{
-										stopMerging = true;
-										continue;
-									}
+	// Every matrix is unpacked into its own arrays, so the jobs only share the result
+	atomic<bool> allInflated(true);
+	auto inflateJobs = [&](unsigned int start, unsigned int end)
+	{
+		for (unsigned int jobIndex = start; jobIndex < end; jobIndex++)
+		{
+			QBTInflateJob& job = m_vInflateJobs[jobIndex];
+			if (InflateMatrix(job.m_pMatrix, job.m_pCompressedData, job.m_compressedSize) == false)
+			{
+				allInflated = false;
+			}
+		}
+	};
 
-									bool stopMergingX = false;
-									for (int xAdd = 1; xAdd <= increaseX && stopMergingX == false; xAdd++)
-									{
-										unsigned int x1 = x + xAdd;
-
-										unsigned int colour1 = pMatrix->m_pColour[x1 + pMatrix->m_sizeX * (y1 + pMatrix->m_sizeY * z)];
-										unsigned int mask1 = pMatrix->m_pVisibilityMask[x1 + pMatrix->m_sizeX * (y1 + pMatrix->m_sizeY * z)];
-										int merged1 = l_merged[x1 + pMatrix->m_sizeX * (y1 + pMatrix->m_sizeY * z)];
-
-										if ((merged1 & MergedSide_Z_Positive) == MergedSide_Z_Positive)
-										{
-											stopMergingX = true;
-											continue;
-										}
-										if ((mask1 & 64) != 64)
-										{
-											stopMergingX = true;
-											continue;
-										}
-										if (colour1 != colour)
-										{
-											stopMergingX = true;
-											continue;
-										}
-									}
+	if (parallel)
+	{
+		m_pJobSystem->ParallelFor(numJobs, 1, inflateJobs);
+	}
+	else
+	{
+		inflateJobs(0, numJobs);
+	}
 
-									if (stopMergingX == true)
-									{
-										stopMerging = true;
-										continue;
-									}
+	// The compressed copies read by the FILE* loader are no longer needed once the matrices are unpacked
+	for (unsigned int i = 0; i < numJobs; i++)
+	{
+		delete[] m_vInflateJobs[i].m_pMatrix->m_voxelData;
+		m_vInflateJobs[i].m_pMatrix->m_voxelData = NULL;
+	}
+	m_vInflateJobs.clear();
 
-									increaseY++;
-									l_merged[x + pMatrix->m_sizeX * (y1 + pMatrix->m_sizeY * z)] |= MergedSide_Z_Positive;
+	return allInflated;
+}
 
-									for (int xAdd = 1; xAdd <= increaseX; xAdd++)
-									{
-										unsigned int x1 = x + xAdd;
-										l_merged[x1 + pMatrix->m_sizeX * (y1 + pMatrix->m_sizeY * z)] |= MergedSide_Z_Positive;
-									}
-								}
+bool QBT::InflateMatrix(QBTMatrix* pMatrix, const unsigned char* pCompressedData, unsigned int compressedSize)
+{
+	PROFILE_SCOPE("QBT::InflateMatrix");
 
-								pMatrix->m_numVertices += 4;
-								pMatrix->m_numTriangles += 2;
-							}
-						}
+	chrono::steady_clock::time_point inflateStart = chrono::steady_clock::now();
+	unsigned int numVoxels = pMatrix->m_sizeX * pMatrix->m_sizeY * pMatrix->m_sizeZ;
 
-						// Left
-						if ((mask & 4) == 4)
-						{
-							if ((merged & MergedSide_X_Negative) != MergedSide_X_Negative)
-							{
-								bool stopMerging = false;
-								int increaseZ = 0;
-								for (unsigned int z1 = z + 1; z1 < pMatrix->m_sizeZ && stopMerging == false; z1++)
-								{
-									unsigned int colour1 = pMatrix->m_pColour[x + pMatrix->m_sizeX * (y + pMatrix->m_sizeY * z1)];
-									unsigned int mask1 = pMatrix->m_pVisibilityMask[x + pMatrix->m_sizeX * (y + pMatrix->m_sizeY * z1)];
-									int merged1 = l_merged[x + pMatrix->m_sizeX * (y + pMatrix->m_sizeY * z1)];
+	pMatrix->m_voxelDataSizeDecompressed = numVoxels * 4;
+	pMatrix->m_voxelDataDecompressed = NULL;
 
-									if ((merged1 & MergedSide_X_Negative) == MergedSide_X_Negative)
-									{
-										stopMerging = true;
-										continue;
-									}
-									if ((mask1 & 4) != 4)
-									{
-										stopMerging = true;
-										continue;
-									}
-									if (colour1 != colour)
-									{
-										stopMerging = true;
-										continue;
-									}
-
-									increaseZ++;
-									l_merged[x + pMatrix->m_sizeX * (y + pMatrix->m_sizeY * z1)] |= MergedSide_X_Negative;
-								}
+	pMatrix->m_pColour = new unsigned int[numVoxels];
+	pMatrix->m_pVisibilityMask = new unsigned int[numVoxels];
+	memset(pMatrix->m_pColour, 0, sizeof(unsigned int) * numVoxels);
+	memset(pMatrix->m_pVisibilityMask, 0, sizeof(unsigned int) * numVoxels);
 
-								stopMerging = false;
-								int increaseY = 0;
-								for (unsigned int y1 = y + 1; y1 < pMatrix->m_sizeY && stopMerging == false; y1++)
-								{
-									unsigned int colour1 = pMatrix->m_pColour[x + pMatrix->m_sizeX * (y1 + pMatrix->m_sizeY * z)];
-									unsigned int mask1 = pMatrix->m_pVisibilityMask[x + pMatrix->m_sizeX * (y1 + pMatrix->m_sizeY * z)];
-									int merged1 = l_merged[x + pMatrix->m_sizeX * (y1 + pMatrix->m_sizeY * z)];
+	if (numVoxels == 0)
+	{
+		return true;
+	}
 
-									if ((merged1 & MergedSide_X_Negative) == MergedSide_X_Negative)
-									{
-										stopMerging = true;
-										continue;
-									}
-									if ((mask1 & 4) != 4)
-									{
-										stopMerging = true;
-										continue;
-									}
-									if (colour1 != colour)
-									{
-										stopMerging = true;
-										continue;
-									}
+	// Setup zlib buffers
+	z_stream infstream;
+	infstream.zalloc = Z_NULL;
+	infstream.zfree = Z_NULL;
+	infstream.opaque = Z_NULL;
+	infstream.avail_in = (uInt)compressedSize; // size of input
+	infstream.next_in = (Bytef *)pCompressedData; // input char array
 
-									bool stopMergingZ = false;
-									for (int zAdd = 1; zAdd <= increaseZ && stopMergingZ == false; zAdd++)
-									{
-										unsigned int z1 = z + zAdd;
-
-										unsigned int colour1 = pMatrix->m_pColour[x + pMatrix->m_sizeX * (y1 + pMatrix->m_sizeY * z1)];
-										unsigned int mask1 = pMatrix->m_pVisibilityMask[x + pMatrix->m_sizeX * (y1 + pMatrix->m_sizeY * z1)];
-										int merged1 = l_merged[x + pMatrix->m_sizeX * (y1 + pMatrix->m_sizeY * z1)];
-
-										if ((merged1 & MergedSide_X_Negative) == MergedSide_X_Negative)
-										{
-											stopMergingZ = true;
-											continue;
-										}
-										if ((mask1 & 4) != 4)
-										{
-											stopMergingZ = true;
-											continue;
-										}
-										if (colour1 != colour)
-										{
-											stopMergingZ = true;
-											continue;
-										}
-									}
+	if (inflateInit(&infstream) != Z_OK)
+	{
+		return false;
+	}
 
-									if (stopMergingZ == true)
-									{
-										stopMerging = true;
-										continue;
-									}
+	// Voxels are stored with x outermost, then z, then y innermost, which is the transpose of the x innermost matrix
+	// layout. Inflate a block of x planes at a time into scratch memory, so that unpacking writes whole runs of
+	// consecutive x values instead of scattering single voxels a full row apart.
+	unsigned int planeVoxels = pMatrix->m_sizeY * pMatrix->m_sizeZ;
+	unsigned int maxBlockPlanes = pMatrix->m_sizeX < QBT_INFLATE_BLOCK_PLANES ? pMatrix->m_sizeX : QBT_INFLATE_BLOCK_PLANES;
+	vector<unsigned char> inflateBuffer((size_t)maxBlockPlanes * planeVoxels * 4);
 
-									increaseY++;
-									l_merged[x + pMatrix->m_sizeX * (y1 + pMatrix->m_sizeY * z)] |= MergedSide_X_Negative;
+	bool ok = true;
+	for (unsigned int x = 0; x < pMatrix->m_sizeX && ok; x += maxBlockPlanes)
+	{
+		unsigned int blockPlanes = (pMatrix->m_sizeX - x) < maxBlockPlanes ? (pMatrix->m_sizeX - x) : maxBlockPlanes;
+		infstream.next_out = (Bytef *)&inflateBuffer[0]; // output char array
+		infstream.avail_out = (uInt)(blockPlanes * planeVoxels * 4); // size of output
 
-									for (int zAdd = 1; zAdd <= increaseZ; zAdd++)
-									{
-										unsigned int z1 = z + zAdd;
-										l_merged[x + pMatrix->m_sizeX * (y1 + pMatrix->m_sizeY * z1)] |= MergedSide_X_Negative;
-									}
-								}
+		// Decompression
+		int result = Z_OK;
+		while (infstream.avail_out > 0 && result == Z_OK)
+		{
+			result = inflate(&infstream, Z_NO_FLUSH);
+		}
+		if (infstream.avail_out > 0)
+		{
+			ok = false;
+			break;
+		}
 
-								pMatrix->m_numVertices += 4;
-								pMatrix->m_numTriangles += 2;
-							}
-						}
+		for (unsigned int z = 0; z < pMatrix->m_sizeZ; z++)
+		{
+			for (unsigned int y = 0; y < pMatrix->m_sizeY; y++)
+			{
+				unsigned int voxelIndex = x + pMatrix->m_sizeX * (y + pMatrix->m_sizeY * z);
+				const unsigned char* pSource = &inflateBuffer[(z * pMatrix->m_sizeY + y) * 4];
 
-						// Right
-						if ((mask & 2) == 2)
-						{
-							if ((merged & MergedSide_X_Positive) != MergedSide_X_Positive)
-							{
-								bool stopMerging = false;
-								int increaseZ = 0;
-								for (unsigned int z1 = z + 1; z1 < pMatrix->m_sizeZ && stopMerging == false; z1++)
-								{
-									unsigned int colour1 = pMatrix->m_pColour[x + pMatrix->m_sizeX * (y + pMatrix->m_sizeY * z1)];
-									unsigned int mask1 = pMatrix->m_pVisibilityMask[x + pMatrix->m_sizeX * (y + pMatrix->m_sizeY * z1)];
-									int merged1 = l_merged[x + pMatrix->m_sizeX * (y + pMatrix->m_sizeY * z1)];
+				for (unsigned int i = 0; i < blockPlanes; i++)
+				{
+					int r = pSource[0];
+					int g = pSource[1];
+					int b = pSource[2];
+					int mask = pSource[3]; // Visibility mask
+					pSource += planeVoxels * 4;
 
-									if ((merged1 & MergedSide_X_Positive) == MergedSide_X_Positive)
-									{
-										stopMerging = true;
-										continue;
-									}
-									if ((mask1 & 2) != 2)
-									{
-										stopMerging = true;
-										continue;
-									}
-									if (colour1 != colour)
-									{
-										stopMerging = true;
-										continue;
-									}
+					unsigned int colour = 0;
 
-									increaseZ++;
-									l_merged[x + pMatrix->m_sizeX * (y + pMatrix->m_sizeY * z1)] |= MergedSide_X_Positive;
-								}
+					// If mask is 0, this is an invisible voxel, not active
+					if (mask != 0)
+					{
+						// Squish the rgba into a single unsigned int for storage in the matrix structure
+						unsigned int alpha = (int)(mask == 0 ? 0 : 255) << 24;
+						unsigned int blue = (int)(b) << 16;
+						unsigned int green = (int)(g) << 8;
+						unsigned int red = (int)(r);
 
-								stopMerging = false;
-								int increaseY = 0;
-								for (unsigned int y1 = y + 1; y1 < pMatrix->m_sizeY && stopMerging == false; y1++)
-								{
-									unsigned int colour1 = pMatrix->m_pColour[x + pMatrix->m_sizeX * (y1 + pMatrix->m_sizeY * z)];
-									unsigned int mask1 = pMatrix->m_pVisibilityMask[x + pMatrix->m_sizeX * (y1 + pMatrix->m_sizeY * z)];
-									int merged1 = l_merged[x + pMatrix->m_sizeX * (y1 + pMatrix->m_sizeY * z)];
+						colour = red + green + blue + alpha;
+					}
 
-									if ((merged1 & MergedSide_X_Positive) == MergedSide_X_Positive)
-									{
-										stopMerging = true;
-										continue;
-									}
-									if ((mask1 & 2) != 2)
-									{
-										stopMerging = true;
-										continue;
-									}
-									if (colour1 != colour)
-									{
-										stopMerging = true;
-										continue;
-									}
+					pMatrix->m_pColour[voxelIndex + i] = colour;
+					pMatrix->m_pVisibilityMask[voxelIndex + i] = mask;
+				}
+			}
+		}
+	}
 
-									bool stopMergingZ = false;
-									for (int zAdd = 1; zAdd <= increaseZ && stopMergingZ == false; zAdd++)
-									{
-										unsigned int z1 = z + zAdd;
-
-										unsigned int colour1 = pMatrix->m_pColour[x + pMatrix->m_sizeX * (y1 + pMatrix->m_sizeY * z1)];
-										unsigned int mask1 = pMatrix->m_pVisibilityMask[x + pMatrix->m_sizeX * (y1 + pMatrix->m_sizeY * z1)];
-										int merged1 = l_merged[x + pMatrix->m_sizeX * (y1 + pMatrix->m_sizeY * z1)];
-
-										if ((merged1 & MergedSide_X_Positive) == MergedSide_X_Positive)
-										{
-											stopMergingZ = true;
-											continue;
-										}
-										if ((mask1 & 2) != 2)
-										{
-											stopMergingZ = true;
-											continue;
-										}
-										if (colour1 != colour)
-										{
-											stopMergingZ = true;
-											continue;
-										}
-									}
+	inflateEnd(&infstream);
+	chrono::steady_clock::time_point inflatedTime = chrono::steady_clock::now();
+	pMatrix->m_inflateMilliseconds = chrono::duration<float, milli>(inflatedTime - inflateStart).count();
 
-									if (stopMergingZ == true)
-									{
-										stopMerging = true;
-										continue;
-									}
+	// Files exported by other tools can have stale or all ones masks
+	if (ok && m_recomputeVisibility)
+	{
+		RecomputeVisibilityMask(pMatrix);
+		pMatrix->m_visibilityMilliseconds = chrono::duration<float, milli>(chrono::steady_clock::now() - inflatedTime).count();
+	}
 
-									increaseY++;
-									l_merged[x + pMatrix->m_sizeX * (y1 + pMatrix->m_sizeY * z)] |= MergedSide_X_Positive;
+	return ok;
+}
 
-									for (int zAdd = 1; zAdd <= increaseZ; zAdd++)
-									{
-										unsigned int z1 = z + zAdd;
-										l_merged[x + pMatrix->m_sizeX * (y1 + pMatrix->m_sizeY * z1)] |= MergedSide_X_Positive;
-									}
-								}
+void QBT::AddMatrix(QBTMatrix* pMatrix)
+{
+	CreateMatrixChunks(pMatrix);
+	pMatrix->m_lodScale = 1;
 
-								pMatrix->m_numVertices += 4;
-								pMatrix->m_numTriangles += 2;
-							}
-						}
+	// Material
+	pMatrix->m_pMaterial = new Material();
+	pMatrix->m_pMaterial->m_ambient = Colour(1.0f, 1.0f, 1.0f);
+	pMatrix->m_pMaterial->m_diffuse = Colour(1.0f, 1.0f, 1.0f);
+	pMatrix->m_pMaterial->m_specular = Colour(1.0f, 1.0f, 1.0f);
+	pMatrix->m_pMaterial->m_emission = Colour(0.0f, 0.0f, 0.0f);
+	pMatrix->m_pMaterial->m_shininess = 64.0f;
+
+	m_vpQBTMatrices.push_back(pMatrix);
+}
 
-						// Top
-						if ((mask & 8) == 8)
-						{
-							if ((merged & MergedSide_Y_Positive) != MergedSide_Y_Positive)
-							{
-								bool stopMerging = false;
-								int increaseZ = 0;
-								for (unsigned int z1 = z + 1; z1 < pMatrix->m_sizeZ && stopMerging == false; z1++)
-								{
-									unsigned int colour1 = pMatrix->m_pColour[x + pMatrix->m_sizeX * (y + pMatrix->m_sizeY * z1)];
-									unsigned int mask1 = pMatrix->m_pVisibilityMask[x + pMatrix->m_sizeX * (y + pMatrix->m_sizeY * z1)];
-									int merged1 = l_merged[x + pMatrix->m_sizeX * (y + pMatrix->m_sizeY * z1)];
+void QBT::CreateMatrixChunks(QBTMatrix* pMatrix)
+{
+	pMatrix->m_numChunksX = (pMatrix->m_sizeX + QBT_CHUNK_SIZE - 1) / QBT_CHUNK_SIZE;
+	pMatrix->m_numChunksY = (pMatrix->m_sizeY + QBT_CHUNK_SIZE - 1) / QBT_CHUNK_SIZE;
+	pMatrix->m_numChunksZ = (pMatrix->m_sizeZ + QBT_CHUNK_SIZE - 1) / QBT_CHUNK_SIZE;
 
-									if ((merged1 & MergedSide_Y_Positive) == MergedSide_Y_Positive)
-									{
-										stopMerging = true;
-										continue;
-									}
-									if ((mask1 & 8) != 8)
-									{
-										stopMerging = true;
-										continue;
-									}
-									if (colour1 != colour)
-									{
-										stopMerging = true;
-										continue;
-									}
+	// Value initialized, which zeroes every field and leaves the occluders empty
+	QBTChunk emptyChunk = QBTChunk();
+	emptyChunk.m_dirty = true;
+	pMatrix->m_vChunks.assign(pMatrix->m_numChunksX * pMatrix->m_numChunksY * pMatrix->m_numChunksZ, emptyChunk);
 
-									increaseZ++;
-									l_merged[x + pMatrix->m_sizeX * (y + pMatrix->m_sizeY * z1)] |= MergedSide_Y_Positive;
-								}
+	for (unsigned int z = 0; z < pMatrix->m_numChunksZ; z++)
+	{
+		for (unsigned int y = 0; y < pMatrix->m_numChunksY; y++)
+		{
+			for (unsigned int x = 0; x < pMatrix->m_numChunksX; x++)
+			{
+				QBTChunk* pChunk = &pMatrix->m_vChunks[x + pMatrix->m_numChunksX * (y + pMatrix->m_numChunksY * z)];
+				pChunk->m_minX = x * QBT_CHUNK_SIZE;
+				pChunk->m_minY = y * QBT_CHUNK_SIZE;
+				pChunk->m_minZ = z * QBT_CHUNK_SIZE;
+				pChunk->m_maxX = std::min(pChunk->m_minX + QBT_CHUNK_SIZE, pMatrix->m_sizeX);
+				pChunk->m_maxY = std::min(pChunk->m_minY + QBT_CHUNK_SIZE, pMatrix->m_sizeY);
+				pChunk->m_maxZ = std::min(pChunk->m_minZ + QBT_CHUNK_SIZE, pMatrix->m_sizeZ);
+			}
+		}
+	}
+}
 
-								stopMerging = false;
-								int increaseX = 0;
-								for (unsigned int x1 = x + 1; x1 < pMatrix->m_sizeX && stopMerging == false; x1++)
-								{
-									unsigned int colour1 = pMatrix->m_pColour[x1 + pMatrix->m_sizeX * (y + pMatrix->m_sizeY * z)];
-									unsigned int mask1 = pMatrix->m_pVisibilityMask[x1 + pMatrix->m_sizeX * (y + pMatrix->m_sizeY * z)];
-									int merged1 = l_merged[x1 + pMatrix->m_sizeX * (y + pMatrix->m_sizeY * z)];
+// Builds the chain of levels of detail of the matrix, replacing any chain it already had. Each level is downsampled from the one
+// before it and rounds its size up, so the last voxel along an odd sized axis covers the edge of the level before it.
+void QBT::CreateLODs(QBTMatrix* pMatrix)
+{
+	DeleteLODs(pMatrix);
+	pMatrix->m_lodLevel = 0;
+	pMatrix->m_lodFade = 0.0f;
+	if (pMatrix->m_pColour == NULL)
+	{
+		return;
+	}
 
-									if ((merged1 & MergedSide_Y_Positive) == MergedSide_Y_Positive)
-									{
-										stopMerging = true;
-										continue;
-									}
-									if ((mask1 & 8) != 8)
-									{
-										stopMerging = true;
-										continue;
-									}
-									if (colour1 != colour)
-									{
-										stopMerging = true;
-										continue;
-									}
+	QBTMatrix* pFine = pMatrix;
+	for (unsigned int i = 0; i < std::min(m_numLODs, QBT_MAX_LODS); i++)
+	{
+		QBTMatrix* pLOD = new QBTMatrix();
+		pLOD->m_positionX = pMatrix->m_positionX;
+		pLOD->m_positionY = pMatrix->m_positionY;
+		pLOD->m_positionZ = pMatrix->m_positionZ;
+		pLOD->m_sizeX = (pFine->m_sizeX + 1) / 2;
+		pLOD->m_sizeY = (pFine->m_sizeY + 1) / 2;
+		pLOD->m_sizeZ = (pFine->m_sizeZ + 1) / 2;
+		pLOD->m_lodScale = pFine->m_lodScale * 2;
+		pLOD->m_pMaterial = pMatrix->m_pMaterial;
+
+		unsigned int numVoxels = pLOD->m_sizeX * pLOD->m_sizeY * pLOD->m_sizeZ;
+		pLOD->m_pColour = new unsigned int[numVoxels];
+		pLOD->m_pVisibilityMask = new unsigned int[numVoxels];
+		if (numVoxels > 0)
+		{
+			DownsampleMatrix(pFine, pLOD, m_lodDownsample, 0, 0, 0, pLOD->m_sizeX - 1, pLOD->m_sizeY - 1, pLOD->m_sizeZ - 1);
+			RecomputeVisibilityMask(pLOD);
+		}
+		CreateMatrixChunks(pLOD);
 
-									bool stopMergingZ = false;
-									for (int zAdd = 1; zAdd <= increaseZ && stopMergingZ == false; zAdd++)
-									{
-										unsigned int z1 = z + zAdd;
-
-										unsigned int colour1 = pMatrix->m_pColour[x1 + pMatrix->m_sizeX * (y + pMatrix->m_sizeY * z1)];
-										unsigned int mask1 = pMatrix->m_pVisibilityMask[x1 + pMatrix->m_sizeX * (y + pMatrix->m_sizeY * z1)];
-										int merged1 = l_merged[x1 + pMatrix->m_sizeX * (y + pMatrix->m_sizeY * z1)];
-
-										if ((merged1 & MergedSide_Y_Positive) == MergedSide_Y_Positive)
-										{
-											stopMergingZ = true;
-											continue;
-										}
-										if ((mask1 & 8) != 8)
-										{
-											stopMergingZ = true;
-											continue;
-										}
-										if (colour1 != colour)
-										{
-											stopMergingZ = true;
-											continue;
-										}
-									}
+		pMatrix->m_vpLODs.push_back(pLOD);
+		pFine = pLOD;
+	}
+}
 
-									if (stopMergingZ == true)
-									{
-										stopMerging = true;
-										continue;
-									}
+// Downsamples an edited box of the matrix into each level of detail again, and marks the chunks it touches for remeshing
+void QBT::UpdateLODs(QBTMatrix* pMatrix, int minX, int minY, int minZ, int maxX, int maxY, int maxZ)
+{
+	QBTMatrix* pFine = pMatrix;
+	for (unsigned int i = 0; i < pMatrix->m_vpLODs.size(); i++)
+	{
+		QBTMatrix* pLOD = pMatrix->m_vpLODs[i];
+		minX /= 2;
+		minY /= 2;
+		minZ /= 2;
+		maxX /= 2;
+		maxY /= 2;
+		maxZ /= 2;
+
+		DownsampleMatrix(pFine, pLOD, m_lodDownsample, minX, minY, minZ, maxX, maxY, maxZ);
+		RecomputeVisibilityMask(pLOD, minX, minY, minZ, maxX, maxY, maxZ);
+		SetBoxDirty(pLOD, minX, minY, minZ, maxX, maxY, maxZ);
+
+		pFine = pLOD;
+	}
+}
 
-									increaseX++;
-									l_merged[x1 + pMatrix->m_sizeX * (y + pMatrix->m_sizeY * z)] |= MergedSide_Y_Positive;
+// The levels share the material of the matrix, so it is left alone
+void QBT::DeleteLODs(QBTMatrix* pMatrix)
+{
+	for (unsigned int i = 0; i < pMatrix->m_vpLODs.size(); i++)
+	{
+		QBTMatrix* pLOD = pMatrix->m_vpLODs[i];
+		DestroyMatrixBuffers(pLOD);
+		DeleteMeshData(pLOD);
+		delete[] pLOD->m_pColour;
+		delete[] pLOD->m_pVisibilityMask;
+		delete pLOD;
+		m_batchesDirty = true;
+	}
+	pMatrix->m_vpLODs.clear();
+}
 
-									for (int zAdd = 1; zAdd <= increaseZ; zAdd++)
-									{
-										unsigned int z1 = z + zAdd;
-										l_merged[x1 + pMatrix->m_sizeX * (y + pMatrix->m_sizeY * z1)] |= MergedSide_Y_Positive;
-									}
-								}
+// Job system
+void QBT::SetJobSystem(JobSystem* pJobSystem)
+{
+	m_pJobSystem = pJobSystem;
+	m_occlusionBuffer.SetJobSystem(pJobSystem);
+}
 
-								pMatrix->m_numVertices += 4;
-								pMatrix->m_numTriangles += 2;
-							}
-						}
+JobSystem* QBT::GetJobSystem()
+{
+	return m_pJobSystem;
+}
 
-						// Bottom
-						if ((mask & 16) == 16)
-						{
-							if ((merged & MergedSide_Y_Negative) != MergedSide_Y_Negative)
-							{
-								bool stopMerging = false;
-								int increaseZ = 0;
-								for (unsigned int z1 = z + 1; z1 < pMatrix->m_sizeZ && stopMerging == false; z1++)
-								{
-									unsigned int colour1 = pMatrix->m_pColour[x + pMatrix->m_sizeX * (y + pMatrix->m_sizeY * z1)];
-									unsigned int mask1 = pMatrix->m_pVisibilityMask[x + pMatrix->m_sizeX * (y + pMatrix->m_sizeY * z1)];
-									int merged1 = l_merged[x + pMatrix->m_sizeX * (y + pMatrix->m_sizeY * z1)];
+// Loader backend
+void QBT::SetLoaderBackend(QBTLoaderBackend backend)
+{
+	m_loaderBackend = backend;
+}
 
-									if ((merged1 & MergedSide_Y_Negative) == MergedSide_Y_Negative)
-									{
-										stopMerging = true;
-										continue;
-									}
-									if ((mask1 & 16) != 16)
-									{
-										stopMerging = true;
-										continue;
-									}
-									if (colour1 != colour)
-									{
-										stopMerging = true;
-										continue;
-									}
+QBTLoaderBackend QBT::GetLoaderBackend()
+{
+	return m_loaderBackend;
+}
 
-									increaseZ++;
-									l_merged[x + pMatrix->m_sizeX * (y + pMatrix->m_sizeY * z1)] |= MergedSide_Y_Negative;
-								}
+void QBT::SetParallelLoading(bool parallel)
+{
+	m_parallelLoading = parallel;
+}
 
-								stopMerging = false;
-								int increaseX = 0;
-								for (unsigned int x1 = x + 1; x1 < pMatrix->m_sizeX && stopMerging == false; x1++)
-								{
-									unsigned int colour1 = pMatrix->m_pColour[x1 + pMatrix->m_sizeX * (y + pMatrix->m_sizeY * z)];
-									unsigned int mask1 = pMatrix->m_pVisibilityMask[x1 + pMatrix->m_sizeX * (y + pMatrix->m_sizeY * z)];
-									int merged1 = l_merged[x1 + pMatrix->m_sizeX * (y + pMatrix->m_sizeY * z)];
+bool QBT::GetParallelLoading()
+{
+	return m_parallelLoading;
+}
 
-									if ((merged1 & MergedSide_Y_Negative) == MergedSide_Y_Negative)
-									{
-										stopMerging = true;
-										continue;
-									}
-									if ((mask1 & 16) != 16)
-									{
-										stopMerging = true;
-										continue;
-									}
-									if (colour1 != colour)
-									{
-										stopMerging = true;
-										continue;
-									}
+void QBT::SetRecomputeVisibility(bool recompute)
+{
+	m_recomputeVisibility = recompute;
+}
 
-									bool stopMergingZ = false;
-									for (int zAdd = 1; zAdd <= increaseZ && stopMergingZ == false; zAdd++)
-									{
-										unsigned int z1 = z + zAdd;
-
-										unsigned int colour1 = pMatrix->m_pColour[x1 + pMatrix->m_sizeX * (y + pMatrix->m_sizeY * z1)];
-										unsigned int mask1 = pMatrix->m_pVisibilityMask[x1 + pMatrix->m_sizeX * (y + pMatrix->m_sizeY * z1)];
-										int merged1 = l_merged[x1 + pMatrix->m_sizeX * (y + pMatrix->m_sizeY * z1)];
-
-										if ((merged1 & MergedSide_Y_Negative) == MergedSide_Y_Negative)
-										{
-											stopMergingZ = true;
-											continue;
-										}
-										if ((mask1 & 16) != 16)
-										{
-											stopMergingZ = true;
-											continue;
-										}
-										if (colour1 != colour)
-										{
-											stopMergingZ = true;
-											continue;
-										}
-									}
+bool QBT::GetRecomputeVisibility()
+{
+	return m_recomputeVisibility;
+}
 
-									if (stopMergingZ == true)
-									{
-										stopMerging = true;
-										continue;
-									}
+// Async loading
+void QBT::LoadQBTFileAsync(string filename)
+{
+	CancelAsyncLoad();
+
+	// The staging model is headless, it never touches OpenGL from the loader thread
+	m_pAsyncQBT = new QBT(NULL);
+	m_pAsyncQBT->SetLoaderBackend(m_loaderBackend);
+	m_pAsyncQBT->SetParallelLoading(m_parallelLoading);
+	m_pAsyncQBT->SetRecomputeVisibility(m_recomputeVisibility);
+	m_pAsyncQBT->SetJobSystem(m_pJobSystem);
+	m_pAsyncQBT->SetCreateInnerVoxels(m_createInnerVoxels);
+	m_pAsyncQBT->SetCreateInnerFaces(m_createInnerFaces);
+	m_pAsyncQBT->SetMergeFaces(m_mergeFaces);
+	m_pAsyncQBT->SetAmbientOcclusion(m_ambientOcclusion);
+	m_pAsyncQBT->SetNumLODs(m_numLODs);
+	m_pAsyncQBT->SetLODDownsample(m_lodDownsample);
+	m_pAsyncQBT->SetVertexFormat(m_vertexFormat);
+	m_pAsyncQBT->SetMesher(m_mesher);
+
+	m_vpAsyncMeshedMatrices.clear();
+	m_asyncUploadIndex = 0;
+	m_asyncUploadChunk = 0;
+	m_asyncUploadOffset = 0;
+	m_asyncLoadFinished = false;
+	m_asyncLoadCancelled = false;
+	m_asyncLoadSucceeded = false;
+
+	m_asyncLoadThread = thread(&QBT::AsyncLoadThread, this, filename);
+}
 
-									increaseX++;
-									l_merged[x1 + pMatrix->m_sizeX * (y + pMatrix->m_sizeY * z)] |= MergedSide_Y_Negative;
+void QBT::UpdateAsyncLoad(float uploadBudgetMilliseconds)
+{
+	PROFILE_SCOPE("QBT::UpdateAsyncLoad");
 
-									for (int zAdd = 1; zAdd <= increaseZ; zAdd++)
-									{
-										unsigned int z1 = z + zAdd;
-										l_merged[x1 + pMatrix->m_sizeX * (y + pMatrix->m_sizeY * z1)] |= MergedSide_Y_Negative;
-									}
-								}
+	if (m_pAsyncQBT == NULL)
+	{
+		return;
+	}
 
-								pMatrix->m_numVertices += 4;
-								pMatrix->m_numTriangles += 2;
-							}
-						}
-					}
-				}
-			}
-		}
-		else
+	chrono::steady_clock::time_point start = chrono::steady_clock::now();
+	for (;;)
+	{
+		QBTMatrix* pMatrix = NULL;
 		{
-			for (unsigned int x = 0; x < pMatrix->m_sizeX; x++)
+			lock_guard<mutex> lock(m_asyncLoadMutex);
+			if (m_asyncUploadIndex < m_vpAsyncMeshedMatrices.size())
 			{
-				for (unsigned int z = 0; z < pMatrix->m_sizeZ; z++)
-				{
-					for (unsigned int y = 0; y < pMatrix->m_sizeY; y++)
-					{
-						unsigned int mask = pMatrix->m_pVisibilityMask[x + pMatrix->m_sizeX * (y + pMatrix->m_sizeY * z)];
+				pMatrix = m_vpAsyncMeshedMatrices[m_asyncUploadIndex];
+			}
+		}
 
-						// If mask is 0, this is an invisible voxel, not active
-						if (mask != 0)
-						{
-							if (mask != 1 || m_createInnerVoxels == true)
-							{
-								// Back
-								if (m_createInnerFaces == true || (mask & 32) == 32)
-								{
-									pMatrix->m_numVertices += 4;
-									pMatrix->m_numTriangles += 2;
-								}
+		if (pMatrix == NULL)
+		{
+			break;
+		}
 
-								// Front
-								if (m_createInnerFaces == true || (mask & 64) == 64)
-								{
-									pMatrix->m_numVertices += 4;
-									pMatrix->m_numTriangles += 2;
-								}
+		// Always make some progress, even if the budget is smaller than a single slice
+		if (UploadMeshSlice(pMatrix))
+		{
+			m_asyncUploadIndex++;
+			m_asyncUploadChunk = 0;
+			m_asyncUploadOffset = 0;
+		}
 
-								// Left
-								if (m_createInnerFaces == true || (mask & 4) == 4)
-								{
-									pMatrix->m_numVertices += 4;
-									pMatrix->m_numTriangles += 2;
-								}
+		if (chrono::duration<float, milli>(chrono::steady_clock::now() - start).count() >= uploadBudgetMilliseconds)
+		{
+			return;
+		}
+	}
 
-								// Right
-								if (m_createInnerFaces == true || (mask & 2) == 2)
-								{
-									pMatrix->m_numVertices += 4;
-									pMatrix->m_numTriangles += 2;
-								}
+	// Only swap once the loader thread is done and every matrix is on the GPU, so the old model stays on screen until then
+	if (m_asyncLoadFinished)
+	{
+		lock_guard<mutex> lock(m_asyncLoadMutex);
+		if (m_asyncUploadIndex < m_vpAsyncMeshedMatrices.size())
+		{
+			return;
+		}
+	}
+	else
+	{
+		return;
+	}
 
-								// Top
-								if (m_createInnerFaces == true || (mask & 8) == 8)
-								{
-									pMatrix->m_numVertices += 4;
-									pMatrix->m_numTriangles += 2;
-								}
+	m_asyncLoadThread.join();
 
-								// Bottom
-								if (m_createInnerFaces == true || (mask & 16) == 16)
-								{
-									pMatrix->m_numVertices += 4;
-									pMatrix->m_numTriangles += 2;
-								}
-							}
-						}
-					}
-				}
-			}
+	if (m_asyncLoadSucceeded)
+	{
+		SwapInAsyncModel();
+	}
+	else
+	{
+		CancelAsyncLoad();
+	}
+}
+
+void QBT::CancelAsyncLoad()
+{
+	if (m_pAsyncQBT == NULL)
+	{
+		return;
+	}
+
+	m_asyncLoadCancelled = true;
+	if (m_asyncLoadThread.joinable())
+	{
+		m_asyncLoadThread.join();
+	}
+
+	// Some of the staging matrices may already have been uploaded
+	m_pAsyncQBT->Unload();
+	delete m_pAsyncQBT;
+	m_pAsyncQBT = NULL;
+
+	m_vpAsyncMeshedMatrices.clear();
+	m_asyncUploadIndex = 0;
+	m_asyncUploadChunk = 0;
+	m_asyncUploadOffset = 0;
+}
+
+bool QBT::IsAsyncLoading()
+{
+	return m_pAsyncQBT != NULL;
+}
+
+void QBT::AsyncLoadThread(string filename)
+{
+	Profiler::GetInstance()->SetThreadName("QBT async loader");
+
+	bool ok = m_pAsyncQBT->ReadQBTFile(filename);
+
+	// Mesh one matrix at a time and hand each over as soon as it is ready, so uploading can start straight away
+	for (unsigned int i = 0; ok && i < m_pAsyncQBT->m_vpQBTMatrices.size(); i++)
+	{
+		if (m_asyncLoadCancelled)
+		{
+			ok = false;
+			break;
 		}
 
-		// Indices
-		pMatrix->m_numIndices = (unsigned int)pMatrix->m_numTriangles * 3;
+		// The levels of detail are uploaded the same way as the matrices, straight after the matrix they belong to
+		QBTMatrix* pMatrix = m_pAsyncQBT->m_vpQBTMatrices[i];
+		m_pAsyncQBT->CreateMeshData(pMatrix);
+		for (unsigned int j = 0; j < pMatrix->m_vpLODs.size(); j++)
+		{
+			m_pAsyncQBT->CreateMeshData(pMatrix->m_vpLODs[j]);
+		}
+
+		lock_guard<mutex> lock(m_asyncLoadMutex);
+		m_vpAsyncMeshedMatrices.push_back(pMatrix);
+		m_vpAsyncMeshedMatrices.insert(m_vpAsyncMeshedMatrices.end(), pMatrix->m_vpLODs.begin(), pMatrix->m_vpLODs.end());
+	}
+
+	m_asyncLoadSucceeded = ok;
+	m_asyncLoadFinished = true;
+}
+
+// Uploads the next slice of the matrix, a chunk at a time, and returns true once every chunk is on the GPU
+bool QBT::UploadMeshSlice(QBTMatrix* pMatrix)
+{
+	size_t uploaded = 0;
+	while (m_asyncUploadChunk < pMatrix->m_vChunks.size() && uploaded < QBT_ASYNC_UPLOAD_SLICE_SIZE)
+	{
+		QBTChunk* pChunk = &pMatrix->m_vChunks[m_asyncUploadChunk];
+		size_t vertexBytes = GetVertexSize(pChunk) * pChunk->m_numVertices;
+
+		if (pChunk->m_numVertices > 0 && pChunk->m_VAO == 0)
+		{
+			CreateChunkBuffers(pChunk, NULL);
+		}
+
+		if (m_asyncUploadOffset < vertexBytes)
+		{
+			const unsigned char* pVertices = pChunk->m_vertexFormat == QBTVertexFormat_Packed ? (const unsigned char*)pChunk->m_pPackedVertices : (const unsigned char*)pChunk->m_pVertices;
+			size_t sliceSize = std::min(QBT_ASYNC_UPLOAD_SLICE_SIZE - uploaded, vertexBytes - m_asyncUploadOffset);
+			glBindBuffer(GL_ARRAY_BUFFER, pChunk->m_VBO);
+			glBufferSubData(GL_ARRAY_BUFFER, m_asyncUploadOffset, sliceSize, pVertices + m_asyncUploadOffset);
+			glBindBuffer(GL_ARRAY_BUFFER, 0);
+			m_asyncUploadOffset += sliceSize;
+			uploaded += sliceSize;
+		}
+
+		if (m_asyncUploadOffset >= vertexBytes)
+		{
+			DeleteMeshData(pChunk);
+			m_asyncUploadChunk++;
+			m_asyncUploadOffset = 0;
+		}
+	}
+
+	return m_asyncUploadChunk >= pMatrix->m_vChunks.size();
+}
+
+void QBT::SwapInAsyncModel()
+{
+	Unload();
+
+	// Take ownership of everything the staging model loaded
+	memcpy(m_magic, m_pAsyncQBT->m_magic, sizeof(m_magic));
+	m_major = m_pAsyncQBT->m_major;
+	m_minor = m_pAsyncQBT->m_minor;
+	m_globalScaleX = m_pAsyncQBT->m_globalScaleX;
+	m_globalScaleY = m_pAsyncQBT->m_globalScaleY;
+	m_globalScaleZ = m_pAsyncQBT->m_globalScaleZ;
+	m_filename = m_pAsyncQBT->m_filename;
+	m_numColors = m_pAsyncQBT->m_numColors;
+	m_pColors = m_pAsyncQBT->m_pColors;
+	m_vpQBTMatrices = m_pAsyncQBT->m_vpQBTMatrices;
+
+	bool optionsChanged = m_createInnerVoxels != m_pAsyncQBT->m_createInnerVoxels ||
+	                      m_createInnerFaces != m_pAsyncQBT->m_createInnerFaces ||
+	                      m_mergeFaces != m_pAsyncQBT->m_mergeFaces ||
+	                      m_ambientOcclusion != m_pAsyncQBT->m_ambientOcclusion ||
+	                      m_mesher != m_pAsyncQBT->m_mesher ||
+	                      m_vertexFormat != m_pAsyncQBT->m_vertexFormat ||
+	                      m_numLODs != m_pAsyncQBT->m_numLODs ||
+	                      m_lodDownsample != m_pAsyncQBT->m_lodDownsample;
+
+	m_pAsyncQBT->m_numColors = 0;
+	m_pAsyncQBT->m_pColors = NULL;
+	m_pAsyncQBT->m_vpQBTMatrices.clear();
+	delete m_pAsyncQBT;
+	m_pAsyncQBT = NULL;
+
+	m_vpAsyncMeshedMatrices.clear();
+	m_asyncUploadIndex = 0;
+	m_asyncUploadChunk = 0;
+	m_asyncUploadOffset = 0;
+	m_batchesDirty = true;
+
+	// The creation options were toggled while the model was loading
+	if (optionsChanged)
+	{
+		RecreateStaticBuffers();
 	}
 }
 
+// Setup
 void QBT::RecreateStaticBuffers()
 {
 	DestroyStaticBuffers();
-	SetVisibilityInformation();
+
+	// The levels of detail are built again too, in case their number or the way they are downsampled has changed
+	for (unsigned int i = 0; i < m_vpQBTMatrices.size(); i++)
+	{
+		CreateLODs(m_vpQBTMatrices[i]);
+		SetMatrixDirty(m_vpQBTMatrices[i]);
+	}
+
 	CreateStaticRenderBuffers();
 }
 
+// A headless QBT has nowhere to upload to, so it keeps a copy of each chunk's mesh instead, the same as CreateMeshData
 void QBT::CreateStaticRenderBuffers()
 {
-	for (unsigned int matrixIndex = 0; matrixIndex < m_vpQBTMatrices.size(); matrixIndex++)
+	PROFILE_SCOPE("QBT::CreateStaticRenderBuffers");
+
+	for (unsigned int i = 0; i < m_vpQBTMatrices.size(); i++)
 	{
-		QBTMatrix* pMatrix = m_vpQBTMatrices[matrixIndex];
+		CreateMatrixRenderBuffers(m_vpQBTMatrices[i]);
+		for (unsigned int j = 0; j < m_vpQBTMatrices[i]->m_vpLODs.size(); j++)
+		{
+			CreateMatrixRenderBuffers(m_vpQBTMatrices[i]->m_vpLODs[j]);
+		}
+	}
+}
+
+void QBT::CreateMatrixRenderBuffers(QBTMatrix* pMatrix)
+{
+	for (unsigned int i = 0; i < pMatrix->m_vChunks.size(); i++)
+	{
+		QBTChunk* pChunk = &pMatrix->m_vChunks[i];
+		if (pChunk->m_dirty == false)
+		{
+			continue;
+		}
+
+		if (m_pRenderer == NULL)
+		{
+			CreateMeshData(pMatrix, pChunk);
+			StoreMeshData(pChunk);
+			continue;
+		}
+
+		DestroyChunkBuffers(pChunk);
+		CreateMeshData(pMatrix, pChunk);
+		m_batchesDirty = true;
+		if (pChunk->m_numVertices > 0)
+		{
+			if (pChunk->m_vertexFormat == QBTVertexFormat_Packed)
+			{
+				CreateChunkBuffers(pChunk, m_packedVertexArena.data());
+			}
+			else
+			{
+				CreateChunkBuffers(pChunk, m_vertexArena.data());
+			}
+		}
+	}
+}
+
+void QBT::CreateMeshData(QBTMatrix* pMatrix)
+{
+	for (unsigned int i = 0; i < pMatrix->m_vChunks.size(); i++)
+	{
+		CreateMeshData(pMatrix, &pMatrix->m_vChunks[i]);
+		StoreMeshData(&pMatrix->m_vChunks[i]);
+	}
+}
+
+// Meshes a chunk into the mesh arenas, with whichever mesher is selected. With the packed vertex format the meshers write packed vertices
+// straight into the packed vertex arena, the full vertices are never written.
+// Both meshers cull against the voxels of the neighbouring chunks, so there are no faces along the chunk borders.
+void QBT::CreateMeshData(QBTMatrix* pMatrix, QBTChunk* pChunk)
+{
+	PROFILE_SCOPE("QBT::CreateMeshData");
 
-		// Vertices
-		PositionColorNormalVertex* verticesBuffer = new PositionColorNormalVertex[pMatrix->m_numVertices];
+	pMatrix->m_numVertices -= pChunk->m_numVertices;
+	pMatrix->m_numTriangles -= pChunk->m_numTriangles;
 
-		// Indices
-		GLuint* indicesBuffer = new GLuint[pMatrix->m_numIndices];
+	// Matrices that are too big for the packed positions keep the full vertex format
+	bool fitsPackedVertex = pMatrix->m_sizeX <= QBT_PACKED_VERTEX_MAX_SIZE && pMatrix->m_sizeY <= QBT_PACKED_VERTEX_MAX_SIZE && pMatrix->m_sizeZ <= QBT_PACKED_VERTEX_MAX_SIZE;
+	bool packVertices = m_vertexFormat == QBTVertexFormat_Packed && fitsPackedVertex;
+	pChunk->m_vertexFormat = packVertices ? QBTVertexFormat_Packed : QBTVertexFormat_PositionColorNormal;
 
-		if(m_mergeFaces)
+	if (m_mesher == QBTMesher_BinaryGreedy)
+	{
+		unsigned int numVertices = m_binaryMesher.CreateMesh(pMatrix, pChunk, m_mergeFaces, m_createInnerVoxels, m_createInnerFaces, m_ambientOcclusion, m_vertexArena, packVertices ? &m_packedVertexArena : NULL);
+
+		pChunk->m_numVertices = numVertices;
+		pChunk->m_numIndices = numVertices / 4 * 6;
+		pChunk->m_numTriangles = numVertices / 2;
+	}
+	else
+	{
+		CreateDefaultMeshData(pMatrix, pChunk, packVertices);
+	}
+
+	CalculateMeshBounds(pChunk);
+	GatherOccluders(pChunk);
+	pMatrix->m_boundsDirty = true;
+
+	pChunk->m_dirty = false;
+
+	pMatrix->m_numVertices += pChunk->m_numVertices;
+	pMatrix->m_numTriangles += pChunk->m_numTriangles;
+}
+
+// Builds the mesh for a chunk of a matrix in a single walk, writing straight into the vertex arena, or the packed vertex arena when
+// packVertices is set. The arenas are reused between chunks and only ever grow. The vertex and triangle counts are known once the
+// walk is done. Every quad is written in the vertex order of the renderer's shared quad index buffer, so no indices are created here.
+void QBT::CreateDefaultMeshData(QBTMatrix* pMatrix, QBTChunk* pChunk, bool packVertices)
+{
+	// Vertices
+	PositionColorNormalVertex* verticesBuffer = m_vertexArena.data();
+	PackedPositionColorNormalVertex* packedVerticesBuffer = m_packedVertexArena.data();
+	size_t arenaVertices = packVertices ? m_packedVertexArena.size() : m_vertexArena.size();
+	unsigned int verticesCounter = 0;
+
+	if(m_mergeFaces)
+	{
+		size_t cubeSize = (size_t)pMatrix->m_sizeX * pMatrix->m_sizeY * pMatrix->m_sizeZ;
+		if (m_mergedSides.size() < cubeSize)
 		{
-			int cubeSize = pMatrix->m_sizeX * pMatrix->m_sizeY * pMatrix->m_sizeZ;
-			int *l_merged;
-			l_merged = new int[cubeSize];
+			m_mergedSides.resize(cubeSize);
+		}
+		unsigned char* l_merged = m_mergedSides.data();
 
-			for (int i = 0; i < cubeSize; i++)
+		// Faces are never merged past the edge of the chunk, so only the chunk needs clearing
+		for (unsigned int z = pChunk->m_minZ; z < pChunk->m_maxZ; z++)
+		{
+			for (unsigned int y = pChunk->m_minY; y < pChunk->m_maxY; y++)
 			{
-				l_merged[i] = MergedSide_None;
+				memset(&l_merged[pChunk->m_minX + pMatrix->m_sizeX * (y + pMatrix->m_sizeY * z)], MergedSide_None, pChunk->m_maxX - pChunk->m_minX);
 			}
+		}
 
-			unsigned int verticesCounter = 0;
-			unsigned int indicesCounter = 0;
-			for (unsigned int x = 0; x < pMatrix->m_sizeX; x++)
+		for (unsigned int x = pChunk->m_minX; x < pChunk->m_maxX; x++)
+		{
+			for (unsigned int y = pChunk->m_minY; y < pChunk->m_maxY; y++)
 			{
-				for (unsigned int y = 0; y < pMatrix->m_sizeY; y++)
+				for (unsigned int z = pChunk->m_minZ; z < pChunk->m_maxZ; z++)
 				{
-					for (unsigned int z = 0; z < pMatrix->m_sizeZ; z++)
+					unsigned int colour = pMatrix->m_pColour[x + pMatrix->m_sizeX * (y + pMatrix->m_sizeY * z)];
+					unsigned int mask = pMatrix->m_pVisibilityMask[x + pMatrix->m_sizeX * (y + pMatrix->m_sizeY * z)];
+					unsigned int alpha = (colour & 0xFF000000) >> 24;
+					unsigned int blue = (colour & 0x00FF0000) >> 16;
+					unsigned int green = (colour & 0x0000FF00) >> 8;
+					unsigned int red = (colour & 0x000000FF);
+
+					float r = (float)(red / 255.0f);
+					float g = (float)(green / 255.0f);
+					float b = (float)(blue / 255.0f);
+
+					if (mask == 0)
 					{
-						unsigned int colour = pMatrix->m_pColour[x + pMatrix->m_sizeX * (y + pMatrix->m_sizeY * z)];
-						unsigned int mask = pMatrix->m_pVisibilityMask[x + pMatrix->m_sizeX * (y + pMatrix->m_sizeY * z)];
-						unsigned int alpha = (colour & 0xFF000000) >> 24;
-						unsigned int blue = (colour & 0x00FF0000) >> 16;
-						unsigned int green = (colour & 0x0000FF00) >> 8;
-						unsigned int red = (colour & 0x000000FF);
-
-						float r = (float)(red / 255.0f);
-						float g = (float)(green / 255.0f);
-						float b = (float)(blue / 255.0f);
-
-						if (mask == 0)
-						{
-							continue;
-						}
+						continue;
+					}
 
-						if (mask == 1 && m_createInnerVoxels == false)
-						{
-							continue;
-						}
+					if (mask == 1 && m_createInnerVoxels == false)
+					{
+						continue;
+					}
+
+					// Make sure there is room for a quad on every side of this voxel
+					if (verticesCounter + 24 > arenaVertices)
+					{
+						arenaVertices = GrowMeshArenas(verticesCounter + 24, packVertices);
+						verticesBuffer = m_vertexArena.data();
+						packedVerticesBuffer = m_packedVertexArena.data();
+					}
 
-						int merged = l_merged[x + pMatrix->m_sizeX * (y + pMatrix->m_sizeY * z)];
+					int merged = l_merged[x + pMatrix->m_sizeX * (y + pMatrix->m_sizeY * z)];
 
-						// Back
-						if ((mask & 32) == 32)
+					// Back
+					if ((mask & 32) == 32)
+					{
+						if ((merged & MergedSide_Z_Negative) != MergedSide_Z_Negative)
 						{
-							if ((merged & MergedSide_Z_Negative) != MergedSide_Z_Negative)
+							unsigned int ambientOcclusion = m_ambientOcclusion ? GetFaceAmbientOcclusion(pMatrix, x, y, z, QBTFace_Back) : 0;
+
+							bool stopMerging = false;
+							int increaseX = 0;
+							for (unsigned int x1 = x + 1; x1 < pChunk->m_maxX && stopMerging == false; x1++)
 							{
-								bool stopMerging = false;
-								int increaseX = 0;
-								for (unsigned int x1 = x + 1; x1 < pMatrix->m_sizeX && stopMerging == false; x1++)
+								unsigned int colour1 = pMatrix->m_pColour[x1 + pMatrix->m_sizeX * (y + pMatrix->m_sizeY * z)];
+								unsigned int mask1 = pMatrix->m_pVisibilityMask[x1 + pMatrix->m_sizeX * (y + pMatrix->m_sizeY * z)];
+								int merged1 = l_merged[x1 + pMatrix->m_sizeX * (y + pMatrix->m_sizeY * z)];
+
+								if ((merged1 & MergedSide_Z_Negative) == MergedSide_Z_Negative)
+								{
+									stopMerging = true;
+									continue;
+								}
+								if ((mask1 & 32) != 32)
+								{
+									stopMerging = true;
+									continue;
+								}
+								if (colour1 != colour || (m_ambientOcclusion && GetFaceAmbientOcclusion(pMatrix, x1, y, z, QBTFace_Back) != ambientOcclusion))
 								{
-									unsigned int colour1 = pMatrix->m_pColour[x1 + pMatrix->m_sizeX * (y + pMatrix->m_sizeY * z)];
-									unsigned int mask1 = pMatrix->m_pVisibilityMask[x1 + pMatrix->m_sizeX * (y + pMatrix->m_sizeY * z)];
-									int merged1 = l_merged[x1 + pMatrix->m_sizeX * (y + pMatrix->m_sizeY * z)];
+									stopMerging = true;
+									continue;
+								}
 
-									if ((merged1 & MergedSide_Z_Negative) == MergedSide_Z_Negative)
-									{
-										stopMerging = true;
-										continue;
-									}
-									if ((mask1 & 32) != 32)
-									{
-										stopMerging = true;
-										continue;
-									}
-									if (colour1 != colour)
-									{
-										stopMerging = true;
-										continue;
-									}
+								increaseX++;
+								l_merged[x1 + pMatrix->m_sizeX * (y + pMatrix->m_sizeY * z)] |= MergedSide_Z_Negative;
+							}
 
-									increaseX++;
-									l_merged[x1 + pMatrix->m_sizeX * (y + pMatrix->m_sizeY * z)] |= MergedSide_Z_Negative;
+							stopMerging = false;
+							int increaseY = 0;
+							for (unsigned int y1 = y + 1; y1 < pChunk->m_maxY && stopMerging == false; y1++)
+							{
+								unsigned int colour1 = pMatrix->m_pColour[x + pMatrix->m_sizeX * (y1 + pMatrix->m_sizeY * z)];
+								unsigned int mask1 = pMatrix->m_pVisibilityMask[x + pMatrix->m_sizeX * (y1 + pMatrix->m_sizeY * z)];
+								int merged1 = l_merged[x + pMatrix->m_sizeX * (y1 + pMatrix->m_sizeY * z)];
+
+								if ((merged1 & MergedSide_Z_Negative) == MergedSide_Z_Negative)
+								{
+									stopMerging = true;
+									continue;
+								}
+								if ((mask1 & 32) != 32)
+								{
+									stopMerging = true;
+									continue;
+								}
+								if (colour1 != colour || (m_ambientOcclusion && GetFaceAmbientOcclusion(pMatrix, x, y1, z, QBTFace_Back) != ambientOcclusion))
+								{
+									stopMerging = true;
+									continue;
 								}
 
-								stopMerging = false;
-								int increaseY = 0;
-								for (unsigned int y1 = y + 1; y1 < pMatrix->m_sizeY && stopMerging == false; y1++)
+								bool stopMergingX = false;
+								for (int xAdd = 1; xAdd <= increaseX && stopMergingX == false; xAdd++)
 								{
-									unsigned int colour1 = pMatrix->m_pColour[x + pMatrix->m_sizeX * (y1 + pMatrix->m_sizeY * z)];
-									unsigned int mask1 = pMatrix->m_pVisibilityMask[x + pMatrix->m_sizeX * (y1 + pMatrix->m_sizeY * z)];
-									int merged1 = l_merged[x + pMatrix->m_sizeX * (y1 + pMatrix->m_sizeY * z)];
+									unsigned int x1 = x + xAdd;
+
+									unsigned int colour1 = pMatrix->m_pColour[x1 + pMatrix->m_sizeX * (y1 + pMatrix->m_sizeY * z)];
+									unsigned int mask1 = pMatrix->m_pVisibilityMask[x1 + pMatrix->m_sizeX * (y1 + pMatrix->m_sizeY * z)];
+									int merged1 = l_merged[x1 + pMatrix->m_sizeX * (y1 + pMatrix->m_sizeY * z)];
 
 									if ((merged1 & MergedSide_Z_Negative) == MergedSide_Z_Negative)
 									{
-										stopMerging = true;
+										stopMergingX = true;
 										continue;
 									}
 									if ((mask1 & 32) != 32)
 									{
-										stopMerging = true;
+										stopMergingX = true;
 										continue;
 									}
-									if (colour1 != colour)
+									if (colour1 != colour || (m_ambientOcclusion && GetFaceAmbientOcclusion(pMatrix, x1, y1, z, QBTFace_Back) != ambientOcclusion))
 									{
-										stopMerging = true;
+										stopMergingX = true;
 										continue;
 									}
+								}
 
-									bool stopMergingX = false;
-									for (int xAdd = 1; xAdd <= increaseX && stopMergingX == false; xAdd++)
-									{
-										unsigned int x1 = x + xAdd;
-
-										unsigned int colour1 = pMatrix->m_pColour[x1 + pMatrix->m_sizeX * (y1 + pMatrix->m_sizeY * z)];
-										unsigned int mask1 = pMatrix->m_pVisibilityMask[x1 + pMatrix->m_sizeX * (y1 + pMatrix->m_sizeY * z)];
-										int merged1 = l_merged[x1 + pMatrix->m_sizeX * (y1 + pMatrix->m_sizeY * z)];
-
-										if ((merged1 & MergedSide_Z_Negative) == MergedSide_Z_Negative)
-										{
-											stopMergingX = true;
-											continue;
-										}
-										if ((mask1 & 32) != 32)
-										{
-											stopMergingX = true;
-											continue;
-										}
-										if (colour1 != colour)
-										{
-											stopMergingX = true;
-											continue;
-										}
-									}
-
-									if (stopMergingX == true)
-									{
-										stopMerging = true;
-										continue;
-									}
+								if (stopMergingX == true)
+								{
+									stopMerging = true;
+									continue;
+								}
 
-									increaseY++;
-									l_merged[x + pMatrix->m_sizeX * (y1 + pMatrix->m_sizeY * z)] |= MergedSide_Z_Negative;
+								increaseY++;
+								l_merged[x + pMatrix->m_sizeX * (y1 + pMatrix->m_sizeY * z)] |= MergedSide_Z_Negative;
 
-									for (int xAdd = 1; xAdd <= increaseX; xAdd++)
-									{
-										unsigned int x1 = x + xAdd;
-										l_merged[x1 + pMatrix->m_sizeX * (y1 + pMatrix->m_sizeY * z)] |= MergedSide_Z_Negative;
-									}
+								for (int xAdd = 1; xAdd <= increaseX; xAdd++)
+								{
+									unsigned int x1 = x + xAdd;
+									l_merged[x1 + pMatrix->m_sizeX * (y1 + pMatrix->m_sizeY * z)] |= MergedSide_Z_Negative;
 								}
+							}
 
+							if (packVertices)
+							{
+								WritePackedQuad(&packedVerticesBuffer[verticesCounter], QBTFace_Back, x, y, z, increaseX + 1, increaseY + 1, colour, ambientOcclusion);
+							}
+							else
+							{
 								verticesBuffer[verticesCounter + 0].x = x + -0.5f;
 								verticesBuffer[verticesCounter + 0].y = y + -0.5f;
 								verticesBuffer[verticesCounter + 0].z = z + -0.5f;
@@ -1268,117 +1494,123 @@ void QBT::CreateStaticRenderBuffers()
 								verticesBuffer[verticesCounter + 3].ny = 0.0f;
 								verticesBuffer[verticesCounter + 3].nz = -1.0f;
 
-								indicesBuffer[indicesCounter + 0] = verticesCounter + 0;
-								indicesBuffer[indicesCounter + 1] = verticesCounter + 2;
-								indicesBuffer[indicesCounter + 2] = verticesCounter + 1;
-								indicesBuffer[indicesCounter + 3] = verticesCounter + 1;
-								indicesBuffer[indicesCounter + 4] = verticesCounter + 2;
-								indicesBuffer[indicesCounter + 5] = verticesCounter + 3;
-
-								indicesCounter += 6;
-								verticesCounter += 4;
+								if (m_ambientOcclusion)
+								{
+									SetQuadAmbientOcclusion(&verticesBuffer[verticesCounter], ambientOcclusion);
+								}
 							}
+
+							verticesCounter += 4;
 						}
+					}
 
-						// Front
-						if ((mask & 64) == 64)
+					// Front
+					if ((mask & 64) == 64)
+					{
+						if ((merged & MergedSide_Z_Positive) != MergedSide_Z_Positive)
 						{
-							if ((merged & MergedSide_Z_Positive) != MergedSide_Z_Positive)
+							unsigned int ambientOcclusion = m_ambientOcclusion ? GetFaceAmbientOcclusion(pMatrix, x, y, z, QBTFace_Front) : 0;
+
+							bool stopMerging = false;
+							int increaseX = 0;
+							for (unsigned int x1 = x + 1; x1 < pChunk->m_maxX && stopMerging == false; x1++)
 							{
-								bool stopMerging = false;
-								int increaseX = 0;
-								for (unsigned int x1 = x + 1; x1 < pMatrix->m_sizeX && stopMerging == false; x1++)
+								unsigned int colour1 = pMatrix->m_pColour[x1 + pMatrix->m_sizeX * (y + pMatrix->m_sizeY * z)];
+								unsigned int mask1 = pMatrix->m_pVisibilityMask[x1 + pMatrix->m_sizeX * (y + pMatrix->m_sizeY * z)];
+								int merged1 = l_merged[x1 + pMatrix->m_sizeX * (y + pMatrix->m_sizeY * z)];
+
+								if ((merged1 & MergedSide_Z_Positive) == MergedSide_Z_Positive)
+								{
+									stopMerging = true;
+									continue;
+								}
+								if ((mask1 & 64) != 64)
+								{
+									stopMerging = true;
+									continue;
+								}
+								if (colour1 != colour || (m_ambientOcclusion && GetFaceAmbientOcclusion(pMatrix, x1, y, z, QBTFace_Front) != ambientOcclusion))
 								{
-									unsigned int colour1 = pMatrix->m_pColour[x1 + pMatrix->m_sizeX * (y + pMatrix->m_sizeY * z)];
-									unsigned int mask1 = pMatrix->m_pVisibilityMask[x1 + pMatrix->m_sizeX * (y + pMatrix->m_sizeY * z)];
-									int merged1 = l_merged[x1 + pMatrix->m_sizeX * (y + pMatrix->m_sizeY * z)];
+									stopMerging = true;
+									continue;
+								}
 
-									if ((merged1 & MergedSide_Z_Positive) == MergedSide_Z_Positive)
-									{
-										stopMerging = true;
-										continue;
-									}
-									if ((mask1 & 64) != 64)
-									{
-										stopMerging = true;
-										continue;
-									}
-									if (colour1 != colour)
-									{
-										stopMerging = true;
-										continue;
-									}
+								increaseX++;
+								l_merged[x1 + pMatrix->m_sizeX * (y + pMatrix->m_sizeY * z)] |= MergedSide_Z_Positive;
+							}
+
+							stopMerging = false;
+							int increaseY = 0;
+							for (unsigned int y1 = y + 1; y1 < pChunk->m_maxY && stopMerging == false; y1++)
+							{
+								unsigned int colour1 = pMatrix->m_pColour[x + pMatrix->m_sizeX * (y1 + pMatrix->m_sizeY * z)];
+								unsigned int mask1 = pMatrix->m_pVisibilityMask[x + pMatrix->m_sizeX * (y1 + pMatrix->m_sizeY * z)];
+								int merged1 = l_merged[x + pMatrix->m_sizeX * (y1 + pMatrix->m_sizeY * z)];
 
-									increaseX++;
-									l_merged[x1 + pMatrix->m_sizeX * (y + pMatrix->m_sizeY * z)] |= MergedSide_Z_Positive;
+								if ((merged1 & MergedSide_Z_Positive) == MergedSide_Z_Positive)
+								{
+									stopMerging = true;
+									continue;
+								}
+								if ((mask1 & 64) != 64)
+								{
+									stopMerging = true;
+									continue;
+								}
+								if (colour1 != colour || (m_ambientOcclusion && GetFaceAmbientOcclusion(pMatrix, x, y1, z, QBTFace_Front) != ambientOcclusion))
+								{
+									stopMerging = true;
+									continue;
 								}
 
-								stopMerging = false;
-								int increaseY = 0;
-								for (unsigned int y1 = y + 1; y1 < pMatrix->m_sizeY && stopMerging == false; y1++)
+								bool stopMergingX = false;
+								for (int xAdd = 1; xAdd <= increaseX && stopMergingX == false; xAdd++)
 								{
-									unsigned int colour1 = pMatrix->m_pColour[x + pMatrix->m_sizeX * (y1 + pMatrix->m_sizeY * z)];
-									unsigned int mask1 = pMatrix->m_pVisibilityMask[x + pMatrix->m_sizeX * (y1 + pMatrix->m_sizeY * z)];
-									int merged1 = l_merged[x + pMatrix->m_sizeX * (y1 + pMatrix->m_sizeY * z)];
+									unsigned int x1 = x + xAdd;
+
+									unsigned int colour1 = pMatrix->m_pColour[x1 + pMatrix->m_sizeX * (y1 + pMatrix->m_sizeY * z)];
+									unsigned int mask1 = pMatrix->m_pVisibilityMask[x1 + pMatrix->m_sizeX * (y1 + pMatrix->m_sizeY * z)];
+									int merged1 = l_merged[x1 + pMatrix->m_sizeX * (y1 + pMatrix->m_sizeY * z)];
 
 									if ((merged1 & MergedSide_Z_Positive) == MergedSide_Z_Positive)
 									{
-										stopMerging = true;
+										stopMergingX = true;
 										continue;
 									}
 									if ((mask1 & 64) != 64)
 									{
-										stopMerging = true;
+										stopMergingX = true;
 										continue;
 									}
-									if (colour1 != colour)
+									if (colour1 != colour || (m_ambientOcclusion && GetFaceAmbientOcclusion(pMatrix, x1, y1, z, QBTFace_Front) != ambientOcclusion))
 									{
-										stopMerging = true;
+										stopMergingX = true;
 										continue;
 									}
+								}
 
-									bool stopMergingX = false;
-									for (int xAdd = 1; xAdd <= increaseX && stopMergingX == false; xAdd++)
-									{
-										unsigned int x1 = x + xAdd;
-
-										unsigned int colour1 = pMatrix->m_pColour[x1 + pMatrix->m_sizeX * (y1 + pMatrix->m_sizeY * z)];
-										unsigned int mask1 = pMatrix->m_pVisibilityMask[x1 + pMatrix->m_sizeX * (y1 + pMatrix->m_sizeY * z)];
-										int merged1 = l_merged[x1 + pMatrix->m_sizeX * (y1 + pMatrix->m_sizeY * z)];
-
-										if ((merged1 & MergedSide_Z_Positive) == MergedSide_Z_Positive)
-										{
-											stopMergingX = true;
-											continue;
-										}
-										if ((mask1 & 64) != 64)
-										{
-											stopMergingX = true;
-											continue;
-										}
-										if (colour1 != colour)
-										{
-											stopMergingX = true;
-											continue;
-										}
-									}
-
-									if (stopMergingX == true)
-									{
-										stopMerging = true;
-										continue;
-									}
+								if (stopMergingX == true)
+								{
+									stopMerging = true;
+									continue;
+								}
 
-									increaseY++;
-									l_merged[x + pMatrix->m_sizeX * (y1 + pMatrix->m_sizeY * z)] |= MergedSide_Z_Positive;
+								increaseY++;
+								l_merged[x + pMatrix->m_sizeX * (y1 + pMatrix->m_sizeY * z)] |= MergedSide_Z_Positive;
 
-									for (int xAdd = 1; xAdd <= increaseX; xAdd++)
-									{
-										unsigned int x1 = x + xAdd;
-										l_merged[x1 + pMatrix->m_sizeX * (y1 + pMatrix->m_sizeY * z)] |= MergedSide_Z_Positive;
-									}
+								for (int xAdd = 1; xAdd <= increaseX; xAdd++)
+								{
+									unsigned int x1 = x + xAdd;
+									l_merged[x1 + pMatrix->m_sizeX * (y1 + pMatrix->m_sizeY * z)] |= MergedSide_Z_Positive;
 								}
+							}
 
+							if (packVertices)
+							{
+								WritePackedQuad(&packedVerticesBuffer[verticesCounter], QBTFace_Front, x, y, z, increaseX + 1, increaseY + 1, colour, ambientOcclusion);
+							}
+							else
+							{
 								verticesBuffer[verticesCounter + 0].x = x + -0.5f;
 								verticesBuffer[verticesCounter + 0].y = y + -0.5f;
 								verticesBuffer[verticesCounter + 0].z = z + 0.5f;
@@ -1390,8 +1622,8 @@ void QBT::CreateStaticRenderBuffers()
 								verticesBuffer[verticesCounter + 0].ny = 0.0f;
 								verticesBuffer[verticesCounter + 0].nz = 1.0f;
 
-								verticesBuffer[verticesCounter + 1].x = x + 0.5f + (1.0f*increaseX);
-								verticesBuffer[verticesCounter + 1].y = y + -0.5f;
+								verticesBuffer[verticesCounter + 1].x = x + -0.5f;
+								verticesBuffer[verticesCounter + 1].y = y + 0.5f + (1.0f*increaseY);
 								verticesBuffer[verticesCounter + 1].z = z + 0.5f;
 								verticesBuffer[verticesCounter + 1].r = r;
 								verticesBuffer[verticesCounter + 1].g = g;
@@ -1401,8 +1633,8 @@ void QBT::CreateStaticRenderBuffers()
 								verticesBuffer[verticesCounter + 1].ny = 0.0f;
 								verticesBuffer[verticesCounter + 1].nz = 1.0f;
 
-								verticesBuffer[verticesCounter + 2].x = x + -0.5f;
-								verticesBuffer[verticesCounter + 2].y = y + 0.5f + (1.0f*increaseY);
+								verticesBuffer[verticesCounter + 2].x = x + 0.5f + (1.0f*increaseX);
+								verticesBuffer[verticesCounter + 2].y = y + -0.5f;
 								verticesBuffer[verticesCounter + 2].z = z + 0.5f;
 								verticesBuffer[verticesCounter + 2].r = r;
 								verticesBuffer[verticesCounter + 2].g = g;
@@ -1423,117 +1655,123 @@ void QBT::CreateStaticRenderBuffers()
 								verticesBuffer[verticesCounter + 3].ny = 0.0f;
 								verticesBuffer[verticesCounter + 3].nz = 1.0f;
 
-								indicesBuffer[indicesCounter + 0] = verticesCounter + 0;
-								indicesBuffer[indicesCounter + 1] = verticesCounter + 1;
-								indicesBuffer[indicesCounter + 2] = verticesCounter + 2;
-								indicesBuffer[indicesCounter + 3] = verticesCounter + 1;
-								indicesBuffer[indicesCounter + 4] = verticesCounter + 3;
-								indicesBuffer[indicesCounter + 5] = verticesCounter + 2;
-
-								indicesCounter += 6;
-								verticesCounter += 4;
+								if (m_ambientOcclusion)
+								{
+									SetQuadAmbientOcclusion(&verticesBuffer[verticesCounter], ambientOcclusion);
+								}
 							}
+
+							verticesCounter += 4;
 						}
+					}
 
-						// Left
-						if ((mask & 4) == 4)
+					// Left
+					if ((mask & 4) == 4)
+					{
+						if ((merged & MergedSide_X_Negative) != MergedSide_X_Negative)
 						{
-							if ((merged & MergedSide_X_Negative) != MergedSide_X_Negative)
+							unsigned int ambientOcclusion = m_ambientOcclusion ? GetFaceAmbientOcclusion(pMatrix, x, y, z, QBTFace_Left) : 0;
+
+							bool stopMerging = false;
+							int increaseZ = 0;
+							for (unsigned int z1 = z + 1; z1 < pChunk->m_maxZ && stopMerging == false; z1++)
+							{
+								unsigned int colour1 = pMatrix->m_pColour[x + pMatrix->m_sizeX * (y + pMatrix->m_sizeY * z1)];
+								unsigned int mask1 = pMatrix->m_pVisibilityMask[x + pMatrix->m_sizeX * (y + pMatrix->m_sizeY * z1)];
+								int merged1 = l_merged[x + pMatrix->m_sizeX * (y + pMatrix->m_sizeY * z1)];
+
+								if ((merged1 & MergedSide_X_Negative) == MergedSide_X_Negative)
+								{
+									stopMerging = true;
+									continue;
+								}
+								if ((mask1 & 4) != 4)
+								{
+									stopMerging = true;
+									continue;
+								}
+								if (colour1 != colour || (m_ambientOcclusion && GetFaceAmbientOcclusion(pMatrix, x, y, z1, QBTFace_Left) != ambientOcclusion))
+								{
+									stopMerging = true;
+									continue;
+								}
+
+								increaseZ++;
+								l_merged[x + pMatrix->m_sizeX * (y + pMatrix->m_sizeY * z1)] |= MergedSide_X_Negative;
+							}
+
+							stopMerging = false;
+							int increaseY = 0;
+							for (unsigned int y1 = y + 1; y1 < pChunk->m_maxY && stopMerging == false; y1++)
 							{
-								bool stopMerging = false;
-								int increaseZ = 0;
-								for (unsigned int z1 = z + 1; z1 < pMatrix->m_sizeZ && stopMerging == false; z1++)
+								unsigned int colour1 = pMatrix->m_pColour[x + pMatrix->m_sizeX * (y1 + pMatrix->m_sizeY * z)];
+								unsigned int mask1 = pMatrix->m_pVisibilityMask[x + pMatrix->m_sizeX * (y1 + pMatrix->m_sizeY * z)];
+								int merged1 = l_merged[x + pMatrix->m_sizeX * (y1 + pMatrix->m_sizeY * z)];
+
+								if ((merged1 & MergedSide_X_Negative) == MergedSide_X_Negative)
+								{
+									stopMerging = true;
+									continue;
+								}
+								if ((mask1 & 4) != 4)
+								{
+									stopMerging = true;
+									continue;
+								}
+								if (colour1 != colour || (m_ambientOcclusion && GetFaceAmbientOcclusion(pMatrix, x, y1, z, QBTFace_Left) != ambientOcclusion))
 								{
-									unsigned int colour1 = pMatrix->m_pColour[x + pMatrix->m_sizeX * (y + pMatrix->m_sizeY * z1)];
-									unsigned int mask1 = pMatrix->m_pVisibilityMask[x + pMatrix->m_sizeX * (y + pMatrix->m_sizeY * z1)];
-									int merged1 = l_merged[x + pMatrix->m_sizeX * (y + pMatrix->m_sizeY * z1)];
+									stopMerging = true;
+									continue;
+								}
+
+								bool stopMergingZ = false;
+								for (int zAdd = 1; zAdd <= increaseZ && stopMergingZ == false; zAdd++)
+								{
+									unsigned int z1 = z + zAdd;
+
+									unsigned int colour1 = pMatrix->m_pColour[x + pMatrix->m_sizeX * (y1 + pMatrix->m_sizeY * z1)];
+									unsigned int mask1 = pMatrix->m_pVisibilityMask[x + pMatrix->m_sizeX * (y1 + pMatrix->m_sizeY * z1)];
+									int merged1 = l_merged[x + pMatrix->m_sizeX * (y1 + pMatrix->m_sizeY * z1)];
 
 									if ((merged1 & MergedSide_X_Negative) == MergedSide_X_Negative)
 									{
-										stopMerging = true;
+										stopMergingZ = true;
 										continue;
 									}
 									if ((mask1 & 4) != 4)
 									{
-										stopMerging = true;
+										stopMergingZ = true;
 										continue;
 									}
-									if (colour1 != colour)
+									if (colour1 != colour || (m_ambientOcclusion && GetFaceAmbientOcclusion(pMatrix, x, y1, z1, QBTFace_Left) != ambientOcclusion))
 									{
-										stopMerging = true;
+										stopMergingZ = true;
 										continue;
 									}
-
-									increaseZ++;
-									l_merged[x + pMatrix->m_sizeX * (y + pMatrix->m_sizeY * z1)] |= MergedSide_X_Negative;
 								}
 
-								stopMerging = false;
-								int increaseY = 0;
-								for (unsigned int y1 = y + 1; y1 < pMatrix->m_sizeY && stopMerging == false; y1++)
+								if (stopMergingZ == true)
 								{
-									unsigned int colour1 = pMatrix->m_pColour[x + pMatrix->m_sizeX * (y1 + pMatrix->m_sizeY * z)];
-									unsigned int mask1 = pMatrix->m_pVisibilityMask[x + pMatrix->m_sizeX * (y1 + pMatrix->m_sizeY * z)];
-									int merged1 = l_merged[x + pMatrix->m_sizeX * (y1 + pMatrix->m_sizeY * z)];
+									stopMerging = true;
+									continue;
+								}
 
-									if ((merged1 & MergedSide_X_Negative) == MergedSide_X_Negative)
-									{
-										stopMerging = true;
-										continue;
-									}
-									if ((mask1 & 4) != 4)
-									{
-										stopMerging = true;
-										continue;
-									}
-									if (colour1 != colour)
-									{
-										stopMerging = true;
-										continue;
-									}
-
-									bool stopMergingZ = false;
-									for (int zAdd = 1; zAdd <= increaseZ && stopMergingZ == false; zAdd++)
-									{
-										unsigned int z1 = z + zAdd;
-
-										unsigned int colour1 = pMatrix->m_pColour[x + pMatrix->m_sizeX * (y1 + pMatrix->m_sizeY * z1)];
-										unsigned int mask1 = pMatrix->m_pVisibilityMask[x + pMatrix->m_sizeX * (y1 + pMatrix->m_sizeY * z1)];
-										int merged1 = l_merged[x + pMatrix->m_sizeX * (y1 + pMatrix->m_sizeY * z1)];
-
-										if ((merged1 & MergedSide_X_Negative) == MergedSide_X_Negative)
-										{
-											stopMergingZ = true;
-											continue;
-										}
-										if ((mask1 & 4) != 4)
-										{
-											stopMergingZ = true;
-											continue;
-										}
-										if (colour1 != colour)
-										{
-											stopMergingZ = true;
-											continue;
-										}
-									}
-
-									if (stopMergingZ == true)
-									{
-										stopMerging = true;
-										continue;
-									}
+								increaseY++;
+								l_merged[x + pMatrix->m_sizeX * (y1 + pMatrix->m_sizeY * z)] |= MergedSide_X_Negative;
 
-									increaseY++;
-									l_merged[x + pMatrix->m_sizeX * (y1 + pMatrix->m_sizeY * z)] |= MergedSide_X_Negative;
-
-									for (int zAdd = 1; zAdd <= increaseZ; zAdd++)
-									{
-										unsigned int z1 = z + zAdd;
-										l_merged[x + pMatrix->m_sizeX * (y1 + pMatrix->m_sizeY * z1)] |= MergedSide_X_Negative;
-									}
+								for (int zAdd = 1; zAdd <= increaseZ; zAdd++)
+								{
+									unsigned int z1 = z + zAdd;
+									l_merged[x + pMatrix->m_sizeX * (y1 + pMatrix->m_sizeY * z1)] |= MergedSide_X_Negative;
 								}
+							}
 
+							if (packVertices)
+							{
+								WritePackedQuad(&packedVerticesBuffer[verticesCounter], QBTFace_Left, x, y, z, increaseY + 1, increaseZ + 1, colour, ambientOcclusion);
+							}
+							else
+							{
 								verticesBuffer[verticesCounter + 0].x = x + -0.5f;
 								verticesBuffer[verticesCounter + 0].y = y + -0.5f;
 								verticesBuffer[verticesCounter + 0].z = z + -0.5f;
@@ -1546,8 +1784,8 @@ void QBT::CreateStaticRenderBuffers()
 								verticesBuffer[verticesCounter + 0].nz = 0.0f;
 
 								verticesBuffer[verticesCounter + 1].x = x + -0.5f;
-								verticesBuffer[verticesCounter + 1].y = y + -0.5f;
-								verticesBuffer[verticesCounter + 1].z = z + 0.5f + (1.0f*increaseZ);
+								verticesBuffer[verticesCounter + 1].y = y + 0.5f + (1.0f*increaseY);
+								verticesBuffer[verticesCounter + 1].z = z + -0.5f;
 								verticesBuffer[verticesCounter + 1].r = r;
 								verticesBuffer[verticesCounter + 1].g = g;
 								verticesBuffer[verticesCounter + 1].b = b;
@@ -1557,8 +1795,8 @@ void QBT::CreateStaticRenderBuffers()
 								verticesBuffer[verticesCounter + 1].nz = 0.0f;
 
 								verticesBuffer[verticesCounter + 2].x = x + -0.5f;
-								verticesBuffer[verticesCounter + 2].y = y + 0.5f + (1.0f*increaseY);
-								verticesBuffer[verticesCounter + 2].z = z + -0.5f;
+								verticesBuffer[verticesCounter + 2].y = y + -0.5f;
+								verticesBuffer[verticesCounter + 2].z = z + 0.5f + (1.0f*increaseZ);
 								verticesBuffer[verticesCounter + 2].r = r;
 								verticesBuffer[verticesCounter + 2].g = g;
 								verticesBuffer[verticesCounter + 2].b = b;
@@ -1578,117 +1816,123 @@ void QBT::CreateStaticRenderBuffers()
 								verticesBuffer[verticesCounter + 3].ny = 0.0f;
 								verticesBuffer[verticesCounter + 3].nz = 0.0f;
 
-								indicesBuffer[indicesCounter + 0] = verticesCounter + 0;
-								indicesBuffer[indicesCounter + 1] = verticesCounter + 1;
-								indicesBuffer[indicesCounter + 2] = verticesCounter + 2;
-								indicesBuffer[indicesCounter + 3] = verticesCounter + 1;
-								indicesBuffer[indicesCounter + 4] = verticesCounter + 3;
-								indicesBuffer[indicesCounter + 5] = verticesCounter + 2;
-
-								indicesCounter += 6;
-								verticesCounter += 4;
+								if (m_ambientOcclusion)
+								{
+									SetQuadAmbientOcclusion(&verticesBuffer[verticesCounter], ambientOcclusion);
+								}
 							}
+
+							verticesCounter += 4;
 						}
+					}
 
-						// Right
-						if ((mask & 2) == 2)
+					// Right
+					if ((mask & 2) == 2)
+					{
+						if ((merged & MergedSide_X_Positive) != MergedSide_X_Positive)
 						{
-							if ((merged & MergedSide_X_Positive) != MergedSide_X_Positive)
+							unsigned int ambientOcclusion = m_ambientOcclusion ? GetFaceAmbientOcclusion(pMatrix, x, y, z, QBTFace_Right) : 0;
+
+							bool stopMerging = false;
+							int increaseZ = 0;
+							for (unsigned int z1 = z + 1; z1 < pChunk->m_maxZ && stopMerging == false; z1++)
 							{
-								bool stopMerging = false;
-								int increaseZ = 0;
-								for (unsigned int z1 = z + 1; z1 < pMatrix->m_sizeZ && stopMerging == false; z1++)
+								unsigned int colour1 = pMatrix->m_pColour[x + pMatrix->m_sizeX * (y + pMatrix->m_sizeY * z1)];
+								unsigned int mask1 = pMatrix->m_pVisibilityMask[x + pMatrix->m_sizeX * (y + pMatrix->m_sizeY * z1)];
+								int merged1 = l_merged[x + pMatrix->m_sizeX * (y + pMatrix->m_sizeY * z1)];
+
+								if ((merged1 & MergedSide_X_Positive) == MergedSide_X_Positive)
+								{
+									stopMerging = true;
+									continue;
+								}
+								if ((mask1 & 2) != 2)
+								{
+									stopMerging = true;
+									continue;
+								}
+								if (colour1 != colour || (m_ambientOcclusion && GetFaceAmbientOcclusion(pMatrix, x, y, z1, QBTFace_Right) != ambientOcclusion))
 								{
-									unsigned int colour1 = pMatrix->m_pColour[x + pMatrix->m_sizeX * (y + pMatrix->m_sizeY * z1)];
-									unsigned int mask1 = pMatrix->m_pVisibilityMask[x + pMatrix->m_sizeX * (y + pMatrix->m_sizeY * z1)];
-									int merged1 = l_merged[x + pMatrix->m_sizeX * (y + pMatrix->m_sizeY * z1)];
+									stopMerging = true;
+									continue;
+								}
 
-									if ((merged1 & MergedSide_X_Positive) == MergedSide_X_Positive)
-									{
-										stopMerging = true;
-										continue;
-									}
-									if ((mask1 & 2) != 2)
-									{
-										stopMerging = true;
-										continue;
-									}
-									if (colour1 != colour)
-									{
-										stopMerging = true;
-										continue;
-									}
+								increaseZ++;
+								l_merged[x + pMatrix->m_sizeX * (y + pMatrix->m_sizeY * z1)] |= MergedSide_X_Positive;
+							}
 
-									increaseZ++;
-									l_merged[x + pMatrix->m_sizeX * (y + pMatrix->m_sizeY * z1)] |= MergedSide_X_Positive;
+							stopMerging = false;
+							int increaseY = 0;
+							for (unsigned int y1 = y + 1; y1 < pChunk->m_maxY && stopMerging == false; y1++)
+							{
+								unsigned int colour1 = pMatrix->m_pColour[x + pMatrix->m_sizeX * (y1 + pMatrix->m_sizeY * z)];
+								unsigned int mask1 = pMatrix->m_pVisibilityMask[x + pMatrix->m_sizeX * (y1 + pMatrix->m_sizeY * z)];
+								int merged1 = l_merged[x + pMatrix->m_sizeX * (y1 + pMatrix->m_sizeY * z)];
+
+								if ((merged1 & MergedSide_X_Positive) == MergedSide_X_Positive)
+								{
+									stopMerging = true;
+									continue;
+								}
+								if ((mask1 & 2) != 2)
+								{
+									stopMerging = true;
+									continue;
+								}
+								if (colour1 != colour || (m_ambientOcclusion && GetFaceAmbientOcclusion(pMatrix, x, y1, z, QBTFace_Right) != ambientOcclusion))
+								{
+									stopMerging = true;
+									continue;
 								}
 
-								stopMerging = false;
-								int increaseY = 0;
-								for (unsigned int y1 = y + 1; y1 < pMatrix->m_sizeY && stopMerging == false; y1++)
+								bool stopMergingZ = false;
+								for (int zAdd = 1; zAdd <= increaseZ && stopMergingZ == false; zAdd++)
 								{
-									unsigned int colour1 = pMatrix->m_pColour[x + pMatrix->m_sizeX * (y1 + pMatrix->m_sizeY * z)];
-									unsigned int mask1 = pMatrix->m_pVisibilityMask[x + pMatrix->m_sizeX * (y1 + pMatrix->m_sizeY * z)];
-									int merged1 = l_merged[x + pMatrix->m_sizeX * (y1 + pMatrix->m_sizeY * z)];
+									unsigned int z1 = z + zAdd;
+
+									unsigned int colour1 = pMatrix->m_pColour[x + pMatrix->m_sizeX * (y1 + pMatrix->m_sizeY * z1)];
+									unsigned int mask1 = pMatrix->m_pVisibilityMask[x + pMatrix->m_sizeX * (y1 + pMatrix->m_sizeY * z1)];
+									int merged1 = l_merged[x + pMatrix->m_sizeX * (y1 + pMatrix->m_sizeY * z1)];
 
 									if ((merged1 & MergedSide_X_Positive) == MergedSide_X_Positive)
 									{
-										stopMerging = true;
+										stopMergingZ = true;
 										continue;
 									}
 									if ((mask1 & 2) != 2)
 									{
-										stopMerging = true;
+										stopMergingZ = true;
 										continue;
 									}
-									if (colour1 != colour)
+									if (colour1 != colour || (m_ambientOcclusion && GetFaceAmbientOcclusion(pMatrix, x, y1, z1, QBTFace_Right) != ambientOcclusion))
 									{
-										stopMerging = true;
+										stopMergingZ = true;
 										continue;
 									}
+								}
 
-									bool stopMergingZ = false;
-									for (int zAdd = 1; zAdd <= increaseZ && stopMergingZ == false; zAdd++)
-									{
-										unsigned int z1 = z + zAdd;
-
-										unsigned int colour1 = pMatrix->m_pColour[x + pMatrix->m_sizeX * (y1 + pMatrix->m_sizeY * z1)];
-										unsigned int mask1 = pMatrix->m_pVisibilityMask[x + pMatrix->m_sizeX * (y1 + pMatrix->m_sizeY * z1)];
-										int merged1 = l_merged[x + pMatrix->m_sizeX * (y1 + pMatrix->m_sizeY * z1)];
-
-										if ((merged1 & MergedSide_X_Positive) == MergedSide_X_Positive)
-										{
-											stopMergingZ = true;
-											continue;
-										}
-										if ((mask1 & 2) != 2)
-										{
-											stopMergingZ = true;
-											continue;
-										}
-										if (colour1 != colour)
-										{
-											stopMergingZ = true;
-											continue;
-										}
-									}
-
-									if (stopMergingZ == true)
-									{
-										stopMerging = true;
-										continue;
-									}
+								if (stopMergingZ == true)
+								{
+									stopMerging = true;
+									continue;
+								}
 
-									increaseY++;
-									l_merged[x + pMatrix->m_sizeX * (y1 + pMatrix->m_sizeY * z)] |= MergedSide_X_Positive;
+								increaseY++;
+								l_merged[x + pMatrix->m_sizeX * (y1 + pMatrix->m_sizeY * z)] |= MergedSide_X_Positive;
 
-									for (int zAdd = 1; zAdd <= increaseZ; zAdd++)
-									{
-										unsigned int z1 = z + zAdd;
-										l_merged[x + pMatrix->m_sizeX * (y1 + pMatrix->m_sizeY * z1)] |= MergedSide_X_Positive;
-									}
+								for (int zAdd = 1; zAdd <= increaseZ; zAdd++)
+								{
+									unsigned int z1 = z + zAdd;
+									l_merged[x + pMatrix->m_sizeX * (y1 + pMatrix->m_sizeY * z1)] |= MergedSide_X_Positive;
 								}
+							}
 
+							if (packVertices)
+							{
+								WritePackedQuad(&packedVerticesBuffer[verticesCounter], QBTFace_Right, x, y, z, increaseY + 1, increaseZ + 1, colour, ambientOcclusion);
+							}
+							else
+							{
 								verticesBuffer[verticesCounter + 0].x = x + 0.5f;
 								verticesBuffer[verticesCounter + 0].y = y + -0.5f;
 								verticesBuffer[verticesCounter + 0].z = z + -0.5f;
@@ -1733,117 +1977,123 @@ void QBT::CreateStaticRenderBuffers()
 								verticesBuffer[verticesCounter + 3].ny = 0.0f;
 								verticesBuffer[verticesCounter + 3].nz = 0.0f;
 
-								indicesBuffer[indicesCounter + 0] = verticesCounter + 0;
-								indicesBuffer[indicesCounter + 1] = verticesCounter + 2;
-								indicesBuffer[indicesCounter + 2] = verticesCounter + 1;
-								indicesBuffer[indicesCounter + 3] = verticesCounter + 1;
-								indicesBuffer[indicesCounter + 4] = verticesCounter + 2;
-								indicesBuffer[indicesCounter + 5] = verticesCounter + 3;
-
-								indicesCounter += 6;
-								verticesCounter += 4;
+								if (m_ambientOcclusion)
+								{
+									SetQuadAmbientOcclusion(&verticesBuffer[verticesCounter], ambientOcclusion);
+								}
 							}
+
+							verticesCounter += 4;
 						}
+					}
 
-						// Top
-						if ((mask & 8) == 8)
+					// Top
+					if ((mask & 8) == 8)
+					{
+						if ((merged & MergedSide_Y_Positive) != MergedSide_Y_Positive)
 						{
-							if ((merged & MergedSide_Y_Positive) != MergedSide_Y_Positive)
+							unsigned int ambientOcclusion = m_ambientOcclusion ? GetFaceAmbientOcclusion(pMatrix, x, y, z, QBTFace_Top) : 0;
+
+							bool stopMerging = false;
+							int increaseZ = 0;
+							for (unsigned int z1 = z + 1; z1 < pChunk->m_maxZ && stopMerging == false; z1++)
 							{
-								bool stopMerging = false;
-								int increaseZ = 0;
-								for (unsigned int z1 = z + 1; z1 < pMatrix->m_sizeZ && stopMerging == false; z1++)
+								unsigned int colour1 = pMatrix->m_pColour[x + pMatrix->m_sizeX * (y + pMatrix->m_sizeY * z1)];
+								unsigned int mask1 = pMatrix->m_pVisibilityMask[x + pMatrix->m_sizeX * (y + pMatrix->m_sizeY * z1)];
+								int merged1 = l_merged[x + pMatrix->m_sizeX * (y + pMatrix->m_sizeY * z1)];
+
+								if ((merged1 & MergedSide_Y_Positive) == MergedSide_Y_Positive)
+								{
+									stopMerging = true;
+									continue;
+								}
+								if ((mask1 & 8) != 8)
+								{
+									stopMerging = true;
+									continue;
+								}
+								if (colour1 != colour || (m_ambientOcclusion && GetFaceAmbientOcclusion(pMatrix, x, y, z1, QBTFace_Top) != ambientOcclusion))
 								{
-									unsigned int colour1 = pMatrix->m_pColour[x + pMatrix->m_sizeX * (y + pMatrix->m_sizeY * z1)];
-									unsigned int mask1 = pMatrix->m_pVisibilityMask[x + pMatrix->m_sizeX * (y + pMatrix->m_sizeY * z1)];
-									int merged1 = l_merged[x + pMatrix->m_sizeX * (y + pMatrix->m_sizeY * z1)];
+									stopMerging = true;
+									continue;
+								}
 
-									if ((merged1 & MergedSide_Y_Positive) == MergedSide_Y_Positive)
-									{
-										stopMerging = true;
-										continue;
-									}
-									if ((mask1 & 8) != 8)
-									{
-										stopMerging = true;
-										continue;
-									}
-									if (colour1 != colour)
-									{
-										stopMerging = true;
-										continue;
-									}
+								increaseZ++;
+								l_merged[x + pMatrix->m_sizeX * (y + pMatrix->m_sizeY * z1)] |= MergedSide_Y_Positive;
+							}
+
+							stopMerging = false;
+							int increaseX = 0;
+							for (unsigned int x1 = x + 1; x1 < pChunk->m_maxX && stopMerging == false; x1++)
+							{
+								unsigned int colour1 = pMatrix->m_pColour[x1 + pMatrix->m_sizeX * (y + pMatrix->m_sizeY * z)];
+								unsigned int mask1 = pMatrix->m_pVisibilityMask[x1 + pMatrix->m_sizeX * (y + pMatrix->m_sizeY * z)];
+								int merged1 = l_merged[x1 + pMatrix->m_sizeX * (y + pMatrix->m_sizeY * z)];
 
-									increaseZ++;
-									l_merged[x + pMatrix->m_sizeX * (y + pMatrix->m_sizeY * z1)] |= MergedSide_Y_Positive;
+								if ((merged1 & MergedSide_Y_Positive) == MergedSide_Y_Positive)
+								{
+									stopMerging = true;
+									continue;
+								}
+								if ((mask1 & 8) != 8)
+								{
+									stopMerging = true;
+									continue;
+								}
+								if (colour1 != colour || (m_ambientOcclusion && GetFaceAmbientOcclusion(pMatrix, x1, y, z, QBTFace_Top) != ambientOcclusion))
+								{
+									stopMerging = true;
+									continue;
 								}
 
-								stopMerging = false;
-								int increaseX = 0;
-								for (unsigned int x1 = x + 1; x1 < pMatrix->m_sizeX && stopMerging == false; x1++)
+								bool stopMergingZ = false;
+								for (int zAdd = 1; zAdd <= increaseZ && stopMergingZ == false; zAdd++)
 								{
-									unsigned int colour1 = pMatrix->m_pColour[x1 + pMatrix->m_sizeX * (y + pMatrix->m_sizeY * z)];
-									unsigned int mask1 = pMatrix->m_pVisibilityMask[x1 + pMatrix->m_sizeX * (y + pMatrix->m_sizeY * z)];
-									int merged1 = l_merged[x1 + pMatrix->m_sizeX * (y + pMatrix->m_sizeY * z)];
+									unsigned int z1 = z + zAdd;
+
+									unsigned int colour1 = pMatrix->m_pColour[x1 + pMatrix->m_sizeX * (y + pMatrix->m_sizeY * z1)];
+									unsigned int mask1 = pMatrix->m_pVisibilityMask[x1 + pMatrix->m_sizeX * (y + pMatrix->m_sizeY * z1)];
+									int merged1 = l_merged[x1 + pMatrix->m_sizeX * (y + pMatrix->m_sizeY * z1)];
 
 									if ((merged1 & MergedSide_Y_Positive) == MergedSide_Y_Positive)
 									{
-										stopMerging = true;
+										stopMergingZ = true;
 										continue;
 									}
 									if ((mask1 & 8) != 8)
 									{
-										stopMerging = true;
+										stopMergingZ = true;
 										continue;
 									}
-									if (colour1 != colour)
+									if (colour1 != colour || (m_ambientOcclusion && GetFaceAmbientOcclusion(pMatrix, x1, y, z1, QBTFace_Top) != ambientOcclusion))
 									{
-										stopMerging = true;
+										stopMergingZ = true;
 										continue;
 									}
+								}
 
-									bool stopMergingZ = false;
-									for (int zAdd = 1; zAdd <= increaseZ && stopMergingZ == false; zAdd++)
-									{
-										unsigned int z1 = z + zAdd;
-
-										unsigned int colour1 = pMatrix->m_pColour[x1 + pMatrix->m_sizeX * (y + pMatrix->m_sizeY * z1)];
-										unsigned int mask1 = pMatrix->m_pVisibilityMask[x1 + pMatrix->m_sizeX * (y + pMatrix->m_sizeY * z1)];
-										int merged1 = l_merged[x1 + pMatrix->m_sizeX * (y + pMatrix->m_sizeY * z1)];
-
-										if ((merged1 & MergedSide_Y_Positive) == MergedSide_Y_Positive)
-										{
-											stopMergingZ = true;
-											continue;
-										}
-										if ((mask1 & 8) != 8)
-										{
-											stopMergingZ = true;
-											continue;
-										}
-										if (colour1 != colour)
-										{
-											stopMergingZ = true;
-											continue;
-										}
-									}
-
-									if (stopMergingZ == true)
-									{
-										stopMerging = true;
-										continue;
-									}
+								if (stopMergingZ == true)
+								{
+									stopMerging = true;
+									continue;
+								}
 
-									increaseX++;
-									l_merged[x1 + pMatrix->m_sizeX * (y + pMatrix->m_sizeY * z)] |= MergedSide_Y_Positive;
+								increaseX++;
+								l_merged[x1 + pMatrix->m_sizeX * (y + pMatrix->m_sizeY * z)] |= MergedSide_Y_Positive;
 
-									for (int zAdd = 1; zAdd <= increaseZ; zAdd++)
-									{
-										unsigned int z1 = z + zAdd;
-										l_merged[x1 + pMatrix->m_sizeX * (y + pMatrix->m_sizeY * z1)] |= MergedSide_Y_Positive;
-									}
+								for (int zAdd = 1; zAdd <= increaseZ; zAdd++)
+								{
+									unsigned int z1 = z + zAdd;
+									l_merged[x1 + pMatrix->m_sizeX * (y + pMatrix->m_sizeY * z1)] |= MergedSide_Y_Positive;
 								}
+							}
 
+							if (packVertices)
+							{
+								WritePackedQuad(&packedVerticesBuffer[verticesCounter], QBTFace_Top, x, y, z, increaseX + 1, increaseZ + 1, colour, ambientOcclusion);
+							}
+							else
+							{
 								verticesBuffer[verticesCounter + 0].x = x + -0.5f;
 								verticesBuffer[verticesCounter + 0].y = y + 0.5f;
 								verticesBuffer[verticesCounter + 0].z = z + 0.5f + (1.0f*increaseZ);
@@ -1855,9 +2105,9 @@ void QBT::CreateStaticRenderBuffers()
 								verticesBuffer[verticesCounter + 0].ny = 1.0f;
 								verticesBuffer[verticesCounter + 0].nz = 0.0f;
 
-								verticesBuffer[verticesCounter + 1].x = x + 0.5f + (1.0f*increaseX);
+								verticesBuffer[verticesCounter + 1].x = x + -0.5f;
 								verticesBuffer[verticesCounter + 1].y = y + 0.5f;
-								verticesBuffer[verticesCounter + 1].z = z + 0.5f + (1.0f*increaseZ);
+								verticesBuffer[verticesCounter + 1].z = z + -0.5f;
 								verticesBuffer[verticesCounter + 1].r = r;
 								verticesBuffer[verticesCounter + 1].g = g;
 								verticesBuffer[verticesCounter + 1].b = b;
@@ -1866,9 +2116,9 @@ void QBT::CreateStaticRenderBuffers()
 								verticesBuffer[verticesCounter + 1].ny = 1.0f;
 								verticesBuffer[verticesCounter + 1].nz = 0.0f;
 
-								verticesBuffer[verticesCounter + 2].x = x + -0.5f;
+								verticesBuffer[verticesCounter + 2].x = x + 0.5f + (1.0f*increaseX);
 								verticesBuffer[verticesCounter + 2].y = y + 0.5f;
-								verticesBuffer[verticesCounter + 2].z = z + -0.5f;
+								verticesBuffer[verticesCounter + 2].z = z + 0.5f + (1.0f*increaseZ);
 								verticesBuffer[verticesCounter + 2].r = r;
 								verticesBuffer[verticesCounter + 2].g = g;
 								verticesBuffer[verticesCounter + 2].b = b;
@@ -1888,117 +2138,123 @@ void QBT::CreateStaticRenderBuffers()
 								verticesBuffer[verticesCounter + 3].ny = 1.0f;
 								verticesBuffer[verticesCounter + 3].nz = 0.0f;
 
-								indicesBuffer[indicesCounter + 0] = verticesCounter + 0;
-								indicesBuffer[indicesCounter + 1] = verticesCounter + 1;
-								indicesBuffer[indicesCounter + 2] = verticesCounter + 2;
-								indicesBuffer[indicesCounter + 3] = verticesCounter + 1;
-								indicesBuffer[indicesCounter + 4] = verticesCounter + 3;
-								indicesBuffer[indicesCounter + 5] = verticesCounter + 2;
-
-								indicesCounter += 6;
-								verticesCounter += 4;
+								if (m_ambientOcclusion)
+								{
+									SetQuadAmbientOcclusion(&verticesBuffer[verticesCounter], ambientOcclusion);
+								}
 							}
+
+							verticesCounter += 4;
 						}
+					}
 
-						// Bottom
-						if ((mask & 16) == 16)
+					// Bottom
+					if ((mask & 16) == 16)
+					{
+						if ((merged & MergedSide_Y_Negative) != MergedSide_Y_Negative)
 						{
-							if ((merged & MergedSide_Y_Negative) != MergedSide_Y_Negative)
+							unsigned int ambientOcclusion = m_ambientOcclusion ? GetFaceAmbientOcclusion(pMatrix, x, y, z, QBTFace_Bottom) : 0;
+
+							bool stopMerging = false;
+							int increaseZ = 0;
+							for (unsigned int z1 = z + 1; z1 < pChunk->m_maxZ && stopMerging == false; z1++)
 							{
-								bool stopMerging = false;
-								int increaseZ = 0;
-								for (unsigned int z1 = z + 1; z1 < pMatrix->m_sizeZ && stopMerging == false; z1++)
+								unsigned int colour1 = pMatrix->m_pColour[x + pMatrix->m_sizeX * (y + pMatrix->m_sizeY * z1)];
+								unsigned int mask1 = pMatrix->m_pVisibilityMask[x + pMatrix->m_sizeX * (y + pMatrix->m_sizeY * z1)];
+								int merged1 = l_merged[x + pMatrix->m_sizeX * (y + pMatrix->m_sizeY * z1)];
+
+								if ((merged1 & MergedSide_Y_Negative) == MergedSide_Y_Negative)
+								{
+									stopMerging = true;
+									continue;
+								}
+								if ((mask1 & 16) != 16)
+								{
+									stopMerging = true;
+									continue;
+								}
+								if (colour1 != colour || (m_ambientOcclusion && GetFaceAmbientOcclusion(pMatrix, x, y, z1, QBTFace_Bottom) != ambientOcclusion))
 								{
-									unsigned int colour1 = pMatrix->m_pColour[x + pMatrix->m_sizeX * (y + pMatrix->m_sizeY * z1)];
-									unsigned int mask1 = pMatrix->m_pVisibilityMask[x + pMatrix->m_sizeX * (y + pMatrix->m_sizeY * z1)];
-									int merged1 = l_merged[x + pMatrix->m_sizeX * (y + pMatrix->m_sizeY * z1)];
+									stopMerging = true;
+									continue;
+								}
 
-									if ((merged1 & MergedSide_Y_Negative) == MergedSide_Y_Negative)
-									{
-										stopMerging = true;
-										continue;
-									}
-									if ((mask1 & 16) != 16)
-									{
-										stopMerging = true;
-										continue;
-									}
-									if (colour1 != colour)
-									{
-										stopMerging = true;
-										continue;
-									}
+								increaseZ++;
+								l_merged[x + pMatrix->m_sizeX * (y + pMatrix->m_sizeY * z1)] |= MergedSide_Y_Negative;
+							}
+
+							stopMerging = false;
+							int increaseX = 0;
+							for (unsigned int x1 = x + 1; x1 < pChunk->m_maxX && stopMerging == false; x1++)
+							{
+								unsigned int colour1 = pMatrix->m_pColour[x1 + pMatrix->m_sizeX * (y + pMatrix->m_sizeY * z)];
+								unsigned int mask1 = pMatrix->m_pVisibilityMask[x1 + pMatrix->m_sizeX * (y + pMatrix->m_sizeY * z)];
+								int merged1 = l_merged[x1 + pMatrix->m_sizeX * (y + pMatrix->m_sizeY * z)];
 
-									increaseZ++;
-									l_merged[x + pMatrix->m_sizeX * (y + pMatrix->m_sizeY * z1)] |= MergedSide_Y_Negative;
+								if ((merged1 & MergedSide_Y_Negative) == MergedSide_Y_Negative)
+								{
+									stopMerging = true;
+									continue;
+								}
+								if ((mask1 & 16) != 16)
+								{
+									stopMerging = true;
+									continue;
+								}
+								if (colour1 != colour || (m_ambientOcclusion && GetFaceAmbientOcclusion(pMatrix, x1, y, z, QBTFace_Bottom) != ambientOcclusion))
+								{
+									stopMerging = true;
+									continue;
 								}
 
-								stopMerging = false;
-								int increaseX = 0;
-								for (unsigned int x1 = x + 1; x1 < pMatrix->m_sizeX && stopMerging == false; x1++)
+								bool stopMergingZ = false;
+								for (int zAdd = 1; zAdd <= increaseZ && stopMergingZ == false; zAdd++)
 								{
-									unsigned int colour1 = pMatrix->m_pColour[x1 + pMatrix->m_sizeX * (y + pMatrix->m_sizeY * z)];
-									unsigned int mask1 = pMatrix->m_pVisibilityMask[x1 + pMatrix->m_sizeX * (y + pMatrix->m_sizeY * z)];
-									int merged1 = l_merged[x1 + pMatrix->m_sizeX * (y + pMatrix->m_sizeY * z)];
+									unsigned int z1 = z + zAdd;
+
+									unsigned int colour1 = pMatrix->m_pColour[x1 + pMatrix->m_sizeX * (y + pMatrix->m_sizeY * z1)];
+									unsigned int mask1 = pMatrix->m_pVisibilityMask[x1 + pMatrix->m_sizeX * (y + pMatrix->m_sizeY * z1)];
+									int merged1 = l_merged[x1 + pMatrix->m_sizeX * (y + pMatrix->m_sizeY * z1)];
 
 									if ((merged1 & MergedSide_Y_Negative) == MergedSide_Y_Negative)
 									{
-										stopMerging = true;
+										stopMergingZ = true;
 										continue;
 									}
 									if ((mask1 & 16) != 16)
 									{
-										stopMerging = true;
+										stopMergingZ = true;
 										continue;
 									}
-									if (colour1 != colour)
+									if (colour1 != colour || (m_ambientOcclusion && GetFaceAmbientOcclusion(pMatrix, x1, y, z1, QBTFace_Bottom) != ambientOcclusion))
 									{
-										stopMerging = true;
+										stopMergingZ = true;
 										continue;
 									}
+								}
 
-									bool stopMergingZ = false;
-									for (int zAdd = 1; zAdd <= increaseZ && stopMergingZ == false; zAdd++)
-									{
-										unsigned int z1 = z + zAdd;
-
-										unsigned int colour1 = pMatrix->m_pColour[x1 + pMatrix->m_sizeX * (y + pMatrix->m_sizeY * z1)];
-										unsigned int mask1 = pMatrix->m_pVisibilityMask[x1 + pMatrix->m_sizeX * (y + pMatrix->m_sizeY * z1)];
-										int merged1 = l_merged[x1 + pMatrix->m_sizeX * (y + pMatrix->m_sizeY * z1)];
-
-										if ((merged1 & MergedSide_Y_Negative) == MergedSide_Y_Negative)
-										{
-											stopMergingZ = true;
-											continue;
-										}
-										if ((mask1 & 16) != 16)
-										{
-											stopMergingZ = true;
-											continue;
-										}
-										if (colour1 != colour)
-										{
-											stopMergingZ = true;
-											continue;
-										}
-									}
-
-									if (stopMergingZ == true)
-									{
-										stopMerging = true;
-										continue;
-									}
+								if (stopMergingZ == true)
+								{
+									stopMerging = true;
+									continue;
+								}
 
-									increaseX++;
-									l_merged[x1 + pMatrix->m_sizeX * (y + pMatrix->m_sizeY * z)] |= MergedSide_Y_Negative;
+								increaseX++;
+								l_merged[x1 + pMatrix->m_sizeX * (y + pMatrix->m_sizeY * z)] |= MergedSide_Y_Negative;
 
-									for (int zAdd = 1; zAdd <= increaseZ; zAdd++)
-									{
-										unsigned int z1 = z + zAdd;
-										l_merged[x1 + pMatrix->m_sizeX * (y + pMatrix->m_sizeY * z1)] |= MergedSide_Y_Negative;
-									}
+								for (int zAdd = 1; zAdd <= increaseZ; zAdd++)
+								{
+									unsigned int z1 = z + zAdd;
+									l_merged[x1 + pMatrix->m_sizeX * (y + pMatrix->m_sizeY * z1)] |= MergedSide_Y_Negative;
 								}
+							}
 
+							if (packVertices)
+							{
+								WritePackedQuad(&packedVerticesBuffer[verticesCounter], QBTFace_Bottom, x, y, z, increaseX + 1, increaseZ + 1, colour, ambientOcclusion);
+							}
+							else
+							{
 								verticesBuffer[verticesCounter + 0].x = x + -0.5f;
 								verticesBuffer[verticesCounter + 0].y = y + -0.5f;
 								verticesBuffer[verticesCounter + 0].z = z + 0.5f + (1.0f*increaseZ);
@@ -2043,54 +2299,64 @@ void QBT::CreateStaticRenderBuffers()
 								verticesBuffer[verticesCounter + 3].ny = -1.0f;
 								verticesBuffer[verticesCounter + 3].nz = 0.0f;
 
-								indicesBuffer[indicesCounter + 0] = verticesCounter + 0;
-								indicesBuffer[indicesCounter + 1] = verticesCounter + 2;
-								indicesBuffer[indicesCounter + 2] = verticesCounter + 1;
-								indicesBuffer[indicesCounter + 3] = verticesCounter + 1;
-								indicesBuffer[indicesCounter + 4] = verticesCounter + 2;
-								indicesBuffer[indicesCounter + 5] = verticesCounter + 3;
-
-								indicesCounter += 6;
-								verticesCounter += 4;
+								if (m_ambientOcclusion)
+								{
+									SetQuadAmbientOcclusion(&verticesBuffer[verticesCounter], ambientOcclusion);
+								}
 							}
+
+							verticesCounter += 4;
 						}
 					}
 				}
 			}
 		}
-		else
+	}
+	else
+	{
+		for (unsigned int x = pChunk->m_minX; x < pChunk->m_maxX; x++)
 		{
-			unsigned int verticesCounter = 0;
-			unsigned int indicesCounter = 0;
-			for (unsigned int x = 0; x < pMatrix->m_sizeX; x++)
+			for (unsigned int y = pChunk->m_minY; y < pChunk->m_maxY; y++)
 			{
-				for (unsigned int y = 0; y < pMatrix->m_sizeY; y++)
+				for (unsigned int z = pChunk->m_minZ; z < pChunk->m_maxZ; z++)
 				{
-					for (unsigned int z = 0; z < pMatrix->m_sizeZ; z++)
+					unsigned int colour = pMatrix->m_pColour[x + pMatrix->m_sizeX * (y + pMatrix->m_sizeY * z)];
+					unsigned int mask = pMatrix->m_pVisibilityMask[x + pMatrix->m_sizeX * (y + pMatrix->m_sizeY * z)];
+					unsigned int alpha = (colour & 0xFF000000) >> 24;
+					unsigned int blue = (colour & 0x00FF0000) >> 16;
+					unsigned int green = (colour & 0x0000FF00) >> 8;
+					unsigned int red = (colour & 0x000000FF);
+
+					if (mask == 0)
 					{
-						unsigned int colour = pMatrix->m_pColour[x + pMatrix->m_sizeX * (y + pMatrix->m_sizeY * z)];
-						unsigned int mask = pMatrix->m_pVisibilityMask[x + pMatrix->m_sizeX * (y + pMatrix->m_sizeY * z)];
-						unsigned int alpha = (colour & 0xFF000000) >> 24;
-						unsigned int blue = (colour & 0x00FF0000) >> 16;
-						unsigned int green = (colour & 0x0000FF00) >> 8;
-						unsigned int red = (colour & 0x000000FF);
-
-						if (mask == 0)
-						{
-							continue;
-						}
+						continue;
+					}
 
-						if (mask == 1 && m_createInnerVoxels == false)
-						{
-							continue;
-						}
+					if (mask == 1 && m_createInnerVoxels == false)
+					{
+						continue;
+					}
+
+					// Make sure there is room for a quad on every side of this voxel
+					if (verticesCounter + 24 > arenaVertices)
+					{
+						arenaVertices = GrowMeshArenas(verticesCounter + 24, packVertices);
+						verticesBuffer = m_vertexArena.data();
+						packedVerticesBuffer = m_packedVertexArena.data();
+					}
 
-						float r = (float)(red / 255.0f);
-						float g = (float)(green / 255.0f);
-						float b = (float)(blue / 255.0f);
+					float r = (float)(red / 255.0f);
+					float g = (float)(green / 255.0f);
+					float b = (float)(blue / 255.0f);
 
-						// Back
-						if (m_createInnerFaces == true || (mask & 32) == 32)
+					// Back
+					if (m_createInnerFaces == true || (mask & 32) == 32)
+					{
+						if (packVertices)
+						{
+							WritePackedQuad(&packedVerticesBuffer[verticesCounter], QBTFace_Back, x, y, z, 1, 1, colour, m_ambientOcclusion ? GetFaceAmbientOcclusion(pMatrix, x, y, z, QBTFace_Back) : 0);
+						}
+						else
 						{
 							verticesBuffer[verticesCounter + 0].x = x + -0.5f;
 							verticesBuffer[verticesCounter + 0].y = y + -0.5f;
@@ -2136,19 +2402,23 @@ void QBT::CreateStaticRenderBuffers()
 							verticesBuffer[verticesCounter + 3].ny = 0.0f;
 							verticesBuffer[verticesCounter + 3].nz = -1.0f;
 
-							indicesBuffer[indicesCounter + 0] = verticesCounter + 0;
-							indicesBuffer[indicesCounter + 1] = verticesCounter + 2;
-							indicesBuffer[indicesCounter + 2] = verticesCounter + 1;
-							indicesBuffer[indicesCounter + 3] = verticesCounter + 1;
-							indicesBuffer[indicesCounter + 4] = verticesCounter + 2;
-							indicesBuffer[indicesCounter + 5] = verticesCounter + 3;
-
-							indicesCounter += 6;
-							verticesCounter += 4;
+							if (m_ambientOcclusion)
+							{
+								SetQuadAmbientOcclusion(&verticesBuffer[verticesCounter], GetFaceAmbientOcclusion(pMatrix, x, y, z, QBTFace_Back));
+							}
 						}
 
-						// Front
-						if (m_createInnerFaces == true || (mask & 64) == 64)
+						verticesCounter += 4;
+					}
+
+					// Front
+					if (m_createInnerFaces == true || (mask & 64) == 64)
+					{
+						if (packVertices)
+						{
+							WritePackedQuad(&packedVerticesBuffer[verticesCounter], QBTFace_Front, x, y, z, 1, 1, colour, m_ambientOcclusion ? GetFaceAmbientOcclusion(pMatrix, x, y, z, QBTFace_Front) : 0);
+						}
+						else
 						{
 							verticesBuffer[verticesCounter + 0].x = x + -0.5f;
 							verticesBuffer[verticesCounter + 0].y = y + -0.5f;
@@ -2161,8 +2431,8 @@ void QBT::CreateStaticRenderBuffers()
 							verticesBuffer[verticesCounter + 0].ny = 0.0f;
 							verticesBuffer[verticesCounter + 0].nz = 1.0f;
 
-							verticesBuffer[verticesCounter + 1].x = x + 0.5f;
-							verticesBuffer[verticesCounter + 1].y = y + -0.5f;
+							verticesBuffer[verticesCounter + 1].x = x + -0.5f;
+							verticesBuffer[verticesCounter + 1].y = y + 0.5f;
 							verticesBuffer[verticesCounter + 1].z = z + 0.5f;
 							verticesBuffer[verticesCounter + 1].r = r;
 							verticesBuffer[verticesCounter + 1].g = g;
@@ -2172,8 +2442,8 @@ void QBT::CreateStaticRenderBuffers()
 							verticesBuffer[verticesCounter + 1].ny = 0.0f;
 							verticesBuffer[verticesCounter + 1].nz = 1.0f;
 
-							verticesBuffer[verticesCounter + 2].x = x + -0.5f;
-							verticesBuffer[verticesCounter + 2].y = y + 0.5f;
+							verticesBuffer[verticesCounter + 2].x = x + 0.5f;
+							verticesBuffer[verticesCounter + 2].y = y + -0.5f;
 							verticesBuffer[verticesCounter + 2].z = z + 0.5f;
 							verticesBuffer[verticesCounter + 2].r = r;
 							verticesBuffer[verticesCounter + 2].g = g;
@@ -2194,19 +2464,23 @@ void QBT::CreateStaticRenderBuffers()
 							verticesBuffer[verticesCounter + 3].ny = 0.0f;
 							verticesBuffer[verticesCounter + 3].nz = 1.0f;
 
-							indicesBuffer[indicesCounter + 0] = verticesCounter + 0;
-							indicesBuffer[indicesCounter + 1] = verticesCounter + 1;
-							indicesBuffer[indicesCounter + 2] = verticesCounter + 2;
-							indicesBuffer[indicesCounter + 3] = verticesCounter + 1;
-							indicesBuffer[indicesCounter + 4] = verticesCounter + 3;
-							indicesBuffer[indicesCounter + 5] = verticesCounter + 2;
-
-							indicesCounter += 6;
-							verticesCounter += 4;
+							if (m_ambientOcclusion)
+							{
+								SetQuadAmbientOcclusion(&verticesBuffer[verticesCounter], GetFaceAmbientOcclusion(pMatrix, x, y, z, QBTFace_Front));
+							}
 						}
 
-						// Left
-						if (m_createInnerFaces == true || (mask & 4) == 4)
+						verticesCounter += 4;
+					}
+
+					// Left
+					if (m_createInnerFaces == true || (mask & 4) == 4)
+					{
+						if (packVertices)
+						{
+							WritePackedQuad(&packedVerticesBuffer[verticesCounter], QBTFace_Left, x, y, z, 1, 1, colour, m_ambientOcclusion ? GetFaceAmbientOcclusion(pMatrix, x, y, z, QBTFace_Left) : 0);
+						}
+						else
 						{
 							verticesBuffer[verticesCounter + 0].x = x + -0.5f;
 							verticesBuffer[verticesCounter + 0].y = y + -0.5f;
@@ -2220,8 +2494,8 @@ void QBT::CreateStaticRenderBuffers()
 							verticesBuffer[verticesCounter + 0].nz = 0.0f;
 
 							verticesBuffer[verticesCounter + 1].x = x + -0.5f;
-							verticesBuffer[verticesCounter + 1].y = y + -0.5f;
-							verticesBuffer[verticesCounter + 1].z = z + 0.5f;
+							verticesBuffer[verticesCounter + 1].y = y + 0.5f;
+							verticesBuffer[verticesCounter + 1].z = z + -0.5f;
 							verticesBuffer[verticesCounter + 1].r = r;
 							verticesBuffer[verticesCounter + 1].g = g;
 							verticesBuffer[verticesCounter + 1].b = b;
@@ -2231,8 +2505,8 @@ void QBT::CreateStaticRenderBuffers()
 							verticesBuffer[verticesCounter + 1].nz = 0.0f;
 
 							verticesBuffer[verticesCounter + 2].x = x + -0.5f;
-							verticesBuffer[verticesCounter + 2].y = y + 0.5f;
-							verticesBuffer[verticesCounter + 2].z = z + -0.5f;
+							verticesBuffer[verticesCounter + 2].y = y + -0.5f;
+							verticesBuffer[verticesCounter + 2].z = z + 0.5f;
 							verticesBuffer[verticesCounter + 2].r = r;
 							verticesBuffer[verticesCounter + 2].g = g;
 							verticesBuffer[verticesCounter + 2].b = b;
@@ -2252,19 +2526,23 @@ void QBT::CreateStaticRenderBuffers()
 							verticesBuffer[verticesCounter + 3].ny = 0.0f;
 							verticesBuffer[verticesCounter + 3].nz = 0.0f;
 
-							indicesBuffer[indicesCounter + 0] = verticesCounter + 0;
-							indicesBuffer[indicesCounter + 1] = verticesCounter + 1;
-							indicesBuffer[indicesCounter + 2] = verticesCounter + 2;
-							indicesBuffer[indicesCounter + 3] = verticesCounter + 1;
-							indicesBuffer[indicesCounter + 4] = verticesCounter + 3;
-							indicesBuffer[indicesCounter + 5] = verticesCounter + 2;
-
-							indicesCounter += 6;
-							verticesCounter += 4;
+							if (m_ambientOcclusion)
+							{
+								SetQuadAmbientOcclusion(&verticesBuffer[verticesCounter], GetFaceAmbientOcclusion(pMatrix, x, y, z, QBTFace_Left));
+							}
 						}
 
-						// Right
-						if (m_createInnerFaces == true || (mask & 2) == 2)
+						verticesCounter += 4;
+					}
+
+					// Right
+					if (m_createInnerFaces == true || (mask & 2) == 2)
+					{
+						if (packVertices)
+						{
+							WritePackedQuad(&packedVerticesBuffer[verticesCounter], QBTFace_Right, x, y, z, 1, 1, colour, m_ambientOcclusion ? GetFaceAmbientOcclusion(pMatrix, x, y, z, QBTFace_Right) : 0);
+						}
+						else
 						{
 							verticesBuffer[verticesCounter + 0].x = x + 0.5f;
 							verticesBuffer[verticesCounter + 0].y = y + -0.5f;
@@ -2310,20 +2588,24 @@ void QBT::CreateStaticRenderBuffers()
 							verticesBuffer[verticesCounter + 3].ny = 0.0f;
 							verticesBuffer[verticesCounter + 3].nz = 0.0f;
 
-							indicesBuffer[indicesCounter + 0] = verticesCounter + 0;
-							indicesBuffer[indicesCounter + 1] = verticesCounter + 2;
-							indicesBuffer[indicesCounter + 2] = verticesCounter + 1;
-							indicesBuffer[indicesCounter + 3] = verticesCounter + 1;
-							indicesBuffer[indicesCounter + 4] = verticesCounter + 2;
-							indicesBuffer[indicesCounter + 5] = verticesCounter + 3;
-
-							indicesCounter += 6;
-							verticesCounter += 4;
+							if (m_ambientOcclusion)
+							{
+								SetQuadAmbientOcclusion(&verticesBuffer[verticesCounter], GetFaceAmbientOcclusion(pMatrix, x, y, z, QBTFace_Right));
+							}
 						}
 
-						// Top
-						if (m_createInnerFaces == true || (mask & 8) == 8)
-						{
+						verticesCounter += 4;
+					}
+
+					// Top
+					if (m_createInnerFaces == true || (mask & 8) == 8)
+					{
+						if (packVertices)
+						{
+							WritePackedQuad(&packedVerticesBuffer[verticesCounter], QBTFace_Top, x, y, z, 1, 1, colour, m_ambientOcclusion ? GetFaceAmbientOcclusion(pMatrix, x, y, z, QBTFace_Top) : 0);
+						}
+						else
+						{
 							verticesBuffer[verticesCounter + 0].x = x + -0.5f;
 							verticesBuffer[verticesCounter + 0].y = y + 0.5f;
 							verticesBuffer[verticesCounter + 0].z = z + 0.5f;
@@ -2335,9 +2617,9 @@ void QBT::CreateStaticRenderBuffers()
 							verticesBuffer[verticesCounter + 0].ny = 1.0f;
 							verticesBuffer[verticesCounter + 0].nz = 0.0f;
 
-							verticesBuffer[verticesCounter + 1].x = x + 0.5f;
+							verticesBuffer[verticesCounter + 1].x = x + -0.5f;
 							verticesBuffer[verticesCounter + 1].y = y + 0.5f;
-							verticesBuffer[verticesCounter + 1].z = z + 0.5f;
+							verticesBuffer[verticesCounter + 1].z = z + -0.5f;
 							verticesBuffer[verticesCounter + 1].r = r;
 							verticesBuffer[verticesCounter + 1].g = g;
 							verticesBuffer[verticesCounter + 1].b = b;
@@ -2346,9 +2628,9 @@ void QBT::CreateStaticRenderBuffers()
 							verticesBuffer[verticesCounter + 1].ny = 1.0f;
 							verticesBuffer[verticesCounter + 1].nz = 0.0f;
 
-							verticesBuffer[verticesCounter + 2].x = x + -0.5f;
+							verticesBuffer[verticesCounter + 2].x = x + 0.5f;
 							verticesBuffer[verticesCounter + 2].y = y + 0.5f;
-							verticesBuffer[verticesCounter + 2].z = z + -0.5f;
+							verticesBuffer[verticesCounter + 2].z = z + 0.5f;
 							verticesBuffer[verticesCounter + 2].r = r;
 							verticesBuffer[verticesCounter + 2].g = g;
 							verticesBuffer[verticesCounter + 2].b = b;
@@ -2368,19 +2650,23 @@ void QBT::CreateStaticRenderBuffers()
 							verticesBuffer[verticesCounter + 3].ny = 1.0f;
 							verticesBuffer[verticesCounter + 3].nz = 0.0f;
 
-							indicesBuffer[indicesCounter + 0] = verticesCounter + 0;
-							indicesBuffer[indicesCounter + 1] = verticesCounter + 1;
-							indicesBuffer[indicesCounter + 2] = verticesCounter + 2;
-							indicesBuffer[indicesCounter + 3] = verticesCounter + 1;
-							indicesBuffer[indicesCounter + 4] = verticesCounter + 3;
-							indicesBuffer[indicesCounter + 5] = verticesCounter + 2;
-
-							indicesCounter += 6;
-							verticesCounter += 4;
+							if (m_ambientOcclusion)
+							{
+								SetQuadAmbientOcclusion(&verticesBuffer[verticesCounter], GetFaceAmbientOcclusion(pMatrix, x, y, z, QBTFace_Top));
+							}
 						}
 
-						// Bottom
-						if (m_createInnerFaces == true || (mask & 16) == 16)
+						verticesCounter += 4;
+					}
+
+					// Bottom
+					if (m_createInnerFaces == true || (mask & 16) == 16)
+					{
+						if (packVertices)
+						{
+							WritePackedQuad(&packedVerticesBuffer[verticesCounter], QBTFace_Bottom, x, y, z, 1, 1, colour, m_ambientOcclusion ? GetFaceAmbientOcclusion(pMatrix, x, y, z, QBTFace_Bottom) : 0);
+						}
+						else
 						{
 							verticesBuffer[verticesCounter + 0].x = x + -0.5f;
 							verticesBuffer[verticesCounter + 0].y = y + -0.5f;
@@ -2404,249 +2690,1462 @@ void QBT::CreateStaticRenderBuffers()
 							verticesBuffer[verticesCounter + 1].ny = -1.0f;
 							verticesBuffer[verticesCounter + 1].nz = 0.0f;
 
-							verticesBuffer[verticesCounter + 2].x = x + -0.5f;
-							verticesBuffer[verticesCounter + 2].y = y + -0.5f;
-							verticesBuffer[verticesCounter + 2].z = z + -0.5f;
-							verticesBuffer[verticesCounter + 2].r = r;
-							verticesBuffer[verticesCounter + 2].g = g;
-							verticesBuffer[verticesCounter + 2].b = b;
-							verticesBuffer[verticesCounter + 2].a = 1.0f;
-							verticesBuffer[verticesCounter + 2].nx = 0.0f;
-							verticesBuffer[verticesCounter + 2].ny = -1.0f;
-							verticesBuffer[verticesCounter + 2].nz = 0.0f;
+							verticesBuffer[verticesCounter + 2].x = x + -0.5f;
+							verticesBuffer[verticesCounter + 2].y = y + -0.5f;
+							verticesBuffer[verticesCounter + 2].z = z + -0.5f;
+							verticesBuffer[verticesCounter + 2].r = r;
+							verticesBuffer[verticesCounter + 2].g = g;
+							verticesBuffer[verticesCounter + 2].b = b;
+							verticesBuffer[verticesCounter + 2].a = 1.0f;
+							verticesBuffer[verticesCounter + 2].nx = 0.0f;
+							verticesBuffer[verticesCounter + 2].ny = -1.0f;
+							verticesBuffer[verticesCounter + 2].nz = 0.0f;
+
+							verticesBuffer[verticesCounter + 3].x = x + 0.5f;
+							verticesBuffer[verticesCounter + 3].y = y + -0.5f;
+							verticesBuffer[verticesCounter + 3].z = z + -0.5f;
+							verticesBuffer[verticesCounter + 3].r = r;
+							verticesBuffer[verticesCounter + 3].g = g;
+							verticesBuffer[verticesCounter + 3].b = b;
+							verticesBuffer[verticesCounter + 3].a = 1.0f;
+							verticesBuffer[verticesCounter + 3].nx = 0.0f;
+							verticesBuffer[verticesCounter + 3].ny = -1.0f;
+							verticesBuffer[verticesCounter + 3].nz = 0.0f;
+
+							if (m_ambientOcclusion)
+							{
+								SetQuadAmbientOcclusion(&verticesBuffer[verticesCounter], GetFaceAmbientOcclusion(pMatrix, x, y, z, QBTFace_Bottom));
+							}
+						}
+
+						verticesCounter += 4;
+					}
+				}
+			}
+		}
+	}
+
+	// Two triangles per quad
+	pChunk->m_numVertices = verticesCounter;
+	pChunk->m_numIndices = verticesCounter / 4 * 6;
+	pChunk->m_numTriangles = verticesCounter / 2;
+}
+
+// Finds the bounds of the mesh in whichever arena it was written to
+void QBT::CalculateMeshBounds(QBTChunk* pChunk)
+{
+	if (pChunk->m_numVertices == 0)
+	{
+		pChunk->m_boundsMin = vec3(0.0f, 0.0f, 0.0f);
+		pChunk->m_boundsMax = vec3(0.0f, 0.0f, 0.0f);
+		return;
+	}
+
+	if (pChunk->m_vertexFormat == QBTVertexFormat_Packed)
+	{
+		// The grid corners are compared as integers, each axis in its own 10 bits
+		const PackedPositionColorNormalVertex* pPackedVertices = m_packedVertexArena.data();
+		unsigned int packedMin[3] = { 1023, 1023, 1023 };
+		unsigned int packedMax[3] = { 0, 0, 0 };
+		for (unsigned int i = 0; i < pChunk->m_numVertices; i++)
+		{
+			for (int axis = 0; axis < 3; axis++)
+			{
+				unsigned int position = (pPackedVertices[i].xyz >> (axis * 10)) & 1023;
+				packedMin[axis] = std::min(packedMin[axis], position);
+				packedMax[axis] = std::max(packedMax[axis], position);
+			}
+		}
+
+		pChunk->m_boundsMin = vec3(packedMin[0] - 0.5f, packedMin[1] - 0.5f, packedMin[2] - 0.5f);
+		pChunk->m_boundsMax = vec3(packedMax[0] - 0.5f, packedMax[1] - 0.5f, packedMax[2] - 0.5f);
+		return;
+	}
+
+	const PositionColorNormalVertex* pVertices = m_vertexArena.data();
+	vec3 boundsMin(pVertices[0].x, pVertices[0].y, pVertices[0].z);
+	vec3 boundsMax = boundsMin;
+	for (unsigned int i = 1; i < pChunk->m_numVertices; i++)
+	{
+		boundsMin.x = std::min(boundsMin.x, pVertices[i].x);
+		boundsMin.y = std::min(boundsMin.y, pVertices[i].y);
+		boundsMin.z = std::min(boundsMin.z, pVertices[i].z);
+		boundsMax.x = std::max(boundsMax.x, pVertices[i].x);
+		boundsMax.y = std::max(boundsMax.y, pVertices[i].y);
+		boundsMax.z = std::max(boundsMax.z, pVertices[i].z);
+	}
+
+	pChunk->m_boundsMin = boundsMin;
+	pChunk->m_boundsMax = boundsMax;
+}
+
+void QBT::CalculateMatrixBounds(QBTMatrix* pMatrix)
+{
+	bool anyBounds = false;
+	pMatrix->m_boundsMin = vec3(0.0f, 0.0f, 0.0f);
+	pMatrix->m_boundsMax = vec3(0.0f, 0.0f, 0.0f);
+	for (unsigned int i = 0; i < pMatrix->m_vChunks.size(); i++)
+	{
+		QBTChunk* pChunk = &pMatrix->m_vChunks[i];
+		if (pChunk->m_numVertices == 0)
+		{
+			continue;
+		}
+
+		if (anyBounds)
+		{
+			pMatrix->m_boundsMin = glm::min(pMatrix->m_boundsMin, pChunk->m_boundsMin);
+			pMatrix->m_boundsMax = glm::max(pMatrix->m_boundsMax, pChunk->m_boundsMax);
+		}
+		else
+		{
+			pMatrix->m_boundsMin = pChunk->m_boundsMin;
+			pMatrix->m_boundsMax = pChunk->m_boundsMax;
+			anyBounds = true;
+		}
+	}
+
+	pMatrix->m_boundsDirty = false;
+}
+
+// Takes the occluders from the mesh in whichever arena it was written to. Only merged faces are big enough, so a mesh without face
+// merging has none.
+void QBT::GatherOccluders(QBTChunk* pChunk)
+{
+	pChunk->m_vOccluders.clear();
+
+	const PositionColorNormalVertex* pVertices = m_vertexArena.data();
+	const PackedPositionColorNormalVertex* pPackedVertices = m_packedVertexArena.data();
+	bool packed = pChunk->m_vertexFormat == QBTVertexFormat_Packed;
+	for (unsigned int i = 0; i + 4 <= pChunk->m_numVertices; i += 4)
+	{
+		QBTOccluder occluder;
+		if (packed)
+		{
+			// Corners 0 and 3 are opposite each other, so the quad's size along each axis is read straight off the grid corners
+			// and the small quads are passed over before anything is decoded
+			unsigned int area = 1;
+			for (int axis = 0; axis < 3; axis++)
+			{
+				unsigned int start = (pPackedVertices[i].xyz >> (axis * 10)) & 1023;
+				unsigned int end = (pPackedVertices[i + 3].xyz >> (axis * 10)) & 1023;
+				area *= start != end ? std::max(start, end) - std::min(start, end) : 1;
+			}
+			if (area < QBT_OCCLUDER_MIN_AREA)
+			{
+				continue;
+			}
+
+			for (int j = 0; j < 4; j++)
+			{
+				unsigned int xyz = pPackedVertices[i + j].xyz;
+				occluder.m_corners[j] = vec3((xyz & 1023) - 0.5f, ((xyz >> 10) & 1023) - 0.5f, ((xyz >> 20) & 1023) - 0.5f);
+			}
+		}
+		else
+		{
+			for (int j = 0; j < 4; j++)
+			{
+				occluder.m_corners[j] = vec3(pVertices[i + j].x, pVertices[i + j].y, pVertices[i + j].z);
+			}
+		}
+
+		// Corners 1 and 2 are the ends of the diagonal, so the edges from corner 0 are two sides of the quad
+		float area = length(cross(occluder.m_corners[1] - occluder.m_corners[0], occluder.m_corners[2] - occluder.m_corners[0]));
+		if (area >= QBT_OCCLUDER_MIN_AREA)
+		{
+			pChunk->m_vOccluders.push_back(occluder);
+		}
+	}
+
+	sort(pChunk->m_vOccluders.begin(), pChunk->m_vOccluders.end(), [](const QBTOccluder& lhs, const QBTOccluder& rhs)
+	{
+		return length(cross(lhs.m_corners[1] - lhs.m_corners[0], lhs.m_corners[2] - lhs.m_corners[0])) >
+		       length(cross(rhs.m_corners[1] - rhs.m_corners[0], rhs.m_corners[2] - rhs.m_corners[0]));
+	});
+	if (pChunk->m_vOccluders.size() > QBT_MAX_CHUNK_OCCLUDERS)
+	{
+		pChunk->m_vOccluders.resize(QBT_MAX_CHUNK_OCCLUDERS);
+	}
+	pChunk->m_vOccluders.shrink_to_fit();
+}
+
+// Grows the arena the mesh is being written to, and returns its new size in vertices
+size_t QBT::GrowMeshArenas(unsigned int minVertices, bool packVertices)
+{
+	if (packVertices)
+	{
+		size_t numVertices = std::max(std::max((size_t)minVertices, m_packedVertexArena.size() * 2), QBT_MESH_ARENA_MIN_VERTICES);
+		m_packedVertexArena.resize(numVertices);
+		return numVertices;
+	}
+
+	size_t numVertices = std::max(std::max((size_t)minVertices, m_vertexArena.size() * 2), QBT_MESH_ARENA_MIN_VERTICES);
+	m_vertexArena.resize(numVertices);
+	return numVertices;
+}
+
+// Takes a copy of the mesh in the arenas, for when the upload happens later on
+void QBT::StoreMeshData(QBTChunk* pChunk)
+{
+	DeleteMeshData(pChunk);
+
+	if (pChunk->m_numVertices == 0)
+	{
+		return;
+	}
+
+	if (pChunk->m_vertexFormat == QBTVertexFormat_Packed)
+	{
+		pChunk->m_pPackedVertices = new PackedPositionColorNormalVertex[pChunk->m_numVertices];
+		memcpy(pChunk->m_pPackedVertices, m_packedVertexArena.data(), sizeof(PackedPositionColorNormalVertex) * pChunk->m_numVertices);
+	}
+	else
+	{
+		pChunk->m_pVertices = new PositionColorNormalVertex[pChunk->m_numVertices];
+		memcpy(pChunk->m_pVertices, m_vertexArena.data(), sizeof(PositionColorNormalVertex) * pChunk->m_numVertices);
+	}
+}
+
+void QBT::DeleteMeshData(QBTMatrix* pMatrix)
+{
+	for (unsigned int i = 0; i < pMatrix->m_vChunks.size(); i++)
+	{
+		DeleteMeshData(&pMatrix->m_vChunks[i]);
+	}
+}
+
+void QBT::DeleteMeshData(QBTChunk* pChunk)
+{
+	delete[] pChunk->m_pVertices;
+	pChunk->m_pVertices = NULL;
+	delete[] pChunk->m_pPackedVertices;
+	pChunk->m_pPackedVertices = NULL;
+}
+
+// Every chunk of the matrix, and of its levels of detail, is remeshed by the next call to CreateStaticRenderBuffers or UpdateDirtyChunks
+void QBT::SetMatrixDirty(QBTMatrix* pMatrix)
+{
+	for (unsigned int i = 0; i < pMatrix->m_vChunks.size(); i++)
+	{
+		pMatrix->m_vChunks[i].m_dirty = true;
+	}
+	for (unsigned int i = 0; i < pMatrix->m_vpLODs.size(); i++)
+	{
+		SetMatrixDirty(pMatrix->m_vpLODs[i]);
+	}
+
+	m_anyDirtyChunks = true;
+}
+
+// Editing
+bool QBT::SetVoxel(QBTMatrix* pMatrix, int x, int y, int z, Colour colour)
+{
+	return SetVoxelBox(pMatrix, x, y, z, x, y, z, colour);
+}
+
+bool QBT::SetVoxelBox(QBTMatrix* pMatrix, int minX, int minY, int minZ, int maxX, int maxY, int maxZ, Colour colour)
+{
+	// Squish the rgb into a single unsigned int, the same as the voxels that are loaded from the file
+	unsigned int red = (unsigned int)(std::min(std::max(colour.GetRed(), 0.0f), 1.0f) * 255.0f + 0.5f);
+	unsigned int green = (unsigned int)(std::min(std::max(colour.GetGreen(), 0.0f), 1.0f) * 255.0f + 0.5f);
+	unsigned int blue = (unsigned int)(std::min(std::max(colour.GetBlue(), 0.0f), 1.0f) * 255.0f + 0.5f);
+
+	return EditVoxelBox(pMatrix, minX, minY, minZ, maxX, maxY, maxZ, red + (green << 8) + (blue << 16) + (255u << 24));
+}
+
+bool QBT::ClearVoxel(QBTMatrix* pMatrix, int x, int y, int z)
+{
+	return EditVoxelBox(pMatrix, x, y, z, x, y, z, 0);
+}
+
+bool QBT::ClearVoxelBox(QBTMatrix* pMatrix, int minX, int minY, int minZ, int maxX, int maxY, int maxZ)
+{
+	return EditVoxelBox(pMatrix, minX, minY, minZ, maxX, maxY, maxZ, 0);
+}
+
+// Remeshes and uploads every chunk that has been edited since the last update, call once per frame so edits show up on the next frame
+void QBT::UpdateDirtyChunks()
+{
+	PROFILE_SCOPE("QBT::UpdateDirtyChunks");
+
+	if (m_anyDirtyChunks == false)
+	{
+		return;
+	}
+
+	CreateStaticRenderBuffers();
+	m_anyDirtyChunks = false;
+}
+
+unsigned int QBT::GetNumDirtyChunks()
+{
+	unsigned int numDirtyChunks = 0;
+	for (unsigned int i = 0; i < m_vpQBTMatrices.size(); i++)
+	{
+		for (unsigned int j = 0; j < m_vpQBTMatrices[i]->m_vChunks.size(); j++)
+		{
+			numDirtyChunks += m_vpQBTMatrices[i]->m_vChunks[j].m_dirty ? 1 : 0;
+		}
+	}
+	return numDirtyChunks;
+}
+
+// A colour of 0 clears the voxels, anything else makes them solid
+bool QBT::EditVoxelBox(QBTMatrix* pMatrix, int minX, int minY, int minZ, int maxX, int maxY, int maxZ, unsigned int colour)
+{
+	if (pMatrix->m_pColour == NULL)
+	{
+		return false;
+	}
+
+	minX = std::max(minX, 0);
+	minY = std::max(minY, 0);
+	minZ = std::max(minZ, 0);
+	maxX = std::min(maxX, (int)pMatrix->m_sizeX - 1);
+	maxY = std::min(maxY, (int)pMatrix->m_sizeY - 1);
+	maxZ = std::min(maxZ, (int)pMatrix->m_sizeZ - 1);
+	if (minX > maxX || minY > maxY || minZ > maxZ)
+	{
+		return false;
+	}
+
+	unsigned int mask = colour != 0 ? QBTVisibility_Solid : 0;
+	for (int z = minZ; z <= maxZ; z++)
+	{
+		for (int y = minY; y <= maxY; y++)
+		{
+			unsigned int voxelIndex = minX + pMatrix->m_sizeX * (y + pMatrix->m_sizeY * z);
+			std::fill(&pMatrix->m_pColour[voxelIndex], &pMatrix->m_pColour[voxelIndex] + (maxX - minX + 1), colour);
+			std::fill(&pMatrix->m_pVisibilityMask[voxelIndex], &pMatrix->m_pVisibilityMask[voxelIndex] + (maxX - minX + 1), mask);
+		}
+	}
+
+	// Fills in the face bits of the box, and of the voxels around it
+	RecomputeVisibilityMask(pMatrix, minX, minY, minZ, maxX, maxY, maxZ);
+
+	SetBoxDirty(pMatrix, minX, minY, minZ, maxX, maxY, maxZ);
+	UpdateLODs(pMatrix, minX, minY, minZ, maxX, maxY, maxZ);
+
+	return true;
+}
+
+// Marks the chunks that overlap the box as dirty, along with any neighbouring chunk whose voxels next to the box have had their faces changed
+void QBT::SetBoxDirty(QBTMatrix* pMatrix, int minX, int minY, int minZ, int maxX, int maxY, int maxZ)
+{
+	unsigned int minChunkX = (unsigned int)std::max(minX - 1, 0) / QBT_CHUNK_SIZE;
+	unsigned int minChunkY = (unsigned int)std::max(minY - 1, 0) / QBT_CHUNK_SIZE;
+	unsigned int minChunkZ = (unsigned int)std::max(minZ - 1, 0) / QBT_CHUNK_SIZE;
+	unsigned int maxChunkX = std::min((unsigned int)(maxX + 1) / QBT_CHUNK_SIZE, pMatrix->m_numChunksX - 1);
+	unsigned int maxChunkY = std::min((unsigned int)(maxY + 1) / QBT_CHUNK_SIZE, pMatrix->m_numChunksY - 1);
+	unsigned int maxChunkZ = std::min((unsigned int)(maxZ + 1) / QBT_CHUNK_SIZE, pMatrix->m_numChunksZ - 1);
+
+	for (unsigned int z = minChunkZ; z <= maxChunkZ; z++)
+	{
+		for (unsigned int y = minChunkY; y <= maxChunkY; y++)
+		{
+			for (unsigned int x = minChunkX; x <= maxChunkX; x++)
+			{
+				pMatrix->m_vChunks[x + pMatrix->m_numChunksX * (y + pMatrix->m_numChunksY * z)].m_dirty = true;
+			}
+		}
+	}
+
+	m_anyDirtyChunks = true;
+}
+
+size_t QBT::GetVertexSize(QBTChunk* pChunk)
+{
+	return pChunk->m_vertexFormat == QBTVertexFormat_Packed ? sizeof(PackedPositionColorNormalVertex) : sizeof(PositionColorNormalVertex);
+}
+
+// Passing NULL for the vertex data only allocates the buffer storage, to be filled in later with glBufferSubData. Indices come from the
+// renderer's shared quad index buffer, which is 16-bit whenever the chunk has few enough vertices.
+void QBT::CreateChunkBuffers(QBTChunk* pChunk, const GLvoid* pVertices)
+{
+	glGenVertexArrays(1, &pChunk->m_VAO);
+	glGenBuffers(1, &pChunk->m_VBO);
+	pChunk->m_indexType = m_pRenderer->GetQuadIndexType(pChunk->m_numVertices);
+
+	// Bind the Vertex Array Object first, then bind and set vertex buffer(s) and attribute pointer(s).
+	glBindVertexArray(pChunk->m_VAO);
+
+	glBindBuffer(GL_ARRAY_BUFFER, pChunk->m_VBO);
+	glBufferData(GL_ARRAY_BUFFER, GetVertexSize(pChunk)*pChunk->m_numVertices, pVertices, GL_STATIC_DRAW);
+
+	glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, m_pRenderer->GetQuadIndexBuffer(pChunk->m_numVertices));
+
+	SetupVertexAttributes(pChunk->m_vertexFormat);
+	SetupInstanceAttributes();
+
+	glBindBuffer(GL_ARRAY_BUFFER, 0); // Note that this is allowed, the call to glVertexAttribPointer registered VBO as the currently bound vertex buffer object so afterwards we can safely unbind
+
+	glBindVertexArray(0); // Unbind VAO (it's always a good thing to unbind any buffer/array to prevent strange bugs), remember: do NOT unbind the EBO, keep it bound to this VAO
+}
+
+void QBT::DestroyChunkBuffers(QBTChunk* pChunk)
+{
+	if (pChunk->m_VAO == 0)
+	{
+		return;
+	}
+
+	glDeleteBuffers(1, &pChunk->m_VBO);
+	glDeleteVertexArrays(1, &pChunk->m_VAO);
+
+	pChunk->m_VBO = 0;
+	pChunk->m_VAO = 0;
+}
+
+// Points the vertex attributes of the bound vertex array at the bound array buffer
+void QBT::SetupVertexAttributes(QBTVertexFormat vertexFormat)
+{
+	if (vertexFormat == QBTVertexFormat_Packed)
+	{
+		// Both packed words go to the shader as integers, it does the decoding
+		glVertexAttribIPointer(0, 2, GL_UNSIGNED_INT, sizeof(PackedPositionColorNormalVertex), (GLvoid*)0);
+		glEnableVertexAttribArray(0);
+	}
+	else
+	{
+		glVertexAttribPointer(0, 3, GL_FLOAT, GL_FALSE, sizeof(GLfloat) * 10, (GLvoid*)0);
+		glEnableVertexAttribArray(0);
+		glVertexAttribPointer(1, 4, GL_FLOAT, GL_FALSE, sizeof(GLfloat) * 10, (GLvoid*)(sizeof(GLfloat) * 3));
+		glEnableVertexAttribArray(1);
+		glVertexAttribPointer(2, 3, GL_FLOAT, GL_FALSE, sizeof(GLfloat) * 10, (GLvoid*)(sizeof(GLfloat) * 7));
+		glEnableVertexAttribArray(2);
+	}
+}
+
+// Points the per instance attributes of the bound vertex array at the instance buffer, a column of the transform at a time
+void QBT::SetupInstanceAttributes()
+{
+	glBindBuffer(GL_ARRAY_BUFFER, m_instanceBuffer);
+	for (int i = 0; i < 4; i++)
+	{
+		glVertexAttribPointer(4 + i, 4, GL_FLOAT, GL_FALSE, sizeof(QBTInstance), (GLvoid*)(sizeof(vec4) * i));
+		glEnableVertexAttribArray(4 + i);
+		glVertexAttribDivisor(4 + i, 1);
+	}
+	glVertexAttribPointer(8, 4, GL_FLOAT, GL_FALSE, sizeof(QBTInstance), (GLvoid*)sizeof(mat4));
+	glEnableVertexAttribArray(8);
+	glVertexAttribDivisor(8, 1);
+}
+
+// Packs the vertices of every chunk with the vertex format into a new batch buffer. Chunks that were remeshed since the last
+// rebuild are copied out of their own buffers, which are then freed, and the rest are copied over from the old batch.
+void QBT::RebuildBatch(QBTVertexFormat vertexFormat)
+{
+	QBTBatch* pBatch = &m_batches[vertexFormat];
+	size_t vertexSize = vertexFormat == QBTVertexFormat_Packed ? sizeof(PackedPositionColorNormalVertex) : sizeof(PositionColorNormalVertex);
+
+	// The levels of detail go into the batch along with the matrices, each under its own draw index
+	unsigned int numDrawIndices = GetNumDrawIndices();
+	unsigned int numVertices = 0;
+	unsigned int maxChunkVertices = 0;
+	for (unsigned int drawIndex = 0; drawIndex < numDrawIndices; drawIndex++)
+	{
+		QBTMatrix* pMatrix = GetDrawIndexMatrix(drawIndex);
+		if (pMatrix == NULL)
+		{
+			continue;
+		}
+		for (unsigned int chunkIndex = 0; chunkIndex < pMatrix->m_vChunks.size(); chunkIndex++)
+		{
+			QBTChunk* pChunk = &pMatrix->m_vChunks[chunkIndex];
+			if (pChunk->m_vertexFormat != vertexFormat)
+			{
+				continue;
+			}
+			if (pChunk->m_numVertices == 0 || (pChunk->m_VAO == 0 && pChunk->m_inBatch == false))
+			{
+				pChunk->m_inBatch = false;
+				continue;
+			}
+
+			numVertices += pChunk->m_numVertices;
+			maxChunkVertices = std::max(maxChunkVertices, pChunk->m_numVertices);
+		}
+	}
+
+	GLuint batchVBO = 0;
+	if (numVertices > 0)
+	{
+		glGenBuffers(1, &batchVBO);
+		glBindBuffer(GL_COPY_WRITE_BUFFER, batchVBO);
+		glBufferData(GL_COPY_WRITE_BUFFER, vertexSize * numVertices, NULL, GL_STATIC_DRAW);
+	}
+
+	vector<GLuint> vertexMatrixIndices;
+	unsigned int firstVertex = 0;
+	for (unsigned int drawIndex = 0; drawIndex < numDrawIndices && numVertices > 0; drawIndex++)
+	{
+		QBTMatrix* pMatrix = GetDrawIndexMatrix(drawIndex);
+		if (pMatrix == NULL)
+		{
+			continue;
+		}
+		for (unsigned int chunkIndex = 0; chunkIndex < pMatrix->m_vChunks.size(); chunkIndex++)
+		{
+			QBTChunk* pChunk = &pMatrix->m_vChunks[chunkIndex];
+			if (pChunk->m_vertexFormat != vertexFormat || pChunk->m_numVertices == 0 || (pChunk->m_VAO == 0 && pChunk->m_inBatch == false))
+			{
+				continue;
+			}
+
+			size_t chunkSize = vertexSize * pChunk->m_numVertices;
+			if (pChunk->m_VAO != 0)
+			{
+				glBindBuffer(GL_COPY_READ_BUFFER, pChunk->m_VBO);
+				glCopyBufferSubData(GL_COPY_READ_BUFFER, GL_COPY_WRITE_BUFFER, 0, vertexSize * firstVertex, chunkSize);
+				DestroyChunkBuffers(pChunk);
+			}
+			else
+			{
+				glBindBuffer(GL_COPY_READ_BUFFER, pBatch->m_VBO);
+				glCopyBufferSubData(GL_COPY_READ_BUFFER, GL_COPY_WRITE_BUFFER, vertexSize * pChunk->m_batchFirstVertex, vertexSize * firstVertex, chunkSize);
+			}
+
+			pChunk->m_inBatch = true;
+			pChunk->m_batchFirstVertex = firstVertex;
+			firstVertex += pChunk->m_numVertices;
+
+			if (m_multiDrawIndirect == false)
+			{
+				vertexMatrixIndices.insert(vertexMatrixIndices.end(), pChunk->m_numVertices, drawIndex);
+			}
+		}
+	}
+	glBindBuffer(GL_COPY_READ_BUFFER, 0);
+	glBindBuffer(GL_COPY_WRITE_BUFFER, 0);
+
+	// The old batch has been copied out of, so it can go now
+	glDeleteBuffers(1, &pBatch->m_VBO);
+	glDeleteBuffers(1, &pBatch->m_matrixIndexVBO);
+	glDeleteVertexArrays(1, &pBatch->m_VAO);
+	memset(pBatch, 0, sizeof(QBTBatch));
+	if (numVertices == 0)
+	{
+		return;
+	}
+
+	pBatch->m_VBO = batchVBO;
+	pBatch->m_numVertices = numVertices;
+	pBatch->m_indexType = m_pRenderer->GetQuadIndexType(maxChunkVertices);
+	GLuint quadIndexBuffer = m_pRenderer->GetQuadIndexBuffer(maxChunkVertices);
+
+	// With base instances the matrix index is an instanced attribute, read from a list of every matrix index
+	if (m_multiDrawIndirect)
+	{
+		for (unsigned int drawIndex = 0; drawIndex < numDrawIndices; drawIndex++)
+		{
+			vertexMatrixIndices.push_back(drawIndex);
+		}
+	}
+	glGenBuffers(1, &pBatch->m_matrixIndexVBO);
+	glBindBuffer(GL_ARRAY_BUFFER, pBatch->m_matrixIndexVBO);
+	glBufferData(GL_ARRAY_BUFFER, sizeof(GLuint) * vertexMatrixIndices.size(), vertexMatrixIndices.data(), GL_STATIC_DRAW);
+
+	glGenVertexArrays(1, &pBatch->m_VAO);
+	glBindVertexArray(pBatch->m_VAO);
+
+	glVertexAttribIPointer(3, 1, GL_UNSIGNED_INT, sizeof(GLuint), (GLvoid*)0);
+	glEnableVertexAttribArray(3);
+	if (m_multiDrawIndirect)
+	{
+		glVertexAttribDivisor(3, 1);
+	}
+
+	glBindBuffer(GL_ARRAY_BUFFER, pBatch->m_VBO);
+	SetupVertexAttributes(vertexFormat);
+	SetupInstanceAttributes();
+	glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, quadIndexBuffer);
+
+	glBindBuffer(GL_ARRAY_BUFFER, 0);
+	glBindVertexArray(0);
+}
+
+void QBT::DestroyBatches()
+{
+	for (int i = 0; i < QBTVertexFormat_NUM; i++)
+	{
+		if (m_batches[i].m_VAO != 0)
+		{
+			glDeleteBuffers(1, &m_batches[i].m_VBO);
+			glDeleteBuffers(1, &m_batches[i].m_matrixIndexVBO);
+			glDeleteVertexArrays(1, &m_batches[i].m_VAO);
+		}
+	}
+	memset(m_batches, 0, sizeof(m_batches));
+
+	unsigned int numDrawIndices = GetNumDrawIndices();
+	for (unsigned int i = 0; i < numDrawIndices; i++)
+	{
+		QBTMatrix* pMatrix = GetDrawIndexMatrix(i);
+		for (unsigned int j = 0; pMatrix != NULL && j < pMatrix->m_vChunks.size(); j++)
+		{
+			pMatrix->m_vChunks[j].m_inBatch = false;
+		}
+	}
+	m_batchesDirty = true;
+}
+
+// Accessors
+string QBT::GetFilename()
+{
+	return m_filename;
+}
+
+int QBT::GetNumMatrices()
+{
+	int numMatrices = (int)m_vpQBTMatrices.size();
+	return numMatrices;
+}
+
+QBTMatrix* QBT::GetMatrix(int index)
+{
+	return m_vpQBTMatrices[index];
+}
+
+int QBT::GetNumVertices()
+{
+	int numVertices = 0;
+	for (int i = 0; i < (int)m_vpQBTMatrices.size(); i++)
+	{
+		numVertices += m_vpQBTMatrices[i]->m_numVertices;
+	}
+	return numVertices;
+}
+
+int QBT::GetNumTriangles()
+{
+	int numTriangles = 0;
+	for (int i = 0; i < (int)m_vpQBTMatrices.size(); i++)
+	{
+		numTriangles += m_vpQBTMatrices[i]->m_numTriangles;
+	}
+	return numTriangles;
+}
+
+size_t QBT::GetMeshMemory()
+{
+	size_t meshMemory = 0;
+	unsigned int numDrawIndices = GetNumDrawIndices();
+	for (unsigned int i = 0; i < numDrawIndices; i++)
+	{
+		QBTMatrix* pMatrix = GetDrawIndexMatrix(i);
+		for (unsigned int j = 0; pMatrix != NULL && j < pMatrix->m_vChunks.size(); j++)
+		{
+			QBTChunk* pChunk = &pMatrix->m_vChunks[j];
+			meshMemory += GetVertexSize(pChunk) * pChunk->m_numVertices;
+		}
+	}
+	return meshMemory;
+}
+
+size_t QBT::GetUnpackedMeshMemory()
+{
+	size_t meshMemory = 0;
+	unsigned int numDrawIndices = GetNumDrawIndices();
+	for (unsigned int i = 0; i < numDrawIndices; i++)
+	{
+		QBTMatrix* pMatrix = GetDrawIndexMatrix(i);
+		meshMemory += pMatrix != NULL ? sizeof(PositionColorNormalVertex) * pMatrix->m_numVertices : 0;
+	}
+	return meshMemory;
+}
+
+// Modifiers
+void QBT::SetMaterialAmbient(Colour ambient)
+{
+	for (int i = 0; i < (int)m_vpQBTMatrices.size(); i++)
+	{
+		m_vpQBTMatrices[i]->m_pMaterial->m_ambient = ambient;
+	}
+}
+
+void QBT::SetMaterialDiffuse(Colour diffuse)
+{
+	for (int i = 0; i < (int)m_vpQBTMatrices.size(); i++)
+	{
+		m_vpQBTMatrices[i]->m_pMaterial->m_diffuse = diffuse;
+	}
+}
+
+void QBT::SetMaterialSpecular(Colour specular)
+{
+	for (int i = 0; i < (int)m_vpQBTMatrices.size(); i++)
+	{
+		m_vpQBTMatrices[i]->m_pMaterial->m_specular = specular;
+	}
+}
+
+void QBT::SetMaterialEmission(Colour emission)
+{
+	for (int i = 0; i < (int)m_vpQBTMatrices.size(); i++)
+	{
+		m_vpQBTMatrices[i]->m_pMaterial->m_emission = emission;
+	}
+}
+
+void QBT::SetMaterialShininess(float shininess)
+{
+	for (int i = 0; i < (int)m_vpQBTMatrices.size(); i++)
+	{
+		m_vpQBTMatrices[i]->m_pMaterial->m_shininess = shininess;
+	}
+}
+
+// Render modes
+void QBT::SetWireframeMode(bool wireframe)
+{
+	m_wireframeRender = wireframe;
+}
+
+bool QBT::GetWireframeMode()
+{
+	return m_wireframeRender;
+}
+
+void QBT::SetUseLighting(bool lighting)
+{
+	m_useLighting = lighting;
+}
+
+void QBT::SetBoundingBoxRendering(bool boundingBox)
+{
+	m_boundingBox = boundingBox;
+}
+
+void QBT::SetBatchedRendering(bool batched)
+{
+	m_batchedRendering = batched;
+}
+
+bool QBT::GetBatchedRendering()
+{
+	return m_batchedRendering;
+}
+
+bool QBT::IsMultiDrawIndirectSupported()
+{
+	return m_multiDrawIndirect;
+}
+
+void QBT::SetFrustumCulling(bool culling)
+{
+	m_frustumCulling = culling;
+}
+
+bool QBT::GetFrustumCulling()
+{
+	return m_frustumCulling;
+}
+
+void QBT::SetOcclusionCulling(bool culling)
+{
+	m_occlusionCulling = culling;
+}
+
+bool QBT::GetOcclusionCulling()
+{
+	return m_occlusionCulling;
+}
+
+QBTOcclusionBuffer* QBT::GetOcclusionBuffer()
+{
+	return &m_occlusionBuffer;
+}
+
+// Level of detail
+void QBT::SetNumLODs(unsigned int numLODs)
+{
+	m_numLODs = std::min(numLODs, QBT_MAX_LODS);
+}
+
+unsigned int QBT::GetNumLODs()
+{
+	return m_numLODs;
+}
+
+void QBT::SetLODDownsample(QBTLODDownsample downsample)
+{
+	m_lodDownsample = downsample;
+}
+
+QBTLODDownsample QBT::GetLODDownsample()
+{
+	return m_lodDownsample;
+}
+
+void QBT::SetLODPixelSize(float pixelSize)
+{
+	m_lodPixelSize = pixelSize;
+}
+
+float QBT::GetLODPixelSize()
+{
+	return m_lodPixelSize;
+}
+
+void QBT::SetLODCrossFade(bool crossFade)
+{
+	m_lodCrossFade = crossFade;
+}
+
+bool QBT::GetLODCrossFade()
+{
+	return m_lodCrossFade;
+}
+
+// Picks the level of each matrix from how wide its voxels are on screen at the point of its bounds nearest to the camera, so a
+// matrix the camera is inside of is always drawn at full detail
+void QBT::SelectLODs(vec3 cameraPosition, const mat4& projection, unsigned int viewportHeight)
+{
+	memset(m_numLODMatrices, 0, sizeof(m_numLODMatrices));
+
+	// Pixels covered by something one unit wide, one unit in front of the camera
+	float pixelsPerUnit = projection[1][1] * viewportHeight * 0.5f;
+
+	for (unsigned int i = 0; i < m_vpQBTMatrices.size(); i++)
+	{
+		QBTMatrix* pMatrix = m_vpQBTMatrices[i];
+		if (pMatrix->m_boundsDirty)
+		{
+			CalculateMatrixBounds(pMatrix);
+		}
+
+		vec3 position((float)pMatrix->m_positionX, (float)pMatrix->m_positionY, (float)pMatrix->m_positionZ);
+		vec3 nearestPoint = glm::clamp(cameraPosition, pMatrix->m_boundsMin + position, pMatrix->m_boundsMax + position);
+		float distance = length(nearestPoint - cameraPosition);
+		float pixelsPerVoxel = distance > 0.0f ? pixelsPerUnit / distance : FLT_MAX;
+
+		GetLODLevel(pixelsPerVoxel, m_lodPixelSize, (unsigned int)pMatrix->m_vpLODs.size(), m_lodCrossFade, &pMatrix->m_lodLevel, &pMatrix->m_lodFade);
+
+		m_numLODMatrices[pMatrix->m_lodLevel]++;
+		if (pMatrix->m_lodFade > 0.0f)
+		{
+			m_numLODMatrices[pMatrix->m_lodLevel + 1]++;
+		}
+	}
+}
+
+unsigned int QBT::GetNumLODMatrices(unsigned int level)
+{
+	return level <= QBT_MAX_LODS ? m_numLODMatrices[level] : 0;
+}
+
+// Instancing
+unsigned int QBT::AddInstance(const mat4& transform, Colour tint)
+{
+	QBTInstance instance;
+	instance.m_transform = transform;
+	instance.m_tint = vec4(tint.GetRed(), tint.GetGreen(), tint.GetBlue(), tint.GetAlpha());
+	m_vInstances.push_back(instance);
+	m_instancesDirty = true;
+
+	return (unsigned int)m_vInstances.size() - 1;
+}
+
+void QBT::SetInstanceTransform(unsigned int instanceIndex, const mat4& transform)
+{
+	m_vInstances[instanceIndex].m_transform = transform;
+	m_instancesDirty = true;
+}
+
+void QBT::SetInstanceTint(unsigned int instanceIndex, Colour tint)
+{
+	m_vInstances[instanceIndex].m_tint = vec4(tint.GetRed(), tint.GetGreen(), tint.GetBlue(), tint.GetAlpha());
+	m_instancesDirty = true;
+}
+
+void QBT::ClearInstances()
+{
+	m_vInstances.clear();
+	m_instancesDirty = true;
+}
+
+unsigned int QBT::GetNumInstances()
+{
+	return (unsigned int)m_vInstances.size();
+}
+
+// Creation optimizations
+void QBT::SetCreateInnerVoxels(bool innerVoxels)
+{
+	m_createInnerVoxels = innerVoxels;
+}
+
+void QBT::SetCreateInnerFaces(bool innerFaces)
+{
+	m_createInnerFaces = innerFaces;
+}
+
+void QBT::SetMergeFaces(bool mergeFaces)
+{
+	m_mergeFaces = mergeFaces;
+}
+
+void QBT::SetAmbientOcclusion(bool ambientOcclusion)
+{
+	m_ambientOcclusion = ambientOcclusion;
+}
+
+bool QBT::GetAmbientOcclusion()
+{
+	return m_ambientOcclusion;
+}
+
+void QBT::SetMesher(QBTMesher mesher)
+{
+	m_mesher = mesher;
+}
+
+QBTMesher QBT::GetMesher()
+{
+	return m_mesher;
+}
+
+void QBT::SetVertexFormat(QBTVertexFormat vertexFormat)
+{
+	m_vertexFormat = vertexFormat;
+}
+
+QBTVertexFormat QBT::GetVertexFormat()
+{
+	return m_vertexFormat;
+}
+
+// Render
+void QBT::Render(Camera* pCamera, Light* pLight)
+{
+	PROFILE_SCOPE("QBT::Render");
 
-							verticesBuffer[verticesCounter + 3].x = x + 0.5f;
-							verticesBuffer[verticesCounter + 3].y = y + -0.5f;
-							verticesBuffer[verticesCounter + 3].z = z + -0.5f;
-							verticesBuffer[verticesCounter + 3].r = r;
-							verticesBuffer[verticesCounter + 3].g = g;
-							verticesBuffer[verticesCounter + 3].b = b;
-							verticesBuffer[verticesCounter + 3].a = 1.0f;
-							verticesBuffer[verticesCounter + 3].nx = 0.0f;
-							verticesBuffer[verticesCounter + 3].ny = -1.0f;
-							verticesBuffer[verticesCounter + 3].nz = 0.0f;
+	if (m_wireframeRender)
+	{
+		glPolygonMode(GL_FRONT_AND_BACK, GL_LINE);
+	}
+	else
+	{
+		glPolygonMode(GL_FRONT_AND_BACK, GL_FILL);
+	}
 
-							indicesBuffer[indicesCounter + 0] = verticesCounter + 0;
-							indicesBuffer[indicesCounter + 1] = verticesCounter + 2;
-							indicesBuffer[indicesCounter + 2] = verticesCounter + 1;
-							indicesBuffer[indicesCounter + 3] = verticesCounter + 1;
-							indicesBuffer[indicesCounter + 4] = verticesCounter + 2;
-							indicesBuffer[indicesCounter + 5] = verticesCounter + 3;
+	// Chunks that were remeshed since the last frame are moved into the batches before anything is drawn
+	if (m_batchedRendering && m_batchesDirty)
+	{
+		for (int i = 0; i < QBTVertexFormat_NUM; i++)
+		{
+			RebuildBatch((QBTVertexFormat)i);
+		}
+		m_batchesDirty = false;
+	}
 
-							indicesCounter += 6;
-							verticesCounter += 4;
-						}
-					}
-				}
-			}
+	// The camera and light blocks are set once a frame by the game, the uniforms of every matrix go up in one upload. Instances
+	// can be placed anywhere, so a model with instances isn't culled.
+	bool culling = m_vInstances.empty();
+	if (culling)
+	{
+		SelectLODs(pCamera->GetPosition(), pCamera->GetProjectionMatrix(), m_pRenderer->GetWindowHeight());
+	}
+	if (culling && m_occlusionCulling)
+	{
+		m_occlusionBuffer.BeginFrame(pCamera->GetProjectionMatrix(), pCamera->GetViewMatrix());
+	}
+	BuildDrawLists((culling && m_frustumCulling) ? pCamera->GetFrustum() : NULL, (culling && m_occlusionCulling) ? &m_occlusionBuffer : NULL);
+	if (m_vInstances.empty() == false)
+	{
+		if (m_instancesDirty)
+		{
+			glBindBuffer(GL_ARRAY_BUFFER, m_instanceBuffer);
+			glBufferData(GL_ARRAY_BUFFER, sizeof(QBTInstance) * m_vInstances.size(), m_vInstances.data(), GL_DYNAMIC_DRAW);
+			glBindBuffer(GL_ARRAY_BUFFER, 0);
+			m_instancesDirty = false;
 		}
 
-		glGenVertexArrays(1, &pMatrix->m_VAO);
-		glGenBuffers(1, &pMatrix->m_VBO);
-		glGenBuffers(1, &pMatrix->m_EBO);
+		m_pRenderer->SetDrawUniforms(m_vDrawUniforms);
 
-		// Bind the Vertex Array Object first, then bind and set vertex buffer(s) and attribute pointer(s).
-		glBindVertexArray(pMatrix->m_VAO);
+		// Matrices that were too big for the packed vertex format are drawn with the full format shader
+		RenderInstancedDrawList(m_pInstancedPositionColorNormalShader, m_drawLists[QBTVertexFormat_PositionColorNormal], &m_batches[QBTVertexFormat_PositionColorNormal]);
+		RenderInstancedDrawList(m_pInstancedPackedPositionColorNormalShader, m_drawLists[QBTVertexFormat_Packed], &m_batches[QBTVertexFormat_Packed]);
+	}
+	else if (m_batchedRendering)
+	{
+		if (m_matrixDataTexture == 0)
+		{
+			// The buffer has to have been bound once before it can be attached to the texture
+			glGenBuffers(1, &m_matrixDataBuffer);
+			glGenBuffers(1, &m_indirectBuffer);
+			glGenTextures(1, &m_matrixDataTexture);
+			glBindBuffer(GL_TEXTURE_BUFFER, m_matrixDataBuffer);
+			glBindTexture(GL_TEXTURE_BUFFER, m_matrixDataTexture);
+			glTexBuffer(GL_TEXTURE_BUFFER, GL_RGBA32F, m_matrixDataBuffer);
+			glBindTexture(GL_TEXTURE_BUFFER, 0);
+		}
 
-		glBindBuffer(GL_ARRAY_BUFFER, pMatrix->m_VBO);
-		glBufferData(GL_ARRAY_BUFFER, sizeof(PositionColorNormalVertex)*pMatrix->m_numVertices, verticesBuffer, GL_STATIC_DRAW);
+		glBindBuffer(GL_TEXTURE_BUFFER, m_matrixDataBuffer);
+		glBufferData(GL_TEXTURE_BUFFER, sizeof(DrawUniformBlock) * m_vDrawUniforms.size(), m_vDrawUniforms.data(), GL_STREAM_DRAW);
+		glBindBuffer(GL_TEXTURE_BUFFER, 0);
 
-		glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, pMatrix->m_EBO);
-		glBufferData(GL_ELEMENT_ARRAY_BUFFER, sizeof(GLuint)*pMatrix->m_numIndices, indicesBuffer, GL_STATIC_DRAW);
+		// Matrices that were too big for the packed vertex format are drawn with the full format shader
+		RenderBatch(m_pBatchedPositionColorNormalShader, m_drawLists[QBTVertexFormat_PositionColorNormal], &m_batches[QBTVertexFormat_PositionColorNormal]);
+		RenderBatch(m_pBatchedPackedPositionColorNormalShader, m_drawLists[QBTVertexFormat_Packed], &m_batches[QBTVertexFormat_Packed]);
+	}
+	else
+	{
+		m_pRenderer->SetDrawUniforms(m_vDrawUniforms);
 
-		glVertexAttribPointer(0, 3, GL_FLOAT, GL_FALSE, sizeof(GLfloat) * 10, (GLvoid*)0);
-		glEnableVertexAttribArray(0);
-		glVertexAttribPointer(1, 4, GL_FLOAT, GL_FALSE, sizeof(GLfloat) * 10, (GLvoid*)(sizeof(GLfloat) * 3));
-		glEnableVertexAttribArray(1);
-		glVertexAttribPointer(2, 3, GL_FLOAT, GL_FALSE, sizeof(GLfloat) * 10, (GLvoid*)(sizeof(GLfloat) * 7));
-		glEnableVertexAttribArray(2);
+		// Matrices that were too big for the packed vertex format are drawn with the full format shader
+		RenderDrawList(m_pPositionColorNormalShader, m_drawLists[QBTVertexFormat_PositionColorNormal]);
+		RenderDrawList(m_pPackedPositionColorNormalShader, m_drawLists[QBTVertexFormat_Packed]);
+	}
 
-		glBindBuffer(GL_ARRAY_BUFFER, 0); // Note that this is allowed, the call to glVertexAttribPointer registered VBO as the currently bound vertex buffer object so afterwards we can safely unbind
+	glPolygonMode(GL_FRONT_AND_BACK, GL_FILL);
 
-		glBindVertexArray(0); // Unbind VAO (it's always a good thing to unbind any buffer/array to prevent strange bugs), remember: do NOT unbind the EBO, keep it bound to this VAO
+	if (m_boundingBox)
+	{
+		RenderBoundingBox(pCamera, pLight);
 	}
 }
 
-// Accessors
-string QBT::GetFilename()
+// With a frustum, matrices and then chunks whose world bounds are outside of it are left out of the draw lists
+void QBT::BuildDrawLists(Frustum* pFrustum, QBTOcclusionBuffer* pOcclusionBuffer)
 {
-	return m_filename;
-}
+	PROFILE_SCOPE("QBT::BuildDrawLists");
 
-int QBT::GetNumMatrices()
-{
-	int numMatrices = (int)m_vpQBTMatrices.size();
-	return numMatrices;
-}
+	for (int i = 0; i < QBTVertexFormat_NUM; i++)
+	{
+		m_drawLists[i].m_vMatrixDraws.clear();
+		m_drawLists[i].m_vpChunks.clear();
+	}
+	m_numVisibleMatrices = 0;
+	m_numCulledMatrices = 0;
+	m_numVisibleChunks = 0;
+	m_numCulledChunks = 0;
+	m_numOccludedMatrices = 0;
+	m_numOccludedChunks = 0;
+
+	// Every occluder is in the occlusion buffer before anything is tested against it
+	if (pOcclusionBuffer != NULL)
+	{
+		RasterizeOccluders(pFrustum, pOcclusionBuffer);
+	}
 
-int QBT::GetNumVertices()
-{
-	int numVertices = 0;
-	for (int i = 0; i < (int)m_vpQBTMatrices.size(); i++)
+	// The uniforms of each matrix are found by its index, both by the draw lists and by the batches. The levels of detail come
+	// after the matrices, with every matrix again for each level.
+	unsigned int numMatrices = (unsigned int)m_vpQBTMatrices.size();
+	m_vDrawUniforms.resize(GetNumDrawIndices());
+	for (unsigned int matrixIndex = 0; matrixIndex < numMatrices; matrixIndex++)
 	{
-		numVertices += m_vpQBTMatrices[i]->m_numVertices;
+		QBTMatrix* pMatrix = m_vpQBTMatrices[matrixIndex];
+		Material* pMaterial = pMatrix->m_pMaterial;
+		DrawUniformBlock* pDrawUniforms = &m_vDrawUniforms[matrixIndex];
+		vec3 position((float)pMatrix->m_positionX, (float)pMatrix->m_positionY, (float)pMatrix->m_positionZ);
+		pDrawUniforms->m_model = translate(mat4(), position);
+		pDrawUniforms->m_materialAmbient = vec4(pMaterial->m_ambient.GetRed(), pMaterial->m_ambient.GetGreen(), pMaterial->m_ambient.GetBlue(), 1.0f);
+		pDrawUniforms->m_materialDiffuse = vec4(pMaterial->m_diffuse.GetRed(), pMaterial->m_diffuse.GetGreen(), pMaterial->m_diffuse.GetBlue(), 1.0f);
+		pDrawUniforms->m_materialSpecular = vec4(pMaterial->m_specular.GetRed(), pMaterial->m_specular.GetGreen(), pMaterial->m_specular.GetBlue(), pMaterial->m_shininess);
+		pDrawUniforms->m_options = vec4(m_useLighting ? 1.0f : 0.0f, 1.0f, 0.0f, 0.0f);
+
+		// The grid corners of a level are scaled up around the centre of the full detail voxels its first voxel covers
+		for (unsigned int level = 1; level <= pMatrix->m_vpLODs.size(); level++)
+		{
+			float lodScale = (float)pMatrix->m_vpLODs[level - 1]->m_lodScale;
+			DrawUniformBlock* pLODDrawUniforms = &m_vDrawUniforms[matrixIndex + level * numMatrices];
+			*pLODDrawUniforms = *pDrawUniforms;
+			pLODDrawUniforms->m_model = translate(mat4(), position + vec3((lodScale - 1.0f) * 0.5f)) * scale(mat4(), vec3(lodScale));
+		}
+
+		// Instances can be placed anywhere, so they are always drawn at full detail
+		unsigned int lodLevel = m_vInstances.empty() ? pMatrix->m_lodLevel : 0;
+		float lodFade = m_vInstances.empty() ? pMatrix->m_lodFade : 0.0f;
+		QBTMatrix* pLevel = lodLevel == 0 ? pMatrix : pMatrix->m_vpLODs[lodLevel - 1];
+		AddMatrixDraws(pLevel, matrixIndex + lodLevel * numMatrices, position, pFrustum, pOcclusionBuffer, true);
+
+		// While cross-fading both levels are drawn against the same dither pattern, and the level fading out keeps the pixels that
+		// the level fading in leaves out, so every pixel is drawn by one of them
+		if (lodFade > 0.0f)
+		{
+			m_vDrawUniforms[matrixIndex + lodLevel * numMatrices].m_options = vec4(pDrawUniforms->m_options.x, lodFade, 1.0f, 0.0f);
+			m_vDrawUniforms[matrixIndex + (lodLevel + 1) * numMatrices].m_options = vec4(pDrawUniforms->m_options.x, lodFade, 0.0f, 0.0f);
+			AddMatrixDraws(pMatrix->m_vpLODs[lodLevel], matrixIndex + (lodLevel + 1) * numMatrices, position, pFrustum, pOcclusionBuffer, false);
+		}
 	}
-	return numVertices;
 }
 
-int QBT::GetNumTriangles()
+// Adds the chunks of a matrix, or of one of its levels of detail, that are inside the frustum and not occluded. Only the level
+// a matrix is mainly drawn at adds to the culling counts.
+void QBT::AddMatrixDraws(QBTMatrix* pMatrix, unsigned int drawIndex, vec3 position, Frustum* pFrustum, QBTOcclusionBuffer* pOcclusionBuffer, bool countCulling)
 {
-	int numTriangles = 0;
-	for (int i = 0; i < (int)m_vpQBTMatrices.size(); i++)
+	if (pMatrix->m_boundsDirty)
 	{
-		numTriangles += m_vpQBTMatrices[i]->m_numTriangles;
+		CalculateMatrixBounds(pMatrix);
+	}
+	float lodScale = (float)pMatrix->m_lodScale;
+	vec3 offset = position + vec3((lodScale - 1.0f) * 0.5f);
+	pMatrix->m_worldBoundsMin = pMatrix->m_boundsMin * lodScale + offset;
+	pMatrix->m_worldBoundsMax = pMatrix->m_boundsMax * lodScale + offset;
+	if (pMatrix->m_numVertices == 0)
+	{
+		return;
 	}
-	return numTriangles;
-}
 
-// Modifiers
-void QBT::SetMaterialAmbient(Colour ambient)
-{
-	for (int i = 0; i < (int)m_vpQBTMatrices.size(); i++)
+	bool matrixCulled = pFrustum != NULL && pFrustum->IsBoxOutside(pMatrix->m_worldBoundsMin, pMatrix->m_worldBoundsMax);
+	bool matrixOccluded = matrixCulled == false && pOcclusionBuffer != NULL && pOcclusionBuffer->IsBoxOccluded(pMatrix->m_worldBoundsMin, pMatrix->m_worldBoundsMax);
+	if (countCulling)
 	{
-		m_vpQBTMatrices[i]->m_pMaterial->m_ambient = ambient;
+		if (matrixCulled)
+		{
+			m_numCulledMatrices++;
+		}
+		else if (matrixOccluded)
+		{
+			m_numOccludedMatrices++;
+		}
+		else
+		{
+			m_numVisibleMatrices++;
+		}
 	}
-}
 
-void QBT::SetMaterialDiffuse(Colour diffuse)
-{
-	for (int i = 0; i < (int)m_vpQBTMatrices.size(); i++)
+	// Every chunk of a matrix has the same vertex format, unless some of them are still waiting to be remeshed
+	for (unsigned int chunkIndex = 0; chunkIndex < pMatrix->m_vChunks.size(); chunkIndex++)
 	{
-		m_vpQBTMatrices[i]->m_pMaterial->m_diffuse = diffuse;
+		QBTChunk* pChunk = &pMatrix->m_vChunks[chunkIndex];
+		if (IsChunkDrawable(pChunk) == false)
+		{
+			continue;
+		}
+
+		// The chunks of a culled or occluded matrix are only counted
+		vec3 boundsMin = pChunk->m_boundsMin * lodScale + offset;
+		vec3 boundsMax = pChunk->m_boundsMax * lodScale + offset;
+		if (matrixCulled || (pFrustum != NULL && pFrustum->IsBoxOutside(boundsMin, boundsMax)))
+		{
+			m_numCulledChunks += countCulling ? 1 : 0;
+			continue;
+		}
+		if (matrixOccluded || (pOcclusionBuffer != NULL && pOcclusionBuffer->IsBoxOccluded(boundsMin, boundsMax)))
+		{
+			m_numOccludedChunks += countCulling ? 1 : 0;
+			continue;
+		}
+		m_numVisibleChunks += countCulling ? 1 : 0;
+
+		QBTDrawList* pDrawList = &m_drawLists[pChunk->m_vertexFormat];
+		if (pDrawList->m_vMatrixDraws.empty() || pDrawList->m_vMatrixDraws.back().m_pMatrix != pMatrix)
+		{
+			QBTMatrixDraw matrixDraw;
+			matrixDraw.m_pMatrix = pMatrix;
+			matrixDraw.m_drawIndex = drawIndex;
+			matrixDraw.m_firstChunk = (unsigned int)pDrawList->m_vpChunks.size();
+			matrixDraw.m_numChunks = 0;
+			pDrawList->m_vMatrixDraws.push_back(matrixDraw);
+		}
+
+		pDrawList->m_vpChunks.push_back(pChunk);
+		pDrawList->m_vMatrixDraws.back().m_numChunks++;
 	}
 }
 
-void QBT::SetMaterialSpecular(Colour specular)
+// The occluders of the chunks inside the frustum go into the buffer nearest chunk first, until it is full
+void QBT::RasterizeOccluders(Frustum* pFrustum, QBTOcclusionBuffer* pOcclusionBuffer)
 {
-	for (int i = 0; i < (int)m_vpQBTMatrices.size(); i++)
+	PROFILE_SCOPE("QBT::RasterizeOccluders");
+
+	m_vOccluderChunks.clear();
+	for (unsigned int matrixIndex = 0; matrixIndex < m_vpQBTMatrices.size(); matrixIndex++)
 	{
-		m_vpQBTMatrices[i]->m_pMaterial->m_specular = specular;
+		// The faces of a matrix drawn at a coarser level, even partly, might not be there to hide anything
+		QBTMatrix* pMatrix = m_vpQBTMatrices[matrixIndex];
+		if (pMatrix->m_numVertices == 0 || pMatrix->m_lodLevel != 0 || pMatrix->m_lodFade > 0.0f)
+		{
+			continue;
+		}
+
+		vec3 position((float)pMatrix->m_positionX, (float)pMatrix->m_positionY, (float)pMatrix->m_positionZ);
+		for (unsigned int chunkIndex = 0; chunkIndex < pMatrix->m_vChunks.size(); chunkIndex++)
+		{
+			QBTChunk* pChunk = &pMatrix->m_vChunks[chunkIndex];
+			if (pChunk->m_vOccluders.empty() || IsChunkDrawable(pChunk) == false)
+			{
+				continue;
+			}
+
+			vec3 boundsMin = pChunk->m_boundsMin + position;
+			vec3 boundsMax = pChunk->m_boundsMax + position;
+			if (pFrustum != NULL && pFrustum->IsBoxOutside(boundsMin, boundsMax))
+			{
+				continue;
+			}
+
+			QBTOccluderChunk occluderChunk;
+			occluderChunk.m_depth = pOcclusionBuffer->GetViewDepth((boundsMin + boundsMax) * 0.5f);
+			occluderChunk.m_pChunk = pChunk;
+			occluderChunk.m_position = position;
+			m_vOccluderChunks.push_back(occluderChunk);
+		}
 	}
+
+	sort(m_vOccluderChunks.begin(), m_vOccluderChunks.end(), [](const QBTOccluderChunk& lhs, const QBTOccluderChunk& rhs)
+	{
+		return lhs.m_depth < rhs.m_depth;
+	});
+
+	bool bufferFull = false;
+	for (unsigned int i = 0; i < m_vOccluderChunks.size() && bufferFull == false; i++)
+	{
+		QBTChunk* pChunk = m_vOccluderChunks[i].m_pChunk;
+		for (unsigned int j = 0; j < pChunk->m_vOccluders.size() && bufferFull == false; j++)
+		{
+			bufferFull = pOcclusionBuffer->AddOccluder(pChunk->m_vOccluders[j], m_vOccluderChunks[i].m_position) == false;
+		}
+	}
+
+	pOcclusionBuffer->Rasterize();
 }
 
-void QBT::SetMaterialEmission(Colour emission)
+// Draw indices number every matrix, and then every matrix again for each level of detail
+unsigned int QBT::GetNumDrawIndices()
 {
-	for (int i = 0; i < (int)m_vpQBTMatrices.size(); i++)
+	size_t numLODs = 0;
+	for (unsigned int i = 0; i < m_vpQBTMatrices.size(); i++)
 	{
-		m_vpQBTMatrices[i]->m_pMaterial->m_emission = emission;
+		numLODs = std::max(numLODs, m_vpQBTMatrices[i]->m_vpLODs.size());
 	}
+
+	return (unsigned int)(m_vpQBTMatrices.size() * (numLODs + 1));
 }
 
-void QBT::SetMaterialShininess(float shininess)
+// The matrix or level of detail drawn with the draw index, NULL for a level the matrix doesn't have
+QBTMatrix* QBT::GetDrawIndexMatrix(unsigned int drawIndex)
 {
-	for (int i = 0; i < (int)m_vpQBTMatrices.size(); i++)
+	QBTMatrix* pMatrix = m_vpQBTMatrices[drawIndex % m_vpQBTMatrices.size()];
+	unsigned int level = drawIndex / (unsigned int)m_vpQBTMatrices.size();
+	if (level == 0)
 	{
-		m_vpQBTMatrices[i]->m_pMaterial->m_shininess = shininess;
+		return pMatrix;
 	}
+
+	return level <= pMatrix->m_vpLODs.size() ? pMatrix->m_vpLODs[level - 1] : NULL;
 }
 
-// Render modes
-void QBT::SetWireframeMode(bool wireframe)
+// Empty chunks and chunks waiting on their upload have no buffers, a headless QBT has no buffers at all and keeps every mesh
+bool QBT::IsChunkDrawable(QBTChunk* pChunk)
 {
-	m_wireframeRender = wireframe;
+	return pChunk->m_numIndices != 0 && (pChunk->m_VAO != 0 || pChunk->m_inBatch || m_pRenderer == NULL);
 }
 
-bool QBT::GetWireframeMode()
+unsigned int QBT::GetNumVisibleMatrices()
 {
-	return m_wireframeRender;
+	return m_numVisibleMatrices;
 }
 
-void QBT::SetUseLighting(bool lighting)
+unsigned int QBT::GetNumCulledMatrices()
 {
-	m_useLighting = lighting;
+	return m_numCulledMatrices;
 }
 
-void QBT::SetBoundingBoxRendering(bool boundingBox)
+unsigned int QBT::GetNumVisibleChunks()
 {
-	m_boundingBox = boundingBox;
+	return m_numVisibleChunks;
 }
 
-// Creation optimizations
-void QBT::SetCreateInnerVoxels(bool innerVoxels)
+unsigned int QBT::GetNumCulledChunks()
 {
-	m_createInnerVoxels = innerVoxels;
+	return m_numCulledChunks;
 }
 
-void QBT::SetCreateInnerFaces(bool innerFaces)
+unsigned int QBT::GetNumOccludedMatrices()
 {
-	m_createInnerFaces = innerFaces;
+	return m_numOccludedMatrices;
 }
 
-void QBT::SetMergeFaces(bool mergeFaces)
+unsigned int QBT::GetNumOccludedChunks()
 {
-	m_mergeFaces = mergeFaces;
+	return m_numOccludedChunks;
 }
 
-// Render
-void QBT::Render(Camera* pCamera, Light* pLight)
+bool QBT::IsChunkInDrawLists(QBTChunk* pChunk)
 {
-	if (m_wireframeRender)
+	for (int i = 0; i < QBTVertexFormat_NUM; i++)
 	{
-		glPolygonMode(GL_FRONT_AND_BACK, GL_LINE);
+		if (find(m_drawLists[i].m_vpChunks.begin(), m_drawLists[i].m_vpChunks.end(), pChunk) != m_drawLists[i].m_vpChunks.end())
+		{
+			return true;
+		}
 	}
-	else
+
+	return false;
+}
+
+unsigned int QBT::GetNumDrawCalls()
+{
+	unsigned int numDrawCalls = 0;
+	for (int i = 0; i < QBTVertexFormat_NUM; i++)
 	{
-		glPolygonMode(GL_FRONT_AND_BACK, GL_FILL);
+		if (m_batchedRendering && m_vInstances.empty())
+		{
+			numDrawCalls += m_drawLists[i].m_vpChunks.empty() ? 0 : 1;
+		}
+		else
+		{
+			numDrawCalls += (unsigned int)m_drawLists[i].m_vpChunks.size();
+		}
+	}
+
+	return numDrawCalls;
+}
+
+unsigned int QBT::GetNumDrawnTriangles()
+{
+	unsigned int numTriangles = 0;
+	for (int i = 0; i < QBTVertexFormat_NUM; i++)
+	{
+		for (unsigned int j = 0; j < m_drawLists[i].m_vpChunks.size(); j++)
+		{
+			numTriangles += m_drawLists[i].m_vpChunks[j]->m_numTriangles;
+		}
+	}
+
+	return numTriangles * (unsigned int)std::max(m_vInstances.size(), (size_t)1);
+}
+
+void QBT::RenderDrawList(Shader* pShader, const QBTDrawList& drawList)
+{
+	if (drawList.m_vMatrixDraws.empty())
+	{
+		return;
 	}
 
 	// Use shader
-	m_pPositionColorNormalShader->UseShader();
+	pShader->UseShader();
 
-	GLint viewPosLoc = glGetUniformLocation(m_pPositionColorNormalShader->GetShader(), "viewPos");
-	glUniform3f(viewPosLoc, pCamera->GetPosition().x, pCamera->GetPosition().y, pCamera->GetPosition().z);
+	for (unsigned int drawIndex = 0; drawIndex < drawList.m_vMatrixDraws.size(); drawIndex++)
+	{
+		const QBTMatrixDraw& matrixDraw = drawList.m_vMatrixDraws[drawIndex];
 
-	// Set light properties
-	glUniform3f(glGetUniformLocation(m_pPositionColorNormalShader->GetShader(), "light.position"), pLight->m_position.x, pLight->m_position.y, pLight->m_position.z);
-	glUniform3f(glGetUniformLocation(m_pPositionColorNormalShader->GetShader(), "light.ambient"), pLight->m_ambient.GetRed(), pLight->m_ambient.GetGreen(), pLight->m_ambient.GetBlue());
-	glUniform3f(glGetUniformLocation(m_pPositionColorNormalShader->GetShader(), "light.diffuse"), pLight->m_diffuse.GetRed(), pLight->m_diffuse.GetGreen(), pLight->m_diffuse.GetBlue());
-	glUniform3f(glGetUniformLocation(m_pPositionColorNormalShader->GetShader(), "light.specular"), pLight->m_specular.GetRed(), pLight->m_specular.GetGreen(), pLight->m_specular.GetBlue());
-	glUniform1f(glGetUniformLocation(m_pPositionColorNormalShader->GetShader(), "light.constant"), pLight->m_constantAttenuation);
-	glUniform1f(glGetUniformLocation(m_pPositionColorNormalShader->GetShader(), "light.linear"), pLight->m_linearAttenuation);
-	glUniform1f(glGetUniformLocation(m_pPositionColorNormalShader->GetShader(), "light.quadratic"), pLight->m_quadraticAttenuation);
+		// The model transform and material of the matrix
+		m_pRenderer->BindDrawUniforms(matrixDraw.m_drawIndex);
 
-	glUniform1i(glGetUniformLocation(m_pPositionColorNormalShader->GetShader(), "useLighting"), m_useLighting);
+		for (unsigned int chunkIndex = 0; chunkIndex < matrixDraw.m_numChunks; chunkIndex++)
+		{
+			QBTChunk* pChunk = drawList.m_vpChunks[matrixDraw.m_firstChunk + chunkIndex];
 
-	for (unsigned int matrixIndex = 0; matrixIndex < m_vpQBTMatrices.size(); matrixIndex++)
+			glBindVertexArray(pChunk->m_VAO);
+			glDrawElements(GL_TRIANGLES, pChunk->m_numIndices, pChunk->m_indexType, 0);
+		}
+	}
+	glBindVertexArray(0);
+}
+
+// Draws every chunk in the draw list once for each instance, from the chunk's own buffers or from the batch it was moved into
+void QBT::RenderInstancedDrawList(Shader* pShader, const QBTDrawList& drawList, QBTBatch* pBatch)
+{
+	if (drawList.m_vMatrixDraws.empty())
 	{
-		QBTMatrix* pMatrix = m_vpQBTMatrices[matrixIndex];
+		return;
+	}
+
+	// Use shader
+	pShader->UseShader();
 
-		// Set material properties
-		glUniform3f(glGetUniformLocation(m_pPositionColorNormalShader->GetShader(), "material.ambient"), pMatrix->m_pMaterial->m_ambient.GetRed(), pMatrix->m_pMaterial->m_ambient.GetGreen(), pMatrix->m_pMaterial->m_ambient.GetBlue());
-		glUniform3f(glGetUniformLocation(m_pPositionColorNormalShader->GetShader(), "material.diffuse"), pMatrix->m_pMaterial->m_diffuse.GetRed(), pMatrix->m_pMaterial->m_diffuse.GetGreen(), pMatrix->m_pMaterial->m_diffuse.GetBlue());
-		glUniform3f(glGetUniformLocation(m_pPositionColorNormalShader->GetShader(), "material.specular"), pMatrix->m_pMaterial->m_specular.GetRed(), pMatrix->m_pMaterial->m_specular.GetGreen(), pMatrix->m_pMaterial->m_specular.GetBlue());
-		glUniform1f(glGetUniformLocation(m_pPositionColorNormalShader->GetShader(), "material.shininess"), pMatrix->m_pMaterial->m_shininess);
+	// The matrix index of the batch is per instance with base instances, and there are fewer matrices than model instances
+	if (pBatch->m_VAO != 0)
+	{
+		glBindVertexArray(pBatch->m_VAO);
+		glDisableVertexAttribArray(3);
+	}
 
-		// Create transformations
-		mat4 view;
-		mat4 projection;
-		view = lookAt(pCamera->GetPosition(), pCamera->GetView(), pCamera->GetUp());
-		projection = perspective(45.0f, (GLfloat)QubeGame::GetInstance()->GetWindowWidth() / (GLfloat)QubeGame::GetInstance()->GetWindowHeight(), 0.01f, 1000.0f);
+	GLsizei numInstances = (GLsizei)m_vInstances.size();
+	for (unsigned int drawIndex = 0; drawIndex < drawList.m_vMatrixDraws.size(); drawIndex++)
+	{
+		const QBTMatrixDraw& matrixDraw = drawList.m_vMatrixDraws[drawIndex];
 
-		// Get their uniform location
-		GLint modelLoc = glGetUniformLocation(m_pPositionColorNormalShader->GetShader(), "model");
-		GLint viewLoc = glGetUniformLocation(m_pPositionColorNormalShader->GetShader(), "view");
-		GLint projLoc = glGetUniformLocation(m_pPositionColorNormalShader->GetShader(), "projection");
+		// The model transform and material of the matrix
+		m_pRenderer->BindDrawUniforms(matrixDraw.m_drawIndex);
 
-		// Pass the matrices to the shader
-		glUniformMatrix4fv(viewLoc, 1, GL_FALSE, value_ptr(view));
-		glUniformMatrix4fv(projLoc, 1, GL_FALSE, value_ptr(projection));
+		for (unsigned int chunkIndex = 0; chunkIndex < matrixDraw.m_numChunks; chunkIndex++)
+		{
+			QBTChunk* pChunk = drawList.m_vpChunks[matrixDraw.m_firstChunk + chunkIndex];
 
-		glBindVertexArray(pMatrix->m_VAO);
+			if (pChunk->m_inBatch)
+			{
+				glBindVertexArray(pBatch->m_VAO);
+				glDrawElementsInstancedBaseVertex(GL_TRIANGLES, pChunk->m_numIndices, pBatch->m_indexType, 0, numInstances, pChunk->m_batchFirstVertex);
+			}
+			else
+			{
+				glBindVertexArray(pChunk->m_VAO);
+				glDrawElementsInstanced(GL_TRIANGLES, pChunk->m_numIndices, pChunk->m_indexType, 0, numInstances);
+			}
+		}
+	}
 
-		mat4 model;
-		model = translate(model, vec3(pMatrix->m_positionX, pMatrix->m_positionY, pMatrix->m_positionZ));
-		glUniformMatrix4fv(modelLoc, 1, GL_FALSE, value_ptr(model));
+	if (pBatch->m_VAO != 0)
+	{
+		glBindVertexArray(pBatch->m_VAO);
+		glEnableVertexAttribArray(3);
+	}
+	glBindVertexArray(0);
+}
 
-		glDrawElements(GL_TRIANGLES, pMatrix->m_numIndices, GL_UNSIGNED_INT, 0);
-		glBindVertexArray(0);
+// Draws every chunk in the draw list with a single multi-draw, each chunk's matrix index goes along with it as its base instance
+void QBT::RenderBatch(Shader* pShader, const QBTDrawList& drawList, QBTBatch* pBatch)
+{
+	if (drawList.m_vpChunks.empty() || pBatch->m_VAO == 0)
+	{
+		return;
 	}
 
-	glPolygonMode(GL_FRONT_AND_BACK, GL_FILL);
+	// Use shader
+	pShader->UseShader();
 
-	if (m_boundingBox)
+	glActiveTexture(GL_TEXTURE0);
+	glBindTexture(GL_TEXTURE_BUFFER, m_matrixDataTexture);
+	pShader->SetUniform(ShaderUniform_MatrixData, 0);
+
+	glBindVertexArray(pBatch->m_VAO);
+
+	GLsizei numDraws = (GLsizei)drawList.m_vpChunks.size();
+	if (m_multiDrawIndirect)
 	{
-		RenderBoundingBox(pCamera, pLight);
+		m_vIndirectCommands.resize(numDraws);
+		for (unsigned int drawIndex = 0; drawIndex < drawList.m_vMatrixDraws.size(); drawIndex++)
+		{
+			const QBTMatrixDraw& matrixDraw = drawList.m_vMatrixDraws[drawIndex];
+			for (unsigned int chunkIndex = matrixDraw.m_firstChunk; chunkIndex < matrixDraw.m_firstChunk + matrixDraw.m_numChunks; chunkIndex++)
+			{
+				QBTDrawElementsIndirectCommand* pCommand = &m_vIndirectCommands[chunkIndex];
+				pCommand->m_count = drawList.m_vpChunks[chunkIndex]->m_numIndices;
+				pCommand->m_instanceCount = 1;
+				pCommand->m_firstIndex = 0;
+				pCommand->m_baseVertex = drawList.m_vpChunks[chunkIndex]->m_batchFirstVertex;
+				pCommand->m_baseInstance = matrixDraw.m_drawIndex;
+			}
+		}
+
+		glBindBuffer(GL_DRAW_INDIRECT_BUFFER, m_indirectBuffer);
+		glBufferData(GL_DRAW_INDIRECT_BUFFER, sizeof(QBTDrawElementsIndirectCommand) * numDraws, m_vIndirectCommands.data(), GL_STREAM_DRAW);
+		glMultiDrawElementsIndirect(GL_TRIANGLES, pBatch->m_indexType, 0, numDraws, 0);
+		glBindBuffer(GL_DRAW_INDIRECT_BUFFER, 0);
+	}
+	else
+	{
+		// The matrix index is stored with every vertex instead, so the draws only need their base vertex
+		m_vDrawCounts.resize(numDraws);
+		m_vDrawBaseVertices.resize(numDraws);
+		m_vDrawIndexOffsets.assign(numDraws, (const GLvoid*)0);
+		for (GLsizei chunkIndex = 0; chunkIndex < numDraws; chunkIndex++)
+		{
+			m_vDrawCounts[chunkIndex] = drawList.m_vpChunks[chunkIndex]->m_numIndices;
+			m_vDrawBaseVertices[chunkIndex] = drawList.m_vpChunks[chunkIndex]->m_batchFirstVertex;
+		}
+
+		glMultiDrawElementsBaseVertex(GL_TRIANGLES, m_vDrawCounts.data(), pBatch->m_indexType, m_vDrawIndexOffsets.data(), numDraws, m_vDrawBaseVertices.data());
 	}
+
+	glBindVertexArray(0);
+	glBindTexture(GL_TEXTURE_BUFFER, 0);
 }
 
 void QBT::RenderBoundingBox(Camera* pCamera, Light* pLight)
@@ -2663,19 +4162,6 @@ void QBT::RenderBoundingBox(Camera* pCamera, Light* pLight)
 		float z2 = (float)pMatrix->m_sizeZ;
 		vec3 center(pMatrix->m_positionX - 0.5f, pMatrix->m_positionY - 0.5f, pMatrix->m_positionZ - 0.5f);
 
-		m_pRenderer->DrawLine(center + vec3(x1, y1, z1), center + vec3(x2, y1, z1), Colour(1.0f, 1.0f, 0.0f), Colour(1.0f, 1.0f, 0.0f));
-		m_pRenderer->DrawLine(center + vec3(x1, y2, z1), center + vec3(x2, y2, z1), Colour(1.0f, 1.0f, 0.0f), Colour(1.0f, 1.0f, 0.0f));
-		m_pRenderer->DrawLine(center + vec3(x1, y1, z2), center + vec3(x2, y1, z2), Colour(1.0f, 1.0f, 0.0f), Colour(1.0f, 1.0f, 0.0f));
-		m_pRenderer->DrawLine(center + vec3(x1, y2, z2), center + vec3(x2, y2, z2), Colour(1.0f, 1.0f, 0.0f), Colour(1.0f, 1.0f, 0.0f));
-
-		m_pRenderer->DrawLine(center + vec3(x1, y1, z1), center + vec3(x1, y2, z1), Colour(1.0f, 1.0f, 0.0f), Colour(1.0f, 1.0f, 0.0f));
-		m_pRenderer->DrawLine(center + vec3(x2, y1, z1), center + vec3(x2, y2, z1), Colour(1.0f, 1.0f, 0.0f), Colour(1.0f, 1.0f, 0.0f));
-		m_pRenderer->DrawLine(center + vec3(x1, y1, z2), center + vec3(x1, y2, z2), Colour(1.0f, 1.0f, 0.0f), Colour(1.0f, 1.0f, 0.0f));
-		m_pRenderer->DrawLine(center + vec3(x2, y1, z2), center + vec3(x2, y2, z2), Colour(1.0f, 1.0f, 0.0f), Colour(1.0f, 1.0f, 0.0f));
-
-		m_pRenderer->DrawLine(center + vec3(x1, y1, z1), center + vec3(x1, y1, z2), Colour(1.0f, 1.0f, 0.0f), Colour(1.0f, 1.0f, 0.0f));
-		m_pRenderer->DrawLine(center + vec3(x2, y1, z1), center + vec3(x2, y1, z2), Colour(1.0f, 1.0f, 0.0f), Colour(1.0f, 1.0f, 0.0f));
-		m_pRenderer->DrawLine(center + vec3(x1, y2, z1), center + vec3(x1, y2, z2), Colour(1.0f, 1.0f, 0.0f), Colour(1.0f, 1.0f, 0.0f));
-		m_pRenderer->DrawLine(center + vec3(x2, y2, z1), center + vec3(x2, y2, z2), Colour(1.0f, 1.0f, 0.0f), Colour(1.0f, 1.0f, 0.0f));
+		m_pRenderer->DrawBox(center + vec3(x1, y1, z1), center + vec3(x2, y2, z2), Colour(1.0f, 1.0f, 0.0f));
 	}
 }
\ No newline at end of file
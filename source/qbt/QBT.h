@@ -18,9 +18,19 @@
 #include "../Renderer/Renderer.h"
 #include "../Renderer/light.h"
 #include "../Renderer/material.h"
-
-#include <vector>
+#include "../JobSystem/JobSystem.h"
+#include "QBTFileMapping.h"
+#include "QBTBinaryMesher.h"
+#include "QBTAmbientOcclusion.h"
+#include "QBTLevelOfDetail.h"
+#include "QBTVisibility.h"
+#include "QBTOcclusion.h"
+
+#include <atomic>
+#include <mutex>
 #include <string>
+#include <thread>
+#include <vector>
 using namespace std;
 
 enum MergedSide
@@ -35,6 +45,65 @@ enum MergedSide
 	MergedSide_Z_Negative = 32,
 };
 
+enum QBTMesher
+{
+	QBTMesher_Default = 0,
+	QBTMesher_BinaryGreedy,
+};
+
+enum QBTVertexFormat
+{
+	QBTVertexFormat_PositionColorNormal = 0,
+	QBTVertexFormat_Packed,
+
+	QBTVertexFormat_NUM,
+};
+
+// Matrices are split into chunks of this many voxels along each axis, each chunk is meshed and drawn on its own
+const unsigned int QBT_CHUNK_SIZE = 32;
+
+class QBTChunk
+{
+public:
+	// Voxels covered by the chunk, the max is exclusive
+	unsigned int m_minX;
+	unsigned int m_minY;
+	unsigned int m_minZ;
+	unsigned int m_maxX;
+	unsigned int m_maxY;
+	unsigned int m_maxZ;
+
+	// Bounds of the mesh, in the same space as the vertices, empty when the chunk has no faces
+	vec3 m_boundsMin;
+	vec3 m_boundsMax;
+
+	// Set when the voxels in the chunk have changed since it was last meshed
+	bool m_dirty;
+
+	unsigned int m_numVertices;
+	unsigned int m_numTriangles;
+	unsigned int m_numIndices;
+
+	// Mesh data, only held between meshing and upload
+	QBTVertexFormat m_vertexFormat;
+	PositionColorNormalVertex* m_pVertices;
+	PackedPositionColorNormalVertex* m_pPackedVertices;
+
+	// Rendering
+	GLuint m_VBO;
+	GLuint m_VAO;
+	GLenum m_indexType; // Of the shared quad index buffer
+
+	// With batched rendering the vertices are moved out of the chunk's own buffer and into the batch of its vertex format
+	bool m_inBatch;
+	unsigned int m_batchFirstVertex;
+
+	// The biggest merged faces of the mesh, biggest first, kept for occlusion culling after the mesh itself has been uploaded
+	vector<QBTOccluder> m_vOccluders;
+};
+
+typedef vector<QBTChunk> QBTChunkList;
+
 class QBTMatrix
 {
 public:
@@ -65,20 +134,119 @@ public:
 	unsigned int *m_pColour;
 	unsigned int *m_pVisibilityMask;
 
+	// Time taken by each stage of loading the matrix. Parsing includes setting up its chunks, inflating doesn't include the
+	// visibility masks, and they are only timed when they are recomputed.
+	float m_parseMilliseconds;
+	float m_inflateMilliseconds;
+	float m_visibilityMilliseconds;
+
+	// Chunks, laid out with x innermost like the voxels
+	unsigned int m_numChunksX;
+	unsigned int m_numChunksY;
+	unsigned int m_numChunksZ;
+	QBTChunkList m_vChunks;
+
+	// Totals of all the chunks, kept up to date as each chunk is meshed
 	unsigned int m_numVertices;
 	unsigned int m_numTriangles;
-	unsigned int m_numIndices;
+
+	// Bounds of every chunk mesh together, gathered again when a chunk has been meshed. The world bounds are these offset by the
+	// matrix position, updated each time the draw lists are built, and chunk bounds are offset the same way when they are tested.
+	vec3 m_boundsMin;
+	vec3 m_boundsMax;
+	bool m_boundsDirty;
+	vec3 m_worldBoundsMin;
+	vec3 m_worldBoundsMax;
 
 	// Material
 	Material* m_pMaterial;
 
-	// Rendering
+	// Occupancy columns for the binary mesher, only built once the matrix is meshed with it
+	QBTBinaryOccupancy m_binaryOccupancy;
+
+	// Level of detail, only the full detail matrix has a chain of levels, each one downsampled 2x from the one before it. The
+	// levels share the position and material of the full detail matrix, and their voxels are m_lodScale full detail voxels wide.
+	vector<QBTMatrix*> m_vpLODs;
+	unsigned int m_lodScale;
+
+	// Picked by SelectLODs, the matrix is drawn at level m_lodLevel, where 0 is full detail, dithered with the next level by m_lodFade
+	unsigned int m_lodLevel;
+	float m_lodFade;
+};
+
+typedef vector<QBTMatrix*> QBTMatrixList;
+
+// A matrix with chunks to draw this frame, its chunks are a range of the draw list's chunks
+class QBTMatrixDraw
+{
+public:
+	QBTMatrix* m_pMatrix;
+	unsigned int m_drawIndex; // Entry in the per draw uniform array
+	unsigned int m_firstChunk;
+	unsigned int m_numChunks;
+};
+
+// Everything drawn with one shader in a frame, gathered on the CPU before any GL calls are made
+class QBTDrawList
+{
+public:
+	vector<QBTMatrixDraw> m_vMatrixDraws;
+	vector<QBTChunk*> m_vpChunks;
+};
+
+// A chunk with occluders that is inside the frustum, and how far it is in front of the camera
+class QBTOccluderChunk
+{
+public:
+	float m_depth;
+	QBTChunk* m_pChunk;
+	vec3 m_position;
+};
+
+// The layout GL reads each draw of glMultiDrawElementsIndirect from
+class QBTDrawElementsIndirectCommand
+{
+public:
+	GLuint m_count;
+	GLuint m_instanceCount;
+	GLuint m_firstIndex;
+	GLint m_baseVertex;
+	GLuint m_baseInstance;
+};
+
+// The vertices of every chunk with the same vertex format packed into one buffer, so the whole model is drawn with one
+// multi-draw per vertex format. Each chunk is a base vertex into the buffer and all of them share the quad index buffer.
+class QBTBatch
+{
+public:
 	GLuint m_VBO;
 	GLuint m_VAO;
-	GLuint m_EBO;
+	GLuint m_matrixIndexVBO; // The matrix index of each instance with base instances, otherwise of each vertex
+	GLenum m_indexType;
+	unsigned int m_numVertices;
 };
 
-typedef vector<QBTMatrix*> QBTMatrixList;
+// One placement of the whole model, read by the instanced shaders as per instance vertex attributes
+class QBTInstance
+{
+public:
+	mat4 m_transform;
+	vec4 m_tint; // Multiplies the voxel colours
+};
+
+enum QBTLoaderBackend
+{
+	QBTLoaderBackend_FileStream = 0,
+	QBTLoaderBackend_MemoryMapped,
+};
+
+// A matrix found by the node scan, waiting to have its compressed voxel data unpacked
+struct QBTInflateJob
+{
+	QBTMatrix* m_pMatrix;
+	const unsigned char* m_pCompressedData;
+	unsigned int m_compressedSize;
+};
 
 class QBT
 {
@@ -93,22 +261,63 @@ public:
 
 	// Loading
 	bool LoadQBTFile(string filename);
+	bool ReadQBTFile(string filename);
 	bool LoadNode(FILE* pQBTfile);
 	bool LoadModel(FILE* pQBTfile);
 	bool LoadMatrix(FILE* pQBTfile);
 	bool LoadCompound(FILE* pQBTfile);
 	bool SkipNode(FILE* pQBTfile);
+	bool LoadNode(QBTMemoryReader& reader);
+	bool LoadModel(QBTMemoryReader& reader);
+	bool LoadMatrix(QBTMemoryReader& reader);
+	bool LoadCompound(QBTMemoryReader& reader);
+	bool SkipNode(QBTMemoryReader& reader);
+
+	// Job system, shared with the occlusion buffer. Without one everything runs on the calling thread.
+	void SetJobSystem(JobSystem* pJobSystem);
+	JobSystem* GetJobSystem();
+
+	// Loader backend
+	void SetLoaderBackend(QBTLoaderBackend backend);
+	QBTLoaderBackend GetLoaderBackend();
+	void SetParallelLoading(bool parallel); // Inflates the matrices as jobs, when there is a job system
+	bool GetParallelLoading();
+	void SetRecomputeVisibility(bool recompute); // Rebuild the visibility masks from voxel occupancy instead of trusting the file
+	bool GetRecomputeVisibility();
+
+	// Async loading
+	void LoadQBTFileAsync(string filename);
+	void UpdateAsyncLoad(float uploadBudgetMilliseconds);
+	void CancelAsyncLoad();
+	bool IsAsyncLoading();
 
 	// Setup
-	void SetVisibilityInformation();
 	void RecreateStaticBuffers();
-	void CreateStaticRenderBuffers();
+	void CreateStaticRenderBuffers(); // Remeshes and uploads the dirty chunks only
+	void CreateMeshData(QBTMatrix* pMatrix); // Meshes every chunk of the matrix and keeps a copy of each mesh, for when the upload happens later on
+	void CreateMeshData(QBTMatrix* pMatrix, QBTChunk* pChunk); // Meshes a single chunk into the mesh arenas
+	void StoreMeshData(QBTChunk* pChunk);
+	void DeleteMeshData(QBTMatrix* pMatrix);
+	void DeleteMeshData(QBTChunk* pChunk);
+	void SetMatrixDirty(QBTMatrix* pMatrix);
+
+	// Editing, voxel coordinates are local to the matrix and boxes are inclusive. The colours and visibility masks are updated
+	// straight away and the chunks that the edit touches are remeshed by the next UpdateDirtyChunks.
+	bool SetVoxel(QBTMatrix* pMatrix, int x, int y, int z, Colour colour);
+	bool SetVoxelBox(QBTMatrix* pMatrix, int minX, int minY, int minZ, int maxX, int maxY, int maxZ, Colour colour);
+	bool ClearVoxel(QBTMatrix* pMatrix, int x, int y, int z);
+	bool ClearVoxelBox(QBTMatrix* pMatrix, int minX, int minY, int minZ, int maxX, int maxY, int maxZ);
+	void UpdateDirtyChunks();
+	unsigned int GetNumDirtyChunks();
 
 	// Accessors
 	string GetFilename();
 	int GetNumMatrices();
+	QBTMatrix* GetMatrix(int index);
 	int GetNumVertices();
 	int GetNumTriangles();
+	size_t GetMeshMemory(); // Bytes of vertex data, levels of detail included, the same amount is uploaded every time the meshes are rebuilt. Index data is shared by every mesh.
+	size_t GetUnpackedMeshMemory(); // Bytes the vertices would take with the full PositionColorNormal vertex format
 
 	// Modifiers
 	void SetMaterialAmbient(Colour ambient);
@@ -122,21 +331,104 @@ public:
 	bool GetWireframeMode();
 	void SetUseLighting(bool lighting);
 	void SetBoundingBoxRendering(bool boundingBox);
+	void SetBatchedRendering(bool batched); // Draws the whole model from shared buffers with multi-draws, the static buffers need recreating after a change
+	bool GetBatchedRendering();
+	bool IsMultiDrawIndirectSupported(); // Otherwise batches are drawn with glMultiDrawElementsBaseVertex
+	void SetFrustumCulling(bool culling);
+	bool GetFrustumCulling();
+	void SetOcclusionCulling(bool culling); // Tests what is left after frustum culling against the biggest merged faces, rasterized on the CPU
+	bool GetOcclusionCulling();
+	QBTOcclusionBuffer* GetOcclusionBuffer();
+
+	// Level of detail, a chain of downsampled levels is built for every matrix when the model is loaded and the level drawn is
+	// picked for each matrix every frame. Models with instances are always drawn at full detail.
+	void SetNumLODs(unsigned int numLODs); // Up to QBT_MAX_LODS, the static buffers need recreating after a change
+	unsigned int GetNumLODs();
+	void SetLODDownsample(QBTLODDownsample downsample); // The static buffers need recreating after a change
+	QBTLODDownsample GetLODDownsample();
+	void SetLODPixelSize(float pixelSize); // Widest the voxels of a coarser level can be on screen before a finer level is drawn instead
+	float GetLODPixelSize();
+	void SetLODCrossFade(bool crossFade); // Dithers between two levels as a matrix moves from one to the other, instead of popping
+	bool GetLODCrossFade();
+	void SelectLODs(vec3 cameraPosition, const mat4& projection, unsigned int viewportHeight); // Done by Render every frame, before the draw lists are built
+	unsigned int GetNumLODMatrices(unsigned int level); // Matrices drawn at the level by the last SelectLODs, including the ones fading into it
 
 	// Creation optimizations
 	void SetCreateInnerVoxels(bool innerVoxels);
 	void SetCreateInnerFaces(bool innerFaces);
 	void SetMergeFaces(bool mergeFaces);
+	void SetAmbientOcclusion(bool ambientOcclusion); // Baked into the vertices when the chunks are meshed
+	bool GetAmbientOcclusion();
+	void SetMesher(QBTMesher mesher);
+	QBTMesher GetMesher();
+	void SetVertexFormat(QBTVertexFormat vertexFormat);
+	QBTVertexFormat GetVertexFormat();
+
+	// Instancing, a model with instances is drawn once for every instance with hardware instancing instead of once where it is
+	unsigned int AddInstance(const mat4& transform, Colour tint = Colour(1.0f, 1.0f, 1.0f, 1.0f));
+	void SetInstanceTransform(unsigned int instanceIndex, const mat4& transform);
+	void SetInstanceTint(unsigned int instanceIndex, Colour tint);
+	void ClearInstances();
+	unsigned int GetNumInstances();
 
 	// Render
 	void Render(Camera* pCamera, Light* pLight);
 	void RenderBoundingBox(Camera* pCamera, Light* pLight);
+	void BuildDrawLists(Frustum* pFrustum = NULL, QBTOcclusionBuffer* pOcclusionBuffer = NULL); // Gathers the chunks to draw for each vertex format and their per draw uniforms, done by Render every frame, after beginning the occlusion buffer for the camera
+	unsigned int GetNumDrawCalls(); // GL draw calls the last draw lists that were built take
+	unsigned int GetNumDrawnTriangles(); // Triangles in the last draw lists that were built, once for each instance
+
+	// Culling counts of the last draw lists that were built, only empty chunks and chunks waiting on their upload are left out
+	unsigned int GetNumVisibleMatrices();
+	unsigned int GetNumCulledMatrices();
+	unsigned int GetNumVisibleChunks();
+	unsigned int GetNumCulledChunks();
+	unsigned int GetNumOccludedMatrices();
+	unsigned int GetNumOccludedChunks();
+	bool IsChunkInDrawLists(QBTChunk* pChunk);
 
 protected:
 	/* Protected methods */
 
 private:
 	/* Private methods */
+	bool ReadQBTFileStream(string filename);
+	bool ReadQBTFileMapped(string filename);
+	void QueueInflate(QBTMatrix* pMatrix, const unsigned char* pCompressedData, unsigned int compressedSize);
+	bool InflateQueuedMatrices();
+	bool InflateMatrix(QBTMatrix* pMatrix, const unsigned char* pCompressedData, unsigned int compressedSize);
+	void AddMatrix(QBTMatrix* pMatrix);
+	void CreateMatrixChunks(QBTMatrix* pMatrix);
+	void CreateLODs(QBTMatrix* pMatrix);
+	void UpdateLODs(QBTMatrix* pMatrix, int minX, int minY, int minZ, int maxX, int maxY, int maxZ);
+	void DeleteLODs(QBTMatrix* pMatrix);
+	void CreateMatrixRenderBuffers(QBTMatrix* pMatrix);
+	void DestroyMatrixBuffers(QBTMatrix* pMatrix);
+	bool EditVoxelBox(QBTMatrix* pMatrix, int minX, int minY, int minZ, int maxX, int maxY, int maxZ, unsigned int colour);
+	void SetBoxDirty(QBTMatrix* pMatrix, int minX, int minY, int minZ, int maxX, int maxY, int maxZ);
+	void CreateDefaultMeshData(QBTMatrix* pMatrix, QBTChunk* pChunk, bool packVertices);
+	void CalculateMeshBounds(QBTChunk* pChunk);
+	void CalculateMatrixBounds(QBTMatrix* pMatrix);
+	void GatherOccluders(QBTChunk* pChunk);
+	void RasterizeOccluders(Frustum* pFrustum, QBTOcclusionBuffer* pOcclusionBuffer);
+	void AddMatrixDraws(QBTMatrix* pMatrix, unsigned int drawIndex, vec3 position, Frustum* pFrustum, QBTOcclusionBuffer* pOcclusionBuffer, bool countCulling);
+	bool IsChunkDrawable(QBTChunk* pChunk);
+	unsigned int GetNumDrawIndices();
+	QBTMatrix* GetDrawIndexMatrix(unsigned int drawIndex);
+	size_t GrowMeshArenas(unsigned int minVertices, bool packVertices);
+	size_t GetVertexSize(QBTChunk* pChunk);
+	void CreateChunkBuffers(QBTChunk* pChunk, const GLvoid* pVertices);
+	void DestroyChunkBuffers(QBTChunk* pChunk);
+	void SetupVertexAttributes(QBTVertexFormat vertexFormat);
+	void SetupInstanceAttributes();
+	void RebuildBatch(QBTVertexFormat vertexFormat);
+	void DestroyBatches();
+	void AsyncLoadThread(string filename);
+	bool UploadMeshSlice(QBTMatrix* pMatrix);
+	void SwapInAsyncModel();
+	void RenderDrawList(Shader* pShader, const QBTDrawList& drawList);
+	void RenderBatch(Shader* pShader, const QBTDrawList& drawList, QBTBatch* pBatch);
+	void RenderInstancedDrawList(Shader* pShader, const QBTDrawList& drawList, QBTBatch* pBatch);
 
 public:
 	/* Public members */
@@ -164,20 +456,110 @@ private:
 	// Matrices
 	QBTMatrixList m_vpQBTMatrices;
 
+	// Mesh arenas, reused for every matrix that is meshed. A chunk is written to only one of them, the one for its vertex format.
+	vector<PositionColorNormalVertex> m_vertexArena;
+	vector<PackedPositionColorNormalVertex> m_packedVertexArena;
+
+	// Set by edits, so UpdateDirtyChunks doesn't have to look through every chunk when nothing has changed
+	bool m_anyDirtyChunks;
+
+	// Merged sides of each voxel for the default mesher, only the chunk being meshed is cleared and used
+	vector<unsigned char> m_mergedSides;
+
+	// Loader backend
+	QBTLoaderBackend m_loaderBackend;
+	bool m_parallelLoading;
+	bool m_recomputeVisibility;
+
+	// Matrices waiting to be unpacked, filled in by the node scan
+	vector<QBTInflateJob> m_vInflateJobs;
+
+	// File being read by the mapped loader, closed after each load but held on to so small files reuse its read buffer
+	QBTFileMapping m_fileMapping;
+
+	// Async loading, the staging model is parsed and meshed on the loader thread and its matrices are uploaded on the main thread
+	QBT* m_pAsyncQBT;
+	thread m_asyncLoadThread;
+	mutex m_asyncLoadMutex;
+	vector<QBTMatrix*> m_vpAsyncMeshedMatrices; // Guarded by m_asyncLoadMutex
+	unsigned int m_asyncUploadIndex;
+	unsigned int m_asyncUploadChunk;
+	size_t m_asyncUploadOffset;
+	atomic<bool> m_asyncLoadFinished;
+	atomic<bool> m_asyncLoadCancelled;
+	bool m_asyncLoadSucceeded;
+
 	// Rendering modes
 	bool m_wireframeRender;
 	bool m_useLighting;
 	bool m_boundingBox;
+	bool m_batchedRendering;
+	bool m_frustumCulling;
+	bool m_occlusionCulling;
+
+	// Level of detail
+	unsigned int m_numLODs;
+	QBTLODDownsample m_lodDownsample;
+	float m_lodPixelSize;
+	bool m_lodCrossFade;
+	unsigned int m_numLODMatrices[QBT_MAX_LODS + 1];
 
 	// Creation optimizations
 	bool m_createInnerVoxels;
 	bool m_createInnerFaces;
 	bool m_mergeFaces;
+	bool m_ambientOcclusion;
+	QBTMesher m_mesher;
+	QBTVertexFormat m_vertexFormat;
+
+	// Binary greedy mesher, keeps its scratch memory between matrices
+	QBTBinaryMesher m_binaryMesher;
+
+	// Draw lists, one per vertex format, reused every frame
+	QBTDrawList m_drawLists[QBTVertexFormat_NUM];
+	vector<DrawUniformBlock> m_vDrawUniforms; // Model transform and material of every matrix, uploaded once a frame
+	unsigned int m_numVisibleMatrices;
+	unsigned int m_numCulledMatrices;
+	unsigned int m_numVisibleChunks;
+	unsigned int m_numCulledChunks;
+	unsigned int m_numOccludedMatrices;
+	unsigned int m_numOccludedChunks;
+
+	// Occlusion culling, the chunks inside the frustum are sorted nearest first each frame so the nearest occluders go in first
+	QBTOcclusionBuffer m_occlusionBuffer;
+	vector<QBTOccluderChunk> m_vOccluderChunks;
+
+	// Batched rendering, rebuilt whenever chunks have been remeshed. The per matrix uniforms are read from a texture buffer, using
+	// the matrix index that comes from the base instance of each draw or, when that isn't supported, from every vertex.
+	QBTBatch m_batches[QBTVertexFormat_NUM];
+	bool m_batchesDirty;
+	bool m_multiDrawIndirect;
+	GLuint m_matrixDataBuffer;
+	GLuint m_matrixDataTexture;
+	GLuint m_indirectBuffer;
+	vector<QBTDrawElementsIndirectCommand> m_vIndirectCommands;
+	vector<GLsizei> m_vDrawCounts;
+	vector<GLint> m_vDrawBaseVertices;
+	vector<const GLvoid*> m_vDrawIndexOffsets;
+
+	// Instancing, every chunk and batch vertex array reads the per instance attributes from the one instance buffer, which always
+	// holds at least one instance so the attributes never point past its end
+	vector<QBTInstance> m_vInstances;
+	GLuint m_instanceBuffer;
+	bool m_instancesDirty;
 
 	// Shaders
 	Shader* m_pPositionColorNormalShader;
+	Shader* m_pPackedPositionColorNormalShader;
+	Shader* m_pBatchedPositionColorNormalShader;
+	Shader* m_pBatchedPackedPositionColorNormalShader;
+	Shader* m_pInstancedPositionColorNormalShader;
+	Shader* m_pInstancedPackedPositionColorNormalShader;
 	Shader* m_pNormalDrawingShader;
 
 	// Renderer
 	Renderer* m_pRenderer;
+
+	// Job system, not owned by the model
+	JobSystem* m_pJobSystem;
 };
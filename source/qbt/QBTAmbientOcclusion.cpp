@@ -0,0 +1,132 @@
+// ******************************************************************************
+// Filename:    QBTAmbientOcclusion.cpp
+// Project:     Qube
+// Author:      Steven Ball
+//
+// Revision History:
+//   Initial Revision - 17/10/26
+//
+// Copyright (c) 2005-2016, Steven Ball
+// ******************************************************************************
+
+#include "QBTAmbientOcclusion.h"
+#include "QBT.h"
+
+
+const QBTFaceLayout QBT_FACE_LAYOUTS[QBTFace_NUM] =
+{
+	// Back
+	{ 2, 0, 1, -1, { 0.0f, 0.0f, -1.0f }, { 0, 1, 0, 1 }, { 0, 0, 1, 1 } },
+	// Front
+	{ 2, 0, 1, 1, { 0.0f, 0.0f, 1.0f }, { 0, 0, 1, 1 }, { 0, 1, 0, 1 } },
+	// Left
+	{ 0, 1, 2, -1, { -1.0f, 0.0f, 0.0f }, { 0, 1, 0, 1 }, { 0, 0, 1, 1 } },
+	// Right
+	{ 0, 1, 2, 1, { 1.0f, 0.0f, 0.0f }, { 0, 0, 1, 1 }, { 0, 1, 0, 1 } },
+	// Top
+	{ 1, 0, 2, 1, { 0.0f, 1.0f, 0.0f }, { 0, 0, 1, 1 }, { 1, 0, 1, 0 } },
+	// Bottom
+	{ 1, 0, 2, -1, { 0.0f, -1.0f, 0.0f }, { 0, 1, 0, 1 }, { 1, 1, 0, 0 } },
+};
+
+// Normals are +X, -X, +Y, -Y, +Z, -Z, and x, y and z are the low, middle and high 10 bits of the position
+const QBTPackedFaceLayout QBT_PACKED_FACE_LAYOUTS[QBTFace_NUM] =
+{
+	// Back
+	{ 0, 5 << 24, { 0, 1, 0, 1 }, { 0, 0, 1 << 10, 1 << 10 } },
+	// Front
+	{ 1 << 20, 4 << 24, { 0, 0, 1, 1 }, { 0, 1 << 10, 0, 1 << 10 } },
+	// Left
+	{ 0, 1 << 24, { 0, 1 << 10, 0, 1 << 10 }, { 0, 0, 1 << 20, 1 << 20 } },
+	// Right
+	{ 1, 0 << 24, { 0, 0, 1 << 10, 1 << 10 }, { 0, 1 << 20, 0, 1 << 20 } },
+	// Top
+	{ 1 << 10, 2 << 24, { 0, 0, 1, 1 }, { 1 << 20, 0, 1 << 20, 0 } },
+	// Bottom
+	{ 0, 3 << 24, { 0, 1, 0, 1 }, { 1 << 20, 1 << 20, 0, 0 } },
+};
+
+unsigned int GetFaceAmbientOcclusion(QBTMatrix* pMatrix, int x, int y, int z, QBTFace face)
+{
+	const QBTFaceLayout& faceLayout = QBT_FACE_LAYOUTS[face];
+
+	int position[3] = { x, y, z };
+	int size[3] = { (int)pMatrix->m_sizeX, (int)pMatrix->m_sizeY, (int)pMatrix->m_sizeZ };
+	int strides[3] = { 1, size[0], size[0] * size[1] };
+
+	// Faces on the edge of the matrix have nothing in front of them
+	position[faceLayout.m_normalAxis] += faceLayout.m_direction;
+	if (position[faceLayout.m_normalAxis] < 0 || position[faceLayout.m_normalAxis] >= size[faceLayout.m_normalAxis])
+	{
+		return 0;
+	}
+
+	// The 3x3 voxels of the layer in front of the face, indexed by their offset along u and v
+	bool solid[3][3];
+	for (int v = -1; v <= 1; v++)
+	{
+		for (int u = -1; u <= 1; u++)
+		{
+			int voxelU = position[faceLayout.m_uAxis] + u;
+			int voxelV = position[faceLayout.m_vAxis] + v;
+			if (voxelU < 0 || voxelU >= size[faceLayout.m_uAxis] || voxelV < 0 || voxelV >= size[faceLayout.m_vAxis])
+			{
+				solid[v + 1][u + 1] = false;
+				continue;
+			}
+
+			position[faceLayout.m_uAxis] = voxelU;
+			position[faceLayout.m_vAxis] = voxelV;
+			solid[v + 1][u + 1] = pMatrix->m_pVisibilityMask[position[0] * strides[0] + position[1] * strides[1] + position[2] * strides[2]] != 0;
+			position[faceLayout.m_uAxis] -= u;
+			position[faceLayout.m_vAxis] -= v;
+		}
+	}
+
+	unsigned int ambientOcclusion = 0;
+	for (int i = 0; i < 4; i++)
+	{
+		int u = faceLayout.m_cornerU[i] * 2;
+		int v = faceLayout.m_cornerV[i] * 2;
+		bool side1 = solid[1][u];
+		bool side2 = solid[v][1];
+		bool corner = solid[v][u];
+
+		// With both edges blocked the corner is as dark as it gets, whatever is across it
+		unsigned int level = (side1 && side2) ? 3 : (side1 ? 1 : 0) + (side2 ? 1 : 0) + (corner ? 1 : 0);
+		ambientOcclusion |= level << (i * 2);
+	}
+
+	return ambientOcclusion;
+}
+
+float GetAmbientOcclusionLight(unsigned int level)
+{
+	return 1.0f - level * QBT_AMBIENT_OCCLUSION_STEP;
+}
+
+unsigned int GetAmbientOcclusionLevel(float light)
+{
+	return (unsigned int)((1.0f - light) / QBT_AMBIENT_OCCLUSION_STEP + 0.5f);
+}
+
+void SetQuadAmbientOcclusion(PositionColorNormalVertex* pQuad, unsigned int ambientOcclusion)
+{
+	unsigned int levels[4];
+	for (int i = 0; i < 4; i++)
+	{
+		levels[i] = (ambientOcclusion >> (i * 2)) & 3;
+		pQuad[i].a = GetAmbientOcclusionLight(levels[i]);
+	}
+
+	// The quad is split between corners 1 and 2. Moving each corner on one place around the quad keeps the winding and
+	// splits it between the old corners 0 and 3 instead.
+	if (levels[0] + levels[3] < levels[1] + levels[2])
+	{
+		PositionColorNormalVertex corner0 = pQuad[0];
+		pQuad[0] = pQuad[1];
+		pQuad[1] = pQuad[3];
+		pQuad[3] = pQuad[2];
+		pQuad[2] = corner0;
+	}
+}
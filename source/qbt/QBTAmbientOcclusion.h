@@ -0,0 +1,113 @@
+// ******************************************************************************
+// Filename:    QBTAmbientOcclusion.h
+// Project:     Qube
+// Author:      Steven Ball
+//
+// Purpose:
+//   Per vertex ambient occlusion for voxel meshes, baked in while the faces
+//   are meshed. Each corner of a voxel face is darkened by the voxels that
+//   touch it in the layer in front of the face, the two along its edges and
+//   the one across its corner. Also holds the layout of the faces of a voxel
+//   that both meshers write their quads in, for full and packed vertices.
+//
+// Revision History:
+//   Initial Revision - 17/10/26
+//
+// Copyright (c) 2005-2016, Steven Ball
+// ******************************************************************************
+
+#pragma once
+
+#include "../Renderer/Renderer.h"
+
+class QBTMatrix;
+
+enum QBTFace
+{
+	QBTFace_Back = 0,
+	QBTFace_Front,
+	QBTFace_Left,
+	QBTFace_Right,
+	QBTFace_Top,
+	QBTFace_Bottom,
+
+	QBTFace_NUM,
+};
+
+// Layout of each face of a voxel. The u and v axes run across the face, and the corners are in the vertex order of the
+// renderer's shared quad index buffer, with 0 or 1 for the low or high side of the voxel along u and v.
+struct QBTFaceLayout
+{
+	int m_normalAxis;
+	int m_uAxis;
+	int m_vAxis;
+	int m_direction;
+	float m_normal[3];
+	unsigned int m_cornerU[4];
+	unsigned int m_cornerV[4];
+};
+
+extern const QBTFaceLayout QBT_FACE_LAYOUTS[QBTFace_NUM];
+
+// Light lost for each voxel that occludes a corner, a corner with both of its edges blocked gets the full 3 steps
+const float QBT_AMBIENT_OCCLUSION_STEP = 0.2f;
+
+// Occlusion levels of the 4 corners of a voxel face, from 0 for an open corner to 3, in 2 bits per corner in the quad vertex
+// order. Neighbouring faces are only merged when all of their levels match, so every corner of a merged quad is exact.
+unsigned int GetFaceAmbientOcclusion(QBTMatrix* pMatrix, int x, int y, int z, QBTFace face);
+
+// Light of each occlusion level, written into the alpha of the full format vertices
+float GetAmbientOcclusionLight(unsigned int level);
+unsigned int GetAmbientOcclusionLevel(float light);
+
+// Writes the light of each corner into a quad of 4 vertices, and turns the quad a quarter when that moves its diagonal onto
+// the brighter pair of corners, so the occlusion fades evenly instead of smearing along the diagonal
+void SetQuadAmbientOcclusion(PositionColorNormalVertex* pQuad, unsigned int ambientOcclusion);
+
+// Layout of each face of a voxel for the packed vertex format, the same faces and corners as QBT_FACE_LAYOUTS but with the corners
+// already shifted into the 10 bits of their axis, so a packed quad is written without looking at the axes.
+struct QBTPackedFaceLayout
+{
+	unsigned int m_normalOffset; // Added to the voxel position for a face on the high side of the voxel
+	unsigned int m_normal; // Normal index, in its bits of the rgbn word
+	unsigned int m_cornerU[4]; // Step to each corner for a quad one voxel wide
+	unsigned int m_cornerV[4]; // and one voxel high
+};
+
+extern const QBTPackedFaceLayout QBT_PACKED_FACE_LAYOUTS[QBTFace_NUM];
+
+// Writes a quad of 4 packed vertices straight from the face, for the voxel at x, y, z and covering width by height voxels along the
+// u and v axes of the face. The corners, occlusion levels and quarter turn are the same as a full quad given SetQuadAmbientOcclusion.
+inline void WritePackedQuad(PackedPositionColorNormalVertex* pQuad, QBTFace face, unsigned int x, unsigned int y, unsigned int z, unsigned int width, unsigned int height, unsigned int colour, unsigned int ambientOcclusion)
+{
+	const QBTPackedFaceLayout& faceLayout = QBT_PACKED_FACE_LAYOUTS[face];
+
+	unsigned int xyz = (x | (y << 10) | (z << 20)) + faceLayout.m_normalOffset;
+	unsigned int rgbn = (colour & 0x00FFFFFF) | faceLayout.m_normal;
+
+	if (ambientOcclusion == 0)
+	{
+		for (int i = 0; i < 4; i++)
+		{
+			pQuad[i].xyz = xyz + faceLayout.m_cornerU[i] * width + faceLayout.m_cornerV[i] * height;
+			pQuad[i].rgbn = rgbn;
+		}
+		return;
+	}
+
+	unsigned int levels[4];
+	for (int i = 0; i < 4; i++)
+	{
+		levels[i] = (ambientOcclusion >> (i * 2)) & 3;
+	}
+
+	// The same quarter turn as SetQuadAmbientOcclusion
+	static const unsigned int corners[2][4] = { { 0, 1, 2, 3 }, { 1, 3, 0, 2 } };
+	const unsigned int* pCorners = corners[levels[0] + levels[3] < levels[1] + levels[2] ? 1 : 0];
+	for (int i = 0; i < 4; i++)
+	{
+		unsigned int j = pCorners[i];
+		pQuad[i].xyz = xyz + faceLayout.m_cornerU[j] * width + faceLayout.m_cornerV[j] * height;
+		pQuad[i].rgbn = rgbn | (levels[j] << 27);
+	}
+}
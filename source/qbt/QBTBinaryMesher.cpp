@@ -0,0 +1,672 @@
+// ******************************************************************************
+// Filename:    QBTBinaryMesher.cpp
+// Project:     Qube
+// Author:      Steven Ball
+//
+// Revision History:
+//   Initial Revision - 17/10/26
+//
+// Copyright (c) 2005-2016, Steven Ball
+// ******************************************************************************
+
+#include "QBTBinaryMesher.h"
+#include "QBT.h"
+
+#include <algorithm>
+
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#define QBT_BINARY_MESHER_SSE2
+#include <emmintrin.h>
+#endif
+
+#ifdef _MSC_VER
+#include <intrin.h>
+#endif //_MSC_VER
+
+
+// Smallest size the mesh arenas grow to, in vertices
+const unsigned int QBT_BINARY_MESHER_MIN_VERTICES = 16384;
+
+// Smallest size of the colour to plane lookup table, always a power of two
+const unsigned int QBT_BINARY_MESHER_MIN_COLOUR_TABLE_SIZE = 1024;
+
+// The vertices are written a few members at a time
+static_assert(sizeof(PositionColorNormalVertex) == 10 * sizeof(float), "PositionColorNormalVertex must be tightly packed");
+
+// A chunk has to sit inside a single column word, so its rows are taken from one word without straddling two
+static_assert(QBT_CHUNK_SIZE <= QBT_BINARY_MESHER_MAX_ROWS && 64 % QBT_CHUNK_SIZE == 0, "Chunks must tile the 64-bit column words");
+
+// Bit helpers
+inline unsigned int CountTrailingZeros(QBTBitColumn bits)
+{
+#ifdef _MSC_VER
+	unsigned long index;
+	_BitScanForward64(&index, bits);
+	return (unsigned int)index;
+#else
+	return (unsigned int)__builtin_ctzll(bits);
+#endif //_MSC_VER
+}
+
+inline QBTBitColumn GetBitMask(unsigned int start, unsigned int count)
+{
+	return (count == 64 ? ~0ULL : ((1ULL << count) - 1)) << start;
+}
+
+// Packs a row of visibility masks into a solid bit and an exposed bit per voxel. A mask of 1 is a voxel that is completely
+// surrounded, so anything above it has a face bit set.
+void PackMaskRow(const unsigned int* pMask, unsigned int count, QBTBitColumn* pSolid, QBTBitColumn* pExposed)
+{
+	QBTBitColumn solid = 0;
+	QBTBitColumn exposed = 0;
+	unsigned int i = 0;
+
+#ifdef QBT_BINARY_MESHER_SSE2
+	const __m128i zero = _mm_setzero_si128();
+	const __m128i inner = _mm_set1_epi32(QBTVisibility_Solid);
+	for (; i + 4 <= count; i += 4)
+	{
+		__m128i masks = _mm_loadu_si128((const __m128i*)(pMask + i));
+		unsigned int empty = (unsigned int)_mm_movemask_ps(_mm_castsi128_ps(_mm_cmpeq_epi32(masks, zero)));
+		unsigned int faces = (unsigned int)_mm_movemask_ps(_mm_castsi128_ps(_mm_cmpgt_epi32(masks, inner)));
+		solid |= (QBTBitColumn)(empty ^ 0xF) << i;
+		exposed |= (QBTBitColumn)faces << i;
+	}
+#endif //QBT_BINARY_MESHER_SSE2
+
+	for (; i < count; i++)
+	{
+		solid |= (QBTBitColumn)(pMask[i] != 0) << i;
+		exposed |= (QBTBitColumn)(pMask[i] > QBTVisibility_Solid) << i;
+	}
+
+	*pSolid = solid;
+	*pExposed = exposed;
+}
+
+// Transposes a 64 x 64 block of bits in place, bit j of word i swaps with bit i of word j. Each step swaps the
+// off-diagonal blocks of the step before it, starting with the 32 x 32 blocks.
+void TransposeBits(QBTBitColumn* pBlock)
+{
+	QBTBitColumn mask = 0x00000000FFFFFFFFULL;
+	for (unsigned int width = 32; width != 0; width >>= 1, mask ^= mask << width)
+	{
+		for (unsigned int k = 0; k < 64; k = ((k | width) + 1) & ~width)
+		{
+			QBTBitColumn swap = ((pBlock[k] >> width) ^ pBlock[k | width]) & mask;
+			pBlock[k] ^= swap << width;
+			pBlock[k | width] ^= swap;
+		}
+	}
+}
+
+
+QBTBinaryOccupancy::QBTBinaryOccupancy()
+{
+	m_built = false;
+	m_sizeX = 0;
+	m_sizeY = 0;
+	m_sizeZ = 0;
+
+	m_dirty = false;
+	for (int axis = 0; axis < 3; axis++)
+	{
+		m_dirtyMin[axis] = 0;
+		m_dirtyMax[axis] = 0;
+	}
+
+	m_numWordsX = 0;
+	m_numWordsY = 0;
+}
+
+void QBTBinaryOccupancy::SetDirty(int minX, int minY, int minZ, int maxX, int maxY, int maxZ)
+{
+	// Columns that haven't been built yet are built in full the first time they are used
+	if (m_built == false)
+	{
+		return;
+	}
+
+	int boxMin[3] = { minX, minY, minZ };
+	int boxMax[3] = { maxX, maxY, maxZ };
+	for (int axis = 0; axis < 3; axis++)
+	{
+		m_dirtyMin[axis] = m_dirty ? std::min(m_dirtyMin[axis], boxMin[axis]) : boxMin[axis];
+		m_dirtyMax[axis] = m_dirty ? std::max(m_dirtyMax[axis], boxMax[axis]) : boxMax[axis];
+	}
+	m_dirty = true;
+}
+
+
+QBTBinaryMesher::QBTBinaryMesher()
+{
+	m_startU = 0;
+	m_startV = 0;
+
+	for (int axis = 0; axis < 4; axis++)
+	{
+		m_sliceCorner[axis] = 0.0f;
+		m_axisU[axis] = 0.0f;
+		m_axisV[axis] = 0.0f;
+		for (int i = 0; i < 4; i++)
+		{
+			m_cornerU[i][axis] = 0.0f;
+			m_cornerV[i][axis] = 0.0f;
+		}
+	}
+	for (int axis = 0; axis < 3; axis++)
+	{
+		m_slicePosition[axis] = 0;
+	}
+	m_sliceStart = 0;
+	m_strideU = 0;
+	m_strideV = 0;
+
+	m_quadColour = 0;
+	m_quadRed = 0.0f;
+	m_quadGreen = 0.0f;
+	m_quadBlue = 0.0f;
+
+	for (unsigned int row = 0; row < QBT_BINARY_MESHER_MAX_ROWS; row++)
+	{
+		m_facePlane[row] = 0;
+	}
+
+	m_numPlanesUsed = 0;
+
+	m_colourTableKeys.resize(QBT_BINARY_MESHER_MIN_COLOUR_TABLE_SIZE);
+	m_colourTablePlanes.resize(QBT_BINARY_MESHER_MIN_COLOUR_TABLE_SIZE);
+	m_colourTableStamps.resize(QBT_BINARY_MESHER_MIN_COLOUR_TABLE_SIZE, 0);
+	m_colourTableStamp = 0;
+
+	m_ambientOcclusion = false;
+
+	m_pVertexArena = NULL;
+	m_pPackedVertexArena = NULL;
+	m_numVertices = 0;
+}
+
+QBTBinaryMesher::~QBTBinaryMesher()
+{
+}
+
+// Meshing
+unsigned int QBTBinaryMesher::CreateMesh(QBTMatrix* pMatrix, QBTChunk* pChunk, bool mergeFaces, bool createInnerVoxels, bool createInnerFaces, bool ambientOcclusion, vector<PositionColorNormalVertex>& vertexArena, vector<PackedPositionColorNormalVertex>* pPackedVertexArena)
+{
+	m_ambientOcclusion = ambientOcclusion;
+	m_pVertexArena = &vertexArena;
+	m_pPackedVertexArena = pPackedVertexArena;
+	m_numVertices = 0;
+
+	UpdateOccupancy(pMatrix);
+
+	// Like the default mesher, merged faces are always culled against their neighbours
+	bool cullFaces = mergeFaces || createInnerFaces == false;
+	for (int face = 0; face < 6; face++)
+	{
+		MeshFace(pMatrix, pChunk, face, mergeFaces, createInnerVoxels, cullFaces);
+	}
+
+	m_pVertexArena = NULL;
+	m_pPackedVertexArena = NULL;
+
+	return m_numVertices;
+}
+
+void QBTBinaryMesher::UpdateOccupancy(QBTMatrix* pMatrix)
+{
+	QBTBinaryOccupancy& occupancy = pMatrix->m_binaryOccupancy;
+
+	if (occupancy.m_built == false || occupancy.m_sizeX != pMatrix->m_sizeX || occupancy.m_sizeY != pMatrix->m_sizeY || occupancy.m_sizeZ != pMatrix->m_sizeZ)
+	{
+		occupancy.m_sizeX = pMatrix->m_sizeX;
+		occupancy.m_sizeY = pMatrix->m_sizeY;
+		occupancy.m_sizeZ = pMatrix->m_sizeZ;
+		occupancy.m_numWordsX = (pMatrix->m_sizeX + 63) / 64;
+		occupancy.m_numWordsY = (pMatrix->m_sizeY + 63) / 64;
+
+		occupancy.m_solidColumnsX.assign(pMatrix->m_sizeY * pMatrix->m_sizeZ * occupancy.m_numWordsX, 0);
+		occupancy.m_exposedColumnsX.assign(pMatrix->m_sizeY * pMatrix->m_sizeZ * occupancy.m_numWordsX, 0);
+		occupancy.m_solidColumnsY.assign(pMatrix->m_sizeX * pMatrix->m_sizeZ * occupancy.m_numWordsY, 0);
+		occupancy.m_exposedColumnsY.assign(pMatrix->m_sizeX * pMatrix->m_sizeZ * occupancy.m_numWordsY, 0);
+
+		occupancy.m_built = true;
+		occupancy.m_dirty = false;
+		occupancy.SetDirty(0, 0, 0, (int)pMatrix->m_sizeX - 1, (int)pMatrix->m_sizeY - 1, (int)pMatrix->m_sizeZ - 1);
+	}
+
+	if (occupancy.m_dirty)
+	{
+		BuildOccupancy(pMatrix, occupancy.m_dirtyMin, occupancy.m_dirtyMax);
+		occupancy.m_dirty = false;
+	}
+}
+
+void QBTBinaryMesher::BuildOccupancy(QBTMatrix* pMatrix, const int* pMin, const int* pMax)
+{
+	QBTBinaryOccupancy& occupancy = pMatrix->m_binaryOccupancy;
+
+	unsigned int sizeX = pMatrix->m_sizeX;
+	unsigned int sizeY = pMatrix->m_sizeY;
+	unsigned int numWordsX = occupancy.m_numWordsX;
+	unsigned int numWordsY = occupancy.m_numWordsY;
+
+	// Whole words are built again, the bits around the box are read from masks that haven't changed
+	unsigned int minWordX = (unsigned int)pMin[0] / 64;
+	unsigned int maxWordX = (unsigned int)pMax[0] / 64;
+	unsigned int minWordY = (unsigned int)pMin[1] / 64;
+	unsigned int maxWordY = (unsigned int)pMax[1] / 64;
+
+	for (unsigned int z = (unsigned int)pMin[2]; z <= (unsigned int)pMax[2]; z++)
+	{
+		for (unsigned int y = (unsigned int)pMin[1]; y <= (unsigned int)pMax[1]; y++)
+		{
+			const unsigned int* pMask = &pMatrix->m_pVisibilityMask[sizeX * (y + sizeY * z)];
+			QBTBitColumn* pSolidX = &occupancy.m_solidColumnsX[(z * sizeY + y) * numWordsX];
+			QBTBitColumn* pExposedX = &occupancy.m_exposedColumnsX[(z * sizeY + y) * numWordsX];
+
+			for (unsigned int word = minWordX; word <= maxWordX; word++)
+			{
+				PackMaskRow(pMask + word * 64, std::min(sizeX - word * 64, 64u), &pSolidX[word], &pExposedX[word]);
+			}
+		}
+
+		// The y columns are the x columns turned on their side, 64 x 64 voxels at a time
+		for (unsigned int wordY = minWordY; wordY <= maxWordY; wordY++)
+		{
+			unsigned int numRows = std::min(sizeY - wordY * 64, 64u);
+			for (unsigned int wordX = minWordX; wordX <= maxWordX; wordX++)
+			{
+				unsigned int numColumns = std::min(sizeX - wordX * 64, 64u);
+				for (int exposed = 0; exposed < 2; exposed++)
+				{
+					const vector<QBTBitColumn>& columnsX = exposed == 1 ? occupancy.m_exposedColumnsX : occupancy.m_solidColumnsX;
+					vector<QBTBitColumn>& columnsY = exposed == 1 ? occupancy.m_exposedColumnsY : occupancy.m_solidColumnsY;
+
+					for (unsigned int row = 0; row < 64; row++)
+					{
+						m_transposeBlock[row] = row < numRows ? columnsX[(z * sizeY + wordY * 64 + row) * numWordsX + wordX] : 0;
+					}
+					TransposeBits(m_transposeBlock);
+					for (unsigned int column = 0; column < numColumns; column++)
+					{
+						columnsY[(z * sizeX + wordX * 64 + column) * numWordsY + wordY] = m_transposeBlock[column];
+					}
+				}
+			}
+		}
+	}
+}
+
+void QBTBinaryMesher::MeshFace(QBTMatrix* pMatrix, QBTChunk* pChunk, int face, bool mergeFaces, bool createInnerVoxels, bool cullFaces)
+{
+	const QBTFaceLayout& faceLayout = QBT_FACE_LAYOUTS[face];
+	QBTBinaryOccupancy& occupancy = pMatrix->m_binaryOccupancy;
+
+	unsigned int chunkMin[3] = { pChunk->m_minX, pChunk->m_minY, pChunk->m_minZ };
+	unsigned int chunkMax[3] = { pChunk->m_maxX, pChunk->m_maxY, pChunk->m_maxZ };
+	unsigned int matrixSize[3] = { pMatrix->m_sizeX, pMatrix->m_sizeY, pMatrix->m_sizeZ };
+
+	m_startU = chunkMin[faceLayout.m_uAxis];
+	m_startV = chunkMin[faceLayout.m_vAxis];
+	unsigned int numRows = chunkMax[faceLayout.m_vAxis] - m_startV;
+	QBTBitColumn chunkBits = GetBitMask(0, chunkMax[faceLayout.m_uAxis] - m_startU);
+	unsigned int maxSliceVertices = numRows * (chunkMax[faceLayout.m_uAxis] - m_startU) * 4;
+	unsigned int shift = m_startU & 63;
+
+	// Faces along x are found from the y columns, rows of z across them, and faces along y and z from the x columns
+	const QBTBitColumn* pSolid;
+	const QBTBitColumn* pDraw;
+	unsigned int sliceStride;
+	unsigned int rowStride;
+	if (faceLayout.m_normalAxis == 0)
+	{
+		pSolid = occupancy.m_solidColumnsY.data();
+		pDraw = createInnerVoxels ? occupancy.m_solidColumnsY.data() : occupancy.m_exposedColumnsY.data();
+		sliceStride = occupancy.m_numWordsY;
+		rowStride = pMatrix->m_sizeX * occupancy.m_numWordsY;
+	}
+	else
+	{
+		pSolid = occupancy.m_solidColumnsX.data();
+		pDraw = createInnerVoxels ? occupancy.m_solidColumnsX.data() : occupancy.m_exposedColumnsX.data();
+		sliceStride = faceLayout.m_normalAxis == 1 ? occupancy.m_numWordsX : pMatrix->m_sizeY * occupancy.m_numWordsX;
+		rowStride = faceLayout.m_normalAxis == 1 ? pMatrix->m_sizeY * occupancy.m_numWordsX : occupancy.m_numWordsX;
+	}
+	unsigned int firstColumn = m_startV * rowStride + (m_startU >> 6);
+
+	// Steps between the voxels of the slice and between the corners of its faces, so each face only adds its offset to them
+	unsigned int axisStrides[3] = { 1, pMatrix->m_sizeX, pMatrix->m_sizeX * pMatrix->m_sizeY };
+	m_strideU = axisStrides[faceLayout.m_uAxis];
+	m_strideV = axisStrides[faceLayout.m_vAxis];
+	for (int axis = 0; axis < 3; axis++)
+	{
+		m_axisU[axis] = axis == faceLayout.m_uAxis ? 1.0f : 0.0f;
+		m_axisV[axis] = axis == faceLayout.m_vAxis ? 1.0f : 0.0f;
+		for (int i = 0; i < 4; i++)
+		{
+			m_cornerU[i][axis] = m_axisU[axis] * faceLayout.m_cornerU[i];
+			m_cornerV[i][axis] = m_axisV[axis] * faceLayout.m_cornerV[i];
+		}
+	}
+
+	for (unsigned int slice = chunkMin[faceLayout.m_normalAxis]; slice < chunkMax[faceLayout.m_normalAxis]; slice++)
+	{
+		int neighbourSlice = (int)slice + faceLayout.m_direction;
+		bool hasNeighbour = cullFaces && neighbourSlice >= 0 && neighbourSlice < (int)matrixSize[faceLayout.m_normalAxis];
+
+		// A face is visible where the voxel is drawn and the neighbouring voxel in the face direction is empty
+		const QBTBitColumn* pDrawRow = &pDraw[firstColumn + slice * sliceStride];
+		QBTBitColumn anyFaces = 0;
+		if (hasNeighbour)
+		{
+			const QBTBitColumn* pNeighbourRow = &pSolid[firstColumn + neighbourSlice * sliceStride];
+			for (unsigned int row = 0; row < numRows; row++)
+			{
+				m_facePlane[row] = ((pDrawRow[row * rowStride] & ~pNeighbourRow[row * rowStride]) >> shift) & chunkBits;
+				anyFaces |= m_facePlane[row];
+			}
+		}
+		else
+		{
+			for (unsigned int row = 0; row < numRows; row++)
+			{
+				m_facePlane[row] = (pDrawRow[row * rowStride] >> shift) & chunkBits;
+				anyFaces |= m_facePlane[row];
+			}
+		}
+
+		if (anyFaces == 0)
+		{
+			continue;
+		}
+
+		// Room for a quad on every voxel of the slice, merging only ever makes fewer of them
+		if (m_pPackedVertexArena != NULL)
+		{
+			if (m_numVertices + maxSliceVertices > m_pPackedVertexArena->size())
+			{
+				size_t numVertices = std::max(std::max((size_t)m_numVertices + maxSliceVertices, m_pPackedVertexArena->size() * 2), (size_t)QBT_BINARY_MESHER_MIN_VERTICES);
+				m_pPackedVertexArena->resize(numVertices);
+			}
+		}
+		else if (m_numVertices + maxSliceVertices > m_pVertexArena->size())
+		{
+			size_t numVertices = std::max(std::max((size_t)m_numVertices + maxSliceVertices, m_pVertexArena->size() * 2), (size_t)QBT_BINARY_MESHER_MIN_VERTICES);
+			m_pVertexArena->resize(numVertices);
+		}
+
+		m_slicePosition[faceLayout.m_normalAxis] = slice;
+		m_slicePosition[faceLayout.m_uAxis] = m_startU;
+		m_slicePosition[faceLayout.m_vAxis] = m_startV;
+		m_sliceStart = m_slicePosition[0] + pMatrix->m_sizeX * (m_slicePosition[1] + pMatrix->m_sizeY * m_slicePosition[2]);
+
+		// Faces are on the side of the voxel they face, and their corners are half a voxel back from the voxel centre
+		for (int axis = 0; axis < 3; axis++)
+		{
+			m_sliceCorner[axis] = m_slicePosition[axis] + faceLayout.m_normal[axis] * 0.5f - (m_axisU[axis] + m_axisV[axis]) * 0.5f;
+		}
+
+		if (mergeFaces)
+		{
+			MergeFaces(pMatrix, face, numRows);
+		}
+		else
+		{
+			EmitFaces(pMatrix, face, numRows);
+		}
+	}
+}
+
+// The colour of the voxel behind a face. With ambient occlusion the occlusion levels of the face corners take the place of the
+// colour alpha, which is the same for every solid voxel, so only faces that match are merged.
+unsigned int QBTBinaryMesher::GetFaceColour(QBTMatrix* pMatrix, int face, unsigned int u, unsigned int v)
+{
+	unsigned int colour = pMatrix->m_pColour[m_sliceStart + u * m_strideU + v * m_strideV];
+	if (m_ambientOcclusion)
+	{
+		const QBTFaceLayout& faceLayout = QBT_FACE_LAYOUTS[face];
+
+		int position[3] = { (int)m_slicePosition[0], (int)m_slicePosition[1], (int)m_slicePosition[2] };
+		position[faceLayout.m_uAxis] += u;
+		position[faceLayout.m_vAxis] += v;
+
+		unsigned int ambientOcclusion = GetFaceAmbientOcclusion(pMatrix, position[0], position[1], position[2], (QBTFace)face);
+		colour = (colour & 0x00FFFFFF) | (ambientOcclusion << 24);
+	}
+
+	return colour;
+}
+
+void QBTBinaryMesher::EmitFaces(QBTMatrix* pMatrix, int face, unsigned int numRows)
+{
+	for (unsigned int row = 0; row < numRows; row++)
+	{
+		QBTBitColumn bits = m_facePlane[row];
+		while (bits != 0)
+		{
+			unsigned int u = CountTrailingZeros(bits);
+			bits &= bits - 1;
+
+			EmitQuad(face, u, row, 1, 1, GetFaceColour(pMatrix, face, u, row));
+		}
+	}
+}
+
+void QBTBinaryMesher::MergeFaces(QBTMatrix* pMatrix, int face, unsigned int numRows)
+{
+	// Split the visible faces into one bit-plane per colour, neighbouring faces mostly share a colour so the last plane is
+	// checked before the lookup table
+	ResetColourPlanes();
+	unsigned int lastColour = 0;
+	unsigned int lastPlane = 0;
+	for (unsigned int row = 0; row < numRows; row++)
+	{
+		QBTBitColumn bits = m_facePlane[row];
+		while (bits != 0)
+		{
+			unsigned int u = CountTrailingZeros(bits);
+			bits &= bits - 1;
+
+			unsigned int colour = GetFaceColour(pMatrix, face, u, row);
+			if (m_numPlanesUsed == 0 || colour != lastColour)
+			{
+				lastColour = colour;
+				lastPlane = GetColourPlane(colour);
+			}
+
+			m_colourPlanes[lastPlane * QBT_BINARY_MESHER_MAX_ROWS + row] |= 1ULL << u;
+			m_planeRows[lastPlane] |= 1ULL << row;
+		}
+	}
+
+	// Greedy merge each plane, widest run along u first and then as many rows along v as match it. Only the rows that
+	// have bits are visited, and the planes and their row masks are left empty for the next slice.
+	for (unsigned int plane = 0; plane < m_numPlanesUsed; plane++)
+	{
+		QBTBitColumn* pPlane = &m_colourPlanes[plane * QBT_BINARY_MESHER_MAX_ROWS];
+		QBTBitColumn rows = m_planeRows[plane];
+		m_planeRows[plane] = 0;
+
+		while (rows != 0)
+		{
+			unsigned int row = CountTrailingZeros(rows);
+			rows &= rows - 1;
+
+			while (pPlane[row] != 0)
+			{
+				unsigned int start = CountTrailingZeros(pPlane[row]);
+				QBTBitColumn inverted = ~(pPlane[row] >> start);
+				unsigned int width = inverted == 0 ? 64 - start : CountTrailingZeros(inverted);
+				QBTBitColumn run = GetBitMask(start, width);
+				pPlane[row] &= ~run;
+
+				unsigned int height = 1;
+				while (row + height < numRows && (pPlane[row + height] & run) == run)
+				{
+					pPlane[row + height] &= ~run;
+					height++;
+				}
+
+				EmitQuad(face, start, row, width, height, m_planeColours[plane]);
+			}
+		}
+	}
+}
+
+// Colour planes
+unsigned int QBTBinaryMesher::GetColourPlane(unsigned int colour)
+{
+	unsigned int tableSize = (unsigned int)m_colourTableKeys.size();
+
+	// Keep the table at most half full, re-inserting the planes of the current slice
+	if ((m_numPlanesUsed + 1) * 2 > tableSize)
+	{
+		tableSize *= 2;
+		m_colourTableKeys.assign(tableSize, 0);
+		m_colourTablePlanes.assign(tableSize, 0);
+		m_colourTableStamps.assign(tableSize, 0);
+		for (unsigned int plane = 0; plane < m_numPlanesUsed; plane++)
+		{
+			unsigned int slot = (m_planeColours[plane] * 2654435761u) & (tableSize - 1);
+			while (m_colourTableStamps[slot] == m_colourTableStamp)
+			{
+				slot = (slot + 1) & (tableSize - 1);
+			}
+			m_colourTableKeys[slot] = m_planeColours[plane];
+			m_colourTablePlanes[slot] = plane;
+			m_colourTableStamps[slot] = m_colourTableStamp;
+		}
+	}
+
+	unsigned int slot = (colour * 2654435761u) & (tableSize - 1);
+	while (m_colourTableStamps[slot] == m_colourTableStamp)
+	{
+		if (m_colourTableKeys[slot] == colour)
+		{
+			return m_colourTablePlanes[slot];
+		}
+		slot = (slot + 1) & (tableSize - 1);
+	}
+
+	unsigned int plane = m_numPlanesUsed++;
+	if (plane >= m_planeColours.size())
+	{
+		m_planeColours.resize(plane + 1);
+		m_colourPlanes.resize((plane + 1) * QBT_BINARY_MESHER_MAX_ROWS, 0);
+		m_planeRows.resize(plane + 1, 0);
+	}
+	m_planeColours[plane] = colour;
+
+	m_colourTableKeys[slot] = colour;
+	m_colourTablePlanes[slot] = plane;
+	m_colourTableStamps[slot] = m_colourTableStamp;
+
+	return plane;
+}
+
+void QBTBinaryMesher::ResetColourPlanes()
+{
+	m_numPlanesUsed = 0;
+
+	// Bumping the stamp empties the lookup table without touching it
+	m_colourTableStamp++;
+	if (m_colourTableStamp == 0)
+	{
+		std::fill(m_colourTableStamps.begin(), m_colourTableStamps.end(), 0);
+		m_colourTableStamp = 1;
+	}
+}
+
+void QBTBinaryMesher::EmitQuad(int face, unsigned int u, unsigned int v, unsigned int width, unsigned int height, unsigned int colour)
+{
+	const QBTFaceLayout& faceLayout = QBT_FACE_LAYOUTS[face];
+
+	if (m_pPackedVertexArena != NULL)
+	{
+		unsigned int position[3] = { m_slicePosition[0], m_slicePosition[1], m_slicePosition[2] };
+		position[faceLayout.m_uAxis] += u;
+		position[faceLayout.m_vAxis] += v;
+
+		WritePackedQuad(&(*m_pPackedVertexArena)[m_numVertices], (QBTFace)face, position[0], position[1], position[2], width, height, colour, m_ambientOcclusion ? colour >> 24 : 0);
+		m_numVertices += 4;
+		return;
+	}
+
+	// Neighbouring quads mostly share a colour, so the last one is kept rather than converted again
+	if (colour != m_quadColour || m_numVertices == 0)
+	{
+		m_quadColour = colour;
+		m_quadRed = (float)((colour & 0x000000FF) / 255.0f);
+		m_quadGreen = (float)(((colour & 0x0000FF00) >> 8) / 255.0f);
+		m_quadBlue = (float)(((colour & 0x00FF0000) >> 16) / 255.0f);
+	}
+
+	float fu = (float)u;
+	float fv = (float)v;
+	float fw = (float)width;
+	float fh = (float)height;
+
+	// Room for the quad was made before the slice was meshed
+	PositionColorNormalVertex* pVertices = &(*m_pVertexArena)[m_numVertices];
+
+#ifdef QBT_BINARY_MESHER_SSE2
+	// Each vertex is written as x, y, z, r then g, b, a, nx then ny, nz. The steps have nothing in their last lane, so
+	// the red that is added to the first corner is carried to every vertex.
+	__m128 corner = _mm_add_ps(_mm_loadu_ps(m_sliceCorner), _mm_setr_ps(0.0f, 0.0f, 0.0f, m_quadRed));
+	corner = _mm_add_ps(corner, _mm_mul_ps(_mm_loadu_ps(m_axisU), _mm_set1_ps(fu)));
+	corner = _mm_add_ps(corner, _mm_mul_ps(_mm_loadu_ps(m_axisV), _mm_set1_ps(fv)));
+	__m128 colourNormal = _mm_setr_ps(m_quadGreen, m_quadBlue, 1.0f, faceLayout.m_normal[0]);
+	__m128 normal = _mm_setr_ps(faceLayout.m_normal[1], faceLayout.m_normal[2], 0.0f, 0.0f);
+	__m128 quadWidth = _mm_set1_ps(fw);
+	__m128 quadHeight = _mm_set1_ps(fh);
+
+	for (int i = 0; i < 4; i++)
+	{
+		__m128 position = _mm_add_ps(corner, _mm_mul_ps(_mm_loadu_ps(m_cornerU[i]), quadWidth));
+		position = _mm_add_ps(position, _mm_mul_ps(_mm_loadu_ps(m_cornerV[i]), quadHeight));
+
+		_mm_storeu_ps(&pVertices[i].x, position);
+		_mm_storeu_ps(&pVertices[i].g, colourNormal);
+		_mm_storel_pi((__m64*)&pVertices[i].ny, normal);
+	}
+#else
+	// Worked out into locals first, the vertex stores could otherwise alias the members and have them loaded again for every vertex
+	float positions[4][3];
+	for (int axis = 0; axis < 3; axis++)
+	{
+		float corner = m_sliceCorner[axis] + m_axisU[axis] * fu + m_axisV[axis] * fv;
+		for (int i = 0; i < 4; i++)
+		{
+			positions[i][axis] = corner + m_cornerU[i][axis] * fw + m_cornerV[i][axis] * fh;
+		}
+	}
+	float r = m_quadRed;
+	float g = m_quadGreen;
+	float b = m_quadBlue;
+	float nx = faceLayout.m_normal[0];
+	float ny = faceLayout.m_normal[1];
+	float nz = faceLayout.m_normal[2];
+
+	for (int i = 0; i < 4; i++)
+	{
+		pVertices[i].x = positions[i][0];
+		pVertices[i].y = positions[i][1];
+		pVertices[i].z = positions[i][2];
+		pVertices[i].r = r;
+		pVertices[i].g = g;
+		pVertices[i].b = b;
+		pVertices[i].a = 1.0f;
+		pVertices[i].nx = nx;
+		pVertices[i].ny = ny;
+		pVertices[i].nz = nz;
+	}
+#endif //QBT_BINARY_MESHER_SSE2
+
+	if (m_ambientOcclusion)
+	{
+		SetQuadAmbientOcclusion(pVertices, colour >> 24);
+	}
+
+	m_numVertices += 4;
+}
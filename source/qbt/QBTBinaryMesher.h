@@ -0,0 +1,151 @@
+// ******************************************************************************
+// Filename:    QBTBinaryMesher.h
+// Project:     Qube
+// Author:      Steven Ball
+//
+// Purpose:
+//   A binary greedy mesher for QBT matrices. Voxel occupancy is packed into
+//   64-bit columns once per matrix and kept up to date as the matrix is
+//   edited. Each chunk slices its rows out of those columns, visible faces
+//   are found a whole row at a time with bitwise operations and then greedily
+//   merged into quads on per colour bit-planes, one slice of a chunk at a time.
+//
+// Revision History:
+//   Initial Revision - 17/10/26
+//
+// Copyright (c) 2005-2016, Steven Ball
+// ******************************************************************************
+
+#pragma once
+
+#include "../Renderer/Renderer.h"
+#include "QBTAmbientOcclusion.h"
+
+#include <vector>
+using namespace std;
+
+class QBTMatrix;
+class QBTChunk;
+
+typedef unsigned long long QBTBitColumn;
+
+// Most rows in a slice of a chunk, one for each bit of a column word
+const unsigned int QBT_BINARY_MESHER_MAX_ROWS = 64;
+
+// Occupancy columns of a whole matrix, bits run along x for each (y, z) and along y for each (x, z). Built by the binary mesher the
+// first time it meshes the matrix, after that only the words over voxels that have had their visibility masks recomputed are built again.
+class QBTBinaryOccupancy
+{
+public:
+	/* Public methods */
+	QBTBinaryOccupancy();
+
+	// The voxels inside the inclusive box have changed since the columns were built
+	void SetDirty(int minX, int minY, int minZ, int maxX, int maxY, int maxZ);
+
+public:
+	/* Public members */
+	bool m_built;
+	unsigned int m_sizeX;
+	unsigned int m_sizeY;
+	unsigned int m_sizeZ;
+
+	// Box around every change since the columns were last built
+	bool m_dirty;
+	int m_dirtyMin[3];
+	int m_dirtyMax[3];
+
+	// Exposed voxels are solid voxels with at least one face bit set in their visibility mask
+	unsigned int m_numWordsX;
+	unsigned int m_numWordsY;
+	vector<QBTBitColumn> m_solidColumnsX;
+	vector<QBTBitColumn> m_exposedColumnsX;
+	vector<QBTBitColumn> m_solidColumnsY;
+	vector<QBTBitColumn> m_exposedColumnsY;
+};
+
+class QBTBinaryMesher
+{
+public:
+	/* Public methods */
+	QBTBinaryMesher();
+	~QBTBinaryMesher();
+
+	// Meshing of a single chunk of the matrix, the vertex arena is grown as needed and the number of vertices written is returned.
+	// Quads are written in the vertex order of the renderer's shared quad index buffer. When a packed vertex arena is given the
+	// vertices are written to it in the packed format instead.
+	unsigned int CreateMesh(QBTMatrix* pMatrix, QBTChunk* pChunk, bool mergeFaces, bool createInnerVoxels, bool createInnerFaces, bool ambientOcclusion, vector<PositionColorNormalVertex>& vertexArena, vector<PackedPositionColorNormalVertex>* pPackedVertexArena);
+
+protected:
+	/* Protected methods */
+
+private:
+	/* Private methods */
+	void UpdateOccupancy(QBTMatrix* pMatrix);
+	void BuildOccupancy(QBTMatrix* pMatrix, const int* pMin, const int* pMax);
+	void MeshFace(QBTMatrix* pMatrix, QBTChunk* pChunk, int face, bool mergeFaces, bool createInnerVoxels, bool cullFaces);
+	unsigned int GetFaceColour(QBTMatrix* pMatrix, int face, unsigned int u, unsigned int v);
+	void EmitFaces(QBTMatrix* pMatrix, int face, unsigned int numRows);
+	void MergeFaces(QBTMatrix* pMatrix, int face, unsigned int numRows);
+
+	// Colour planes
+	unsigned int GetColourPlane(unsigned int colour);
+	void ResetColourPlanes();
+
+	void EmitQuad(int face, unsigned int u, unsigned int v, unsigned int width, unsigned int height, unsigned int colour);
+
+public:
+	/* Public members */
+
+protected:
+	/* Protected members */
+
+private:
+	/* Private members */
+	// Voxel position of the first face of the chunk along the u and v axes of the face being meshed
+	unsigned int m_startU;
+	unsigned int m_startV;
+
+	// The slice being meshed, its first voxel and the corner of that voxel's face, and the steps to the next voxel along u and v.
+	// Positions have a fourth lane that is always zero, so they can be worked on four floats at a time.
+	unsigned int m_slicePosition[3];
+	unsigned int m_sliceStart;
+	unsigned int m_strideU;
+	unsigned int m_strideV;
+	float m_sliceCorner[4];
+	float m_axisU[4];
+	float m_axisV[4];
+	float m_cornerU[4][4]; // Step to each corner of a quad, scaled by its width
+	float m_cornerV[4][4]; // and by its height
+
+	// Colour of the last quad
+	unsigned int m_quadColour;
+	float m_quadRed;
+	float m_quadGreen;
+	float m_quadBlue;
+
+	// Block of x columns being turned into y columns
+	QBTBitColumn m_transposeBlock[64];
+
+	// The visible faces of the slice being meshed, one row along u for each voxel along v. A chunk is never wider than a
+	// word, so each row is the bits of its chunk shifted down to the first bit.
+	QBTBitColumn m_facePlane[QBT_BINARY_MESHER_MAX_ROWS];
+
+	// One bit-plane per colour in the slice being meshed, planes are left empty again once they have been merged
+	vector<QBTBitColumn> m_colourPlanes;
+	vector<unsigned int> m_planeColours;
+	vector<QBTBitColumn> m_planeRows; // Which rows of each plane have any bits set
+	unsigned int m_numPlanesUsed;
+
+	// Open addressed colour to plane lookup, entries are only valid when their stamp matches the current slice
+	vector<unsigned int> m_colourTableKeys;
+	vector<unsigned int> m_colourTablePlanes;
+	vector<unsigned int> m_colourTableStamps;
+	unsigned int m_colourTableStamp;
+
+	// Output
+	bool m_ambientOcclusion;
+	vector<PositionColorNormalVertex>* m_pVertexArena;
+	vector<PackedPositionColorNormalVertex>* m_pPackedVertexArena;
+	unsigned int m_numVertices;
+};
@@ -0,0 +1,227 @@
+// ******************************************************************************
+// Filename:    QBTFileMapping.cpp
+// Project:     Qube
+// Author:      Steven Ball
+//
+// Revision History:
+//   Initial Revision - 17/10/26
+//
+// Copyright (c) 2005-2016, Steven Ball
+// ******************************************************************************
+
+#include "QBTFileMapping.h"
+
+#ifdef _WIN32
+#define NOMINMAX
+#include <windows.h>
+#else
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#endif //_WIN32
+
+// Files smaller than this are read into memory with a single read, setting up and tearing down a mapping costs more
+const size_t QBT_MAPPING_MIN_SIZE = 64 * 1024;
+// Files smaller than this are not given readahead hints
+const size_t QBT_MAPPING_READAHEAD_SIZE = 256 * 1024;
+
+
+QBTFileMapping::QBTFileMapping()
+{
+	m_pData = NULL;
+	m_size = 0;
+	m_mapped = false;
+
+	m_pSmallFileBuffer = NULL;
+	m_smallFileCapacity = 0;
+
+#ifdef _WIN32
+	m_fileHandle = INVALID_HANDLE_VALUE;
+	m_mappingHandle = NULL;
+#else
+	m_fileDescriptor = -1;
+#endif //_WIN32
+}
+
+QBTFileMapping::~QBTFileMapping()
+{
+	Close();
+
+	delete[] m_pSmallFileBuffer;
+	m_pSmallFileBuffer = NULL;
+	m_smallFileCapacity = 0;
+}
+
+unsigned char* QBTFileMapping::GetSmallFileBuffer(size_t size)
+{
+	if (size > m_smallFileCapacity)
+	{
+		delete[] m_pSmallFileBuffer;
+		m_pSmallFileBuffer = new unsigned char[size];
+		m_smallFileCapacity = size;
+	}
+
+	return m_pSmallFileBuffer;
+}
+
+// Mapping
+bool QBTFileMapping::Open(string filename)
+{
+	Close();
+
+#ifdef _WIN32
+	m_fileHandle = CreateFileA(filename.c_str(), GENERIC_READ, FILE_SHARE_READ, NULL, OPEN_EXISTING, FILE_FLAG_SEQUENTIAL_SCAN, NULL);
+	if (m_fileHandle == INVALID_HANDLE_VALUE)
+	{
+		return false;
+	}
+
+	LARGE_INTEGER fileSize;
+	if (GetFileSizeEx(m_fileHandle, &fileSize) == FALSE || fileSize.QuadPart == 0)
+	{
+		Close();
+		return false;
+	}
+	m_size = (size_t)fileSize.QuadPart;
+
+	if (m_size < QBT_MAPPING_MIN_SIZE)
+	{
+		unsigned char* pBuffer = GetSmallFileBuffer(m_size);
+		DWORD bytesRead = 0;
+		BOOL readOk = ReadFile(m_fileHandle, pBuffer, (DWORD)m_size, &bytesRead, NULL);
+		CloseHandle(m_fileHandle);
+		m_fileHandle = INVALID_HANDLE_VALUE;
+		if (readOk == FALSE || bytesRead != m_size)
+		{
+			Close();
+			return false;
+		}
+
+		m_pData = pBuffer;
+		return true;
+	}
+
+	m_mappingHandle = CreateFileMappingA(m_fileHandle, NULL, PAGE_READONLY, 0, 0, NULL);
+	if (m_mappingHandle == NULL)
+	{
+		Close();
+		return false;
+	}
+
+	m_pData = (const unsigned char*)MapViewOfFile(m_mappingHandle, FILE_MAP_READ, 0, 0, 0);
+	m_mapped = m_pData != NULL;
+#else
+	m_fileDescriptor = open(filename.c_str(), O_RDONLY);
+	if (m_fileDescriptor == -1)
+	{
+		return false;
+	}
+
+	struct stat fileStat;
+	if (fstat(m_fileDescriptor, &fileStat) != 0 || fileStat.st_size == 0)
+	{
+		Close();
+		return false;
+	}
+	m_size = (size_t)fileStat.st_size;
+
+	if (m_size < QBT_MAPPING_MIN_SIZE)
+	{
+		unsigned char* pBuffer = GetSmallFileBuffer(m_size);
+		size_t totalRead = 0;
+		while (totalRead < m_size)
+		{
+			ssize_t bytesRead = read(m_fileDescriptor, pBuffer + totalRead, m_size - totalRead);
+			if (bytesRead <= 0)
+			{
+				break;
+			}
+			totalRead += (size_t)bytesRead;
+		}
+		close(m_fileDescriptor);
+		m_fileDescriptor = -1;
+		if (totalRead != m_size)
+		{
+			Close();
+			return false;
+		}
+
+		m_pData = pBuffer;
+		return true;
+	}
+
+	void* pMapping = mmap(NULL, m_size, PROT_READ, MAP_PRIVATE, m_fileDescriptor, 0);
+	if (pMapping == MAP_FAILED)
+	{
+		pMapping = NULL;
+	}
+	else if (m_size >= QBT_MAPPING_READAHEAD_SIZE)
+	{
+		// The whole file is parsed front to back straight away, so ask for aggressive readahead behind the parser and for the pages
+		// to be read in before it gets to them. Small files are not worth the extra syscalls.
+		madvise(pMapping, m_size, MADV_SEQUENTIAL);
+		madvise(pMapping, m_size, MADV_WILLNEED);
+	}
+	m_pData = (const unsigned char*)pMapping;
+	m_mapped = m_pData != NULL;
+#endif //_WIN32
+
+	if (m_pData == NULL)
+	{
+		Close();
+		return false;
+	}
+
+	return true;
+}
+
+void QBTFileMapping::Close()
+{
+#ifdef _WIN32
+	if (m_mapped)
+	{
+		UnmapViewOfFile(m_pData);
+	}
+	if (m_mappingHandle != NULL)
+	{
+		CloseHandle(m_mappingHandle);
+		m_mappingHandle = NULL;
+	}
+	if (m_fileHandle != INVALID_HANDLE_VALUE)
+	{
+		CloseHandle(m_fileHandle);
+		m_fileHandle = INVALID_HANDLE_VALUE;
+	}
+#else
+	if (m_mapped)
+	{
+		munmap((void*)m_pData, m_size);
+	}
+	if (m_fileDescriptor != -1)
+	{
+		close(m_fileDescriptor);
+		m_fileDescriptor = -1;
+	}
+#endif //_WIN32
+
+	m_mapped = false;
+	m_pData = NULL;
+	m_size = 0;
+}
+
+bool QBTFileMapping::IsOpen()
+{
+	return m_pData != NULL;
+}
+
+// Accessors
+const unsigned char* QBTFileMapping::GetData()
+{
+	return m_pData;
+}
+
+size_t QBTFileMapping::GetSize()
+{
+	return m_size;
+}
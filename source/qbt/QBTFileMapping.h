@@ -0,0 +1,123 @@
+// ******************************************************************************
+// Filename:    QBTFileMapping.h
+// Project:     Qube
+// Author:      Steven Ball
+//
+// Purpose:
+//   A read-only memory mapped view of a file on disk. Used by the QBT loader so
+//   that headers, the color map and the compressed voxel blobs can be parsed
+//   straight out of the mapping without any intermediate fread copies. Small
+//   files are read into memory in one go instead, where mapping costs more.
+//
+// Revision History:
+//   Initial Revision - 17/10/26
+//
+// Copyright (c) 2005-2016, Steven Ball
+// ******************************************************************************
+
+#pragma once
+
+#include <stddef.h>
+#include <string.h>
+
+#include <string>
+#include <vector>
+using namespace std;
+
+
+class QBTFileMapping
+{
+public:
+	/* Public methods */
+	QBTFileMapping();
+	~QBTFileMapping();
+
+	// Mapping
+	bool Open(string filename);
+	void Close();
+	bool IsOpen();
+
+	// Accessors
+	const unsigned char* GetData();
+	size_t GetSize();
+
+protected:
+	/* Protected methods */
+
+private:
+	/* Private methods */
+	unsigned char* GetSmallFileBuffer(size_t size);
+
+public:
+	/* Public members */
+
+protected:
+	/* Protected members */
+
+private:
+	/* Private members */
+	const unsigned char* m_pData;
+	size_t m_size;
+
+	bool m_mapped;
+
+	// Backing storage when the file was too small to be worth mapping. Kept between files and only grown, so loading one small
+	// file after another doesn't allocate and fault in a fresh buffer each time, and never cleared, the read fills it.
+	unsigned char* m_pSmallFileBuffer;
+	size_t m_smallFileCapacity;
+
+#ifdef _WIN32
+	void* m_fileHandle;
+	void* m_mappingHandle;
+#else
+	int m_fileDescriptor;
+#endif //_WIN32
+};
+
+
+// A bounds checked cursor over a block of memory, mirrors the fread() calls of the FILE* loader.
+class QBTMemoryReader
+{
+public:
+	QBTMemoryReader(const unsigned char* pData, size_t size)
+	{
+		m_pData = pData;
+		m_size = size;
+		m_offset = 0;
+	}
+
+	bool Read(void* pDestination, size_t numBytes)
+	{
+		if (m_offset + numBytes > m_size)
+		{
+			m_offset = m_size;
+			return false;
+		}
+
+		memcpy(pDestination, m_pData + m_offset, numBytes);
+		m_offset += numBytes;
+		return true;
+	}
+
+	// Returns a pointer into the mapped data and advances past it, no copy is made
+	const unsigned char* Skip(size_t numBytes)
+	{
+		if (m_offset + numBytes > m_size)
+		{
+			m_offset = m_size;
+			return NULL;
+		}
+
+		const unsigned char* pCurrent = m_pData + m_offset;
+		m_offset += numBytes;
+		return pCurrent;
+	}
+
+	size_t GetOffset() const { return m_offset; }
+	size_t GetRemaining() const { return m_size - m_offset; }
+
+private:
+	const unsigned char* m_pData;
+	size_t m_size;
+	size_t m_offset;
+};
@@ -0,0 +1,510 @@
+// ******************************************************************************
+// Filename:    QBTGenerator.cpp
+// Project:     Qube
+// Author:      Steven Ball
+//
+// Revision History:
+//   Initial Revision - 17/10/26
+//
+// Copyright (c) 2005-2016, Steven Ball
+// ******************************************************************************
+
+#include "QBTGenerator.h"
+#include "QBTVisibility.h"
+#include "../zlib/zlib.h"
+#include "../Profiler/Profiler.h"
+
+#include <math.h>
+#include <string.h>
+
+#include <algorithm>
+
+// Points that the noise is sampled at to find the threshold that fills the right share of the voxels
+const unsigned int NOISE_THRESHOLD_SAMPLES = 4096;
+
+// Height bands that the solid voxels are coloured by
+const unsigned int COLOUR_BANDS = 8;
+
+// Bytes of compressed voxel data written to the file at a time
+const unsigned int DEFLATE_CHUNK_SIZE = 262144;
+
+// Each use of the hash gets its own salt, so the noise, the random voxels and the colours don't line up with each other
+const unsigned int SALT_NOISE = 0x9E3779B9;
+const unsigned int SALT_THRESHOLD = 0x7F4A7C15;
+const unsigned int SALT_RANDOM = 0x94D049BB;
+const unsigned int SALT_ENTROPY = 0xBF58476D;
+const unsigned int SALT_COLOUR = 0x2545F491;
+
+
+QBTGeneratorSettings::QBTGeneratorSettings()
+{
+	m_seed = 1;
+	m_numMatrices = 1;
+	m_sizeX = 64;
+	m_sizeY = 64;
+	m_sizeZ = 64;
+	m_shape = QBTGeneratorShape_Terrain;
+	m_fillRatio = 0.5f;
+	m_hollow = false;
+	m_colourEntropy = 0.0f;
+	m_noiseScale = 32.0f;
+	m_noiseOctaves = 4;
+}
+
+QBTGenerator::QBTGenerator(const QBTGeneratorSettings& settings)
+{
+	m_settings = settings;
+	m_settings.m_numMatrices = std::max(m_settings.m_numMatrices, 1u);
+	m_settings.m_sizeX = std::min(std::max(m_settings.m_sizeX, 1u), QBT_GENERATOR_MAX_SIZE);
+	m_settings.m_sizeY = std::min(std::max(m_settings.m_sizeY, 1u), QBT_GENERATOR_MAX_SIZE);
+	m_settings.m_sizeZ = std::min(std::max(m_settings.m_sizeZ, 1u), QBT_GENERATOR_MAX_SIZE);
+	if (m_settings.m_shape < 0 || m_settings.m_shape >= QBTGeneratorShape_NUM)
+	{
+		m_settings.m_shape = QBTGeneratorShape_Terrain;
+	}
+	m_settings.m_fillRatio = std::min(std::max(m_settings.m_fillRatio, 0.0f), 1.0f);
+	m_settings.m_colourEntropy = std::min(std::max(m_settings.m_colourEntropy, 0.0f), 1.0f);
+	m_settings.m_noiseScale = std::max(m_settings.m_noiseScale, 1.0f);
+	m_settings.m_noiseOctaves = std::min(std::max(m_settings.m_noiseOctaves, 1u), QBT_GENERATOR_MAX_OCTAVES);
+
+	m_noiseThreshold = 0.0f;
+	if (m_settings.m_shape == QBTGeneratorShape_Noise)
+	{
+		CalculateNoiseThreshold();
+	}
+
+	m_numSolidVoxels = 0;
+}
+
+QBTGenerator::~QBTGenerator()
+{
+}
+
+const QBTGeneratorSettings& QBTGenerator::GetSettings()
+{
+	return m_settings;
+}
+
+bool QBTGenerator::WriteFile(string filename)
+{
+	PROFILE_SCOPE("QBTGenerator::WriteFile");
+
+	FILE* pFile = fopen(filename.c_str(), "wb");
+	if (pFile == NULL)
+	{
+		return false;
+	}
+
+	// Header, with no colour map so the voxels carry their own colours
+	unsigned char version[2] = { 1, 0 };
+	float globalScale[3] = { 1.0f, 1.0f, 1.0f };
+	unsigned int numColours = 0;
+	bool ok = fwrite("QB 2", 4, 1, pFile) == 1;
+	ok = ok && fwrite(version, sizeof(version), 1, pFile) == 1;
+	ok = ok && fwrite(globalScale, sizeof(globalScale), 1, pFile) == 1;
+	ok = ok && fwrite("COLORMAP", 8, 1, pFile) == 1;
+	ok = ok && fwrite(&numColours, sizeof(numColours), 1, pFile) == 1;
+	ok = ok && fwrite("DATATREE", 8, 1, pFile) == 1;
+
+	// Model node holding every matrix, its size is only known once they have been written
+	unsigned int modelHeader[3] = { 1, 0, m_settings.m_numMatrices };
+	long modelStart = ftell(pFile);
+	ok = ok && fwrite(modelHeader, sizeof(modelHeader), 1, pFile) == 1;
+
+	size_t numVoxels = (size_t)m_settings.m_sizeX * m_settings.m_sizeY * m_settings.m_sizeZ;
+	vector<unsigned int> solid((numVoxels + 31) / 32);
+	vector<unsigned int> shell;
+	if (m_settings.m_hollow)
+	{
+		shell.resize(solid.size());
+	}
+
+	m_numSolidVoxels = 0;
+	for (unsigned int i = 0; ok && i < m_settings.m_numMatrices; i++)
+	{
+		ok = WriteMatrix(pFile, i, solid, shell);
+	}
+
+	// The model's data is its child count and the matrix nodes after it
+	long modelEnd = ftell(pFile);
+	modelHeader[1] = (unsigned int)(modelEnd - modelStart - sizeof(unsigned int) * 2);
+	ok = ok && fseek(pFile, modelStart, SEEK_SET) == 0;
+	ok = ok && fwrite(modelHeader, sizeof(modelHeader), 1, pFile) == 1;
+
+	return fclose(pFile) == 0 && ok;
+}
+
+unsigned long long QBTGenerator::GetNumSolidVoxels()
+{
+	return m_numSolidVoxels;
+}
+
+bool QBTGenerator::IsSolid(int x, int y, int z)
+{
+	if (y < 0 || y >= (int)m_settings.m_sizeY)
+	{
+		return false;
+	}
+
+	switch (m_settings.m_shape)
+	{
+	case QBTGeneratorShape_Terrain:
+		return y < (int)GetTerrainHeight(x, z);
+	case QBTGeneratorShape_Noise:
+		return GetNoise3D((float)x, (float)y, (float)z) < m_noiseThreshold;
+	default:
+		return HashToFloat(Hash(x, y, z, m_settings.m_seed ^ SALT_RANDOM)) < m_settings.m_fillRatio;
+	}
+}
+
+// The terrain sits on the fill ratio, with the hills and valleys only going as far as they can without running out of the matrix
+unsigned int QBTGenerator::GetTerrainHeight(int x, int z)
+{
+	if (m_settings.m_shape != QBTGeneratorShape_Terrain)
+	{
+		int y = (int)m_settings.m_sizeY - 1;
+		while (y >= 0 && IsSolid(x, y, z) == false)
+		{
+			y--;
+		}
+		return (unsigned int)(y + 1);
+	}
+
+	float fill = m_settings.m_fillRatio;
+	float height = m_settings.m_sizeY * (fill + (GetNoise2D((float)x, (float)z) - 0.5f) * 2.0f * std::min(fill, 1.0f - fill));
+	return (unsigned int)std::min(std::max((int)floorf(height + 0.5f), 0), (int)m_settings.m_sizeY);
+}
+
+const char* QBTGenerator::GetShapeName(QBTGeneratorShape shape)
+{
+	switch (shape)
+	{
+	case QBTGeneratorShape_Terrain: return "Terrain";
+	case QBTGeneratorShape_Noise: return "Noise";
+	case QBTGeneratorShape_Random: return "Random";
+	default: return "Unknown";
+	}
+}
+
+// Mixes the coordinates in and runs the murmur3 finalizer over them, so neighbouring voxels get unrelated values
+unsigned int QBTGenerator::Hash(unsigned int x, unsigned int y, unsigned int z, unsigned int seed)
+{
+	unsigned int hash = seed;
+	hash ^= x * 0x8DA6B343;
+	hash ^= y * 0xD8163841;
+	hash ^= z * 0xCB1AB31F;
+	hash ^= hash >> 16;
+	hash *= 0x85EBCA6B;
+	hash ^= hash >> 13;
+	hash *= 0xC2B2AE35;
+	hash ^= hash >> 16;
+
+	return hash;
+}
+
+// Between 0 and 1, never reaching 1
+float QBTGenerator::HashToFloat(unsigned int hash)
+{
+	return (hash >> 8) * (1.0f / 16777216.0f);
+}
+
+// Each octave is twice the frequency and half the weight of the one before it, with a value on every lattice point
+float QBTGenerator::GetNoise2D(float x, float z)
+{
+	float noise = 0.0f;
+	float totalWeight = 0.0f;
+	float frequency = 1.0f / m_settings.m_noiseScale;
+	float weight = 1.0f;
+	for (unsigned int octave = 0; octave < m_settings.m_noiseOctaves; octave++)
+	{
+		unsigned int seed = m_settings.m_seed ^ (SALT_NOISE * (octave + 1));
+		float sampleX = x * frequency;
+		float sampleZ = z * frequency;
+		int x0 = (int)floorf(sampleX);
+		int z0 = (int)floorf(sampleZ);
+		float tx = sampleX - x0;
+		float tz = sampleZ - z0;
+		tx = tx * tx * (3.0f - 2.0f * tx);
+		tz = tz * tz * (3.0f - 2.0f * tz);
+
+		float v00 = HashToFloat(Hash(x0, 0, z0, seed));
+		float v10 = HashToFloat(Hash(x0 + 1, 0, z0, seed));
+		float v01 = HashToFloat(Hash(x0, 0, z0 + 1, seed));
+		float v11 = HashToFloat(Hash(x0 + 1, 0, z0 + 1, seed));
+		float v0 = v00 + (v10 - v00) * tx;
+		float v1 = v01 + (v11 - v01) * tx;
+
+		noise += (v0 + (v1 - v0) * tz) * weight;
+		totalWeight += weight;
+		frequency *= 2.0f;
+		weight *= 0.5f;
+	}
+
+	return noise / totalWeight;
+}
+
+float QBTGenerator::GetNoise3D(float x, float y, float z)
+{
+	float noise = 0.0f;
+	float totalWeight = 0.0f;
+	float frequency = 1.0f / m_settings.m_noiseScale;
+	float weight = 1.0f;
+	for (unsigned int octave = 0; octave < m_settings.m_noiseOctaves; octave++)
+	{
+		unsigned int seed = m_settings.m_seed ^ (SALT_NOISE * (octave + 1));
+		float sampleX = x * frequency;
+		float sampleY = y * frequency;
+		float sampleZ = z * frequency;
+		int x0 = (int)floorf(sampleX);
+		int y0 = (int)floorf(sampleY);
+		int z0 = (int)floorf(sampleZ);
+		float tx = sampleX - x0;
+		float ty = sampleY - y0;
+		float tz = sampleZ - z0;
+		tx = tx * tx * (3.0f - 2.0f * tx);
+		ty = ty * ty * (3.0f - 2.0f * ty);
+		tz = tz * tz * (3.0f - 2.0f * tz);
+
+		float v[2][2];
+		for (int j = 0; j < 2; j++)
+		{
+			for (int k = 0; k < 2; k++)
+			{
+				float v0 = HashToFloat(Hash(x0, y0 + j, z0 + k, seed));
+				float v1 = HashToFloat(Hash(x0 + 1, y0 + j, z0 + k, seed));
+				v[j][k] = v0 + (v1 - v0) * tx;
+			}
+		}
+		float vz0 = v[0][0] + (v[1][0] - v[0][0]) * ty;
+		float vz1 = v[0][1] + (v[1][1] - v[0][1]) * ty;
+
+		noise += (vz0 + (vz1 - vz0) * tz) * weight;
+		totalWeight += weight;
+		frequency *= 2.0f;
+		weight *= 0.5f;
+	}
+
+	return noise / totalWeight;
+}
+
+// Summed octaves bunch up around the middle, so rather than using the fill ratio as the threshold it is found from where that share
+// of the samples over the whole model falls
+void QBTGenerator::CalculateNoiseThreshold()
+{
+	if (m_settings.m_fillRatio <= 0.0f)
+	{
+		m_noiseThreshold = -1.0f;
+		return;
+	}
+	if (m_settings.m_fillRatio >= 1.0f)
+	{
+		m_noiseThreshold = 2.0f;
+		return;
+	}
+
+	vector<float> samples(NOISE_THRESHOLD_SAMPLES);
+	unsigned int seed = m_settings.m_seed ^ SALT_THRESHOLD;
+	for (unsigned int i = 0; i < NOISE_THRESHOLD_SAMPLES; i++)
+	{
+		float x = HashToFloat(Hash(i, 0, 0, seed)) * m_settings.m_sizeX * m_settings.m_numMatrices;
+		float y = HashToFloat(Hash(i, 1, 0, seed)) * m_settings.m_sizeY;
+		float z = HashToFloat(Hash(i, 2, 0, seed)) * m_settings.m_sizeZ;
+		samples[i] = GetNoise3D(floorf(x), floorf(y), floorf(z));
+	}
+
+	unsigned int thresholdIndex = (unsigned int)(m_settings.m_fillRatio * NOISE_THRESHOLD_SAMPLES);
+	nth_element(samples.begin(), samples.begin() + thresholdIndex, samples.end());
+	m_noiseThreshold = samples[thresholdIndex];
+}
+
+unsigned int QBTGenerator::GetVoxelIndex(unsigned int x, unsigned int y, unsigned int z)
+{
+	return y + m_settings.m_sizeY * (z + m_settings.m_sizeZ * x);
+}
+
+bool QBTGenerator::GetBit(const vector<unsigned int>& bits, unsigned int x, unsigned int y, unsigned int z)
+{
+	unsigned int index = GetVoxelIndex(x, y, z);
+	return (bits[index >> 5] & (1u << (index & 31))) != 0;
+}
+
+void QBTGenerator::FillMatrix(unsigned int matrixIndex, vector<unsigned int>& solid)
+{
+	fill(solid.begin(), solid.end(), 0u);
+
+	int offsetX = (int)(matrixIndex * m_settings.m_sizeX);
+	for (unsigned int x = 0; x < m_settings.m_sizeX; x++)
+	{
+		for (unsigned int z = 0; z < m_settings.m_sizeZ; z++)
+		{
+			// Terrain columns only need their height
+			unsigned int height = m_settings.m_shape == QBTGeneratorShape_Terrain ? GetTerrainHeight(offsetX + x, z) : m_settings.m_sizeY;
+			for (unsigned int y = 0; y < height; y++)
+			{
+				if (m_settings.m_shape == QBTGeneratorShape_Terrain || IsSolid(offsetX + x, y, z))
+				{
+					unsigned int index = GetVoxelIndex(x, y, z);
+					solid[index >> 5] |= 1u << (index & 31);
+				}
+			}
+		}
+	}
+}
+
+// The outside of the matrix counts as empty, the same as it does for the visibility mask
+void QBTGenerator::HollowMatrix(const vector<unsigned int>& solid, vector<unsigned int>& shell)
+{
+	fill(shell.begin(), shell.end(), 0u);
+
+	for (unsigned int x = 0; x < m_settings.m_sizeX; x++)
+	{
+		for (unsigned int z = 0; z < m_settings.m_sizeZ; z++)
+		{
+			for (unsigned int y = 0; y < m_settings.m_sizeY; y++)
+			{
+				if (GetBit(solid, x, y, z) && GetVoxelMask(solid, x, y, z) != QBTVisibility_Solid)
+				{
+					unsigned int index = GetVoxelIndex(x, y, z);
+					shell[index >> 5] |= 1u << (index & 31);
+				}
+			}
+		}
+	}
+}
+
+unsigned int QBTGenerator::GetVoxelMask(const vector<unsigned int>& solid, unsigned int x, unsigned int y, unsigned int z)
+{
+	if (GetBit(solid, x, y, z) == false)
+	{
+		return 0;
+	}
+
+	unsigned int mask = QBTVisibility_Solid;
+	if (x + 1 == m_settings.m_sizeX || GetBit(solid, x + 1, y, z) == false) mask |= QBTVisibility_X_Positive;
+	if (x == 0 || GetBit(solid, x - 1, y, z) == false) mask |= QBTVisibility_X_Negative;
+	if (y + 1 == m_settings.m_sizeY || GetBit(solid, x, y + 1, z) == false) mask |= QBTVisibility_Y_Positive;
+	if (y == 0 || GetBit(solid, x, y - 1, z) == false) mask |= QBTVisibility_Y_Negative;
+	if (z == 0 || GetBit(solid, x, y, z - 1) == false) mask |= QBTVisibility_Z_Negative;
+	if (z + 1 == m_settings.m_sizeZ || GetBit(solid, x, y, z + 1) == false) mask |= QBTVisibility_Z_Positive;
+
+	return mask;
+}
+
+// Height bands give long runs of one colour for the mesher to merge, the random colours break them up
+void QBTGenerator::GetVoxelColour(int x, int y, int z, unsigned char* pColour)
+{
+	if (m_settings.m_colourEntropy > 0.0f && HashToFloat(Hash(x, y, z, m_settings.m_seed ^ SALT_ENTROPY)) < m_settings.m_colourEntropy)
+	{
+		unsigned int hash = Hash(x, y, z, m_settings.m_seed ^ SALT_COLOUR);
+		pColour[0] = (unsigned char)(hash & 0xFF);
+		pColour[1] = (unsigned char)((hash >> 8) & 0xFF);
+		pColour[2] = (unsigned char)((hash >> 16) & 0xFF);
+		return;
+	}
+
+	unsigned int band = y * COLOUR_BANDS / m_settings.m_sizeY;
+	pColour[0] = (unsigned char)(60 + band * 20);
+	pColour[1] = (unsigned char)(170 - band * 12);
+	pColour[2] = (unsigned char)(50 + band * 8);
+}
+
+// Writes the node a plane of x at a time, so only one plane of the voxel data is ever held uncompressed
+bool QBTGenerator::WriteMatrix(FILE* pFile, unsigned int matrixIndex, vector<unsigned int>& solid, vector<unsigned int>& shell)
+{
+	FillMatrix(matrixIndex, solid);
+	if (m_settings.m_hollow)
+	{
+		HollowMatrix(solid, shell);
+	}
+	const vector<unsigned int>& voxels = m_settings.m_hollow ? shell : solid;
+
+	char name[32];
+	sprintf(name, "Matrix%u", matrixIndex);
+	unsigned int nameLength = (unsigned int)strlen(name);
+	unsigned int nodeHeader[2] = { 0, 0 };
+	int position[3] = { (int)(matrixIndex * m_settings.m_sizeX), 0, 0 };
+	unsigned int localScale[3] = { 1, 1, 1 };
+	float pivot[3] = { 0.0f, 0.0f, 0.0f };
+	unsigned int size[3] = { m_settings.m_sizeX, m_settings.m_sizeY, m_settings.m_sizeZ };
+	unsigned int compressedSize = 0;
+
+	// The node and compressed sizes are written over once the data is there
+	long nodeStart = ftell(pFile);
+	bool ok = fwrite(nodeHeader, sizeof(nodeHeader), 1, pFile) == 1;
+	ok = ok && fwrite(&nameLength, sizeof(nameLength), 1, pFile) == 1;
+	ok = ok && fwrite(name, nameLength, 1, pFile) == 1;
+	ok = ok && fwrite(position, sizeof(position), 1, pFile) == 1;
+	ok = ok && fwrite(localScale, sizeof(localScale), 1, pFile) == 1;
+	ok = ok && fwrite(pivot, sizeof(pivot), 1, pFile) == 1;
+	ok = ok && fwrite(size, sizeof(size), 1, pFile) == 1;
+	long compressedSizeStart = ftell(pFile);
+	ok = ok && fwrite(&compressedSize, sizeof(compressedSize), 1, pFile) == 1;
+	if (ok == false)
+	{
+		return false;
+	}
+
+	z_stream stream;
+	memset(&stream, 0, sizeof(stream));
+	if (deflateInit(&stream, Z_DEFAULT_COMPRESSION) != Z_OK)
+	{
+		return false;
+	}
+
+	// Voxels are rgba in x, z, y order, with the visibility mask in place of the alpha
+	vector<unsigned char> plane((size_t)m_settings.m_sizeZ * m_settings.m_sizeY * 4);
+	vector<unsigned char> compressed(DEFLATE_CHUNK_SIZE);
+	int zlibResult = Z_OK;
+	for (unsigned int x = 0; ok && x < m_settings.m_sizeX; x++)
+	{
+		unsigned char* pVoxel = &plane[0];
+		for (unsigned int z = 0; z < m_settings.m_sizeZ; z++)
+		{
+			for (unsigned int y = 0; y < m_settings.m_sizeY; y++)
+			{
+				unsigned int mask = GetVoxelMask(voxels, x, y, z);
+				if (mask != 0)
+				{
+					GetVoxelColour(position[0] + x, y, z, pVoxel);
+					m_numSolidVoxels++;
+				}
+				else
+				{
+					pVoxel[0] = 0;
+					pVoxel[1] = 0;
+					pVoxel[2] = 0;
+				}
+				pVoxel[3] = (unsigned char)mask;
+				pVoxel += 4;
+			}
+		}
+
+		stream.next_in = &plane[0];
+		stream.avail_in = (uInt)plane.size();
+		int flush = x + 1 == m_settings.m_sizeX ? Z_FINISH : Z_NO_FLUSH;
+		do
+		{
+			stream.next_out = &compressed[0];
+			stream.avail_out = DEFLATE_CHUNK_SIZE;
+			zlibResult = deflate(&stream, flush);
+			size_t compressedBytes = DEFLATE_CHUNK_SIZE - stream.avail_out;
+			if (zlibResult == Z_STREAM_ERROR || (compressedBytes > 0 && fwrite(&compressed[0], compressedBytes, 1, pFile) != 1))
+			{
+				ok = false;
+			}
+		} while (ok && stream.avail_out == 0);
+	}
+	ok = ok && zlibResult == Z_STREAM_END;
+	compressedSize = (unsigned int)stream.total_out;
+	deflateEnd(&stream);
+
+	long nodeEnd = ftell(pFile);
+	nodeHeader[1] = (unsigned int)(nodeEnd - nodeStart - sizeof(nodeHeader));
+	ok = ok && fseek(pFile, nodeStart, SEEK_SET) == 0;
+	ok = ok && fwrite(nodeHeader, sizeof(nodeHeader), 1, pFile) == 1;
+	ok = ok && fseek(pFile, compressedSizeStart, SEEK_SET) == 0;
+	ok = ok && fwrite(&compressedSize, sizeof(compressedSize), 1, pFile) == 1;
+	ok = ok && fseek(pFile, nodeEnd, SEEK_SET) == 0;
+
+	return ok;
+}
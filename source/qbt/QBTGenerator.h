@@ -0,0 +1,119 @@
+// ******************************************************************************
+// Filename:    QBTGenerator.h
+// Project:     Qube
+// Author:      Steven Ball
+//
+// Purpose:
+//   Writes synthetic QBT files for performance and stress testing. A model is
+//   a row of matrices along x, filled from noise in world space so the shape
+//   carries on from one matrix to the next, optionally hollowed out to just
+//   its shell and coloured anywhere between smooth height bands and a random
+//   colour per voxel. The matrices are written in the same node layout that
+//   LoadNode and LoadMatrix read, with the visibility masks already worked
+//   out, and the same settings and seed always give the same file.
+//
+// Revision History:
+//   Initial Revision - 17/10/26
+//
+// Copyright (c) 2005-2016, Steven Ball
+// ******************************************************************************
+
+#pragma once
+
+#include <stdio.h>
+
+#include <string>
+#include <vector>
+using namespace std;
+
+// Largest size of a matrix along any axis
+const unsigned int QBT_GENERATOR_MAX_SIZE = 512;
+
+// Most octaves of noise that are summed up
+const unsigned int QBT_GENERATOR_MAX_OCTAVES = 8;
+
+enum QBTGeneratorShape
+{
+	QBTGeneratorShape_Terrain = 0, // Heightfield, the columns are solid up to a 2D noise height
+	QBTGeneratorShape_Noise, // 3D noise, caves and overhangs
+	QBTGeneratorShape_Random, // Every voxel picked on its own, the worst case for merging faces
+
+	QBTGeneratorShape_NUM,
+};
+
+class QBTGeneratorSettings
+{
+public:
+	QBTGeneratorSettings();
+
+	unsigned int m_seed;
+	unsigned int m_numMatrices;
+	unsigned int m_sizeX;
+	unsigned int m_sizeY;
+	unsigned int m_sizeZ;
+	QBTGeneratorShape m_shape;
+	float m_fillRatio; // Share of the voxels that are solid before hollowing
+	bool m_hollow; // Only the solid voxels with an empty neighbour are kept
+	float m_colourEntropy; // Share of the solid voxels that get a random colour rather than the colour of their height band
+	float m_noiseScale; // Voxels across the largest features of the noise
+	unsigned int m_noiseOctaves;
+};
+
+class QBTGenerator
+{
+public:
+	/* Public methods */
+	QBTGenerator(const QBTGeneratorSettings& settings); // The settings are clamped to what can be written
+	~QBTGenerator();
+
+	const QBTGeneratorSettings& GetSettings();
+
+	bool WriteFile(string filename);
+
+	// Solid voxels written by the last WriteFile, after hollowing
+	unsigned long long GetNumSolidVoxels();
+
+	// Before hollowing, in model voxels with the first matrix at the origin
+	bool IsSolid(int x, int y, int z);
+	unsigned int GetTerrainHeight(int x, int z); // One above the highest solid voxel of the column, 0 for an empty column
+
+	static const char* GetShapeName(QBTGeneratorShape shape);
+
+protected:
+	/* Protected methods */
+
+private:
+	/* Private methods */
+	static unsigned int Hash(unsigned int x, unsigned int y, unsigned int z, unsigned int seed);
+	static float HashToFloat(unsigned int hash);
+
+	// Fractal value noise between 0 and 1
+	float GetNoise2D(float x, float z);
+	float GetNoise3D(float x, float y, float z);
+
+	void CalculateNoiseThreshold();
+
+	// One bit per voxel in the x, z, y order of the file
+	unsigned int GetVoxelIndex(unsigned int x, unsigned int y, unsigned int z);
+	bool GetBit(const vector<unsigned int>& bits, unsigned int x, unsigned int y, unsigned int z);
+	void FillMatrix(unsigned int matrixIndex, vector<unsigned int>& solid);
+	void HollowMatrix(const vector<unsigned int>& solid, vector<unsigned int>& shell);
+	unsigned int GetVoxelMask(const vector<unsigned int>& solid, unsigned int x, unsigned int y, unsigned int z);
+	void GetVoxelColour(int x, int y, int z, unsigned char* pColour);
+
+	bool WriteMatrix(FILE* pFile, unsigned int matrixIndex, vector<unsigned int>& solid, vector<unsigned int>& shell);
+
+public:
+	/* Public members */
+
+protected:
+	/* Protected members */
+
+private:
+	/* Private members */
+	QBTGeneratorSettings m_settings;
+
+	float m_noiseThreshold; // 3D noise below this is solid
+
+	unsigned long long m_numSolidVoxels;
+};
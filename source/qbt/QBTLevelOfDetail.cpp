@@ -0,0 +1,117 @@
+// ******************************************************************************
+// Filename:    QBTLevelOfDetail.cpp
+// Project:     Qube
+// Author:      Steven Ball
+//
+// Revision History:
+//   Initial Revision - 17/10/26
+//
+// Copyright (c) 2005-2016, Steven Ball
+// ******************************************************************************
+
+#include "QBTLevelOfDetail.h"
+#include "QBT.h"
+
+#include <math.h>
+
+#include <algorithm>
+
+
+void DownsampleMatrix(QBTMatrix* pFine, QBTMatrix* pCoarse, QBTLODDownsample downsample, int minX, int minY, int minZ, int maxX, int maxY, int maxZ)
+{
+	for (int z = minZ; z <= maxZ; z++)
+	{
+		for (int y = minY; y <= maxY; y++)
+		{
+			for (int x = minX; x <= maxX; x++)
+			{
+				// Gather the solid fine voxels, the last coarse voxel along an odd sized axis only covers one fine voxel
+				unsigned int colours[8];
+				unsigned int numSolid = 0;
+				unsigned int numInside = 0;
+				for (unsigned int fineZ = z * 2; fineZ < std::min((unsigned int)z * 2 + 2, pFine->m_sizeZ); fineZ++)
+				{
+					for (unsigned int fineY = y * 2; fineY < std::min((unsigned int)y * 2 + 2, pFine->m_sizeY); fineY++)
+					{
+						for (unsigned int fineX = x * 2; fineX < std::min((unsigned int)x * 2 + 2, pFine->m_sizeX); fineX++)
+						{
+							unsigned int colour = pFine->m_pColour[fineX + pFine->m_sizeX * (fineY + pFine->m_sizeY * fineZ)];
+							if (colour != 0)
+							{
+								colours[numSolid++] = colour;
+							}
+							numInside++;
+						}
+					}
+				}
+
+				unsigned int colour = 0;
+				if (numSolid * 2 >= numInside && numSolid > 0)
+				{
+					if (downsample == QBTLODDownsample_Average)
+					{
+						unsigned int red = 0;
+						unsigned int green = 0;
+						unsigned int blue = 0;
+						for (unsigned int i = 0; i < numSolid; i++)
+						{
+							red += colours[i] & 255;
+							green += (colours[i] >> 8) & 255;
+							blue += (colours[i] >> 16) & 255;
+						}
+
+						red = (red + numSolid / 2) / numSolid;
+						green = (green + numSolid / 2) / numSolid;
+						blue = (blue + numSolid / 2) / numSolid;
+						colour = red | (green << 8) | (blue << 16) | (255 << 24);
+					}
+					else
+					{
+						// Ties go to the colour found first
+						unsigned int bestCount = 0;
+						for (unsigned int i = 0; i < numSolid; i++)
+						{
+							unsigned int count = 0;
+							for (unsigned int j = i; j < numSolid; j++)
+							{
+								count += colours[j] == colours[i] ? 1 : 0;
+							}
+							if (count > bestCount)
+							{
+								bestCount = count;
+								colour = colours[i];
+							}
+						}
+					}
+				}
+
+				unsigned int voxelIndex = x + pCoarse->m_sizeX * (y + pCoarse->m_sizeY * z);
+				pCoarse->m_pColour[voxelIndex] = colour;
+				pCoarse->m_pVisibilityMask[voxelIndex] = colour != 0 ? QBTVisibility_Solid : 0;
+			}
+		}
+	}
+}
+
+void GetLODLevel(float pixelsPerVoxel, float lodPixelSize, unsigned int numLODs, bool crossFade, unsigned int* pLevel, float* pFade)
+{
+	*pLevel = 0;
+	*pFade = 0.0f;
+	if (numLODs == 0 || pixelsPerVoxel * 2.0f > lodPixelSize)
+	{
+		return;
+	}
+
+	// Each level up doubles the width of the voxels
+	float lodValue = log2f(lodPixelSize / pixelsPerVoxel);
+	unsigned int level = std::min((unsigned int)lodValue, numLODs);
+	float fade = (lodValue - level) / QBT_LOD_FADE_RANGE;
+	if (crossFade && fade < 1.0f)
+	{
+		*pLevel = level - 1;
+		*pFade = fade;
+		return;
+	}
+
+	*pLevel = level;
+}
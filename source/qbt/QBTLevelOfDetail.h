@@ -0,0 +1,45 @@
+// ******************************************************************************
+// Filename:    QBTLevelOfDetail.h
+// Project:     Qube
+// Author:      Steven Ball
+//
+// Purpose:
+//   Level of detail for QBT matrices. Each level is a voxel grid downsampled
+//   2x along every axis from the level before it, meshed and drawn the same
+//   way as the full detail matrix with a scaled model transform. The level a
+//   matrix is drawn at comes from how many pixels its voxels cover on screen.
+//
+// Revision History:
+//   Initial Revision - 17/10/26
+//
+// Copyright (c) 2005-2016, Steven Ball
+// ******************************************************************************
+
+#pragma once
+
+class QBTMatrix;
+
+enum QBTLODDownsample
+{
+	QBTLODDownsample_Majority = 0,
+	QBTLODDownsample_Average,
+
+	QBTLODDownsample_NUM,
+};
+
+// Most downsampled levels a matrix can have, the last one is 8 times coarser than the full detail matrix
+const unsigned int QBT_MAX_LODS = 3;
+
+// Share of each level's range, at its start, where it is cross-faded with the finer level before it
+const float QBT_LOD_FADE_RANGE = 0.25f;
+
+// Fills the inclusive box of the coarse matrix, in its own voxels, from the 2x2x2 fine voxels under each coarse voxel. A coarse
+// voxel is solid when at least half of the fine voxels under it that are inside the fine matrix are solid, and takes either the
+// most common or the average colour of them. Only the solid bit of the visibility mask is written, the face bits are left to
+// RecomputeVisibilityMask.
+void DownsampleMatrix(QBTMatrix* pFine, QBTMatrix* pCoarse, QBTLODDownsample downsample, int minX, int minY, int minZ, int maxX, int maxY, int maxZ);
+
+// The level to draw a matrix at when its full detail voxels are pixelsPerVoxel pixels wide, the coarsest level whose voxels are
+// no wider than lodPixelSize. With cross-fading the level is faded in over the start of its range, and the finer level is
+// returned along with how far the fade into the next level has got, otherwise the fade is always 0.
+void GetLODLevel(float pixelsPerVoxel, float lodPixelSize, unsigned int numLODs, bool crossFade, unsigned int* pLevel, float* pFade);
@@ -0,0 +1,424 @@
+// ******************************************************************************
+// Filename:    QBTOcclusion.cpp
+// Project:     Qube
+// Author:      Steven Ball
+//
+// Revision History:
+//   Initial Revision - 17/10/26
+//
+// Copyright (c) 2005-2016, Steven Ball
+// ******************************************************************************
+
+#include "QBTOcclusion.h"
+#include "../Profiler/Profiler.h"
+
+#include <float.h>
+#include <math.h>
+
+#include <algorithm>
+using namespace std;
+
+#if defined(__x86_64__) || defined(__i386__) || defined(_M_X64) || defined(_M_IX86)
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#define QBT_OCCLUSION_SSE2
+#endif
+#endif
+
+#ifdef QBT_OCCLUSION_SSE2
+#include <immintrin.h>
+#endif //QBT_OCCLUSION_SSE2
+
+
+// Pixels are sampled at their centres. Every pixel of a span is worked out from its offset to the start of the span, the same
+// way by the scalar and the vector code, so both come up with exactly the same depths.
+void RasterizeSpanScalar(const QBTOcclusionTriangle& triangle, float* pDepthRow, int startX, int endX, float pixelY)
+{
+	float edgeRow[3];
+	for (int i = 0; i < 3; i++)
+	{
+		edgeRow[i] = triangle.m_edgeY[i] * pixelY + triangle.m_edgeOffset[i];
+	}
+	float depthRow = triangle.m_depthY * pixelY + triangle.m_depthOffset;
+
+	for (int x = startX; x < endX; x++)
+	{
+		float pixelX = (float)startX + ((float)(x - startX) + 0.5f);
+		bool inside = true;
+		for (int i = 0; i < 3; i++)
+		{
+			inside = inside && (triangle.m_edgeX[i] * pixelX + edgeRow[i] >= 0.0f);
+		}
+		if (inside)
+		{
+			pDepthRow[x] = std::max(pDepthRow[x], triangle.m_depthX * pixelX + depthRow);
+		}
+	}
+}
+
+bool IsSpanOccludedScalar(const float* pDepthRow, int startX, int endX, float depth)
+{
+	for (int x = startX; x < endX; x++)
+	{
+		if (pDepthRow[x] <= depth)
+		{
+			return false;
+		}
+	}
+
+	return true;
+}
+
+// Spans start and end on multiples of 4 pixels
+#ifdef QBT_OCCLUSION_SSE2
+void RasterizeSpanSSE2(const QBTOcclusionTriangle& triangle, float* pDepthRow, int startX, int endX, float pixelY)
+{
+	__m128 edgeX[3];
+	__m128 edgeRow[3];
+	for (int i = 0; i < 3; i++)
+	{
+		edgeX[i] = _mm_set1_ps(triangle.m_edgeX[i]);
+		edgeRow[i] = _mm_set1_ps(triangle.m_edgeY[i] * pixelY + triangle.m_edgeOffset[i]);
+	}
+	__m128 depthX = _mm_set1_ps(triangle.m_depthX);
+	__m128 depthRow = _mm_set1_ps(triangle.m_depthY * pixelY + triangle.m_depthOffset);
+
+	const __m128 zero = _mm_setzero_ps();
+	const __m128 start = _mm_set1_ps((float)startX);
+	__m128 offset = _mm_setr_ps(0.5f, 1.5f, 2.5f, 3.5f);
+	const __m128 step = _mm_set1_ps(4.0f);
+	for (int x = startX; x < endX; x += 4)
+	{
+		__m128 pixelX = _mm_add_ps(start, offset);
+		__m128 inside = _mm_cmpge_ps(_mm_add_ps(_mm_mul_ps(edgeX[0], pixelX), edgeRow[0]), zero);
+		inside = _mm_and_ps(inside, _mm_cmpge_ps(_mm_add_ps(_mm_mul_ps(edgeX[1], pixelX), edgeRow[1]), zero));
+		inside = _mm_and_ps(inside, _mm_cmpge_ps(_mm_add_ps(_mm_mul_ps(edgeX[2], pixelX), edgeRow[2]), zero));
+
+		// Depths are never negative, so a pixel outside of the triangle can be written as 0 and lose to whatever is there
+		__m128 depth = _mm_and_ps(inside, _mm_add_ps(_mm_mul_ps(depthX, pixelX), depthRow));
+		_mm_storeu_ps(pDepthRow + x, _mm_max_ps(_mm_loadu_ps(pDepthRow + x), depth));
+		offset = _mm_add_ps(offset, step);
+	}
+}
+
+bool IsSpanOccludedSSE2(const float* pDepthRow, int startX, int endX, float depth)
+{
+	__m128 boxDepth = _mm_set1_ps(depth);
+	for (int x = startX; x < endX; x += 4)
+	{
+		if (_mm_movemask_ps(_mm_cmple_ps(_mm_loadu_ps(pDepthRow + x), boxDepth)) != 0)
+		{
+			return false;
+		}
+	}
+
+	return true;
+}
+#endif //QBT_OCCLUSION_SSE2
+
+QBTOcclusionBuffer::QBTOcclusionBuffer()
+{
+	m_width = 0;
+	m_height = 0;
+	m_pJobSystem = NULL;
+	m_simdLevel = QBTSimdLevel_Scalar;
+	m_maxOccluders = 8192;
+	m_numOccluders = 0;
+	m_rasterized = false;
+
+	SetSimdLevel(QBTSimdLevel_AVX2);
+	SetResolution(QBT_OCCLUSION_WIDTH, QBT_OCCLUSION_HEIGHT);
+}
+
+QBTOcclusionBuffer::~QBTOcclusionBuffer()
+{
+}
+
+// Setup
+void QBTOcclusionBuffer::SetResolution(unsigned int width, unsigned int height)
+{
+	m_width = std::max((width + 3) & ~3u, 4u);
+	m_height = std::max(height, 1u);
+	m_depth.assign((size_t)m_width * m_height, 0.0f);
+	m_vTriangles.clear();
+	m_numOccluders = 0;
+}
+
+unsigned int QBTOcclusionBuffer::GetWidth()
+{
+	return m_width;
+}
+
+unsigned int QBTOcclusionBuffer::GetHeight()
+{
+	return m_height;
+}
+
+void QBTOcclusionBuffer::SetJobSystem(JobSystem* pJobSystem)
+{
+	m_pJobSystem = pJobSystem;
+}
+
+// Rows are at most 4 pixels at a time, wider levels run the SSE2 code
+void QBTOcclusionBuffer::SetSimdLevel(QBTSimdLevel simdLevel)
+{
+	m_simdLevel = std::min(std::min(simdLevel, GetSupportedSimdLevel()), QBTSimdLevel_SSE2);
+}
+
+QBTSimdLevel QBTOcclusionBuffer::GetSimdLevel()
+{
+	return m_simdLevel;
+}
+
+void QBTOcclusionBuffer::SetMaxOccluders(unsigned int maxOccluders)
+{
+	m_maxOccluders = maxOccluders;
+}
+
+unsigned int QBTOcclusionBuffer::GetMaxOccluders()
+{
+	return m_maxOccluders;
+}
+
+// Frame
+void QBTOcclusionBuffer::BeginFrame(const mat4& projection, const mat4& view)
+{
+	m_viewProjection = projection * view;
+	std::fill(m_depth.begin(), m_depth.end(), 0.0f);
+	m_vTriangles.clear();
+	m_numOccluders = 0;
+	m_rasterized = false;
+}
+
+bool QBTOcclusionBuffer::AddOccluder(const QBTOccluder& occluder, vec3 offset)
+{
+	if (m_numOccluders >= m_maxOccluders)
+	{
+		return false;
+	}
+
+	vec4 screen[4];
+	for (int i = 0; i < 4; i++)
+	{
+		screen[i] = ProjectPoint(occluder.m_corners[i] + offset);
+		if (screen[i].w < QBT_OCCLUSION_MIN_DEPTH)
+		{
+			return true;
+		}
+	}
+
+	// The same two triangles that the quad index buffer draws
+	SetupTriangle(screen[0], screen[2], screen[1]);
+	SetupTriangle(screen[1], screen[2], screen[3]);
+	m_numOccluders++;
+
+	return true;
+}
+
+void QBTOcclusionBuffer::Rasterize()
+{
+	PROFILE_SCOPE("QBTOcclusionBuffer::Rasterize");
+
+	// Every band is only written by the job that has it, so the bands can be rasterized in any order
+	unsigned int numBands = (m_height + QBT_OCCLUSION_BAND_HEIGHT - 1) / QBT_OCCLUSION_BAND_HEIGHT;
+	auto rasterizeBands = [this](unsigned int start, unsigned int end)
+	{
+		for (unsigned int band = start; band < end; band++)
+		{
+			RasterizeBand(band);
+		}
+	};
+
+	if (m_pJobSystem != NULL && m_pJobSystem->GetNumWorkers() > 0 && m_vTriangles.empty() == false)
+	{
+		m_pJobSystem->ParallelFor(numBands, 1, rasterizeBands);
+	}
+	else
+	{
+		rasterizeBands(0, numBands);
+	}
+
+	m_rasterized = true;
+}
+
+// The box is tested as the screen rectangle around its corners at the depth of its nearest corner. Spans are widened out to
+// multiples of 4 pixels, which only ever makes a box more likely to be visible.
+bool QBTOcclusionBuffer::IsBoxOccluded(vec3 boundsMin, vec3 boundsMax)
+{
+	if (m_rasterized == false || m_vTriangles.empty())
+	{
+		return false;
+	}
+
+	float minX = FLT_MAX;
+	float maxX = -FLT_MAX;
+	float minY = FLT_MAX;
+	float maxY = -FLT_MAX;
+	float nearestDepth = 0.0f;
+	for (int i = 0; i < 8; i++)
+	{
+		vec3 corner((i & 1) ? boundsMax.x : boundsMin.x, (i & 2) ? boundsMax.y : boundsMin.y, (i & 4) ? boundsMax.z : boundsMin.z);
+		vec4 screen = ProjectPoint(corner);
+
+		// A box that reaches the camera is never hidden
+		if (screen.w < QBT_OCCLUSION_MIN_DEPTH)
+		{
+			return false;
+		}
+
+		minX = std::min(minX, screen.x);
+		maxX = std::max(maxX, screen.x);
+		minY = std::min(minY, screen.y);
+		maxY = std::max(maxY, screen.y);
+		nearestDepth = std::max(nearestDepth, screen.z);
+	}
+
+	int startX = std::max((int)floorf(minX), 0) & ~3;
+	int endX = std::min(((int)floorf(maxX) | 3) + 1, (int)m_width);
+	int startY = std::max((int)floorf(minY), 0);
+	int endY = std::min((int)floorf(maxY) + 1, (int)m_height);
+	if (startX >= endX || startY >= endY)
+	{
+		return false;
+	}
+
+	float depth = nearestDepth * QBT_OCCLUSION_DEPTH_BIAS;
+	for (int y = startY; y < endY; y++)
+	{
+		const float* pDepthRow = &m_depth[(size_t)y * m_width];
+#ifdef QBT_OCCLUSION_SSE2
+		if (m_simdLevel >= QBTSimdLevel_SSE2)
+		{
+			if (IsSpanOccludedSSE2(pDepthRow, startX, endX, depth) == false)
+			{
+				return false;
+			}
+			continue;
+		}
+#endif //QBT_OCCLUSION_SSE2
+		if (IsSpanOccludedScalar(pDepthRow, startX, endX, depth) == false)
+		{
+			return false;
+		}
+	}
+
+	return true;
+}
+
+float QBTOcclusionBuffer::GetViewDepth(vec3 position)
+{
+	return m_viewProjection[0][3] * position.x + m_viewProjection[1][3] * position.y + m_viewProjection[2][3] * position.z + m_viewProjection[3][3];
+}
+
+// Accessors
+unsigned int QBTOcclusionBuffer::GetNumOccluders()
+{
+	return m_numOccluders;
+}
+
+unsigned int QBTOcclusionBuffer::GetNumTriangles()
+{
+	return (unsigned int)m_vTriangles.size();
+}
+
+float QBTOcclusionBuffer::GetDepth(unsigned int x, unsigned int y)
+{
+	return m_depth[(size_t)y * m_width + x];
+}
+
+// Screen position in pixels, with the reciprocal depth in z and the depth itself in w. The reciprocal depth is linear across
+// the screen, so it can be interpolated as a plane.
+vec4 QBTOcclusionBuffer::ProjectPoint(vec3 position)
+{
+	vec4 clip = m_viewProjection * vec4(position, 1.0f);
+	if (clip.w < QBT_OCCLUSION_MIN_DEPTH)
+	{
+		return vec4(0.0f, 0.0f, 0.0f, clip.w);
+	}
+
+	float reciprocalDepth = 1.0f / clip.w;
+	return vec4((clip.x * reciprocalDepth * 0.5f + 0.5f) * m_width, (clip.y * reciprocalDepth * 0.5f + 0.5f) * m_height, reciprocalDepth, clip.w);
+}
+
+void QBTOcclusionBuffer::SetupTriangle(const vec4& screen0, const vec4& screen1, const vec4& screen2)
+{
+	float area = (screen1.x - screen0.x) * (screen2.y - screen0.y) - (screen2.x - screen0.x) * (screen1.y - screen0.y);
+	if (fabs(area) < 1.0e-6f)
+	{
+		return;
+	}
+
+	// Faces block the view from either side, so back facing triangles are turned around rather than being dropped
+	const vec4* pVertices[3] = { &screen0, &screen1, &screen2 };
+	if (area < 0.0f)
+	{
+		std::swap(pVertices[1], pVertices[2]);
+		area = -area;
+	}
+
+	QBTOcclusionTriangle triangle;
+	float minX = pVertices[0]->x;
+	float maxX = pVertices[0]->x;
+	float minY = pVertices[0]->y;
+	float maxY = pVertices[0]->y;
+	for (int i = 0; i < 3; i++)
+	{
+		const vec4& start = *pVertices[i];
+		const vec4& end = *pVertices[(i + 1) % 3];
+		triangle.m_edgeX[i] = start.y - end.y;
+		triangle.m_edgeY[i] = end.x - start.x;
+		triangle.m_edgeOffset[i] = start.x * end.y - start.y * end.x;
+
+		minX = std::min(minX, start.x);
+		maxX = std::max(maxX, start.x);
+		minY = std::min(minY, start.y);
+		maxY = std::max(maxY, start.y);
+	}
+
+	triangle.m_minX = std::max((int)floorf(minX), 0) & ~3;
+	triangle.m_maxX = std::min(((int)floorf(maxX) | 3) + 1, (int)m_width);
+	triangle.m_minY = std::max((int)floorf(minY), 0);
+	triangle.m_maxY = std::min((int)floorf(maxY) + 1, (int)m_height);
+	if (triangle.m_minX >= triangle.m_maxX || triangle.m_minY >= triangle.m_maxY)
+	{
+		return;
+	}
+
+	// The depth written for a pixel is the furthest that the plane gets from the camera anywhere over the pixel
+	const vec4& vertex0 = *pVertices[0];
+	const vec4& vertex1 = *pVertices[1];
+	const vec4& vertex2 = *pVertices[2];
+	triangle.m_depthX = ((vertex1.z - vertex0.z) * (vertex2.y - vertex0.y) - (vertex2.z - vertex0.z) * (vertex1.y - vertex0.y)) / area;
+	triangle.m_depthY = ((vertex2.z - vertex0.z) * (vertex1.x - vertex0.x) - (vertex1.z - vertex0.z) * (vertex2.x - vertex0.x)) / area;
+	triangle.m_depthOffset = vertex0.z - triangle.m_depthX * vertex0.x - triangle.m_depthY * vertex0.y;
+	triangle.m_depthOffset -= 0.5f * (fabs(triangle.m_depthX) + fabs(triangle.m_depthY));
+
+	m_vTriangles.push_back(triangle);
+}
+
+void QBTOcclusionBuffer::RasterizeBand(unsigned int band)
+{
+	PROFILE_SCOPE("QBTOcclusionBuffer::RasterizeBand");
+
+	int bandStartY = (int)(band * QBT_OCCLUSION_BAND_HEIGHT);
+	int bandEndY = std::min(bandStartY + (int)QBT_OCCLUSION_BAND_HEIGHT, (int)m_height);
+
+	for (unsigned int i = 0; i < m_vTriangles.size(); i++)
+	{
+		const QBTOcclusionTriangle& triangle = m_vTriangles[i];
+		int startY = std::max(triangle.m_minY, bandStartY);
+		int endY = std::min(triangle.m_maxY, bandEndY);
+		for (int y = startY; y < endY; y++)
+		{
+			float* pDepthRow = &m_depth[(size_t)y * m_width];
+			float pixelY = (float)y + 0.5f;
+#ifdef QBT_OCCLUSION_SSE2
+			if (m_simdLevel >= QBTSimdLevel_SSE2)
+			{
+				RasterizeSpanSSE2(triangle, pDepthRow, triangle.m_minX, triangle.m_maxX, pixelY);
+				continue;
+			}
+#endif //QBT_OCCLUSION_SSE2
+			RasterizeSpanScalar(triangle, pDepthRow, triangle.m_minX, triangle.m_maxX, pixelY);
+		}
+	}
+}
@@ -0,0 +1,137 @@
+// ******************************************************************************
+// Filename:    QBTOcclusion.h
+// Project:     Qube
+// Author:      Steven Ball
+//
+// Purpose:
+//   A software occlusion buffer. The biggest merged faces of the meshes near
+//   the camera are rasterized into a small depth buffer on the CPU, split into
+//   bands of rows that are run as jobs on the job system, and the bounds
+//   of matrices and chunks are then tested against it before they are drawn.
+//   Rows are run 4 pixels at a time with SSE2 when the CPU supports it.
+//
+// Revision History:
+//   Initial Revision - 17/10/26
+//
+// Copyright (c) 2005-2016, Steven Ball
+// ******************************************************************************
+
+#pragma once
+
+#include "QBTVisibility.h"
+
+#include "../JobSystem/JobSystem.h"
+
+#include <glm/vec3.hpp>
+#include <glm/vec4.hpp>
+#include <glm/mat4x4.hpp>
+using namespace glm;
+
+#include <vector>
+using namespace std;
+
+// Size of the depth buffer, the width is kept to a multiple of 4 so that every row can be run 4 pixels at a time
+const unsigned int QBT_OCCLUSION_WIDTH = 256;
+const unsigned int QBT_OCCLUSION_HEIGHT = 144;
+
+// Rows of the depth buffer that one worker rasterizes at a time
+const unsigned int QBT_OCCLUSION_BAND_HEIGHT = 8;
+
+// Only merged faces at least this big, in voxel faces, are kept as occluders, and only the biggest few of each chunk
+const float QBT_OCCLUDER_MIN_AREA = 4.0f;
+const unsigned int QBT_MAX_CHUNK_OCCLUDERS = 64;
+
+// Occluders that come closer to the camera than this are left out, rather than being clipped against the near plane
+const float QBT_OCCLUSION_MIN_DEPTH = 0.01f;
+
+// A box is only occluded when the occluders are nearer than it by at least this fraction of its reciprocal depth, so that
+// faces lying on the box itself can't hide it through rounding
+const float QBT_OCCLUSION_DEPTH_BIAS = 1.0001f;
+
+// A quad of a mesh in the vertex order of the shared quad index buffer, corners 1 and 2 are the ends of its diagonal
+class QBTOccluder
+{
+public:
+	vec3 m_corners[4];
+};
+
+// A triangle of an occluder after projection. The edges and the reciprocal depth are set up as planes in screen space,
+// so each pixel only needs a multiply and an add for every one of them.
+class QBTOcclusionTriangle
+{
+public:
+	float m_edgeX[3];
+	float m_edgeY[3];
+	float m_edgeOffset[3];
+	float m_depthX;
+	float m_depthY;
+	float m_depthOffset;
+	int m_minX;
+	int m_maxX;
+	int m_minY;
+	int m_maxY;
+};
+
+class QBTOcclusionBuffer
+{
+public:
+	/* Public methods */
+	QBTOcclusionBuffer();
+	~QBTOcclusionBuffer();
+
+	// Setup
+	void SetResolution(unsigned int width, unsigned int height); // The width is rounded up to a multiple of 4
+	unsigned int GetWidth();
+	unsigned int GetHeight();
+	void SetJobSystem(JobSystem* pJobSystem); // Without one every band is rasterized on the calling thread
+	void SetSimdLevel(QBTSimdLevel simdLevel); // Defaults to the widest that the CPU supports, up to SSE2
+	QBTSimdLevel GetSimdLevel();
+	void SetMaxOccluders(unsigned int maxOccluders);
+	unsigned int GetMaxOccluders();
+
+	// Each frame the buffer is cleared for the camera, the occluders are added, nearest first, and rasterized once before
+	// anything is tested
+	void BeginFrame(const mat4& projection, const mat4& view);
+	bool AddOccluder(const QBTOccluder& occluder, vec3 offset); // False once the buffer has all the occluders that it takes
+	void Rasterize();
+	bool IsBoxOccluded(vec3 boundsMin, vec3 boundsMax);
+	float GetViewDepth(vec3 position);
+
+	// Accessors
+	unsigned int GetNumOccluders();
+	unsigned int GetNumTriangles();
+	float GetDepth(unsigned int x, unsigned int y); // Reciprocal depth of the nearest occluder, 0 where there is none
+
+protected:
+	/* Protected methods */
+
+private:
+	/* Private methods */
+	vec4 ProjectPoint(vec3 position);
+	void SetupTriangle(const vec4& screen0, const vec4& screen1, const vec4& screen2);
+	void RasterizeBand(unsigned int band);
+
+public:
+	/* Public members */
+
+protected:
+	/* Protected members */
+
+private:
+	/* Private members */
+	unsigned int m_width;
+	unsigned int m_height;
+	JobSystem* m_pJobSystem;
+	QBTSimdLevel m_simdLevel;
+	unsigned int m_maxOccluders;
+
+	// World space to clip space of the camera
+	mat4 m_viewProjection;
+
+	// Reciprocal depth of each pixel, bigger is nearer
+	vector<float> m_depth;
+
+	vector<QBTOcclusionTriangle> m_vTriangles;
+	unsigned int m_numOccluders;
+	bool m_rasterized;
+};
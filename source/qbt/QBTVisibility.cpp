@@ -0,0 +1,281 @@
+// ******************************************************************************
+// Filename:    QBTVisibility.cpp
+// Project:     Qube
+// Author:      Steven Ball
+//
+// Revision History:
+//   Initial Revision - 17/10/26
+//
+// Copyright (c) 2005-2016, Steven Ball
+// ******************************************************************************
+
+#include "QBTVisibility.h"
+#include "QBT.h"
+
+#include <algorithm>
+#include <vector>
+using namespace std;
+
+#if defined(__x86_64__) || defined(__i386__) || defined(_M_X64) || defined(_M_IX86)
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#define QBT_VISIBILITY_SSE2
+#define QBT_VISIBILITY_AVX2
+#endif
+#endif
+
+#ifdef QBT_VISIBILITY_SSE2
+#include <immintrin.h>
+#ifdef _MSC_VER
+#include <intrin.h>
+#define QBT_AVX2_FUNCTION
+#else
+#define QBT_AVX2_FUNCTION __attribute__((target("avx2")))
+#endif //_MSC_VER
+#endif //QBT_VISIBILITY_SSE2
+
+
+// The rows of voxels around the row that is being recomputed, rows outside of the matrix point at a row of empty voxels
+struct QBTVisibilityRows
+{
+	unsigned int* m_pRow;
+	const unsigned int* m_pYPositive;
+	const unsigned int* m_pYNegative;
+	const unsigned int* m_pZNegative;
+	const unsigned int* m_pZPositive;
+	unsigned int m_sizeX;
+};
+
+// Masks are recomputed in place. That is safe because a voxel only ever reads whether its neighbours are solid, and
+// the new mask of a voxel is non zero exactly when the old one was.
+inline void RecomputeVoxel(const QBTVisibilityRows& rows, unsigned int x)
+{
+	const unsigned int* pRow = rows.m_pRow;
+	if (pRow[x] == 0)
+	{
+		return;
+	}
+
+	unsigned int mask = QBTVisibility_Solid;
+	mask |= (x + 1 == rows.m_sizeX || pRow[x + 1] == 0) ? QBTVisibility_X_Positive : 0;
+	mask |= (x == 0 || pRow[x - 1] == 0) ? QBTVisibility_X_Negative : 0;
+	mask |= rows.m_pYPositive[x] == 0 ? QBTVisibility_Y_Positive : 0;
+	mask |= rows.m_pYNegative[x] == 0 ? QBTVisibility_Y_Negative : 0;
+	mask |= rows.m_pZNegative[x] == 0 ? QBTVisibility_Z_Negative : 0;
+	mask |= rows.m_pZPositive[x] == 0 ? QBTVisibility_Z_Positive : 0;
+	rows.m_pRow[x] = mask;
+}
+
+// Vectorized rows, each returns the first voxel that it did not get to. Both x neighbours are loaded as unaligned
+// vectors, so the first and last voxels of the row are always left to the scalar code.
+#ifdef QBT_VISIBILITY_SSE2
+unsigned int RecomputeRowSSE2(const QBTVisibilityRows& rows, unsigned int startX, unsigned int endX)
+{
+	const __m128i zero = _mm_setzero_si128();
+	const __m128i solid = _mm_set1_epi32(QBTVisibility_Solid);
+	const __m128i xPositive = _mm_set1_epi32(QBTVisibility_X_Positive);
+	const __m128i xNegative = _mm_set1_epi32(QBTVisibility_X_Negative);
+	const __m128i yPositive = _mm_set1_epi32(QBTVisibility_Y_Positive);
+	const __m128i yNegative = _mm_set1_epi32(QBTVisibility_Y_Negative);
+	const __m128i zNegative = _mm_set1_epi32(QBTVisibility_Z_Negative);
+	const __m128i zPositive = _mm_set1_epi32(QBTVisibility_Z_Positive);
+
+	unsigned int x = std::max(startX, 1u);
+	unsigned int vectorEndX = std::min(endX, rows.m_sizeX - 1);
+	__m128i previous = zero;
+	if (x + 4 <= vectorEndX)
+	{
+		previous = _mm_loadu_si128((const __m128i*)(rows.m_pRow + x - 1));
+	}
+	for (; x + 4 <= vectorEndX; x += 4)
+	{
+		__m128i mask = solid;
+		mask = _mm_or_si128(mask, _mm_and_si128(_mm_cmpeq_epi32(_mm_loadu_si128((const __m128i*)(rows.m_pRow + x + 1)), zero), xPositive));
+		mask = _mm_or_si128(mask, _mm_and_si128(_mm_cmpeq_epi32(previous, zero), xNegative));
+		mask = _mm_or_si128(mask, _mm_and_si128(_mm_cmpeq_epi32(_mm_loadu_si128((const __m128i*)(rows.m_pYPositive + x)), zero), yPositive));
+		mask = _mm_or_si128(mask, _mm_and_si128(_mm_cmpeq_epi32(_mm_loadu_si128((const __m128i*)(rows.m_pYNegative + x)), zero), yNegative));
+		mask = _mm_or_si128(mask, _mm_and_si128(_mm_cmpeq_epi32(_mm_loadu_si128((const __m128i*)(rows.m_pZNegative + x)), zero), zNegative));
+		mask = _mm_or_si128(mask, _mm_and_si128(_mm_cmpeq_epi32(_mm_loadu_si128((const __m128i*)(rows.m_pZPositive + x)), zero), zPositive));
+
+		__m128i empty = _mm_cmpeq_epi32(_mm_loadu_si128((const __m128i*)(rows.m_pRow + x)), zero);
+
+		// The x - 1 neighbours of the next vector overlap this store, load them first so they are not forwarded from it
+		if (x + 8 <= vectorEndX)
+		{
+			previous = _mm_loadu_si128((const __m128i*)(rows.m_pRow + x + 3));
+		}
+		_mm_storeu_si128((__m128i*)(rows.m_pRow + x), _mm_andnot_si128(empty, mask));
+	}
+
+	return x;
+}
+#endif //QBT_VISIBILITY_SSE2
+
+#ifdef QBT_VISIBILITY_AVX2
+QBT_AVX2_FUNCTION unsigned int RecomputeRowAVX2(const QBTVisibilityRows& rows, unsigned int startX, unsigned int endX)
+{
+	const __m256i zero = _mm256_setzero_si256();
+	const __m256i solid = _mm256_set1_epi32(QBTVisibility_Solid);
+	const __m256i xPositive = _mm256_set1_epi32(QBTVisibility_X_Positive);
+	const __m256i xNegative = _mm256_set1_epi32(QBTVisibility_X_Negative);
+	const __m256i yPositive = _mm256_set1_epi32(QBTVisibility_Y_Positive);
+	const __m256i yNegative = _mm256_set1_epi32(QBTVisibility_Y_Negative);
+	const __m256i zNegative = _mm256_set1_epi32(QBTVisibility_Z_Negative);
+	const __m256i zPositive = _mm256_set1_epi32(QBTVisibility_Z_Positive);
+
+	unsigned int x = std::max(startX, 1u);
+	unsigned int vectorEndX = std::min(endX, rows.m_sizeX - 1);
+	__m256i previous = zero;
+	if (x + 8 <= vectorEndX)
+	{
+		previous = _mm256_loadu_si256((const __m256i*)(rows.m_pRow + x - 1));
+	}
+	for (; x + 8 <= vectorEndX; x += 8)
+	{
+		__m256i mask = solid;
+		mask = _mm256_or_si256(mask, _mm256_and_si256(_mm256_cmpeq_epi32(_mm256_loadu_si256((const __m256i*)(rows.m_pRow + x + 1)), zero), xPositive));
+		mask = _mm256_or_si256(mask, _mm256_and_si256(_mm256_cmpeq_epi32(previous, zero), xNegative));
+		mask = _mm256_or_si256(mask, _mm256_and_si256(_mm256_cmpeq_epi32(_mm256_loadu_si256((const __m256i*)(rows.m_pYPositive + x)), zero), yPositive));
+		mask = _mm256_or_si256(mask, _mm256_and_si256(_mm256_cmpeq_epi32(_mm256_loadu_si256((const __m256i*)(rows.m_pYNegative + x)), zero), yNegative));
+		mask = _mm256_or_si256(mask, _mm256_and_si256(_mm256_cmpeq_epi32(_mm256_loadu_si256((const __m256i*)(rows.m_pZNegative + x)), zero), zNegative));
+		mask = _mm256_or_si256(mask, _mm256_and_si256(_mm256_cmpeq_epi32(_mm256_loadu_si256((const __m256i*)(rows.m_pZPositive + x)), zero), zPositive));
+
+		__m256i empty = _mm256_cmpeq_epi32(_mm256_loadu_si256((const __m256i*)(rows.m_pRow + x)), zero);
+
+		// The x - 1 neighbours of the next vector overlap this store, load them first so they are not forwarded from it
+		if (x + 16 <= vectorEndX)
+		{
+			previous = _mm256_loadu_si256((const __m256i*)(rows.m_pRow + x + 7));
+		}
+		_mm256_storeu_si256((__m256i*)(rows.m_pRow + x), _mm256_andnot_si256(empty, mask));
+	}
+
+	return x;
+}
+#endif //QBT_VISIBILITY_AVX2
+
+void RecomputeRow(const QBTVisibilityRows& rows, unsigned int startX, unsigned int endX, QBTSimdLevel simdLevel)
+{
+	unsigned int vectorStartX = std::max(startX, 1u);
+	unsigned int x = startX;
+	for (; x < std::min(vectorStartX, endX); x++)
+	{
+		RecomputeVoxel(rows, x);
+	}
+
+#ifdef QBT_VISIBILITY_AVX2
+	if (simdLevel == QBTSimdLevel_AVX2)
+	{
+		x = RecomputeRowAVX2(rows, x, endX);
+	}
+#endif //QBT_VISIBILITY_AVX2
+#ifdef QBT_VISIBILITY_SSE2
+	if (simdLevel >= QBTSimdLevel_SSE2)
+	{
+		x = RecomputeRowSSE2(rows, x, endX);
+	}
+#endif //QBT_VISIBILITY_SSE2
+
+	for (; x < endX; x++)
+	{
+		RecomputeVoxel(rows, x);
+	}
+}
+
+QBTSimdLevel GetSupportedSimdLevel()
+{
+#ifdef QBT_VISIBILITY_AVX2
+	static QBTSimdLevel supportedLevel = []()
+	{
+#ifdef _MSC_VER
+		// AVX2 also needs the OS to save the upper halves of the ymm registers
+		int info[4];
+		__cpuid(info, 0);
+		if (info[0] >= 7)
+		{
+			__cpuid(info, 1);
+			bool osSavesYmm = (info[2] & (1 << 27)) != 0 && (info[2] & (1 << 28)) != 0 && (_xgetbv(0) & 6) == 6;
+			__cpuidex(info, 7, 0);
+			if (osSavesYmm && (info[1] & (1 << 5)) != 0)
+			{
+				return QBTSimdLevel_AVX2;
+			}
+		}
+#else
+		if (__builtin_cpu_supports("avx2"))
+		{
+			return QBTSimdLevel_AVX2;
+		}
+#endif //_MSC_VER
+		return QBTSimdLevel_SSE2;
+	}();
+
+	return supportedLevel;
+#elif defined(QBT_VISIBILITY_SSE2)
+	return QBTSimdLevel_SSE2;
+#else
+	return QBTSimdLevel_Scalar;
+#endif //QBT_VISIBILITY_AVX2
+}
+
+void RecomputeVisibilityMask(QBTMatrix* pMatrix)
+{
+	RecomputeVisibilityMask(pMatrix, GetSupportedSimdLevel());
+}
+
+void RecomputeVisibilityMask(QBTMatrix* pMatrix, QBTSimdLevel simdLevel)
+{
+	RecomputeVisibilityMask(pMatrix, 0, 0, 0, (int)pMatrix->m_sizeX - 1, (int)pMatrix->m_sizeY - 1, (int)pMatrix->m_sizeZ - 1, simdLevel);
+}
+
+void RecomputeVisibilityMask(QBTMatrix* pMatrix, int minX, int minY, int minZ, int maxX, int maxY, int maxZ)
+{
+	RecomputeVisibilityMask(pMatrix, minX, minY, minZ, maxX, maxY, maxZ, GetSupportedSimdLevel());
+}
+
+void RecomputeVisibilityMask(QBTMatrix* pMatrix, int minX, int minY, int minZ, int maxX, int maxY, int maxZ, QBTSimdLevel simdLevel)
+{
+	if (simdLevel > GetSupportedSimdLevel())
+	{
+		simdLevel = GetSupportedSimdLevel();
+	}
+
+	int sizeX = (int)pMatrix->m_sizeX;
+	int sizeY = (int)pMatrix->m_sizeY;
+	int sizeZ = (int)pMatrix->m_sizeZ;
+
+	// Changing a voxel changes the face bits of its neighbours
+	minX = std::max(minX - 1, 0);
+	minY = std::max(minY - 1, 0);
+	minZ = std::max(minZ - 1, 0);
+	maxX = std::min(maxX + 1, sizeX - 1);
+	maxY = std::min(maxY + 1, sizeY - 1);
+	maxZ = std::min(maxZ + 1, sizeZ - 1);
+	if (minX > maxX || minY > maxY || minZ > maxZ)
+	{
+		return;
+	}
+
+	pMatrix->m_binaryOccupancy.SetDirty(minX, minY, minZ, maxX, maxY, maxZ);
+
+	vector<unsigned int> emptyRow(sizeX, 0);
+
+	QBTVisibilityRows rows;
+	rows.m_sizeX = (unsigned int)sizeX;
+
+	unsigned int* pMask = pMatrix->m_pVisibilityMask;
+	size_t sliceSize = (size_t)sizeX * sizeY;
+	for (int z = minZ; z <= maxZ; z++)
+	{
+		for (int y = minY; y <= maxY; y++)
+		{
+			unsigned int* pRow = &pMask[z * sliceSize + (size_t)y * sizeX];
+			rows.m_pRow = pRow;
+			rows.m_pYPositive = y + 1 < sizeY ? pRow + sizeX : &emptyRow[0];
+			rows.m_pYNegative = y > 0 ? pRow - sizeX : &emptyRow[0];
+			rows.m_pZNegative = z > 0 ? pRow - sliceSize : &emptyRow[0];
+			rows.m_pZPositive = z + 1 < sizeZ ? pRow + sliceSize : &emptyRow[0];
+
+			RecomputeRow(rows, (unsigned int)minX, (unsigned int)maxX + 1, simdLevel);
+		}
+	}
+}
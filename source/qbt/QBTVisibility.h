@@ -0,0 +1,51 @@
+// ******************************************************************************
+// Filename:    QBTVisibility.h
+// Project:     Qube
+// Author:      Steven Ball
+//
+// Purpose:
+//   Recomputes the per voxel visibility mask of a QBT matrix from solid voxel
+//   occupancy, instead of trusting the mask that was stored in the file. Runs
+//   a row of voxels at a time with SSE2 or AVX2 when the CPU supports it, with
+//   a scalar fallback for everything else.
+//
+// Revision History:
+//   Initial Revision - 17/10/26
+//
+// Copyright (c) 2005-2016, Steven Ball
+// ******************************************************************************
+
+#pragma once
+
+class QBTMatrix;
+
+// Visibility mask bits, a solid voxel with none of the face bits set is completely surrounded
+enum QBTVisibilityBits
+{
+	QBTVisibility_Solid = 1,
+	QBTVisibility_X_Positive = 2,
+	QBTVisibility_X_Negative = 4,
+	QBTVisibility_Y_Positive = 8,
+	QBTVisibility_Y_Negative = 16,
+	QBTVisibility_Z_Negative = 32,
+	QBTVisibility_Z_Positive = 64,
+};
+
+enum QBTSimdLevel
+{
+	QBTSimdLevel_Scalar = 0,
+	QBTSimdLevel_SSE2,
+	QBTSimdLevel_AVX2,
+};
+
+// The widest instruction set that this CPU and build can run
+QBTSimdLevel GetSupportedSimdLevel();
+
+// Recompute the visibility mask of a whole matrix
+void RecomputeVisibilityMask(QBTMatrix* pMatrix);
+void RecomputeVisibilityMask(QBTMatrix* pMatrix, QBTSimdLevel simdLevel);
+
+// Recompute the visibility mask after the voxels inside the inclusive box have been changed, the neighbours just outside of the box are updated too.
+// The binary mesher's occupancy columns over the same voxels are marked to be built again.
+void RecomputeVisibilityMask(QBTMatrix* pMatrix, int minX, int minY, int minZ, int maxX, int maxY, int maxZ);
+void RecomputeVisibilityMask(QBTMatrix* pMatrix, int minX, int minY, int minZ, int maxX, int maxY, int maxZ, QBTSimdLevel simdLevel);